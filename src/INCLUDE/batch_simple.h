@@ -0,0 +1,355 @@
+#ifndef ___BATCH_SIMPLE_H_INCLUDED___
+#define ___BATCH_SIMPLE_H_INCLUDED___
+
+#include <windows.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/mp3_simple.h"
+#include "INCLUDE/mp3pool_simple.h"
+#include "INCLUDE/file_simple.h"
+#include "INCLUDE/pool_simple.h"
+
+using namespace std;
+
+// How much of the input file is encoded per CMP3Chunker::Encode call.
+#define BATCH_READ_BLOCK (1024 * 1024)
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+class CBatchTranscoder;
+
+// Encodes one WAV (or raw PCM) file into an MP3 file, run by the CWorkStealingPool.
+class CTranscodeJob: public IJob, public IMP3Receiver {
+private:
+	CBatchTranscoder *m_pOwner;
+	string		m_strInput;
+	string		m_strOutput;
+	FILE		*m_pOutput;
+
+	// Sound converted to 16-bit stereo, if the file has another format.
+	vector<SHORT> m_arrConverted;
+
+	// Converts dwBytes of sound into m_arrConverted, returns number of samples (SHORT).
+	DWORD Convert(CWaveFile &wavFile, const BYTE *pData, DWORD dwBytes);
+
+public:
+	CTranscodeJob(CBatchTranscoder *pOwner, const string &strInput, const string &strOutput);
+	~CTranscodeJob();
+
+	virtual void Run(UINT nWorker);
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes);
+};
+
+// Class that encodes many WAV/raw PCM files into MP3, in parallel on a
+// CWorkStealingPool (each file is one job), and reports per-file and total
+// throughput. Input files are read via memory-mapped windows (CWaveFile).
+//
+// Supported input is 8-bit or 16-bit PCM, mono or stereo, raw PCM files
+// (.pcm, .raw) are taken as 44100Hz 16-bit stereo.
+class CBatchTranscoder {
+	friend class CTranscodeJob;
+private:
+	unsigned int m_nBitRate;
+	unsigned int m_nOutSampleRate;
+	string		m_strOutputDir;
+	UINT		m_nThreads;
+
+	// Files to encode, with their sizes (the biggest are submitted first).
+	vector< pair<ULONGLONG, string> > m_arrFiles;
+
+	// Results, updated by the jobs.
+	QMutex		m_qMutex;
+	UINT		m_nDone;
+	UINT		m_nFailed;
+	double		m_dAudioSeconds;
+	ULONGLONG	m_nBytes;
+
+	string OutputPath(const string &strInput) const;
+	void Report(UINT nWorker, const char *pInput, double dAudioSeconds, double dSeconds,
+		ULONGLONG nBytes, const char *pError);
+
+public:
+	// nBitRate and nOutSampleRate - see CMP3Simple.
+	//
+	// pOutputDir - where to write MP3 files, NULL - next to each input file.
+	//
+	// nThreads - number of files encoded at once, zero - one per CPU.
+	CBatchTranscoder(unsigned int nBitRate, unsigned int nOutSampleRate = 0,
+		const char *pOutputDir = NULL, UINT nThreads = 0);
+	~CBatchTranscoder() {};
+
+	// Adds one file.
+	void AddFile(const char *pFileName);
+
+	// Adds all .wav, .pcm and .raw files of the directory.
+	void AddDirectory(const char *pDirName);
+
+	// Adds files listed in the text file (one path per line, '#' starts a comment).
+	void AddList(const char *pListName);
+
+	// Directory - see AddDirectory, any other file - see AddList.
+	void Add(const char *pPath);
+
+	// Encodes all added files, prints a line per file and totals. Returns number of failed files.
+	UINT Run();
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CTranscodeJob::CTranscodeJob(CBatchTranscoder *pOwner, const string &strInput, const string &strOutput):
+		m_strInput(strInput), m_strOutput(strOutput) {
+	this->m_pOwner = pOwner;
+	this->m_pOutput = NULL;
+}
+
+CTranscodeJob::~CTranscodeJob() {
+	if (this->m_pOutput != NULL) fclose(this->m_pOutput);
+}
+
+void CTranscodeJob::ReceiveMP3(PBYTE pData, DWORD dwBytes) {
+	fwrite(pData, dwBytes, 1, this->m_pOutput);
+}
+
+DWORD CTranscodeJob::Convert(CWaveFile &wavFile, const BYTE *pData, DWORD dwBytes) {
+	DWORD nFrames = dwBytes / wavFile.BlockAlign();
+	DWORD i;
+	PSHORT pOut;
+	SHORT nSample;
+
+	this->m_arrConverted.resize(nFrames * 2);
+	pOut = &this->m_arrConverted[0];
+
+	if (wavFile.BitsPerSample() == 8) {
+		// 8-bit PCM is unsigned.
+		for (i = 0; i < nFrames; i++) {
+			pOut[2 * i] = (SHORT) (((int) pData[i * wavFile.Channels()] - 128) << 8);
+			pOut[2 * i + 1] = (SHORT) (((int) pData[i * wavFile.Channels() + wavFile.Channels() - 1] - 128) << 8);
+		}
+	}
+	else {
+		// 16-bit mono, duplicate to both channels.
+		for (i = 0; i < nFrames; i++) {
+			memcpy(&nSample, pData + i * 2, sizeof(SHORT));
+			pOut[2 * i] = pOut[2 * i + 1] = nSample;
+		}
+	}
+
+	return nFrames * 2;
+}
+
+void CTranscodeJob::Run(UINT nWorker) {
+	LONGLONG nStart = QClock::Micros();
+	double dAudioSeconds = 0;
+	ULONGLONG nOffset = 0;
+	DWORD dwBlock, dwBytes, nSamples;
+	const BYTE *pData;
+	PSHORT pSamples;
+	CMP3Simple *pEnc = NULL;
+
+	try {
+		CWaveFile wavFile(this->m_strInput.c_str());
+		bool isNative = (wavFile.FormatTag() == WAVE_FILE_PCM) && (wavFile.BitsPerSample() == 16) &&
+			(wavFile.Channels() == 2);
+
+		if ((wavFile.FormatTag() != WAVE_FILE_PCM) || (wavFile.Channels() > 2) ||
+			((wavFile.BitsPerSample() != 8) && (wavFile.BitsPerSample() != 16))) {
+			throw "Unsupported format (only 8/16-bit PCM, mono or stereo).";
+		}
+
+		// Files of the same format reuse the streams of the previous ones.
+		pEnc = CMP3EncoderPool::Lease(this->m_pOwner->m_nBitRate, wavFile.SampleRate(), this->m_pOwner->m_nOutSampleRate);
+		CMP3Chunker mp3Chunker(*pEnc, this);
+
+		this->m_pOutput = fopen(this->m_strOutput.c_str(), "wb");
+		if (this->m_pOutput == NULL) throw "Can't create MP3 file.";
+
+		dwBlock = BATCH_READ_BLOCK - BATCH_READ_BLOCK % wavFile.BlockAlign();
+		while (nOffset < wavFile.DataSize()) {
+			dwBytes = (wavFile.DataSize() - nOffset < dwBlock) ? (DWORD) (wavFile.DataSize() - nOffset) : dwBlock;
+			pData = wavFile.Read(nOffset, dwBytes);
+			if (pData == NULL) throw "Can't read file.";
+
+			if (isNative) {
+				// Encoded right from the mapped file. LAME doesn't write into the input.
+				pSamples = (PSHORT) pData;
+				nSamples = dwBytes / sizeof(SHORT);
+			}
+			else {
+				nSamples = this->Convert(wavFile, pData, dwBytes);
+				pSamples = &this->m_arrConverted[0];
+			}
+
+			if (mp3Chunker.Encode(pSamples, nSamples) != BE_ERR_SUCCESSFUL) throw "Encoding failed.";
+			nOffset += dwBytes;
+		}
+		if (mp3Chunker.Flush() != BE_ERR_SUCCESSFUL) throw "Encoding failed.";
+		CMP3EncoderPool::Return(pEnc);
+		pEnc = NULL;
+
+		fclose(this->m_pOutput);
+		this->m_pOutput = NULL;
+
+		dAudioSeconds = (double) wavFile.Frames() / wavFile.SampleRate();
+		this->m_pOwner->Report(nWorker, this->m_strInput.c_str(), dAudioSeconds,
+			(QClock::Micros() - nStart) / 1000000.0, wavFile.DataSize(), NULL);
+	}
+	catch (const char *err) {
+		CMP3EncoderPool::Return(pEnc);
+		this->m_pOwner->Report(nWorker, this->m_strInput.c_str(), 0,
+			(QClock::Micros() - nStart) / 1000000.0, 0, err);
+	}
+}
+///////////////////////////////////////////////////////////////////////////
+CBatchTranscoder::CBatchTranscoder(unsigned int nBitRate, unsigned int nOutSampleRate,
+								   const char *pOutputDir, UINT nThreads): m_qMutex() {
+	this->m_nBitRate = nBitRate;
+	this->m_nOutSampleRate = nOutSampleRate;
+	if (pOutputDir != NULL) this->m_strOutputDir = pOutputDir;
+	this->m_nThreads = nThreads;
+	this->m_nDone = 0;
+	this->m_nFailed = 0;
+	this->m_dAudioSeconds = 0;
+	this->m_nBytes = 0;
+}
+
+void CBatchTranscoder::AddFile(const char *pFileName) {
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	ULONGLONG nSize = 0;
+
+	if (::GetFileAttributesEx(pFileName, GetFileExInfoStandard, &fad)) {
+		nSize = ((ULONGLONG) fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+	}
+	this->m_arrFiles.push_back(make_pair(nSize, string(pFileName)));
+}
+
+void CBatchTranscoder::AddDirectory(const char *pDirName) {
+	static const char *arrExtensions[3] = {".wav", ".pcm", ".raw"};
+	WIN32_FIND_DATA fd;
+	HANDLE hFind;
+	string strDir(pDirName);
+	const char *pExtension;
+	int i;
+
+	if (!strDir.empty() && (strDir[strDir.size() - 1] != '\\') && (strDir[strDir.size() - 1] != '/')) strDir += '\\';
+
+	hFind = ::FindFirstFile((strDir + "*.*").c_str(), &fd);
+	if (hFind == INVALID_HANDLE_VALUE) throw "Can't read directory.";
+
+	do {
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+
+		pExtension = ::strrchr(fd.cFileName, '.');
+		if (pExtension == NULL) continue;
+
+		for (i = 0; i < 3; i++) {
+			if (::_stricmp(pExtension, arrExtensions[i]) == 0) {
+				this->AddFile((strDir + fd.cFileName).c_str());
+				break;
+			}
+		}
+	} while (::FindNextFile(hFind, &fd));
+
+	::FindClose(hFind);
+}
+
+void CBatchTranscoder::AddList(const char *pListName) {
+	char szLine[MAX_PATH + 2];
+	size_t nLength;
+	FILE *f = fopen(pListName, "r");
+
+	if (f == NULL) throw "Can't open list file.";
+
+	while (fgets(szLine, sizeof(szLine), f) != NULL) {
+		nLength = ::strlen(szLine);
+		while ((nLength > 0) && ((szLine[nLength - 1] == '\n') || (szLine[nLength - 1] == '\r'))) szLine[--nLength] = 0;
+		if ((nLength == 0) || (szLine[0] == '#')) continue;
+
+		this->AddFile(szLine);
+	}
+
+	fclose(f);
+}
+
+void CBatchTranscoder::Add(const char *pPath) {
+	DWORD dwAttributes = ::GetFileAttributes(pPath);
+
+	if (dwAttributes == INVALID_FILE_ATTRIBUTES) throw "Batch path not found.";
+
+	if (dwAttributes & FILE_ATTRIBUTE_DIRECTORY) this->AddDirectory(pPath);
+	else this->AddList(pPath);
+}
+
+string CBatchTranscoder::OutputPath(const string &strInput) const {
+	string strOutput;
+	size_t nSlash = strInput.find_last_of("\\/");
+	size_t nDot = strInput.find_last_of('.');
+
+	// Same name, .mp3 extension.
+	if ((nDot != string::npos) && ((nSlash == string::npos) || (nDot > nSlash))) strOutput = strInput.substr(0, nDot);
+	else strOutput = strInput;
+	strOutput += ".mp3";
+
+	if (!this->m_strOutputDir.empty()) {
+		if (nSlash != string::npos) strOutput = strOutput.substr(nSlash + 1);
+		strOutput = this->m_strOutputDir + "\\" + strOutput;
+	}
+	return strOutput;
+}
+
+void CBatchTranscoder::Report(UINT nWorker, const char *pInput, double dAudioSeconds, double dSeconds,
+							  ULONGLONG nBytes, const char *pError) {
+	this->m_qMutex.Lock();
+
+	this->m_nDone++;
+	if (pError != NULL) {
+		this->m_nFailed++;
+		printf("[%u] %s: FAILED, %s\n", nWorker, pInput, pError);
+	}
+	else {
+		this->m_dAudioSeconds += dAudioSeconds;
+		this->m_nBytes += nBytes;
+		if (dSeconds <= 0) dSeconds = 0.000001;
+		printf("[%u] %s: %.1fs of sound in %.2fs (%.1fx real-time, %.1f MB/s)\n", nWorker, pInput,
+			dAudioSeconds, dSeconds, dAudioSeconds / dSeconds, nBytes / dSeconds / (1024 * 1024));
+	}
+
+	this->m_qMutex.Unlock();
+}
+
+UINT CBatchTranscoder::Run() {
+	LONGLONG nStart;
+	LONG nSteals;
+	double dSeconds;
+	size_t i;
+
+	// Biggest files first, so the small ones fill the gaps at the end.
+	sort(this->m_arrFiles.begin(), this->m_arrFiles.end());
+	reverse(this->m_arrFiles.begin(), this->m_arrFiles.end());
+
+	nStart = QClock::Micros();
+	{
+		CWorkStealingPool qPool(this->m_nThreads);
+
+		printf("Encoding %u file(s) on %u thread(s).\n\n", (UINT) this->m_arrFiles.size(), qPool.Threads());
+
+		for (i = 0; i < this->m_arrFiles.size(); i++) {
+			qPool.Submit(new CTranscodeJob(this, this->m_arrFiles[i].second, this->OutputPath(this->m_arrFiles[i].second)));
+		}
+		qPool.Wait();
+		nSteals = qPool.GetSteals();
+	}
+	dSeconds = (QClock::Micros() - nStart) / 1000000.0;
+	if (dSeconds <= 0) dSeconds = 0.000001;
+
+	printf("\n%u file(s) done, %u failed, %d stolen. %.1fs of sound in %.2fs (%.1fx real-time, %.1f MB/s).\n",
+		this->m_nDone, this->m_nFailed, nSteals, this->m_dAudioSeconds, dSeconds,
+		this->m_dAudioSeconds / dSeconds, this->m_nBytes / dSeconds / (1024 * 1024));
+	CMP3EncoderPool::PrintStats();
+
+	return this->m_nFailed;
+}
+
+#endif
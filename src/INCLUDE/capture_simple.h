@@ -0,0 +1,219 @@
+#ifndef ___CAPTURE_SIMPLE_H_INCLUDED___
+#define ___CAPTURE_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <vector>
+#include "INCLUDE/sync_simple.h"
+
+using namespace std;
+
+// Limits for the capture ring, see ICaptureSource::Start().
+#define CAPTURE_MIN_BUFFERS 2
+#define CAPTURE_MAX_BUFFERS 64
+#define CAPTURE_MIN_BUFFER_MS 10
+#define CAPTURE_MAX_BUFFER_MS 10000
+
+// Sample rates ICaptureSource::MatchFormat() falls back to, and how many of them.
+#define CAPTURE_RATES 9
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// See ICaptureSource::Start(IReceiver *pReceiver) below.
+// Instances of any class extending "IReceiver" will be able to receive raw (PCM)
+// sound from a capture source (a CWaveINSimple, or one of the sources of
+// source_simple.h) and process sound via own implementation of the
+// "ReceiveBuffer" method.
+
+class CPCMBuffer;
+
+class IReceiver {
+public:
+	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) = 0;
+
+	// Receives the filled buffer as a shared, reference counted view (see
+	// CPCMBuffer). A receiver which wants to keep (or pass on) the sound after
+	// returning calls pBuffer->AddRef(), and Release() once done with it. By
+	// default the sound is simply passed to "ReceiveBuffer".
+	virtual void ReceivePCM(CPCMBuffer *pBuffer);
+};
+///////////////////////////////////////////////////////////////////////////
+// Whoever lends CPCMBuffer's (a capture source) gets them back here, once the
+// last reference is released, so the memory can be filled again. Recycle()
+// runs on whichever thread releases it (e.g. a fan-out sink's), possibly while
+// the owner is being stopped, so it must not race the owner's Stop() (see
+// CWaveINSimple::Recycle()).
+class IPCMBufferOwner {
+public:
+	virtual void Recycle(CPCMBuffer *pBuffer) = 0;
+};
+///////////////////////////////////////////////////////////////////////////
+// Read-only, reference counted view of a filled capture buffer, so several
+// consumers (e.g. on their own threads, see CFanOutReceiver) can share the
+// sound without copying it. A view lent by a capture source is given back to
+// it (see IPCMBufferOwner) when the last reference is released. A view made by
+// CPCMBuffer::Copy() owns its memory and frees it instead.
+class CPCMBuffer {
+private:
+	IPCMBufferOwner *m_pOwner;
+	LPVOID	m_pContext;
+	LPSTR	m_lpData;
+	DWORD	m_dwBytes;
+	volatile LONG m_nRefs;
+
+public:
+	// Views are made by the capture sources (one per buffer of their ring) and by CPCMBuffer::Copy().
+	CPCMBuffer() { this->m_pOwner = NULL; this->m_pContext = NULL; this->m_lpData = NULL; this->m_dwBytes = 0; this->m_nRefs = 0; };
+	~CPCMBuffer() {};
+
+	// Returns a new view holding its own copy of the sound (one reference),
+	// for sound which doesn't come from a capture source.
+	static CPCMBuffer *Copy(LPSTR lpData, DWORD dwBytes);
+
+	// For the owner. Binds the view to the owner's memory, pContext is
+	// anything the owner needs to recycle it (e.g. the WAVEHDR).
+	void Attach(IPCMBufferOwner *pOwner, LPVOID pContext, LPSTR lpData) {
+		this->m_pOwner = pOwner; this->m_pContext = pContext; this->m_lpData = lpData;
+	};
+
+	// For the owner. Memory was filled with dwBytes of sound, the owner holds
+	// the only reference now.
+	void Fill(DWORD dwBytes) { this->m_dwBytes = dwBytes; this->m_nRefs = 1; };
+
+	LPVOID Context() const { return this->m_pContext; };
+	LPSTR Memory() const { return this->m_lpData; };
+
+	// Sound must not be modified, other consumers see the same memory.
+	const char *Data() const { return this->m_lpData; };
+	DWORD Bytes() const { return this->m_dwBytes; };
+
+	void AddRef() { QAtomicInc(&this->m_nRefs); };
+	void Release();
+};
+///////////////////////////////////////////////////////////////////////////
+// Something which delivers PCM sound to an IReceiver, in buffers of a fixed
+// duration, on its own thread: a WaveIN device (CWaveINSimple, Windows only),
+// or a replayed file and a generated signal (see source_simple.h, everywhere),
+// so the whole encoding and output path can be run without a sound card.
+class ICaptureSource {
+public:
+	// Returns name of the source.
+	virtual const TCHAR *GetName() const = 0;
+
+	// Starts delivering sound to pReceiver, in nBuffers (CAPTURE_MIN_BUFFERS ..
+	// CAPTURE_MAX_BUFFERS) buffers of nBufferMillis (CAPTURE_MIN_BUFFER_MS ..
+	// CAPTURE_MAX_BUFFER_MS) each. Throws if the source can't be started.
+	virtual void Start(IReceiver *pReceiver, UINT nBuffers = 2, UINT nBufferMillis = 2000) = 0;
+
+	// Stops delivering. Every buffer passed to the receiver was released (or
+	// is still referenced by it) once Stop() returns.
+	virtual void Stop() = 0;
+
+	// Returns size (in bytes) of each buffer for the given buffer duration,
+	// exactly as Start() will allocate it.
+	virtual DWORD CalcBufferLength(UINT nBufferMillis) const = 0;
+
+	// Format of the delivered sound (interleaved PCM).
+	virtual DWORD GetSampleRate() const = 0;
+	virtual WORD GetChannels() const = 0;
+	virtual WORD GetBitsPerSample() const = 0;
+
+	// Asks for the format (integer PCM) of the sound delivered from the next
+	// Start() on, a running source keeps its format until it is stopped.
+	// Returns false, and keeps the format, if the source can't deliver it (or
+	// is running). By default a source has only the one format it delivers.
+	virtual bool SelectFormat(DWORD nSampleRate, WORD nChannels, WORD nBitsPerSample) {
+		return (nSampleRate == this->GetSampleRate()) && (nChannels == this->GetChannels()) &&
+			(nBitsPerSample == this->GetBitsPerSample());
+	};
+
+	// Selects the format asked for or, if the source can't deliver it, the
+	// nearest one it can: another of the usual rates (higher ones first, so
+	// no sound is lost), then the other channel count (mono or stereo), then
+	// 16, 24 or 8 bits. The format selected is returned in the arguments.
+	// Returns false if none of them can be delivered.
+	bool MatchFormat(DWORD &nSampleRate, WORD &nChannels, WORD &nBitsPerSample);
+
+protected:
+	// Sources are destroyed by whoever made them, e.g. CWaveINSimple::CleanUp().
+	virtual ~ICaptureSource() {};
+
+	// Buffer length for the format and duration, a multiple of the block
+	// alignment so a sample frame is never split between two buffers.
+	static DWORD BufferLengthOf(DWORD dwBytesPerSec, WORD nBlockAlign, UINT nBufferMillis);
+
+	static const DWORD m_arrRates[CAPTURE_RATES];
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+void IReceiver::ReceivePCM(CPCMBuffer *pBuffer) {
+	this->ReceiveBuffer((LPSTR) pBuffer->Data(), pBuffer->Bytes());
+}
+///////////////////////////////////////////////////////////////////////////
+CPCMBuffer *CPCMBuffer::Copy(LPSTR lpData, DWORD dwBytes) {
+	CPCMBuffer *pBuffer = new CPCMBuffer();
+
+	pBuffer->m_lpData = new char[dwBytes > 0 ? dwBytes : 1];
+	memcpy(pBuffer->m_lpData, lpData, dwBytes);
+	pBuffer->m_dwBytes = dwBytes;
+	pBuffer->m_nRefs = 1;
+	return pBuffer;
+}
+
+void CPCMBuffer::Release() {
+	if (QAtomicDec(&this->m_nRefs) == 0) {
+		if (this->m_pOwner != NULL) this->m_pOwner->Recycle(this);
+		else {
+			delete[] this->m_lpData;
+			delete this;
+		}
+	}
+}
+///////////////////////////////////////////////////////////////////////////
+DWORD ICaptureSource::BufferLengthOf(DWORD dwBytesPerSec, WORD nBlockAlign, UINT nBufferMillis) {
+	DWORD dwBufferLength;
+
+	if (nBufferMillis < CAPTURE_MIN_BUFFER_MS) nBufferMillis = CAPTURE_MIN_BUFFER_MS;
+	else if (nBufferMillis > CAPTURE_MAX_BUFFER_MS) nBufferMillis = CAPTURE_MAX_BUFFER_MS;
+
+	dwBufferLength = (DWORD) (((ULONGLONG) dwBytesPerSec * nBufferMillis + 500) / 1000);
+	dwBufferLength -= dwBufferLength % nBlockAlign;
+	if (dwBufferLength == 0) dwBufferLength = nBlockAlign;
+	return dwBufferLength;
+}
+
+const DWORD ICaptureSource::m_arrRates[CAPTURE_RATES] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000 };
+
+bool ICaptureSource::MatchFormat(DWORD &nSampleRate, WORD &nChannels, WORD &nBitsPerSample) {
+	WORD arrBits[4] = { nBitsPerSample, 16, 24, 8 };
+	WORD arrChannels[2] = { nChannels, (WORD) ((nChannels == 1) ? 2 : 1) };
+	vector<DWORD> arrRates(1, nSampleRate);
+	int b, c, i;
+	size_t r;
+
+	// Rates above the one asked for, nearest first, then those below it.
+	for (i = 0; i < CAPTURE_RATES; i++) {
+		if (m_arrRates[i] > nSampleRate) arrRates.push_back(m_arrRates[i]);
+	}
+	for (i = CAPTURE_RATES - 1; i >= 0; i--) {
+		if (m_arrRates[i] < nSampleRate) arrRates.push_back(m_arrRates[i]);
+	}
+
+	for (b = 0; b < 4; b++) {
+		if ((b > 0) && (arrBits[b] == nBitsPerSample)) continue;
+		for (c = 0; c < 2; c++) {
+			if ((c > 0) && (nChannels > 2)) break;
+			for (r = 0; r < arrRates.size(); r++) {
+				if (this->SelectFormat(arrRates[r], arrChannels[c], arrBits[b])) {
+					nSampleRate = arrRates[r];
+					nChannels = arrChannels[c];
+					nBitsPerSample = arrBits[b];
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+#endif
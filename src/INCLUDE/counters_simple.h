@@ -0,0 +1,284 @@
+#ifndef ___COUNTERS_SIMPLE_H_INCLUDED___
+#define ___COUNTERS_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/stats_simple.h"
+
+using namespace std;
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Lock-free 64-bit counter, updated on the hot path (capture, encoding) and
+// read from any other thread at any time.
+class CCounter {
+private:
+	volatile LONGLONG m_nValue;
+
+public:
+	CCounter() { this->m_nValue = 0; };
+
+	void Inc() { QAtomicAdd64(&this->m_nValue, 1); };
+	void Add(LONGLONG nValue) { QAtomicAdd64(&this->m_nValue, nValue); };
+	LONGLONG Get() { return QAtomicLoad64(&this->m_nValue); };
+};
+///////////////////////////////////////////////////////////////////////////
+// Lock-free version of the CLatencyHistogram (same buckets), for the hot
+// path: adding a value is a few atomic increments, never a lock. Values read
+// while others are being added may be off by those few values.
+class CCounterHistogram {
+private:
+	volatile LONG m_arrBuckets[HISTOGRAM_BUCKETS];
+	volatile LONGLONG m_nCount;
+	volatile LONGLONG m_nSum;
+	volatile LONGLONG m_nMax;
+
+public:
+	CCounterHistogram();
+	~CCounterHistogram() {};
+
+	void Add(LONGLONG nValue);
+
+	LONGLONG Count() { return QAtomicLoad64(&this->m_nCount); };
+	LONGLONG Max() { return QAtomicLoad64(&this->m_nMax); };
+	double Mean();
+
+	// See CLatencyHistogram::Percentile().
+	LONGLONG Percentile(double dPercent);
+};
+///////////////////////////////////////////////////////////////////////////
+// Named group of counters and histograms of one component (a capture device,
+// an encoded stream, an output file), e.g. "capture.Line In". Every set is
+// listed in a process-wide registry from its construction to its
+// destruction, so Snapshot() can print all of them at any time.
+//
+// Only creating and destroying a set (and taking a snapshot) takes the
+// registry's lock, the counters themselves are never locked.
+class CCounterSet {
+private:
+	static vector<CCounterSet*> m_arrSets;
+	static QMutex m_qRegistryMutex;
+
+	string		m_strName;
+	vector<const char*> m_arrCounterNames;
+	vector<CCounter*> m_arrCounters;
+	vector<const char*> m_arrHistogramNames;
+	vector<CCounterHistogram*> m_arrHistograms;
+
+	// Appends the "name value" lines of the set to strText.
+	void Print(string &strText);
+
+public:
+	// pKind, pName - the set is called "<pKind>.<pName>".
+	CCounterSet(const char *pKind, const char *pName);
+	virtual ~CCounterSet();
+
+	// Lists a member of the subclass under pName (a literal, it is not copied).
+	// Called by the subclass' constructor.
+	void Add(const char *pName, CCounter *pCounter);
+	void Add(const char *pName, CCounterHistogram *pHistogram);
+
+	const char *GetName() const { return this->m_strName.c_str(); };
+
+	// Returns the current values of every set, one "<set>.<counter> <value>"
+	// line per counter, histograms as "<set>.<histogram> n=.. mean=.. p50=.. p99=.. p999=.. max=..".
+	static string Snapshot();
+
+	// Prints the Snapshot() to stdout.
+	static void PrintSnapshot();
+};
+///////////////////////////////////////////////////////////////////////////
+// Counters of a capture device (or capture source, see ICaptureSource).
+//
+// OutsideQueue - how long (in microseconds) each buffer was away from the
+// driver: from the moment it came back filled until it was queued again,
+// i.e. the time the receiver (and whoever it shared the buffer with) kept it.
+//
+// Requeue - how long (in microseconds) giving the buffer back took, once
+// released.
+//
+// Overruns - times the driver was left without an empty buffer, so the sound
+// recorded meanwhile was (or could have been) lost.
+//
+// Start - how long (in microseconds) from Start() until the first buffer
+// reached the receiver, and Stop - from Stop() until every buffer was back.
+class CCaptureCounters: public CCounterSet {
+public:
+	CCounter	Buffers;
+	CCounter	Bytes;
+	CCounter	Overruns;
+	CCounterHistogram OutsideQueue;
+	CCounterHistogram Requeue;
+	CCounterHistogram Start;
+	CCounterHistogram Stop;
+
+	CCaptureCounters(const char *pName);
+};
+///////////////////////////////////////////////////////////////////////////
+// Counters of an encoded stream (e.g. mp3Writer).
+//
+// Encode - how long (in microseconds) encoding of each capture buffer took.
+//
+// Stalls - times the output couldn't keep up with the encoder (see
+// CAsyncFileSink::GetStalls()).
+class CStreamCounters: public CCounterSet {
+public:
+	CCounter	Buffers;
+	CCounter	PCMBytes;
+	CCounter	MP3Bytes;
+	CCounter	Stalls;
+	CCounterHistogram Encode;
+
+	CStreamCounters(const char *pName);
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+vector<CCounterSet*> CCounterSet::m_arrSets;
+QMutex CCounterSet::m_qRegistryMutex;
+
+CCounterHistogram::CCounterHistogram() {
+	ZeroMemory((void *) this->m_arrBuckets, sizeof(this->m_arrBuckets));
+	this->m_nCount = 0;
+	this->m_nSum = 0;
+	this->m_nMax = 0;
+}
+
+void CCounterHistogram::Add(LONGLONG nValue) {
+	if (nValue < 0) nValue = 0;
+
+	QAtomicInc(&this->m_arrBuckets[CLatencyHistogram::BucketOf((ULONGLONG) nValue)]);
+	QAtomicAdd64(&this->m_nCount, 1);
+	QAtomicAdd64(&this->m_nSum, nValue);
+	QAtomicMax64(&this->m_nMax, nValue);
+}
+
+double CCounterHistogram::Mean() {
+	LONGLONG nCount = this->Count();
+
+	return (nCount > 0) ? (double) QAtomicLoad64(&this->m_nSum) / nCount : 0.0;
+}
+
+LONGLONG CCounterHistogram::Percentile(double dPercent) {
+	LONGLONG nRank, nTotal = 0, nSeen = 0, nValue = 0;
+	LONG arrBuckets[HISTOGRAM_BUCKETS];
+	int i;
+
+	// Counted from a copy of the buckets, so the rank and the walk agree.
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		arrBuckets[i] = QAtomicLoad(&this->m_arrBuckets[i]);
+		nTotal += arrBuckets[i];
+	}
+	if (nTotal == 0) return 0;
+
+	nRank = (LONGLONG) (dPercent / 100.0 * nTotal + 0.5);
+	if (nRank < 1) nRank = 1;
+	if (nRank > nTotal) nRank = nTotal;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		nSeen += arrBuckets[i];
+		if (nSeen >= nRank) {
+			nValue = (LONGLONG) CLatencyHistogram::BucketLimit(i) - 1;
+			break;
+		}
+	}
+	if (nValue > this->Max()) nValue = this->Max();
+	return nValue;
+}
+///////////////////////////////////////////////////////////////////////////
+CCounterSet::CCounterSet(const char *pKind, const char *pName): m_strName(pKind) {
+	this->m_strName += ".";
+	this->m_strName += pName;
+
+	m_qRegistryMutex.Lock();
+	m_arrSets.push_back(this);
+	m_qRegistryMutex.Unlock();
+}
+
+CCounterSet::~CCounterSet() {
+	UINT i;
+
+	m_qRegistryMutex.Lock();
+	for (i = 0; i < m_arrSets.size(); i++) {
+		if (m_arrSets[i] == this) {
+			m_arrSets.erase(m_arrSets.begin() + i);
+			break;
+		}
+	}
+	m_qRegistryMutex.Unlock();
+}
+
+void CCounterSet::Add(const char *pName, CCounter *pCounter) {
+	// The set is listed already, a snapshot may be walking it.
+	m_qRegistryMutex.Lock();
+	this->m_arrCounterNames.push_back(pName);
+	this->m_arrCounters.push_back(pCounter);
+	m_qRegistryMutex.Unlock();
+}
+
+void CCounterSet::Add(const char *pName, CCounterHistogram *pHistogram) {
+	m_qRegistryMutex.Lock();
+	this->m_arrHistogramNames.push_back(pName);
+	this->m_arrHistograms.push_back(pHistogram);
+	m_qRegistryMutex.Unlock();
+}
+
+void CCounterSet::Print(string &strText) {
+	char szLine[512];
+	CCounterHistogram *pHistogram;
+	UINT i;
+
+	for (i = 0; i < this->m_arrCounters.size(); i++) {
+		_snprintf(szLine, sizeof(szLine) - 1, "%s.%s %" QFMT_I64 "d\n", this->m_strName.c_str(),
+			this->m_arrCounterNames[i], this->m_arrCounters[i]->Get());
+		szLine[sizeof(szLine) - 1] = 0;
+		strText += szLine;
+	}
+
+	for (i = 0; i < this->m_arrHistograms.size(); i++) {
+		pHistogram = this->m_arrHistograms[i];
+		_snprintf(szLine, sizeof(szLine) - 1, "%s.%s n=%" QFMT_I64 "d mean=%.1f p50=%" QFMT_I64 "d p99=%" QFMT_I64 "d"
+			" p999=%" QFMT_I64 "d max=%" QFMT_I64 "d\n", this->m_strName.c_str(), this->m_arrHistogramNames[i],
+			pHistogram->Count(), pHistogram->Mean(), pHistogram->Percentile(50), pHistogram->Percentile(99),
+			pHistogram->Percentile(99.9), pHistogram->Max());
+		szLine[sizeof(szLine) - 1] = 0;
+		strText += szLine;
+	}
+}
+
+string CCounterSet::Snapshot() {
+	string strText;
+	UINT i;
+
+	m_qRegistryMutex.Lock();
+	for (i = 0; i < m_arrSets.size(); i++) m_arrSets[i]->Print(strText);
+	m_qRegistryMutex.Unlock();
+	return strText;
+}
+
+void CCounterSet::PrintSnapshot() {
+	printf("%s", Snapshot().c_str());
+}
+///////////////////////////////////////////////////////////////////////////
+CCaptureCounters::CCaptureCounters(const char *pName): CCounterSet("capture", pName) {
+	this->Add("buffers", &this->Buffers);
+	this->Add("bytes", &this->Bytes);
+	this->Add("overruns", &this->Overruns);
+	this->Add("outside_queue_us", &this->OutsideQueue);
+	this->Add("requeue_us", &this->Requeue);
+	this->Add("start_us", &this->Start);
+	this->Add("stop_us", &this->Stop);
+}
+///////////////////////////////////////////////////////////////////////////
+CStreamCounters::CStreamCounters(const char *pName): CCounterSet("stream", pName) {
+	this->Add("buffers", &this->Buffers);
+	this->Add("pcm_bytes", &this->PCMBytes);
+	this->Add("mp3_bytes", &this->MP3Bytes);
+	this->Add("stalls", &this->Stalls);
+	this->Add("encode_us", &this->Encode);
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef ___FANOUT_SIMPLE_H_INCLUDED___
+#define ___FANOUT_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <vector>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/capture_simple.h"
+#include "INCLUDE/queue_simple.h"
+
+using namespace std;
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+class CFanOutReceiver;
+
+// One downstream sink of the CFanOutReceiver, with its own thread and its
+// own queue of CPCMBuffer's (pointers only, the sound is never copied).
+class CFanOutSink {
+	friend class CFanOutReceiver;
+private:
+	IReceiver	*m_pTarget;
+	QSPSCRing	m_qRing;
+	QEvent		m_qDataReady;
+	QThread		m_qThread;
+	volatile LONG m_isStopping;
+
+	// Buffers this sink missed, because its queue was full.
+	volatile LONG m_nOverruns;
+
+	CFanOutSink(IReceiver *pTarget, LONG nSlots);
+	~CFanOutSink();
+
+	// Called on the capture thread. Returns false if the queue is full.
+	bool Push(CPCMBuffer *pBuffer);
+
+	// Passes all queued buffers to the target, and releases them.
+	void Drain();
+	void Stop();
+
+	static DWORD WINAPI sinkProc(LPVOID arg);
+};
+
+// IReceiver which passes the same capture to several IReceiver's (e.g. an MP3
+// file, a WAV archive and a level meter), each on its own thread. Every sink
+// gets a reference to the same CPCMBuffer, the WAVEHDR goes back to the driver
+// once the last sink is done with it, so there is no copy per sink and a slow
+// sink doesn't delay the others.
+//
+// A sink which falls behind keeps WAVEHDR's away from the driver, so give the
+// device enough buffers (see ICaptureSource::Start). If a sink's queue gets full,
+// further buffers are skipped for that sink only (see GetOverruns()), the
+// capture thread is never blocked.
+//
+// Sound received via ReceiveBuffer() (i.e. not from a capture source) is copied
+// once, into a CPCMBuffer shared by all sinks.
+class CFanOutReceiver: public IReceiver {
+private:
+	vector<CFanOutSink*> m_arrSinks;
+	LONG		m_nSlots;
+
+public:
+	// nSlots - length of each sink's queue, in buffers.
+	CFanOutReceiver(LONG nSlots = CAPTURE_MAX_BUFFERS);
+	~CFanOutReceiver();
+
+	// Adds a sink, must be called before the capture starts. Returns index of the sink.
+	UINT AddSink(IReceiver *pTarget);
+
+	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded);
+	virtual void ReceivePCM(CPCMBuffer *pBuffer);
+
+	// Waits until every sink has processed everything queued so far and stops the
+	// sink threads. Call it after the producer (the capture source) was stopped.
+	void Stop();
+
+	UINT GetSinkCount() const { return (UINT) this->m_arrSinks.size(); }
+
+	// Number of buffers the nSink-th sink missed.
+	LONG GetOverruns(UINT nSink) { return QAtomicLoad(&this->m_arrSinks[nSink]->m_nOverruns); }
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CFanOutSink::CFanOutSink(IReceiver *pTarget, LONG nSlots):
+		m_qRing(nSlots, sizeof(CPCMBuffer*)), m_qDataReady(), m_qThread() {
+	this->m_pTarget = pTarget;
+	this->m_isStopping = 0;
+	this->m_nOverruns = 0;
+
+	this->m_qThread.Start(&CFanOutSink::sinkProc, (LPVOID) this);
+}
+
+CFanOutSink::~CFanOutSink() {
+	this->Stop();
+}
+
+void CFanOutSink::Stop() {
+	if (this->m_qThread.IsStarted()) {
+		QAtomicStore(&this->m_isStopping, 1);
+		this->m_qDataReady.Set();
+		this->m_qThread.Join();
+	}
+}
+
+bool CFanOutSink::Push(CPCMBuffer *pBuffer) {
+	LPSTR pSlot = this->m_qRing.BeginWrite();
+
+	if (pSlot == NULL) {
+		QAtomicInc(&this->m_nOverruns);
+		return false;
+	}
+
+	memcpy(pSlot, &pBuffer, sizeof(CPCMBuffer*));
+	this->m_qRing.EndWrite(sizeof(CPCMBuffer*));
+	this->m_qDataReady.Set();
+	return true;
+}
+
+void CFanOutSink::Drain() {
+	CPCMBuffer *pBuffer;
+	LPSTR pSlot;
+	DWORD dwBytes;
+
+	while ((pSlot = this->m_qRing.BeginRead(&dwBytes)) != NULL) {
+		memcpy(&pBuffer, pSlot, sizeof(CPCMBuffer*));
+		this->m_qRing.EndRead();
+
+		if (this->m_pTarget != NULL) this->m_pTarget->ReceivePCM(pBuffer);
+		pBuffer->Release();
+	}
+}
+
+DWORD WINAPI CFanOutSink::sinkProc(LPVOID arg) {
+	CFanOutSink *_this = (CFanOutSink *) arg;
+	LONG isStopping;
+
+	for (;;) {
+		// Same as CAsyncReceiver, read the flag before draining.
+		isStopping = QAtomicLoad(&_this->m_isStopping);
+		_this->Drain();
+		if (isStopping) break;
+
+		_this->m_qDataReady.Wait();
+	}
+	return(0);
+}
+///////////////////////////////////////////////////////////////////////////
+CFanOutReceiver::CFanOutReceiver(LONG nSlots) {
+	this->m_nSlots = nSlots;
+}
+
+CFanOutReceiver::~CFanOutReceiver() {
+	size_t i;
+
+	this->Stop();
+	for (i = 0; i < this->m_arrSinks.size(); i++) delete this->m_arrSinks[i];
+	this->m_arrSinks.clear();
+}
+
+UINT CFanOutReceiver::AddSink(IReceiver *pTarget) {
+	this->m_arrSinks.push_back(new CFanOutSink(pTarget, this->m_nSlots));
+	return (UINT) this->m_arrSinks.size() - 1;
+}
+
+void CFanOutReceiver::ReceivePCM(CPCMBuffer *pBuffer) {
+	size_t i;
+
+	for (i = 0; i < this->m_arrSinks.size(); i++) {
+		// Reference of the sink, released by its thread.
+		pBuffer->AddRef();
+		if (!this->m_arrSinks[i]->Push(pBuffer)) pBuffer->Release();
+	}
+}
+
+void CFanOutReceiver::ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) {
+	CPCMBuffer *pBuffer = CPCMBuffer::Copy(lpData, dwBytesRecorded);
+
+	this->ReceivePCM(pBuffer);
+	pBuffer->Release();
+}
+
+void CFanOutReceiver::Stop() {
+	size_t i;
+
+	for (i = 0; i < this->m_arrSinks.size(); i++) this->m_arrSinks[i]->Stop();
+}
+
+#endif
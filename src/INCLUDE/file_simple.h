@@ -0,0 +1,309 @@
+#ifndef ___FILE_SIMPLE_H_INCLUDED___
+#define ___FILE_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Format tags of the WAV files, see CWaveFile.
+#define WAVE_FILE_PCM 1
+#define WAVE_FILE_FLOAT 3
+#define WAVE_FILE_EXTENSIBLE 0xFFFE
+
+// Size of the window mapped by CMappedFile, big files are never mapped as a
+// whole (a 32-bit process wouldn't have enough address space for them).
+#define MAPPED_FILE_WINDOW (16 * 1024 * 1024)
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Read-only access to a file via a memory-mapped window, which slides over
+// the file as requested by View(). Reading this way costs no system call
+// (and no copy) per block, the OS pages the data in directly.
+class CMappedFile {
+private:
+#ifdef _WIN32
+	HANDLE		m_hFile;
+	HANDLE		m_hMapping;
+#else
+	int			m_nFile;
+#endif
+	ULONGLONG	m_nSize;
+
+	// Currently mapped window.
+	PBYTE		m_pView;
+	ULONGLONG	m_nViewOffset;
+	DWORD		m_dwViewSize;
+
+	DWORD		m_dwGranularity;
+
+	void Unmap();
+
+public:
+	// Opens and maps the file, throws if it can't be opened.
+	CMappedFile(const TCHAR *pFileName);
+	~CMappedFile();
+
+	ULONGLONG Size() const { return this->m_nSize; }
+
+	// Returns pointer to dwBytes of the file starting at nOffset (dwBytes
+	// must not be bigger than MAPPED_FILE_WINDOW). Pointer remains valid
+	// until the next call. Returns NULL if the range is outside of the file.
+	const BYTE *View(ULONGLONG nOffset, DWORD dwBytes);
+};
+
+// Read-only access to the sound of a WAV file (RIFF/WAVE, PCM or IEEE float),
+// via CMappedFile. A file without the RIFF header is taken as raw PCM in the
+// format CWaveINSimple records by default (44100Hz, 16-bit, stereo).
+class CWaveFile {
+private:
+	CMappedFile	m_File;
+	bool		m_isRaw;
+
+	// Format of the sound, tag is WAVE_FILE_PCM or WAVE_FILE_FLOAT
+	// (extensible format is resolved to one of them).
+	WORD		m_wFormatTag;
+	WORD		m_nChannels;
+	DWORD		m_nSamplesPerSec;
+	WORD		m_wBitsPerSample;
+	WORD		m_nBlockAlign;
+
+	// Where the sound is, within the file.
+	ULONGLONG	m_nDataOffset;
+	ULONGLONG	m_nDataSize;
+
+	void ParseRIFF();
+
+public:
+	// Opens the file and finds the sound in it, throws if that fails.
+	CWaveFile(const TCHAR *pFileName);
+	~CWaveFile() {};
+
+	bool IsRaw() const { return this->m_isRaw; }
+	WORD FormatTag() const { return this->m_wFormatTag; }
+	WORD Channels() const { return this->m_nChannels; }
+	DWORD SampleRate() const { return this->m_nSamplesPerSec; }
+	WORD BitsPerSample() const { return this->m_wBitsPerSample; }
+	WORD BlockAlign() const { return this->m_nBlockAlign; }
+
+	// Size of the sound, in bytes and in sample frames (one sample of each channel).
+	ULONGLONG DataSize() const { return this->m_nDataSize; }
+	ULONGLONG Frames() const { return this->m_nDataSize / this->m_nBlockAlign; }
+
+	// Returns pointer to dwBytes of the sound starting at nOffset (counted from the
+	// start of the sound), see CMappedFile::View().
+	const BYTE *Read(ULONGLONG nOffset, DWORD dwBytes) { return this->m_File.View(this->m_nDataOffset + nOffset, dwBytes); }
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+#ifdef _WIN32
+CMappedFile::CMappedFile(const TCHAR *pFileName) {
+	SYSTEM_INFO si;
+	DWORD dwSizeLow, dwSizeHigh;
+
+	this->m_hMapping = NULL;
+	this->m_pView = NULL;
+	this->m_nViewOffset = 0;
+	this->m_dwViewSize = 0;
+
+	::GetSystemInfo(&si);
+	this->m_dwGranularity = si.dwAllocationGranularity;
+
+	this->m_hFile = ::CreateFile(pFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (this->m_hFile == INVALID_HANDLE_VALUE) throw "Can't open file.";
+
+	dwSizeLow = ::GetFileSize(this->m_hFile, &dwSizeHigh);
+	if ((dwSizeLow == INVALID_FILE_SIZE) && (::GetLastError() != NO_ERROR)) {
+		::CloseHandle(this->m_hFile);
+		throw "Can't get file size.";
+	}
+	this->m_nSize = ((ULONGLONG) dwSizeHigh << 32) | dwSizeLow;
+
+	// Empty file can't be mapped, View() will return NULL for it.
+	if (this->m_nSize > 0) {
+		this->m_hMapping = ::CreateFileMapping(this->m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (this->m_hMapping == NULL) {
+			::CloseHandle(this->m_hFile);
+			throw "Can't map file.";
+		}
+	}
+}
+
+CMappedFile::~CMappedFile() {
+	this->Unmap();
+	if (this->m_hMapping != NULL) ::CloseHandle(this->m_hMapping);
+	::CloseHandle(this->m_hFile);
+}
+
+void CMappedFile::Unmap() {
+	if (this->m_pView != NULL) {
+		::UnmapViewOfFile(this->m_pView);
+		this->m_pView = NULL;
+		this->m_dwViewSize = 0;
+	}
+}
+
+const BYTE *CMappedFile::View(ULONGLONG nOffset, DWORD dwBytes) {
+	ULONGLONG nStart, nEnd;
+
+	if ((dwBytes > MAPPED_FILE_WINDOW) || (nOffset + dwBytes > this->m_nSize) || (this->m_hMapping == NULL)) return NULL;
+
+	// Still inside the current window?
+	if ((this->m_pView == NULL) || (nOffset < this->m_nViewOffset) ||
+		(nOffset + dwBytes > this->m_nViewOffset + this->m_dwViewSize)) {
+
+		this->Unmap();
+
+		// Window must start at a multiple of the allocation granularity.
+		nStart = nOffset - (nOffset % this->m_dwGranularity);
+		nEnd = nStart + MAPPED_FILE_WINDOW + this->m_dwGranularity;
+		if (nEnd > this->m_nSize) nEnd = this->m_nSize;
+
+		this->m_pView = (PBYTE) ::MapViewOfFile(this->m_hMapping, FILE_MAP_READ,
+			(DWORD) (nStart >> 32), (DWORD) (nStart & 0xFFFFFFFF), (SIZE_T) (nEnd - nStart));
+		if (this->m_pView == NULL) return NULL;
+
+		this->m_nViewOffset = nStart;
+		this->m_dwViewSize = (DWORD) (nEnd - nStart);
+	}
+
+	return this->m_pView + (nOffset - this->m_nViewOffset);
+}
+#else
+CMappedFile::CMappedFile(const TCHAR *pFileName) {
+	struct stat st;
+
+	this->m_pView = NULL;
+	this->m_nViewOffset = 0;
+	this->m_dwViewSize = 0;
+	this->m_dwGranularity = (DWORD) ::sysconf(_SC_PAGESIZE);
+
+	this->m_nFile = ::open(pFileName, O_RDONLY);
+	if (this->m_nFile < 0) throw "Can't open file.";
+
+	if (::fstat(this->m_nFile, &st) != 0) {
+		::close(this->m_nFile);
+		throw "Can't get file size.";
+	}
+	this->m_nSize = (ULONGLONG) st.st_size;
+}
+
+CMappedFile::~CMappedFile() {
+	this->Unmap();
+	::close(this->m_nFile);
+}
+
+void CMappedFile::Unmap() {
+	if (this->m_pView != NULL) {
+		::munmap(this->m_pView, this->m_dwViewSize);
+		this->m_pView = NULL;
+		this->m_dwViewSize = 0;
+	}
+}
+
+const BYTE *CMappedFile::View(ULONGLONG nOffset, DWORD dwBytes) {
+	ULONGLONG nStart, nEnd;
+	void *pView;
+
+	// Empty file can't be mapped, same as on Windows.
+	if ((dwBytes > MAPPED_FILE_WINDOW) || (nOffset + dwBytes > this->m_nSize) || (this->m_nSize == 0)) return NULL;
+
+	if ((this->m_pView == NULL) || (nOffset < this->m_nViewOffset) ||
+		(nOffset + dwBytes > this->m_nViewOffset + this->m_dwViewSize)) {
+
+		this->Unmap();
+
+		// Window must start at a multiple of the page size.
+		nStart = nOffset - (nOffset % this->m_dwGranularity);
+		nEnd = nStart + MAPPED_FILE_WINDOW + this->m_dwGranularity;
+		if (nEnd > this->m_nSize) nEnd = this->m_nSize;
+
+		pView = ::mmap(NULL, (size_t) (nEnd - nStart), PROT_READ, MAP_SHARED, this->m_nFile, (off_t) nStart);
+		if (pView == MAP_FAILED) return NULL;
+		::madvise(pView, (size_t) (nEnd - nStart), MADV_SEQUENTIAL);
+
+		this->m_pView = (PBYTE) pView;
+		this->m_nViewOffset = nStart;
+		this->m_dwViewSize = (DWORD) (nEnd - nStart);
+	}
+
+	return this->m_pView + (nOffset - this->m_nViewOffset);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+CWaveFile::CWaveFile(const TCHAR *pFileName): m_File(pFileName) {
+	const BYTE *pHeader = this->m_File.View(0, 12);
+
+	if ((pHeader != NULL) && (memcmp(pHeader, "RIFF", 4) == 0) && (memcmp(pHeader + 8, "WAVE", 4) == 0)) {
+		this->m_isRaw = false;
+		this->ParseRIFF();
+	}
+	else {
+		this->m_isRaw = true;
+		this->m_wFormatTag = WAVE_FILE_PCM;
+		this->m_nChannels = 2;
+		this->m_nSamplesPerSec = 44100;
+		this->m_wBitsPerSample = 16;
+		this->m_nBlockAlign = 4;
+		this->m_nDataOffset = 0;
+		this->m_nDataSize = this->m_File.Size() - this->m_File.Size() % 4;
+	}
+}
+
+void CWaveFile::ParseRIFF() {
+	ULONGLONG nOffset = 12;
+	const BYTE *pChunk;
+	DWORD dwChunkSize;
+	bool isFormatFound = false;
+
+	for (;;) {
+		pChunk = this->m_File.View(nOffset, 8);
+		if (pChunk == NULL) throw "WAV file has no data chunk.";
+		memcpy(&dwChunkSize, pChunk + 4, sizeof(DWORD));
+
+		if (memcmp(pChunk, "fmt ", 4) == 0) {
+			if (dwChunkSize < 16) throw "Invalid WAV format chunk.";
+			pChunk = this->m_File.View(nOffset + 8, (dwChunkSize >= 26) ? 26 : 16);
+			if (pChunk == NULL) throw "Invalid WAV format chunk.";
+
+			memcpy(&this->m_wFormatTag, pChunk, sizeof(WORD));
+			memcpy(&this->m_nChannels, pChunk + 2, sizeof(WORD));
+			memcpy(&this->m_nSamplesPerSec, pChunk + 4, sizeof(DWORD));
+			memcpy(&this->m_nBlockAlign, pChunk + 12, sizeof(WORD));
+			memcpy(&this->m_wBitsPerSample, pChunk + 14, sizeof(WORD));
+
+			// Extensible format keeps the real tag in the first two bytes of its sub-format GUID.
+			if ((this->m_wFormatTag == WAVE_FILE_EXTENSIBLE) && (dwChunkSize >= 26)) {
+				memcpy(&this->m_wFormatTag, pChunk + 24, sizeof(WORD));
+			}
+
+			if (((this->m_wFormatTag != WAVE_FILE_PCM) && (this->m_wFormatTag != WAVE_FILE_FLOAT)) ||
+				(this->m_nChannels == 0) || (this->m_nBlockAlign == 0) || (this->m_nSamplesPerSec == 0)) {
+				throw "Unsupported WAV format.";
+			}
+			isFormatFound = true;
+		}
+		else if (memcmp(pChunk, "data", 4) == 0) {
+			if (!isFormatFound) throw "WAV file has no format chunk.";
+
+			// Recorders which were killed may leave zero (or garbage) as size
+			// of the data, so trust the file size more.
+			this->m_nDataOffset = nOffset + 8;
+			this->m_nDataSize = this->m_File.Size() - this->m_nDataOffset;
+			if ((dwChunkSize > 0) && (dwChunkSize < this->m_nDataSize)) this->m_nDataSize = dwChunkSize;
+			this->m_nDataSize -= this->m_nDataSize % this->m_nBlockAlign;
+			return;
+		}
+
+		// Chunks are aligned to WORD.
+		nOffset += 8 + (ULONGLONG) dwChunkSize + (dwChunkSize & 1);
+	}
+}
+
+#endif
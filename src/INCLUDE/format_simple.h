@@ -0,0 +1,107 @@
+#ifndef ___FORMAT_SIMPLE_H_INCLUDED___
+#define ___FORMAT_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <vector>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/capture_simple.h"
+#include "INCLUDE/pcm_simple.h"
+
+using namespace std;
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// IReceiver which brings the sound of a capture source to what the rest of
+// the pipeline (e.g. CGainReceiver, mp3Writer) takes: 16-bit, mono or
+// stereo. 8, 24 and 32-bit sound is converted by the vector kernels of
+// CPCMConvert (with dither when it is reduced), and stereo is mixed down to
+// mono or mono spread to stereo if another channel count was asked for,
+// e.g. when the device couldn't record the one wanted (see
+// ICaptureSource::MatchFormat()).
+//
+// The target receives the converted copy, it should process the sound before
+// returning. Sound needing no conversion is passed on as it is.
+class CFormatReceiver: public IReceiver {
+private:
+	IReceiver	*m_pTarget;
+	WORD		m_nChannels;
+	WORD		m_wBitsPerSample;
+	WORD		m_nOutChannels;
+
+	CPCMDither	m_Dither;
+	vector<SHORT> m_arrSamples;
+	vector<SHORT> m_arrChannels;
+
+public:
+	// pTarget - IReceiver that will receive the 16-bit sound.
+	//
+	// nChannels, wBitsPerSample - format of the sound received (8, 16, 24 or
+	// 32-bit integer PCM).
+	//
+	// nOutChannels - channels of the sound passed on, nChannels or (for mono
+	// and stereo sound) the other one. Throws if the format can't be converted.
+	CFormatReceiver(IReceiver *pTarget, WORD nChannels, WORD wBitsPerSample, WORD nOutChannels);
+	~CFormatReceiver() {};
+
+	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded);
+
+	// Passes the buffer on as it is if there is nothing to convert.
+	virtual void ReceivePCM(CPCMBuffer *pBuffer);
+
+	// Whether sound of the format has to be converted for nOutChannels.
+	static bool IsNeeded(WORD nChannels, WORD wBitsPerSample, WORD nOutChannels) {
+		return (wBitsPerSample != 16) || (nChannels != nOutChannels);
+	};
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CFormatReceiver::CFormatReceiver(IReceiver *pTarget, WORD nChannels, WORD wBitsPerSample, WORD nOutChannels) {
+	if ((wBitsPerSample != 8) && (wBitsPerSample != 16) && (wBitsPerSample != 24) && (wBitsPerSample != 32)) {
+		throw "Only 8, 16, 24 and 32-bit sound can be converted.";
+	}
+	if ((nChannels != nOutChannels) && ((nChannels > 2) || (nOutChannels > 2))) {
+		throw "Only mono and stereo sound can be mixed.";
+	}
+
+	this->m_pTarget = pTarget;
+	this->m_nChannels = nChannels;
+	this->m_wBitsPerSample = wBitsPerSample;
+	this->m_nOutChannels = nOutChannels;
+}
+
+void CFormatReceiver::ReceivePCM(CPCMBuffer *pBuffer) {
+	if (IsNeeded(this->m_nChannels, this->m_wBitsPerSample, this->m_nOutChannels)) {
+		this->ReceiveBuffer((LPSTR) pBuffer->Data(), pBuffer->Bytes());
+	}
+	else this->m_pTarget->ReceivePCM(pBuffer);
+}
+
+void CFormatReceiver::ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) {
+	DWORD nFrames = dwBytesRecorded / (this->m_nChannels * (this->m_wBitsPerSample / 8));
+	DWORD nSamples = nFrames * this->m_nChannels;
+	const SHORT *pSamples = (const SHORT *) lpData;
+
+	if (nFrames == 0) return;
+
+	if (this->m_wBitsPerSample != 16) {
+		if (this->m_arrSamples.size() < nSamples) this->m_arrSamples.resize(nSamples);
+		switch (this->m_wBitsPerSample) {
+		case 8: CPCMConvert::U8ToS16((const BYTE *) lpData, &this->m_arrSamples[0], nSamples); break;
+		case 24: CPCMConvert::S24ToS16((const BYTE *) lpData, &this->m_arrSamples[0], nSamples, &this->m_Dither); break;
+		default: CPCMConvert::S32ToS16((const LONG *) lpData, &this->m_arrSamples[0], nSamples, &this->m_Dither); break;
+		}
+		pSamples = &this->m_arrSamples[0];
+	}
+
+	if (this->m_nChannels != this->m_nOutChannels) {
+		if (this->m_arrChannels.size() < nFrames * this->m_nOutChannels) this->m_arrChannels.resize(nFrames * this->m_nOutChannels);
+		if (this->m_nOutChannels == 1) CPCMConvert::StereoToMono(pSamples, &this->m_arrChannels[0], nFrames);
+		else CPCMConvert::MonoToStereo(pSamples, &this->m_arrChannels[0], nFrames);
+		pSamples = &this->m_arrChannels[0];
+	}
+
+	this->m_pTarget->ReceiveBuffer((LPSTR) pSamples, nFrames * this->m_nOutChannels * 2);
+}
+
+#endif
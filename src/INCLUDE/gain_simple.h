@@ -0,0 +1,155 @@
+#ifndef ___GAIN_SIMPLE_H_INCLUDED___
+#define ___GAIN_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <math.h>
+#include <vector>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/capture_simple.h"
+#include "INCLUDE/pcm_simple.h"
+
+using namespace std;
+
+// Soft limiter's knee, in dBFS: louder samples are bent towards full scale.
+#define GAIN_KNEE_DB -3.0
+
+// Automatic gain control: level (RMS, in dBFS) it aims for by default, range
+// of the gain it may use (dB), and the level (dBFS) below which the sound is
+// taken as silence, which keeps the gain as it is instead of raising it.
+#define GAIN_AGC_TARGET_DB -18.0
+#define GAIN_AGC_MIN_DB -20.0
+#define GAIN_AGC_MAX_DB 30.0
+#define GAIN_AGC_GATE_DB -55.0
+
+// How fast (dB per second of sound) the AGC lowers the gain (attack) when the
+// sound gets louder, and raises it (release) when it gets quieter.
+#define GAIN_AGC_ATTACK_DB 20.0
+#define GAIN_AGC_RELEASE_DB 3.0
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// IReceiver which amplifies (or attenuates) the sound in software before
+// passing it to the target IReceiver (e.g. mp3Writer), for lines whose mixer
+// has no volume control (see CMixerLine::SetVolume()) or too coarse a one.
+//
+// The gain is either fixed or set by the automatic gain control (AGC), which
+// follows the level of every buffer. Changes are never applied as a step: the
+// gain moves linearly over the length of a buffer. A soft limiter keeps the
+// loud peaks from clipping. Sound must be 16-bit, the work is done by the
+// vector kernels of CPCMConvert (see CPCMConvert::Gain()).
+//
+// The sound of the capture buffer isn't modified (it may be shared, see
+// CPCMBuffer), the target receives a copy, so it should process the sound
+// before returning, as mp3Writer does. Put a CAsyncReceiver in front of this
+// one to keep the work off the capture thread.
+class CGainReceiver: public IReceiver {
+private:
+	IReceiver	*m_pTarget;
+	DWORD		m_dwBytesPerSec;
+	bool		m_isAGC;
+
+	// Gain (or with the AGC the target level) asked for, in hundredths of
+	// a dB; may be changed from any thread (see Adjust()).
+	volatile LONG m_nSetting;
+
+	// Gain (dB) the previous buffer ended with, where the next ramp starts.
+	double		m_dGainDB;
+	volatile LONG m_nGain;
+
+	vector<SHORT> m_arrSamples;
+
+	// Level (RMS, dBFS) of 16-bit samples.
+	static double LevelDB(const SHORT *pSamples, DWORD nSamples);
+
+public:
+	// pTarget - IReceiver that will receive the amplified sound.
+	//
+	// nSamplesPerSec, nChannels - format of the (16-bit) sound.
+	//
+	// dGainDB - the fixed gain (dB), or with isAGC the starting one.
+	//
+	// dTargetDB - level the AGC aims for (RMS, dBFS).
+	CGainReceiver(IReceiver *pTarget, DWORD nSamplesPerSec, WORD nChannels, double dGainDB, bool isAGC = false,
+		double dTargetDB = GAIN_AGC_TARGET_DB);
+	~CGainReceiver() {};
+
+	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded);
+
+	// Raises (or lowers, dDeltaDB negative) the gain, with the AGC the level
+	// it aims for. Takes effect (as a ramp) from the next buffer. Returns the
+	// new gain (level). Any thread.
+	double Adjust(double dDeltaDB);
+
+	// Gain (dB) applied at the end of the latest buffer. Any thread.
+	double GetGainDB() { return QAtomicLoad(&this->m_nGain) / 100.0; };
+
+	bool IsAGC() const { return this->m_isAGC; };
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CGainReceiver::CGainReceiver(IReceiver *pTarget, DWORD nSamplesPerSec, WORD nChannels, double dGainDB, bool isAGC,
+							 double dTargetDB) {
+	this->m_pTarget = pTarget;
+	this->m_dwBytesPerSec = nSamplesPerSec * nChannels * 2;
+	this->m_isAGC = isAGC;
+	this->m_nSetting = (LONG) floor((isAGC ? dTargetDB : dGainDB) * 100.0 + 0.5);
+	this->m_dGainDB = dGainDB;
+	this->m_nGain = (LONG) floor(dGainDB * 100.0 + 0.5);
+}
+
+double CGainReceiver::LevelDB(const SHORT *pSamples, DWORD nSamples) {
+	ULONGLONG nSum;
+
+	if (nSamples == 0) return -200.0;
+	nSum = CPCMConvert::SumOfSquares(pSamples, nSamples);
+	if (nSum == 0) return -200.0;
+	return 10.0 * log10((double) nSum / nSamples / (32768.0 * 32768.0));
+}
+
+double CGainReceiver::Adjust(double dDeltaDB) {
+	return QAtomicAdd(&this->m_nSetting, (LONG) floor(dDeltaDB * 100.0 + 0.5)) / 100.0;
+}
+
+void CGainReceiver::ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) {
+	const SHORT *pIn = (const SHORT *) lpData;
+	DWORD nSamples = dwBytesRecorded / 2;
+	double dSetting = QAtomicLoad(&this->m_nSetting) / 100.0;
+	double dSeconds, dLevel, dGainDB, dDelta;
+	float fStart, fEnd;
+
+	if (nSamples == 0) return;
+	if (this->m_arrSamples.size() < nSamples) this->m_arrSamples.resize(nSamples);
+
+	if (this->m_isAGC) {
+		// The gain the buffer would need, moved towards at the attack or
+		// release rate. Silence keeps the gain, so noise isn't pulled up.
+		dGainDB = this->m_dGainDB;
+		dLevel = LevelDB(pIn, nSamples);
+		if (dLevel > GAIN_AGC_GATE_DB) {
+			dSeconds = (double) dwBytesRecorded / this->m_dwBytesPerSec;
+			dDelta = dSetting - dLevel;
+			if (dDelta < GAIN_AGC_MIN_DB) dDelta = GAIN_AGC_MIN_DB;
+			if (dDelta > GAIN_AGC_MAX_DB) dDelta = GAIN_AGC_MAX_DB;
+			dDelta -= dGainDB;
+			if (dDelta < -GAIN_AGC_ATTACK_DB * dSeconds) dDelta = -GAIN_AGC_ATTACK_DB * dSeconds;
+			if (dDelta > GAIN_AGC_RELEASE_DB * dSeconds) dDelta = GAIN_AGC_RELEASE_DB * dSeconds;
+			dGainDB += dDelta;
+		}
+	}
+	else dGainDB = dSetting;
+
+	// Ramp from where the previous buffer ended, the limiter catches what
+	// the gain pushes over the knee.
+	fStart = (float) pow(10.0, this->m_dGainDB / 20.0);
+	fEnd = (float) pow(10.0, dGainDB / 20.0);
+	CPCMConvert::Gain(pIn, &this->m_arrSamples[0], nSamples, fStart, (fEnd - fStart) / nSamples,
+		(float) (32768.0 * pow(10.0, GAIN_KNEE_DB / 20.0)));
+
+	this->m_dGainDB = dGainDB;
+	QAtomicStore(&this->m_nGain, (LONG) floor(dGainDB * 100.0 + 0.5));
+
+	this->m_pTarget->ReceiveBuffer((LPSTR) &this->m_arrSamples[0], nSamples * 2);
+}
+
+#endif
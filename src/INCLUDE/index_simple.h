@@ -0,0 +1,457 @@
+#ifndef ___INDEX_SIMPLE_H_INCLUDED___
+#define ___INDEX_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "INCLUDE/mp3_simple.h"
+#include "INCLUDE/sink_simple.h"
+#include "INCLUDE/file_simple.h"
+
+using namespace std;
+
+// Default distance between two entries of the index, in milliseconds of sound.
+#define INDEX_DEFAULT_MS 1000
+
+// Appended to the MP3 file's name, for the name of its index.
+#define INDEX_EXTENSION ".idx"
+
+// Bytes copied per ReceiveMP3() call by CMP3FileIndex::Extract().
+#define INDEX_EXTRACT_BLOCK (256 * 1024)
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Version of the index files written, older ones are ignored.
+#define INDEX_VERSION 2
+
+// Index (sidecar) file: the header, then one entry per INDEX_DEFAULT_MS (or
+// so) of sound, in the byte order of the machine which wrote it. The first
+// frame (where it is and its header) tells whether the index still belongs
+// to the MP3 file next to it, e.g. not to an earlier recording.
+struct MP3_INDEX_HEADER {
+	char		szMagic[4];			// "MP3I"
+	DWORD		dwVersion;			// INDEX_VERSION
+	DWORD		dwSampleRate;		// of the MP3, zero if it has no frames
+	DWORD		dwGranularity;		// samples between two entries (at least)
+	DWORD		dwFirstFrame;		// offset of the first frame in the MP3 file
+	BYTE		arrFirstHeader[4];	// and its header
+};
+
+// Frame starting at nSample (samples per channel from the start of the
+// sound) is at nOffset (bytes from the start of the MP3 file).
+struct MP3_INDEX_ENTRY {
+	ULONGLONG	nSample;
+	ULONGLONG	nOffset;
+};
+
+// Output which passes the encoded sound on to another sink (the MP3 file)
+// and writes the index of its frames next to it, an entry for the first
+// frame of every dwGranularityMillis of sound. Since CMP3Simple encodes
+// without the bit reservoir, any indexed frame is a valid place to start
+// playing, see CMP3FileIndex.
+//
+// The index is a few bytes per second of sound, written through the C
+// library's buffer, so it costs about nothing on the encoder's thread. A
+// recording which was killed leaves an index which is only shorter.
+class CIndexingSink: public IMP3Sink {
+private:
+	IMP3Sink	*m_pSink;
+	FILE		*m_pIndex;
+	DWORD		m_dwGranularityMillis;
+
+	// Samples and bytes of the stream so far, and the sample of the next entry.
+	ULONGLONG	m_nSamples;
+	ULONGLONG	m_nPosition;
+	ULONGLONG	m_nNextEntry;
+	DWORD		m_dwGranularity;
+	LONG		m_nEntries;
+
+	// Frame parsing: bytes of the current frame still to skip, and the frame
+	// header being put together (it may come in pieces).
+	DWORD		m_dwSkip;
+	BYTE		m_arrHeader[4];
+	DWORD		m_dwHeader;
+
+	// Writes the header once the first frame is known (or on Close(), if none came).
+	void WriteHeader(DWORD dwSampleRate, DWORD dwFirstFrame);
+
+public:
+	// pSink - the MP3 file, deleted with this object.
+	//
+	// pIndexFileName - the index to create (an existing one is overwritten).
+	//
+	// dwGranularityMillis - sound between two entries, INDEX_DEFAULT_MS by default.
+	//
+	// Throws if the index can't be created (pSink is deleted then).
+	CIndexingSink(IMP3Sink *pSink, const char *pIndexFileName, DWORD dwGranularityMillis = INDEX_DEFAULT_MS);
+	~CIndexingSink();
+
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes);
+
+	// Closes the MP3 file and the index. Safe to call more than once.
+	virtual void Close();
+
+	virtual void SetCounters(CStreamCounters *pCounters);
+
+	// Prints the MP3 file's statistics and the entries of the index.
+	virtual void PrintStats();
+};
+
+// Random access to an MP3 file (e.g. a long recording) by time, via the
+// index written with it (see CIndexingSink). A position is found by a
+// binary search of the index and a walk over the few frames after the entry
+// found, both read through memory-mapped windows, so finding any time costs
+// O(log n) however long the file is. Without the index the frames are
+// indexed on open, by reading the whole file once.
+class CMP3FileIndex {
+private:
+	CMappedFile	m_File;
+	CMappedFile	*m_pIndex;
+	ULONGLONG	m_nEntries;
+	DWORD		m_dwSampleRate;
+
+	// Entries found in the MP3 itself, without the index file.
+	vector<MP3_INDEX_ENTRY> m_arrEntries;
+
+	// Returns the nEntry-th entry of the index.
+	MP3_INDEX_ENTRY Entry(ULONGLONG nEntry);
+
+	// True if the index file belongs to the MP3 file: the first frame is
+	// where the header says, and the first and the last entries are frames.
+	bool IsIndexValid(const MP3_INDEX_HEADER &header);
+
+	// Indexes the file by reading all of its frames.
+	void Scan();
+
+	// Seek(), also returning the length of the frame found (zero past the end).
+	ULONGLONG Find(ULONGLONG nSample, ULONGLONG *pFrameSample, PDWORD pdwLength);
+
+public:
+	// pMP3FileName - the MP3 file.
+	//
+	// pIndexFileName - its index, NULL - the MP3 file's name with INDEX_EXTENSION.
+	//
+	// Throws if the MP3 file can't be opened, or has no frame. A missing,
+	// damaged or stale (of another MP3 file) index isn't an error, the file is
+	// scanned instead (see IsIndexed()).
+	CMP3FileIndex(const char *pMP3FileName, const char *pIndexFileName = NULL);
+	~CMP3FileIndex();
+
+	// True if the index file was used.
+	bool IsIndexed() const { return this->m_pIndex != NULL; }
+
+	// Sample rate of the MP3 file.
+	DWORD SampleRate() const { return this->m_dwSampleRate; }
+
+	// Finds the frame holding nSample (samples per channel from the start).
+	// Returns its offset in the file, and in *pFrameSample the sample it starts
+	// with. Past the end of the sound, returns the end of the last frame (and
+	// the number of samples in the file).
+	ULONGLONG Seek(ULONGLONG nSample, ULONGLONG *pFrameSample = NULL);
+
+	// Length of the sound, in samples per channel (walks the frames after the last entry).
+	ULONGLONG Samples();
+
+	// Passes the frames holding the sound between the two times (in
+	// milliseconds, nEndMillis past the end - till the end) to pReceiver, in
+	// blocks of at most INDEX_EXTRACT_BLOCK bytes. The frames play on their
+	// own, e.g. as an MP3 file. Returns number of bytes passed.
+	ULONGLONG Extract(ULONGLONG nStartMillis, ULONGLONG nEndMillis, IMP3Receiver *pReceiver);
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CIndexingSink::CIndexingSink(IMP3Sink *pSink, const char *pIndexFileName, DWORD dwGranularityMillis) {
+	this->m_pSink = pSink;
+	this->m_dwGranularityMillis = (dwGranularityMillis > 0) ? dwGranularityMillis : INDEX_DEFAULT_MS;
+	this->m_nSamples = 0;
+	this->m_nPosition = 0;
+	this->m_nNextEntry = 0;
+	this->m_dwGranularity = 0;
+	this->m_nEntries = 0;
+	this->m_dwSkip = 0;
+	this->m_dwHeader = 0;
+
+	this->m_pIndex = fopen(pIndexFileName, "wb");
+	if (this->m_pIndex == NULL) {
+		delete pSink;
+		throw "Can't create index file.";
+	}
+}
+
+CIndexingSink::~CIndexingSink() {
+	this->Close();
+	delete this->m_pSink;
+}
+
+void CIndexingSink::SetCounters(CStreamCounters *pCounters) {
+	this->m_pCounters = pCounters;
+	this->m_pSink->SetCounters(pCounters);
+}
+
+void CIndexingSink::WriteHeader(DWORD dwSampleRate, DWORD dwFirstFrame) {
+	MP3_INDEX_HEADER header;
+
+	memcpy(header.szMagic, "MP3I", 4);
+	header.dwVersion = INDEX_VERSION;
+	header.dwSampleRate = dwSampleRate;
+	header.dwGranularity = this->m_dwGranularity;
+	header.dwFirstFrame = dwFirstFrame;
+	memcpy(header.arrFirstHeader, this->m_arrHeader, 4);
+	fwrite(&header, sizeof(header), 1, this->m_pIndex);
+}
+
+void CIndexingSink::ReceiveMP3(PBYTE pData, DWORD dwBytes) {
+	MP3_INDEX_ENTRY entry;
+	DWORD dwLength, dwSkip, i = 0;
+
+	this->m_pSink->ReceiveMP3(pData, dwBytes);
+	if (this->m_pIndex == NULL) return;
+
+	while (i < dwBytes) {
+		// Inside a frame.
+		if (this->m_dwSkip > 0) {
+			dwSkip = (dwBytes - i < this->m_dwSkip) ? dwBytes - i : this->m_dwSkip;
+			this->m_dwSkip -= dwSkip;
+			this->m_nPosition += dwSkip;
+			i += dwSkip;
+			continue;
+		}
+
+		while ((this->m_dwHeader < 4) && (i < dwBytes)) {
+			this->m_arrHeader[this->m_dwHeader++] = pData[i++];
+			this->m_nPosition++;
+		}
+		if (this->m_dwHeader < 4) return;
+
+		dwLength = CMP3Frame::Length(this->m_arrHeader);
+		if (dwLength == 0) {
+			// Not a frame (e.g. a tag), look one byte further.
+			memmove(this->m_arrHeader, this->m_arrHeader + 1, 3);
+			this->m_dwHeader = 3;
+			continue;
+		}
+
+		if (this->m_dwGranularity == 0) {
+			this->m_dwGranularity = (DWORD) ((ULONGLONG) CMP3Frame::SampleRate(this->m_arrHeader) * this->m_dwGranularityMillis / 1000);
+			if (this->m_dwGranularity == 0) this->m_dwGranularity = 1;
+			this->WriteHeader(CMP3Frame::SampleRate(this->m_arrHeader), (DWORD) (this->m_nPosition - 4));
+		}
+
+		// First frame at or after the next multiple of the granularity.
+		if (this->m_nSamples >= this->m_nNextEntry) {
+			entry.nSample = this->m_nSamples;
+			entry.nOffset = this->m_nPosition - 4;
+			fwrite(&entry, sizeof(entry), 1, this->m_pIndex);
+			this->m_nEntries++;
+			this->m_nNextEntry = this->m_nSamples - this->m_nSamples % this->m_dwGranularity + this->m_dwGranularity;
+		}
+
+		this->m_nSamples += CMP3Frame::Samples(this->m_arrHeader);
+		this->m_dwSkip = dwLength - 4;
+		this->m_dwHeader = 0;
+	}
+}
+
+void CIndexingSink::Close() {
+	this->m_pSink->Close();
+
+	if (this->m_pIndex != NULL) {
+		// No frame came, the index says so.
+		if (this->m_dwGranularity == 0) this->WriteHeader(0, 0);
+		fclose(this->m_pIndex);
+		this->m_pIndex = NULL;
+	}
+}
+
+void CIndexingSink::PrintStats() {
+	this->m_pSink->PrintStats();
+	printf("Index: %d entries, one per %u ms.\n", this->m_nEntries, this->m_dwGranularityMillis);
+}
+///////////////////////////////////////////////////////////////////////////
+CMP3FileIndex::CMP3FileIndex(const char *pMP3FileName, const char *pIndexFileName): m_File(pMP3FileName) {
+	string strIndex = (pIndexFileName != NULL) ? string(pIndexFileName) : string(pMP3FileName) + INDEX_EXTENSION;
+	const BYTE *pData;
+	MP3_INDEX_HEADER header;
+
+	this->m_pIndex = NULL;
+	this->m_nEntries = 0;
+	this->m_dwSampleRate = 0;
+
+	try {
+		this->m_pIndex = new CMappedFile(strIndex.c_str());
+	}
+	catch (const char *) {
+		this->m_pIndex = NULL;
+	}
+
+	if (this->m_pIndex != NULL) {
+		pData = this->m_pIndex->View(0, sizeof(header));
+		if (pData != NULL) memcpy(&header, pData, sizeof(header));
+
+		// A partial last entry (of a killed recording) is left out.
+		if ((pData != NULL) && (memcmp(header.szMagic, "MP3I", 4) == 0) && (header.dwVersion == INDEX_VERSION) &&
+			(header.dwSampleRate > 0) && (this->m_pIndex->Size() >= sizeof(header) + sizeof(MP3_INDEX_ENTRY))) {
+			this->m_nEntries = (this->m_pIndex->Size() - sizeof(header)) / sizeof(MP3_INDEX_ENTRY);
+			this->m_dwSampleRate = header.dwSampleRate;
+		}
+		if ((this->m_nEntries == 0) || !this->IsIndexValid(header)) {
+			this->m_nEntries = 0;
+			this->m_dwSampleRate = 0;
+			delete this->m_pIndex;
+			this->m_pIndex = NULL;
+		}
+	}
+
+	if (this->m_pIndex == NULL) this->Scan();
+	if (this->m_nEntries == 0) throw "MP3 file has no frames.";
+}
+
+CMP3FileIndex::~CMP3FileIndex() {
+	delete this->m_pIndex;
+}
+
+bool CMP3FileIndex::IsIndexValid(const MP3_INDEX_HEADER &header) {
+	const BYTE *pHeader;
+	MP3_INDEX_ENTRY entry;
+	ULONGLONG arrEntries[2] = {0, this->m_nEntries - 1};
+	int i;
+
+	pHeader = this->m_File.View(header.dwFirstFrame, 4);
+	if ((pHeader == NULL) || (memcmp(pHeader, header.arrFirstHeader, 4) != 0)) return false;
+
+	for (i = 0; i < 2; i++) {
+		entry = this->Entry(arrEntries[i]);
+		pHeader = this->m_File.View(entry.nOffset, 4);
+		if ((pHeader == NULL) || (CMP3Frame::Length(pHeader) == 0) ||
+			(CMP3Frame::SampleRate(pHeader) != header.dwSampleRate)) return false;
+	}
+	return true;
+}
+
+void CMP3FileIndex::Scan() {
+	MP3_INDEX_ENTRY entry;
+	ULONGLONG nOffset = 0, nSamples = 0, nNextEntry = 0;
+	const BYTE *pHeader;
+	DWORD dwLength, dwGranularity = 0;
+
+	while ((pHeader = this->m_File.View(nOffset, 4)) != NULL) {
+		dwLength = CMP3Frame::Length(pHeader);
+		if (dwLength == 0) {
+			nOffset++;
+			continue;
+		}
+
+		if (dwGranularity == 0) {
+			this->m_dwSampleRate = CMP3Frame::SampleRate(pHeader);
+			dwGranularity = (this->m_dwSampleRate * INDEX_DEFAULT_MS) / 1000;
+		}
+		if (nSamples >= nNextEntry) {
+			entry.nSample = nSamples;
+			entry.nOffset = nOffset;
+			this->m_arrEntries.push_back(entry);
+			nNextEntry = nSamples - nSamples % dwGranularity + dwGranularity;
+		}
+
+		nSamples += CMP3Frame::Samples(pHeader);
+		nOffset += dwLength;
+	}
+	this->m_nEntries = this->m_arrEntries.size();
+}
+
+MP3_INDEX_ENTRY CMP3FileIndex::Entry(ULONGLONG nEntry) {
+	MP3_INDEX_ENTRY entry;
+	const BYTE *pData;
+
+	if (this->m_pIndex == NULL) return this->m_arrEntries[(size_t) nEntry];
+
+	pData = this->m_pIndex->View(sizeof(MP3_INDEX_HEADER) + nEntry * sizeof(MP3_INDEX_ENTRY), sizeof(MP3_INDEX_ENTRY));
+	if (pData == NULL) throw "Can't read index file.";
+	memcpy(&entry, pData, sizeof(entry));
+	return entry;
+}
+
+ULONGLONG CMP3FileIndex::Find(ULONGLONG nSample, ULONGLONG *pFrameSample, PDWORD pdwLength) {
+	MP3_INDEX_ENTRY entry;
+	ULONGLONG nLow = 0, nHigh = this->m_nEntries, nMiddle, nOffset, nEnd, nSamples;
+	const BYTE *pHeader;
+	DWORD dwLength, dwSamples;
+
+	// Last entry at or before nSample.
+	while (nHigh - nLow > 1) {
+		nMiddle = nLow + (nHigh - nLow) / 2;
+		if (this->Entry(nMiddle).nSample <= nSample) nLow = nMiddle;
+		else nHigh = nMiddle;
+	}
+	entry = this->Entry(nLow);
+	nOffset = nEnd = entry.nOffset;
+	nSamples = entry.nSample;
+
+	// Then frame by frame, a granularity's worth at most.
+	while ((pHeader = this->m_File.View(nOffset, 4)) != NULL) {
+		dwLength = CMP3Frame::Length(pHeader);
+		if (dwLength == 0) {
+			nOffset++;
+			continue;
+		}
+		// The last frame may be cut (a killed recording), it isn't played then.
+		if (nOffset + dwLength > this->m_File.Size()) break;
+
+		dwSamples = CMP3Frame::Samples(pHeader);
+		if (nSample < nSamples + dwSamples) {
+			*pFrameSample = nSamples;
+			*pdwLength = dwLength;
+			return nOffset;
+		}
+		nSamples += dwSamples;
+		nOffset += dwLength;
+		nEnd = nOffset;
+	}
+
+	// Past the end, whatever follows the last frame (e.g. zeros) isn't sound.
+	*pFrameSample = nSamples;
+	*pdwLength = 0;
+	return nEnd;
+}
+
+ULONGLONG CMP3FileIndex::Seek(ULONGLONG nSample, ULONGLONG *pFrameSample) {
+	ULONGLONG nFrameSample, nOffset;
+	DWORD dwLength;
+
+	nOffset = this->Find(nSample, &nFrameSample, &dwLength);
+	if (pFrameSample != NULL) *pFrameSample = nFrameSample;
+	return nOffset;
+}
+
+ULONGLONG CMP3FileIndex::Samples() {
+	ULONGLONG nSamples;
+
+	this->Seek((ULONGLONG) -1, &nSamples);
+	return nSamples;
+}
+
+ULONGLONG CMP3FileIndex::Extract(ULONGLONG nStartMillis, ULONGLONG nEndMillis, IMP3Receiver *pReceiver) {
+	ULONGLONG nStart, nEnd, nEndSample, nFrameSample, nOffset;
+	const BYTE *pData;
+	DWORD dwBytes;
+
+	if (nEndMillis <= nStartMillis) return 0;
+
+	nStart = this->Seek(nStartMillis * this->m_dwSampleRate / 1000);
+
+	// Up to the frame holding the last sample asked for, included.
+	nEndSample = (nEndMillis >= (ULONGLONG) -1 / this->m_dwSampleRate) ? (ULONGLONG) -1 : nEndMillis * this->m_dwSampleRate / 1000;
+	nEnd = this->Find(nEndSample, &nFrameSample, &dwBytes);
+	if (nFrameSample < nEndSample) nEnd += dwBytes;
+
+	for (nOffset = nStart; nOffset < nEnd; nOffset += dwBytes) {
+		dwBytes = (nEnd - nOffset < INDEX_EXTRACT_BLOCK) ? (DWORD) (nEnd - nOffset) : INDEX_EXTRACT_BLOCK;
+		pData = this->m_File.View(nOffset, dwBytes);
+		if (pData == NULL) break;
+		pReceiver->ReceiveMP3((PBYTE) pData, dwBytes);
+	}
+	return nOffset - nStart;
+}
+
+#endif
@@ -0,0 +1,382 @@
+#ifndef ___LAME_SIMPLE_H_INCLUDED___
+#define ___LAME_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "INCLUDE/BladeMP3EncDLL.h"
+#include "INCLUDE/sync_simple.h"
+
+// Names tried by CLameShim::Load(), in order.
+#define LAME_LIBRARY_NAME "libmp3lame.so.0"
+#define LAME_LIBRARY_NAME_DEV "libmp3lame.so"
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// The Blade API of lame_enc.dll (beInitStream, beEncodeChunk, etc., see
+// BladeMP3EncDLL.h) on top of libmp3lame, for the systems without lame_enc.dll
+// (Linux). The library is loaded with dlopen(), so nothing needs to be linked
+// or installed at build time. CMP3Simple::LoadLIBS() points the be* function
+// pointers to the static methods below, everything else works unchanged.
+//
+// Settings of BE_CONFIG (LHV1) are mapped to the lame_set_*() calls the same
+// way lame_enc.dll does it, except that dwReSampleRate of zero keeps the input
+// sample rate (lame_enc.dll lets LAME pick one), as CMP3Simple expects.
+class CLameShim {
+private:
+	// Opaque lame_global_flags*.
+	typedef void *LAME_HANDLE;
+
+	typedef LAME_HANDLE (*LAME_INIT)(void);
+	typedef int (*LAME_SET_INT)(LAME_HANDLE, int);
+	typedef int (*LAME_GET_INT)(const LAME_HANDLE);
+	typedef int (*LAME_INIT_PARAMS)(LAME_HANDLE);
+	typedef int (*LAME_ENCODE_BUFFER)(LAME_HANDLE, const short *, const short *, const int, unsigned char *, const int);
+	typedef int (*LAME_ENCODE_INTERLEAVED)(LAME_HANDLE, short *, int, unsigned char *, int);
+	typedef int (*LAME_ENCODE_FLOAT)(LAME_HANDLE, const float *, const float *, const int, unsigned char *, const int);
+	typedef int (*LAME_ENCODE_FLUSH)(LAME_HANDLE, unsigned char *, int);
+	typedef int (*LAME_CLOSE)(LAME_HANDLE);
+	typedef const char *(*LAME_GET_STRING)(void);
+	typedef void (*LAME_MP3_TAGS_FID)(LAME_HANDLE, FILE *);
+
+	// What a HBE_STREAM points to.
+	struct LAME_STREAM {
+		LAME_HANDLE	gfp;
+		DWORD		nChannels;
+	};
+
+	static QMutex	m_qMutex;
+	static void		*m_hLibrary;
+
+	static LAME_INIT			lame_init;
+	static LAME_SET_INT			lame_set_in_samplerate;
+	static LAME_SET_INT			lame_set_out_samplerate;
+	static LAME_SET_INT			lame_set_num_channels;
+	static LAME_SET_INT			lame_set_mode;
+	static LAME_SET_INT			lame_set_brate;
+	static LAME_SET_INT			lame_set_VBR;
+	static LAME_SET_INT			lame_set_VBR_q;
+	static LAME_SET_INT			lame_set_VBR_min_bitrate_kbps;
+	static LAME_SET_INT			lame_set_VBR_max_bitrate_kbps;
+	static LAME_SET_INT			lame_set_VBR_mean_bitrate_kbps;
+	static LAME_SET_INT			lame_set_quality;
+	static LAME_SET_INT			lame_set_copyright;
+	static LAME_SET_INT			lame_set_original;
+	static LAME_SET_INT			lame_set_extension;
+	static LAME_SET_INT			lame_set_error_protection;
+	static LAME_SET_INT			lame_set_strict_ISO;
+	static LAME_SET_INT			lame_set_disable_reservoir;
+	static LAME_SET_INT			lame_set_bWriteVbrTag;
+	static LAME_SET_INT			lame_set_emphasis;
+	static LAME_INIT_PARAMS		lame_init_params;
+	static LAME_GET_INT			lame_get_framesize;
+	static LAME_ENCODE_BUFFER	lame_encode_buffer;
+	static LAME_ENCODE_INTERLEAVED lame_encode_buffer_interleaved;
+	static LAME_ENCODE_FLOAT	lame_encode_buffer_float;
+	static LAME_ENCODE_FLUSH	lame_encode_flush;
+	static LAME_CLOSE			lame_close;
+	static LAME_GET_STRING		get_lame_version;
+	static LAME_GET_STRING		get_lame_url;
+	static LAME_MP3_TAGS_FID	lame_mp3_tags_fid;
+
+	// Resolves all the functions above, returns false if a required one is missing.
+	static bool Bind(void *hLibrary);
+
+	static LAME_STREAM *StreamOf(HBE_STREAM hbeStream) { return (LAME_STREAM *) hbeStream; }
+
+	CLameShim() {};
+
+public:
+	// Loads libmp3lame (once), returns false if it isn't available.
+	static bool Load();
+
+	// Returns true if the library encodes float sound (lame_encode_buffer_float),
+	// i.e. beEncodeChunkFloatS16NI() may be used.
+	static bool HasFloat() { return lame_encode_buffer_float != NULL; }
+
+	// Same contract as the functions of lame_enc.dll with the same name.
+	static BE_ERR beInitStream(PBE_CONFIG pbeConfig, PDWORD dwSamples, PDWORD dwBufferSize, PHBE_STREAM phbeStream);
+	static BE_ERR beEncodeChunk(HBE_STREAM hbeStream, DWORD nSamples, PSHORT pSamples, PBYTE pOutput, PDWORD pdwOutput);
+	static BE_ERR beEncodeChunkFloatS16NI(HBE_STREAM hbeStream, DWORD nSamples, PFLOAT buffer_l, PFLOAT buffer_r,
+		PBYTE pOutput, PDWORD pdwOutput);
+	static BE_ERR beDeinitStream(HBE_STREAM hbeStream, PBYTE pOutput, PDWORD pdwOutput);
+	static BE_ERR beCloseStream(HBE_STREAM hbeStream);
+	static VOID beVersion(PBE_VERSION pbeVersion);
+
+	// Deprecated in lame_enc.dll as well, use beWriteInfoTag().
+	static BE_ERR beWriteVBRHeader(LPCSTR lpszFileName);
+
+	// Writes the INFO (Xing) tag into the file and closes the stream.
+	static BE_ERR beWriteInfoTag(HBE_STREAM hbeStream, LPCSTR lpszFileName);
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+QMutex CLameShim::m_qMutex;
+void *CLameShim::m_hLibrary = NULL;
+
+CLameShim::LAME_INIT			CLameShim::lame_init = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_in_samplerate = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_out_samplerate = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_num_channels = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_mode = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_brate = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_VBR = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_VBR_q = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_VBR_min_bitrate_kbps = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_VBR_max_bitrate_kbps = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_VBR_mean_bitrate_kbps = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_quality = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_copyright = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_original = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_extension = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_error_protection = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_strict_ISO = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_disable_reservoir = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_bWriteVbrTag = NULL;
+CLameShim::LAME_SET_INT			CLameShim::lame_set_emphasis = NULL;
+CLameShim::LAME_INIT_PARAMS		CLameShim::lame_init_params = NULL;
+CLameShim::LAME_GET_INT			CLameShim::lame_get_framesize = NULL;
+CLameShim::LAME_ENCODE_BUFFER	CLameShim::lame_encode_buffer = NULL;
+CLameShim::LAME_ENCODE_INTERLEAVED CLameShim::lame_encode_buffer_interleaved = NULL;
+CLameShim::LAME_ENCODE_FLOAT	CLameShim::lame_encode_buffer_float = NULL;
+CLameShim::LAME_ENCODE_FLUSH	CLameShim::lame_encode_flush = NULL;
+CLameShim::LAME_CLOSE			CLameShim::lame_close = NULL;
+CLameShim::LAME_GET_STRING		CLameShim::get_lame_version = NULL;
+CLameShim::LAME_GET_STRING		CLameShim::get_lame_url = NULL;
+CLameShim::LAME_MP3_TAGS_FID	CLameShim::lame_mp3_tags_fid = NULL;
+
+bool CLameShim::Bind(void *hLibrary) {
+	lame_init						= (LAME_INIT) ::dlsym(hLibrary, "lame_init");
+	lame_set_in_samplerate			= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_in_samplerate");
+	lame_set_out_samplerate			= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_out_samplerate");
+	lame_set_num_channels			= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_num_channels");
+	lame_set_mode					= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_mode");
+	lame_set_brate					= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_brate");
+	lame_set_VBR					= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_VBR");
+	lame_set_VBR_q					= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_VBR_q");
+	lame_set_VBR_min_bitrate_kbps	= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_VBR_min_bitrate_kbps");
+	lame_set_VBR_max_bitrate_kbps	= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_VBR_max_bitrate_kbps");
+	lame_set_VBR_mean_bitrate_kbps	= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_VBR_mean_bitrate_kbps");
+	lame_set_quality				= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_quality");
+	lame_set_copyright				= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_copyright");
+	lame_set_original				= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_original");
+	lame_set_extension				= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_extension");
+	lame_set_error_protection		= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_error_protection");
+	lame_set_strict_ISO				= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_strict_ISO");
+	lame_set_disable_reservoir		= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_disable_reservoir");
+	lame_set_bWriteVbrTag			= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_bWriteVbrTag");
+	lame_set_emphasis				= (LAME_SET_INT) ::dlsym(hLibrary, "lame_set_emphasis");
+	lame_init_params				= (LAME_INIT_PARAMS) ::dlsym(hLibrary, "lame_init_params");
+	lame_get_framesize				= (LAME_GET_INT) ::dlsym(hLibrary, "lame_get_framesize");
+	lame_encode_buffer				= (LAME_ENCODE_BUFFER) ::dlsym(hLibrary, "lame_encode_buffer");
+	lame_encode_buffer_interleaved	= (LAME_ENCODE_INTERLEAVED) ::dlsym(hLibrary, "lame_encode_buffer_interleaved");
+	lame_encode_flush				= (LAME_ENCODE_FLUSH) ::dlsym(hLibrary, "lame_encode_flush");
+	lame_close						= (LAME_CLOSE) ::dlsym(hLibrary, "lame_close");
+
+	// Optional ones.
+	get_lame_version				= (LAME_GET_STRING) ::dlsym(hLibrary, "get_lame_version");
+	get_lame_url					= (LAME_GET_STRING) ::dlsym(hLibrary, "get_lame_url");
+	lame_mp3_tags_fid				= (LAME_MP3_TAGS_FID) ::dlsym(hLibrary, "lame_mp3_tags_fid");
+	lame_encode_buffer_float		= (LAME_ENCODE_FLOAT) ::dlsym(hLibrary, "lame_encode_buffer_float");
+
+	return lame_init && lame_set_in_samplerate && lame_set_out_samplerate && lame_set_num_channels &&
+		lame_set_mode && lame_set_brate && lame_set_VBR && lame_set_VBR_q && lame_set_VBR_min_bitrate_kbps &&
+		lame_set_VBR_max_bitrate_kbps && lame_set_VBR_mean_bitrate_kbps && lame_set_quality &&
+		lame_set_copyright && lame_set_original && lame_set_extension && lame_set_error_protection &&
+		lame_set_strict_ISO && lame_set_disable_reservoir && lame_set_bWriteVbrTag && lame_set_emphasis &&
+		lame_init_params && lame_get_framesize && lame_encode_buffer && lame_encode_buffer_interleaved &&
+		lame_encode_flush && lame_close;
+}
+
+bool CLameShim::Load() {
+	void *hLibrary;
+
+	m_qMutex.Lock();
+
+	if (m_hLibrary == NULL) {
+		hLibrary = ::dlopen(LAME_LIBRARY_NAME, RTLD_NOW | RTLD_LOCAL);
+		if (hLibrary == NULL) hLibrary = ::dlopen(LAME_LIBRARY_NAME_DEV, RTLD_NOW | RTLD_LOCAL);
+
+		if (hLibrary != NULL) {
+			if (Bind(hLibrary)) m_hLibrary = hLibrary;
+			else ::dlclose(hLibrary);
+		}
+	}
+
+	m_qMutex.Unlock();
+	return m_hLibrary != NULL;
+}
+
+BE_ERR CLameShim::beInitStream(PBE_CONFIG pbeConfig, PDWORD dwSamples, PDWORD dwBufferSize, PHBE_STREAM phbeStream) {
+	LAME_STREAM *pStream;
+	LAME_HANDLE gfp;
+	DWORD nFrameSize;
+
+	if ((pbeConfig == NULL) || (pbeConfig->dwConfig != BE_CONFIG_LAME)) return BE_ERR_INVALID_FORMAT;
+
+	gfp = lame_init();
+	if (gfp == NULL) return BE_ERR_NO_MORE_HANDLES;
+
+	pStream = new LAME_STREAM;
+	pStream->gfp = gfp;
+	pStream->nChannels = (pbeConfig->format.LHV1.nMode == BE_MP3_MODE_MONO) ? 1 : 2;
+
+	// MPEG_mode of LAME has the same values as BE_MP3_MODE_XXXXX.
+	lame_set_num_channels(gfp, (int) pStream->nChannels);
+	lame_set_mode(gfp, (int) pbeConfig->format.LHV1.nMode);
+	lame_set_in_samplerate(gfp, (int) pbeConfig->format.LHV1.dwSampleRate);
+	lame_set_out_samplerate(gfp, (int) ((pbeConfig->format.LHV1.dwReSampleRate != 0) ?
+		pbeConfig->format.LHV1.dwReSampleRate : pbeConfig->format.LHV1.dwSampleRate));
+
+	if (pbeConfig->format.LHV1.bEnableVBR) {
+		if (pbeConfig->format.LHV1.dwVbrAbr_bps > 0) {
+			// vbr_abr
+			lame_set_VBR(gfp, 3);
+			lame_set_VBR_mean_bitrate_kbps(gfp, (int) (pbeConfig->format.LHV1.dwVbrAbr_bps / 1000));
+		}
+		else {
+			// vbr_default
+			lame_set_VBR(gfp, 4);
+			lame_set_VBR_q(gfp, pbeConfig->format.LHV1.nVBRQuality);
+		}
+		lame_set_VBR_min_bitrate_kbps(gfp, (int) pbeConfig->format.LHV1.dwBitrate);
+		if (pbeConfig->format.LHV1.dwMaxBitrate > 0) lame_set_VBR_max_bitrate_kbps(gfp, (int) pbeConfig->format.LHV1.dwMaxBitrate);
+	}
+	else {
+		// vbr_off
+		lame_set_VBR(gfp, 0);
+		lame_set_brate(gfp, (int) pbeConfig->format.LHV1.dwBitrate);
+	}
+
+	lame_set_copyright(gfp, pbeConfig->format.LHV1.bCopyright ? 1 : 0);
+	lame_set_original(gfp, pbeConfig->format.LHV1.bOriginal ? 1 : 0);
+	lame_set_extension(gfp, pbeConfig->format.LHV1.bPrivate ? 1 : 0);
+	lame_set_error_protection(gfp, pbeConfig->format.LHV1.bCRC ? 1 : 0);
+	lame_set_strict_ISO(gfp, pbeConfig->format.LHV1.bStrictIso ? 1 : 0);
+	lame_set_disable_reservoir(gfp, pbeConfig->format.LHV1.bNoRes ? 1 : 0);
+	lame_set_bWriteVbrTag(gfp, pbeConfig->format.LHV1.bWriteVBRHeader ? 1 : 0);
+	lame_set_emphasis(gfp, (int) pbeConfig->format.LHV1.dwEmphasis);
+
+	// Same as lame_enc.dll, quality counts only if its high byte is NOT the low byte.
+	if ((pbeConfig->format.LHV1.nQuality >> 8) == ((~pbeConfig->format.LHV1.nQuality) & 0xFF)) {
+		lame_set_quality(gfp, pbeConfig->format.LHV1.nQuality & 0xFF);
+	}
+
+	if (lame_init_params(gfp) < 0) {
+		lame_close(gfp);
+		delete pStream;
+		return BE_ERR_INVALID_FORMAT_PARAMETERS;
+	}
+
+	// One frame of input (all channels), and the worst case output of it (see lame.h).
+	nFrameSize = (DWORD) lame_get_framesize(gfp);
+	*dwSamples = nFrameSize * pStream->nChannels;
+	*dwBufferSize = nFrameSize * 5 / 4 + 7200;
+	*phbeStream = (HBE_STREAM) pStream;
+	return BE_ERR_SUCCESSFUL;
+}
+
+BE_ERR CLameShim::beEncodeChunk(HBE_STREAM hbeStream, DWORD nSamples, PSHORT pSamples, PBYTE pOutput, PDWORD pdwOutput) {
+	LAME_STREAM *pStream = StreamOf(hbeStream);
+	int nBytes;
+
+	*pdwOutput = 0;
+	if (pStream == NULL) return BE_ERR_INVALID_HANDLE;
+
+	// Output buffer size of zero tells LAME the buffer is big enough, same as
+	// lame_enc.dll (caller allocated dwBufferSize bytes).
+	if (pStream->nChannels == 2) {
+		nBytes = lame_encode_buffer_interleaved(pStream->gfp, pSamples, (int) (nSamples / 2), pOutput, 0);
+	}
+	else nBytes = lame_encode_buffer(pStream->gfp, pSamples, pSamples, (int) nSamples, pOutput, 0);
+
+	if (nBytes < 0) return (nBytes == -1) ? BE_ERR_BUFFER_TOO_SMALL : BE_ERR_INVALID_FORMAT;
+	*pdwOutput = (DWORD) nBytes;
+	return BE_ERR_SUCCESSFUL;
+}
+
+BE_ERR CLameShim::beEncodeChunkFloatS16NI(HBE_STREAM hbeStream, DWORD nSamples, PFLOAT buffer_l, PFLOAT buffer_r,
+										   PBYTE pOutput, PDWORD pdwOutput) {
+	LAME_STREAM *pStream = StreamOf(hbeStream);
+	int nBytes;
+
+	*pdwOutput = 0;
+	if ((pStream == NULL) || (lame_encode_buffer_float == NULL)) return BE_ERR_INVALID_HANDLE;
+
+	// nSamples per channel, floats in the 16 bits range, as lame_enc.dll passes them.
+	nBytes = lame_encode_buffer_float(pStream->gfp, buffer_l, buffer_r, (int) nSamples, pOutput, 0);
+
+	if (nBytes < 0) return (nBytes == -1) ? BE_ERR_BUFFER_TOO_SMALL : BE_ERR_INVALID_FORMAT;
+	*pdwOutput = (DWORD) nBytes;
+	return BE_ERR_SUCCESSFUL;
+}
+
+BE_ERR CLameShim::beDeinitStream(HBE_STREAM hbeStream, PBYTE pOutput, PDWORD pdwOutput) {
+	LAME_STREAM *pStream = StreamOf(hbeStream);
+	int nBytes;
+
+	*pdwOutput = 0;
+	if (pStream == NULL) return BE_ERR_INVALID_HANDLE;
+
+	nBytes = lame_encode_flush(pStream->gfp, pOutput, 0);
+	if (nBytes < 0) return BE_ERR_BUFFER_TOO_SMALL;
+	*pdwOutput = (DWORD) nBytes;
+	return BE_ERR_SUCCESSFUL;
+}
+
+BE_ERR CLameShim::beCloseStream(HBE_STREAM hbeStream) {
+	LAME_STREAM *pStream = StreamOf(hbeStream);
+
+	if (pStream == NULL) return BE_ERR_INVALID_HANDLE;
+
+	lame_close(pStream->gfp);
+	delete pStream;
+	return BE_ERR_SUCCESSFUL;
+}
+
+VOID CLameShim::beVersion(PBE_VERSION pbeVersion) {
+	const char *pVersion = (get_lame_version != NULL) ? get_lame_version() : "";
+	const char *pMinor = strchr(pVersion, '.');
+
+	memset(pbeVersion, 0, sizeof(BE_VERSION));
+
+	// There is no DLL, both versions are the one of libmp3lame ("3.100").
+	pbeVersion->byMajorVersion = (BYTE) atoi(pVersion);
+	pbeVersion->byMinorVersion = (BYTE) ((pMinor != NULL) ? atoi(pMinor + 1) : 0);
+	pbeVersion->byDLLMajorVersion = pbeVersion->byMajorVersion;
+	pbeVersion->byDLLMinorVersion = pbeVersion->byMinorVersion;
+
+	if (get_lame_url != NULL) {
+		strncpy(pbeVersion->zHomepage, get_lame_url(), BE_MAX_HOMEPAGE);
+		pbeVersion->zHomepage[BE_MAX_HOMEPAGE] = 0;
+	}
+}
+
+BE_ERR CLameShim::beWriteVBRHeader(LPCSTR lpszFileName) {
+	// Needs the stream, which this old call doesn't get.
+	return BE_ERR_INVALID_HANDLE;
+}
+
+BE_ERR CLameShim::beWriteInfoTag(HBE_STREAM hbeStream, LPCSTR lpszFileName) {
+	LAME_STREAM *pStream = StreamOf(hbeStream);
+	FILE *pFile;
+	BE_ERR err = BE_ERR_SUCCESSFUL;
+
+	if (pStream == NULL) return BE_ERR_INVALID_HANDLE;
+
+	if ((lpszFileName != NULL) && (lame_mp3_tags_fid != NULL)) {
+		pFile = fopen(lpszFileName, "rb+");
+		if (pFile != NULL) {
+			lame_mp3_tags_fid(pStream->gfp, pFile);
+			fclose(pFile);
+		}
+		else err = BE_ERR_INVALID_FORMAT_PARAMETERS;
+	}
+
+	beCloseStream(hbeStream);
+	return err;
+}
+
+#endif
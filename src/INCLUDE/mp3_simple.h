@@ -1,13 +1,18 @@
 #ifndef ___MP3_SIMPLE_H_INCLUDED___
 #define ___MP3_SIMPLE_H_INCLUDED___
 
-#include <windows.h>
+#include "INCLUDE/platform_simple.h"
 #include "INCLUDE/BladeMP3EncDLL.h"
 #include "INCLUDE/sync_simple.h"
 
+#ifndef _WIN32
+#include "INCLUDE/lame_simple.h"
+#endif
+
 // Pointers to LAME API functions
 BEINITSTREAM		beInitStream	=NULL;
 BEENCODECHUNK		beEncodeChunk	=NULL;
+BEENCODECHUNKFLOATS16NI	beEncodeChunkFloatS16NI	=NULL;
 BEDEINITSTREAM		beDeinitStream	=NULL;
 BECLOSESTREAM		beCloseStream	=NULL;
 BEVERSION		beVersion	=NULL;
@@ -21,13 +26,18 @@ BEWRITEINFOTAG		beWriteInfoTag	=NULL;
 class CMP3Simple {
 private:
 	static QMutex m_qMutex;
-	static bool m_isLibLoaded;
+	// Set (QAtomicStore) once every pointer to the LAME API is, see LoadLIBS().
+	static volatile LONG m_isLibLoaded;
 
 	BE_CONFIG	beConfig;
 	HBE_STREAM	hbeStream;
 	DWORD		dwMP3Buffer;
 	DWORD		dwPCMBuffer;
 
+	// Float sound converted to 16 bits, when LAME can't take it as it is (see
+	// HasFloatEncode()). Allocated on the first use.
+	PSHORT		pFloatSamples;
+
 public:
 	// This static method performs LAME API initialization
 	static void LoadLIBS();
@@ -47,8 +57,11 @@ public:
 	// nOutSampleRate - requested frequency for the encoded/output (MP3) sound.
 	// If equal with zero, then sound is not
 	// re-sampled (nOutSampleRate = nInputSampleRate).
+	//
+	// nMode - BE_MP3_MODE_JSTEREO (default), BE_MP3_MODE_STEREO, BE_MP3_MODE_DUALCHANNEL
+	// or BE_MP3_MODE_MONO. For the mono mode input sound must be mono as well.
 	CMP3Simple(unsigned int nBitRate, unsigned int nInputSampleRate = 44100,
-		unsigned int nOutSampleRate = 0);
+		unsigned int nOutSampleRate = 0, LONG nMode = BE_MP3_MODE_JSTEREO);
 
 
 	~CMP3Simple();
@@ -57,7 +70,7 @@ public:
 	//
 	// pSamples - pointer to the buffer containing raw (PCM) sound to be encoded.
 	// Mind that buffer must be an array of SHORT (16 bits PCM stereo sound, for
-	// mono 8 bits PCM sound better to double every byte to obtain 16 bits).
+	// 8 bits, mono, 24/32 bits or float sound see CPCMConvert in pcm_simple.h).
 	//
 	// nSamples - number of elements in "pSamples" (SHORT). Not to be confused with
 	// buffer size which represents (usually) volume in bytes. See also
@@ -71,6 +84,32 @@ public:
 	// to "pOutput". See also "MaxOutBufferSize" method.
 	BE_ERR Encode(PSHORT pSamples, DWORD nSamples, PBYTE pOutput, PDWORD pdwOutput);
 
+	// The same for float sound split into channels (e.g. straight from a DSP
+	// stage, see CResampler::ProcessPlanar), saving the conversion to
+	// interleaved 16 bits on the way.
+	//
+	// pLeft, pRight - samples of each channel in the 16 bits range (-32768.0
+	// .. 32767.0), pRight isn't used in the mono mode.
+	//
+	// nFrames - number of samples in each of them, at most MaxInBufferSize() / Channels().
+	//
+	// Goes to beEncodeChunkFloatS16NI when LAME has it, otherwise the sound is
+	// rounded to 16 bits and passed to beEncodeChunk (BE_ERR_BUFFER_TOO_SMALL
+	// if nFrames is over the limit).
+	BE_ERR Encode(const FLOAT *pLeft, const FLOAT *pRight, DWORD nFrames, PBYTE pOutput, PDWORD pdwOutput);
+
+	// Returns true if LAME encodes float sound directly (beEncodeChunkFloatS16NI).
+	static bool HasFloatEncode() { LoadLIBS(); return beEncodeChunkFloatS16NI != NULL; }
+
+	// This method finishes the stream, i.e. encodes whatever LAME still keeps
+	// inside and writes the last frame(s) into "pOutput" (at least
+	// "MinOutBufferSize" bytes). Call it once, after the last "Encode".
+	BE_ERR Flush(PBYTE pOutput, PDWORD pdwOutput);
+
+	// Closes the LAME stream and initializes a new one with the same settings,
+	// so the object can encode another, unrelated, sound from scratch.
+	void Reset();
+
 	// Returns maximum suggested number of elements (SHORT) to send to "Encode" method.
 	// e.g. PSHORT pSamples = (PSHORT) malloc(sizeof(SHORT) * MaxInBufferSize())
 	// or PSHORT pSamples = new SHORT[MaxInBufferSize()]
@@ -96,18 +135,146 @@ public:
 
 		return this->beConfig.format.LHV1.dwReSampleRate;
 	}
+
+	// Returns requested MP3 mode (BE_MP3_MODE_XXXXX).
+	LONG Mode() const { return this->beConfig.format.LHV1.nMode; }
+
+	// Returns number of channels expected in "pSamples" (interleaved).
+	DWORD Channels() const { return (this->Mode() == BE_MP3_MODE_MONO) ? 1 : 2; }
+
+	// Returns number of samples (per channel) in one MP3 frame: 1152 for MPEG-1
+	// (32000Hz and above), 576 for MPEG-2/2.5.
+	DWORD SamplesPerFrame() const { return (this->OutSampleRate() >= 32000) ? 1152 : 576; }
+};
+
+// Helper to walk MPEG Audio Layer III frames of an encoded (MP3) stream.
+// Since CMP3Simple encodes without the bit reservoir, every frame is
+// self-contained and may be cut, copied or dropped on its own.
+class CMP3Frame {
+public:
+	// Returns length (in bytes) of the frame starting at pHeader (at least
+	// 4 bytes must be readable), or zero if there is no valid Layer III
+	// frame header at pHeader.
+	static DWORD Length(const BYTE *pHeader);
+
+	// Returns sample rate (in Hz) of the frame starting at pHeader, or zero.
+	static DWORD SampleRate(const BYTE *pHeader);
+
+	// Returns number of samples (per channel) in the frame starting at pHeader, or zero.
+	static DWORD Samples(const BYTE *pHeader);
+};
+
+// See CMP3Chunker below.
+// Instances of any class extending "IMP3Receiver" will be able to receive encoded
+// (MP3) sound and process it via own implementation of the "ReceiveMP3" method
+// (e.g. write it into a file).
+class IMP3Receiver {
+public:
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes) = 0;
+};
+
+// Class that feeds CMP3Simple::Encode with blocks of exactly MaxInBufferSize()
+// samples, whatever the size of the incoming buffers is, and passes the encoded
+// sound to an IMP3Receiver. Full blocks are encoded right from the caller's
+// buffer, only the tail which doesn't make a full block is kept (copied) until
+// the next call. Output goes into one reusable buffer of MinOutBufferSize() bytes,
+// so the cost of each Encode call is predictable and nothing big lives on the stack.
+class CMP3Chunker {
+private:
+	CMP3Simple	&m_mp3Enc;
+	IMP3Receiver *m_pReceiver;
+
+	// Samples left over from the previous call (less than MaxInBufferSize()).
+	PSHORT		m_pCarry;
+	DWORD		m_nCarry;
+
+	// The same for float sound, frames of each channel.
+	PFLOAT		m_pCarryLeft;
+	PFLOAT		m_pCarryRight;
+	DWORD		m_nCarryFrames;
+
+	// Buffer receiving encoded sound, MinOutBufferSize() bytes.
+	PBYTE		m_pOutput;
+
+	// Samples passed to Encode() so far.
+	ULONGLONG	m_nSamples;
+
+	BE_ERR EncodeBlock(PSHORT pSamples, DWORD nSamples);
+	BE_ERR EncodeBlock(const FLOAT *pLeft, const FLOAT *pRight, DWORD nFrames);
+
+public:
+	CMP3Chunker(CMP3Simple &mp3Enc, IMP3Receiver *pReceiver);
+	~CMP3Chunker();
+
+	// Same as CMP3Simple::Encode, except that any number of samples may be
+	// passed and encoded sound goes to the IMP3Receiver.
+	BE_ERR Encode(PSHORT pSamples, DWORD nSamples);
+
+	// The same for float sound split into channels (see the float
+	// CMP3Simple::Encode), nFrames per channel. Don't mix it with the one
+	// above on the same stream.
+	BE_ERR Encode(const FLOAT *pLeft, const FLOAT *pRight, DWORD nFrames);
+
+	// Encodes the samples left over and finishes the stream (see CMP3Simple::Flush).
+	BE_ERR Flush();
+
+	// Number of samples waiting for the next full block.
+	DWORD Pending() const { return this->m_nCarry + this->m_nCarryFrames * this->m_mp3Enc.Channels(); }
+
+	// Number of samples passed to Encode() (either one) so far.
+	ULONGLONG Samples() const { return this->m_nSamples; }
 };
 
 //---------------------------- IMPLEMENTATION ----------------------------------------------------
-bool CMP3Simple::m_isLibLoaded = false;
+volatile LONG CMP3Simple::m_isLibLoaded = 0;
 QMutex CMP3Simple::m_qMutex;
 
 BE_ERR CMP3Simple::Encode(PSHORT pSamples, DWORD nSamples, PBYTE pOutput, PDWORD pdwOutput) {
 	return beEncodeChunk(this->hbeStream, nSamples, pSamples, pOutput, pdwOutput);
 }
 
+BE_ERR CMP3Simple::Encode(const FLOAT *pLeft, const FLOAT *pRight, DWORD nFrames, PBYTE pOutput, PDWORD pdwOutput) {
+	DWORD nChannels = this->Channels(), i;
+	FLOAT fValue;
+	int c;
+
+	if (pRight == NULL) pRight = pLeft;
+	if (beEncodeChunkFloatS16NI != NULL) {
+		return beEncodeChunkFloatS16NI(this->hbeStream, nFrames, (PFLOAT) pLeft, (PFLOAT) pRight, pOutput, pdwOutput);
+	}
+
+	// Rounded, clipped and interleaved for beEncodeChunk.
+	*pdwOutput = 0;
+	if (nFrames * nChannels > this->dwPCMBuffer) return BE_ERR_BUFFER_TOO_SMALL;
+	if (this->pFloatSamples == NULL) this->pFloatSamples = new SHORT[this->dwPCMBuffer];
+	for (i = 0; i < nFrames; i++) {
+		for (c = 0; c < (int) nChannels; c++) {
+			fValue = (c == 0) ? pLeft[i] : pRight[i];
+			fValue += (fValue < 0.0f) ? -0.5f : 0.5f;
+			if (fValue > 32767.0f) fValue = 32767.0f;
+			if (fValue < -32768.0f) fValue = -32768.0f;
+			this->pFloatSamples[i * nChannels + c] = (SHORT) fValue;
+		}
+	}
+	return beEncodeChunk(this->hbeStream, nFrames * nChannels, this->pFloatSamples, pOutput, pdwOutput);
+}
+
+BE_ERR CMP3Simple::Flush(PBYTE pOutput, PDWORD pdwOutput) {
+	return beDeinitStream(this->hbeStream, pOutput, pdwOutput);
+}
+
+void CMP3Simple::Reset() {
+	BE_ERR		err = 0;
+
+	beCloseStream(this->hbeStream);
+	this->hbeStream = 0;
+
+	err = beInitStream(&this->beConfig, &this->dwPCMBuffer, &this->dwMP3Buffer, &this->hbeStream);
+	if(err != BE_ERR_SUCCESSFUL) throw "ERRORR in beInitStream.";
+}
+
 CMP3Simple::CMP3Simple(unsigned int nBitRate, unsigned int nInputSampleRate,
-						   unsigned int nOutSampleRate) {
+						   unsigned int nOutSampleRate, LONG nMode) {
 	BE_ERR		err = 0;
 
 	CMP3Simple::LoadLIBS();
@@ -115,14 +282,15 @@ CMP3Simple::CMP3Simple(unsigned int nBitRate, unsigned int nInputSampleRate,
 	this->dwMP3Buffer = 0;
 	this->dwPCMBuffer = 0;
 	this->hbeStream = 0;
+	this->pFloatSamples = NULL;
 	memset(&this->beConfig, 0, sizeof(BE_CONFIG));
 
 	this->beConfig.dwConfig = BE_CONFIG_LAME;
 	this->beConfig.format.LHV1.dwStructVersion = 1;
 	this->beConfig.format.LHV1.dwStructSize = sizeof(BE_CONFIG);
 
-	// OUTPUT IN STREO
-	this->beConfig.format.LHV1.nMode = BE_MP3_MODE_JSTEREO;	
+	// OUTPUT IN STREO (BY DEFAULT)
+	this->beConfig.format.LHV1.nMode = nMode;
 
 	// QUALITY PRESET SETTING, CBR = Constant Bit Rate
 	this->beConfig.format.LHV1.nPreset = LQP_CBR;
@@ -164,15 +332,21 @@ CMP3Simple::CMP3Simple(unsigned int nBitRate, unsigned int nInputSampleRate,
 CMP3Simple::~CMP3Simple() {
 
 	beCloseStream(this->hbeStream);
+	delete[] this->pFloatSamples;
 }
 
 void CMP3Simple::LoadLIBS() {
+#ifdef _WIN32
 	HINSTANCE  hDLLlame = NULL;
+#endif
+
+	// Fast path, once loaded there is no need to take the mutex anymore.
+	if (QAtomicLoad(&m_isLibLoaded)) return;
 
 	m_qMutex.Lock();
-	if (!m_isLibLoaded) {
+	if (!QAtomicLoad(&m_isLibLoaded)) {
 		// LAME API wasn't loaded yet, so load it
-
+#ifdef _WIN32
 		hDLLlame = ::LoadLibrary("lame_enc.dll");
 
 		if( hDLLlame == NULL ) {
@@ -182,6 +356,8 @@ void CMP3Simple::LoadLIBS() {
 
 		beInitStream	= (BEINITSTREAM) GetProcAddress(hDLLlame, TEXT_BEINITSTREAM);
 		beEncodeChunk	= (BEENCODECHUNK) GetProcAddress(hDLLlame, TEXT_BEENCODECHUNK);
+		// Optional, older DLLs don't have it.
+		beEncodeChunkFloatS16NI = (BEENCODECHUNKFLOATS16NI) GetProcAddress(hDLLlame, TEXT_BEENCODECHUNKFLOATS16NI);
 		beDeinitStream	= (BEDEINITSTREAM) GetProcAddress(hDLLlame, TEXT_BEDEINITSTREAM);
 		beCloseStream	= (BECLOSESTREAM) GetProcAddress(hDLLlame, TEXT_BECLOSESTREAM);
 		beVersion      	= (BEVERSION) GetProcAddress(hDLLlame, TEXT_BEVERSION);
@@ -195,11 +371,219 @@ void CMP3Simple::LoadLIBS() {
 			m_qMutex.Unlock();
 			throw "Unable to get LAME interfaces";
 		}
+#else
+		// No lame_enc.dll here, the same API is provided on top of libmp3lame.
+		if (!CLameShim::Load()) {
+			m_qMutex.Unlock();
+			throw "Error loading libmp3lame.so";
+		}
 
-		m_isLibLoaded = true;
+		beInitStream	= &CLameShim::beInitStream;
+		beEncodeChunk	= &CLameShim::beEncodeChunk;
+		beEncodeChunkFloatS16NI = CLameShim::HasFloat() ? &CLameShim::beEncodeChunkFloatS16NI : NULL;
+		beDeinitStream	= &CLameShim::beDeinitStream;
+		beCloseStream	= &CLameShim::beCloseStream;
+		beVersion		= &CLameShim::beVersion;
+		beWriteVBRHeader= &CLameShim::beWriteVBRHeader;
+		beWriteInfoTag	= &CLameShim::beWriteInfoTag;
+#endif
+
+		// Publishes the pointers above to the fast path of other threads.
+		QAtomicStore(&m_isLibLoaded, 1);
 	}
 
 	m_qMutex.Unlock();
 }
 
-#endif
\ No newline at end of file
+///////////////////////////////////////////////////////////////////////////
+DWORD CMP3Frame::SampleRate(const BYTE *pHeader) {
+	static const DWORD arrRates[3] = {44100, 48000, 32000};
+	DWORD nVersion, nRate;
+
+	// Sync word (11 bits) and Layer III.
+	if ((pHeader[0] != 0xFF) || ((pHeader[1] & 0xE0) != 0xE0) || (((pHeader[1] >> 1) & 3) != 1)) return 0;
+
+	nVersion = (pHeader[1] >> 3) & 3;
+	nRate = (pHeader[2] >> 2) & 3;
+	if ((nVersion == 1) || (nRate == 3)) return 0;
+
+	switch (nVersion) {
+		case 3: return arrRates[nRate];			// MPEG-1
+		case 2: return arrRates[nRate] >> 1;	// MPEG-2
+		default: return arrRates[nRate] >> 2;	// MPEG-2.5
+	}
+}
+
+DWORD CMP3Frame::Samples(const BYTE *pHeader) {
+	if (CMP3Frame::SampleRate(pHeader) == 0) return 0;
+	return (((pHeader[1] >> 3) & 3) == 3) ? 1152 : 576;
+}
+
+DWORD CMP3Frame::Length(const BYTE *pHeader) {
+	static const DWORD arrBitRates[2][16] = {
+		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},		// MPEG-2/2.5
+		{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0}	// MPEG-1
+	};
+	DWORD nRate, nBitRate, isMPEG1;
+
+	nRate = CMP3Frame::SampleRate(pHeader);
+	if (nRate == 0) return 0;
+
+	isMPEG1 = (((pHeader[1] >> 3) & 3) == 3) ? 1 : 0;
+	nBitRate = arrBitRates[isMPEG1][pHeader[2] >> 4];
+	if (nBitRate == 0) return 0;
+
+	// 144 (MPEG-1) or 72 (MPEG-2/2.5) bytes per kbps per Hz, plus the padding slot.
+	return (isMPEG1 ? 144000 : 72000) * nBitRate / nRate + ((pHeader[2] >> 1) & 1);
+}
+///////////////////////////////////////////////////////////////////////////
+CMP3Chunker::CMP3Chunker(CMP3Simple &mp3Enc, IMP3Receiver *pReceiver): m_mp3Enc(mp3Enc) {
+	this->m_pReceiver = pReceiver;
+	this->m_nCarry = 0;
+	this->m_pCarry = new SHORT[mp3Enc.MaxInBufferSize()];
+	this->m_nCarryFrames = 0;
+	this->m_pCarryLeft = new FLOAT[mp3Enc.MaxInBufferSize() / mp3Enc.Channels()];
+	this->m_pCarryRight = new FLOAT[mp3Enc.MaxInBufferSize() / mp3Enc.Channels()];
+	this->m_pOutput = new BYTE[mp3Enc.MinOutBufferSize()];
+	this->m_nSamples = 0;
+}
+
+CMP3Chunker::~CMP3Chunker() {
+	delete[] this->m_pCarry;
+	delete[] this->m_pCarryLeft;
+	delete[] this->m_pCarryRight;
+	delete[] this->m_pOutput;
+}
+
+BE_ERR CMP3Chunker::EncodeBlock(PSHORT pSamples, DWORD nSamples) {
+	DWORD dwOut = 0;
+	BE_ERR err;
+
+	err = this->m_mp3Enc.Encode(pSamples, nSamples, this->m_pOutput, &dwOut);
+	if ((err == BE_ERR_SUCCESSFUL) && (dwOut > 0) && (this->m_pReceiver != NULL)) {
+		this->m_pReceiver->ReceiveMP3(this->m_pOutput, dwOut);
+	}
+	return err;
+}
+
+BE_ERR CMP3Chunker::Encode(PSHORT pSamples, DWORD nSamples) {
+	DWORD nBlock = this->m_mp3Enc.MaxInBufferSize();
+	DWORD n;
+	BE_ERR err;
+
+	this->m_nSamples += nSamples;
+
+	// First complete the block started by the previous call.
+	if (this->m_nCarry > 0) {
+		n = nBlock - this->m_nCarry;
+		if (n > nSamples) n = nSamples;
+
+		memcpy(this->m_pCarry + this->m_nCarry, pSamples, n * sizeof(SHORT));
+		this->m_nCarry += n;
+		pSamples += n;
+		nSamples -= n;
+
+		if (this->m_nCarry < nBlock) return BE_ERR_SUCCESSFUL;
+
+		this->m_nCarry = 0;
+		err = this->EncodeBlock(this->m_pCarry, nBlock);
+		if (err != BE_ERR_SUCCESSFUL) return err;
+	}
+
+	// Then encode full blocks in place.
+	while (nSamples >= nBlock) {
+		err = this->EncodeBlock(pSamples, nBlock);
+		if (err != BE_ERR_SUCCESSFUL) return err;
+
+		pSamples += nBlock;
+		nSamples -= nBlock;
+	}
+
+	// And keep the tail for the next call.
+	if (nSamples > 0) {
+		memcpy(this->m_pCarry, pSamples, nSamples * sizeof(SHORT));
+		this->m_nCarry = nSamples;
+	}
+
+	return BE_ERR_SUCCESSFUL;
+}
+
+BE_ERR CMP3Chunker::EncodeBlock(const FLOAT *pLeft, const FLOAT *pRight, DWORD nFrames) {
+	DWORD dwOut = 0;
+	BE_ERR err;
+
+	err = this->m_mp3Enc.Encode(pLeft, pRight, nFrames, this->m_pOutput, &dwOut);
+	if ((err == BE_ERR_SUCCESSFUL) && (dwOut > 0) && (this->m_pReceiver != NULL)) {
+		this->m_pReceiver->ReceiveMP3(this->m_pOutput, dwOut);
+	}
+	return err;
+}
+
+BE_ERR CMP3Chunker::Encode(const FLOAT *pLeft, const FLOAT *pRight, DWORD nFrames) {
+	DWORD nBlock = this->m_mp3Enc.MaxInBufferSize() / this->m_mp3Enc.Channels();
+	DWORD n;
+	BE_ERR err;
+
+	if (pRight == NULL) pRight = pLeft;
+	this->m_nSamples += (ULONGLONG) nFrames * this->m_mp3Enc.Channels();
+
+	// Same as for the 16-bit sound, the channels side by side.
+	if (this->m_nCarryFrames > 0) {
+		n = nBlock - this->m_nCarryFrames;
+		if (n > nFrames) n = nFrames;
+
+		memcpy(this->m_pCarryLeft + this->m_nCarryFrames, pLeft, n * sizeof(FLOAT));
+		memcpy(this->m_pCarryRight + this->m_nCarryFrames, pRight, n * sizeof(FLOAT));
+		this->m_nCarryFrames += n;
+		pLeft += n;
+		pRight += n;
+		nFrames -= n;
+
+		if (this->m_nCarryFrames < nBlock) return BE_ERR_SUCCESSFUL;
+
+		this->m_nCarryFrames = 0;
+		err = this->EncodeBlock(this->m_pCarryLeft, this->m_pCarryRight, nBlock);
+		if (err != BE_ERR_SUCCESSFUL) return err;
+	}
+
+	while (nFrames >= nBlock) {
+		err = this->EncodeBlock(pLeft, pRight, nBlock);
+		if (err != BE_ERR_SUCCESSFUL) return err;
+
+		pLeft += nBlock;
+		pRight += nBlock;
+		nFrames -= nBlock;
+	}
+
+	if (nFrames > 0) {
+		memcpy(this->m_pCarryLeft, pLeft, nFrames * sizeof(FLOAT));
+		memcpy(this->m_pCarryRight, pRight, nFrames * sizeof(FLOAT));
+		this->m_nCarryFrames = nFrames;
+	}
+
+	return BE_ERR_SUCCESSFUL;
+}
+
+BE_ERR CMP3Chunker::Flush() {
+	DWORD dwOut = 0;
+	BE_ERR err;
+
+	if (this->m_nCarry > 0) {
+		err = this->EncodeBlock(this->m_pCarry, this->m_nCarry);
+		this->m_nCarry = 0;
+		if (err != BE_ERR_SUCCESSFUL) return err;
+	}
+	if (this->m_nCarryFrames > 0) {
+		err = this->EncodeBlock(this->m_pCarryLeft, this->m_pCarryRight, this->m_nCarryFrames);
+		this->m_nCarryFrames = 0;
+		if (err != BE_ERR_SUCCESSFUL) return err;
+	}
+
+	err = this->m_mp3Enc.Flush(this->m_pOutput, &dwOut);
+	if ((err == BE_ERR_SUCCESSFUL) && (dwOut > 0) && (this->m_pReceiver != NULL)) {
+		this->m_pReceiver->ReceiveMP3(this->m_pOutput, dwOut);
+	}
+	return err;
+}
+
+#endif
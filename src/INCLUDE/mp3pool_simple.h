@@ -0,0 +1,282 @@
+#ifndef ___MP3POOL_SIMPLE_H_INCLUDED___
+#define ___MP3POOL_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <stdio.h>
+#include <vector>
+#include <map>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/mp3_simple.h"
+
+using namespace std;
+
+// Max number of idle streams kept per key, more returned streams are closed.
+#define MP3_POOL_MAX_IDLE 8
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Settings which make two LAME streams interchangeable.
+struct MP3_POOL_KEY {
+	unsigned int nBitRate;
+	unsigned int nInputSampleRate;
+	unsigned int nOutSampleRate;
+	LONG		 nMode;
+
+	bool operator<(const MP3_POOL_KEY &other) const {
+		if (this->nBitRate != other.nBitRate) return this->nBitRate < other.nBitRate;
+		if (this->nInputSampleRate != other.nInputSampleRate) return this->nInputSampleRate < other.nInputSampleRate;
+		if (this->nOutSampleRate != other.nOutSampleRate) return this->nOutSampleRate < other.nOutSampleRate;
+		return this->nMode < other.nMode;
+	}
+};
+
+// Pool of initialized CMP3Simple instances (LAME streams).
+//
+// Creating a CMP3Simple costs a LoadLIBS() and a beInitStream(), destroying it a
+// beCloseStream(). For many short sessions (recordings, files) that is most of
+// the time until the first encoded byte. A session leases a ready stream with the
+// settings it needs instead, and returns it when done. The returned stream is
+// reset (closed and initialized again) right away, on the returning thread, so
+// the next lease of the same settings gets a fresh stream without waiting.
+//
+// All methods are static and thread safe, just like CWaveINSimple's devices.
+class CMP3EncoderPool {
+private:
+	static QMutex m_qMutex;
+	static map<MP3_POOL_KEY, vector<CMP3Simple*> > m_mapIdle;
+
+	// Statistics, guarded by m_qMutex.
+	static LONG m_nHits;
+	static LONG m_nMisses;
+	static LONG m_nInits;
+	static LONGLONG m_nInitMicros;
+	static LONG m_nResets;
+	static LONGLONG m_nResetMicros;
+
+	static MP3_POOL_KEY MakeKey(unsigned int nBitRate, unsigned int nInputSampleRate,
+		unsigned int nOutSampleRate, LONG nMode);
+
+	// Creates a new stream and measures how long it took.
+	static CMP3Simple *Create(const MP3_POOL_KEY &key);
+
+	// Returns average time (in microseconds) to create a stream, measured so far.
+	static LONGLONG AverageInitMicros();
+
+	CMP3EncoderPool() {};
+
+public:
+	// Returns a stream ready for encoding, see CMP3Simple's constructor for the
+	// parameters. Creates a new one if none is idle. Throws if that fails.
+	static CMP3Simple *Lease(unsigned int nBitRate, unsigned int nInputSampleRate = 44100,
+		unsigned int nOutSampleRate = 0, LONG nMode = BE_MP3_MODE_JSTEREO);
+
+	// Gives the stream back to the pool. The stream may be in any state
+	// (flushed or not), it is reset before the next lease.
+	static void Return(CMP3Simple *pEnc);
+
+	// Creates nCount idle streams with the given settings up front, so even
+	// the first leases are hits.
+	static void Prewarm(UINT nCount, unsigned int nBitRate, unsigned int nInputSampleRate = 44100,
+		unsigned int nOutSampleRate = 0, LONG nMode = BE_MP3_MODE_JSTEREO);
+
+	// Closes all idle streams. Call it at the end of the application.
+	static void CleanUp();
+
+	// Leases served by an idle stream, and leases which had to create one.
+	static LONG GetHits();
+	static LONG GetMisses();
+
+	// Time the pool saved, in microseconds: the creation hits didn't pay (hits x
+	// average creation time) less the resets paid for every stream returned.
+	// Negative if resetting costs more than it saves.
+	static LONGLONG GetInitMicrosSaved();
+
+	// Time spent on resetting returned streams, off the lease path, in microseconds.
+	static LONGLONG GetResetMicros();
+
+	// Prints the statistics above.
+	static void PrintStats();
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+QMutex CMP3EncoderPool::m_qMutex;
+map<MP3_POOL_KEY, vector<CMP3Simple*> > CMP3EncoderPool::m_mapIdle;
+LONG CMP3EncoderPool::m_nHits = 0;
+LONG CMP3EncoderPool::m_nMisses = 0;
+LONG CMP3EncoderPool::m_nInits = 0;
+LONGLONG CMP3EncoderPool::m_nInitMicros = 0;
+LONG CMP3EncoderPool::m_nResets = 0;
+LONGLONG CMP3EncoderPool::m_nResetMicros = 0;
+
+MP3_POOL_KEY CMP3EncoderPool::MakeKey(unsigned int nBitRate, unsigned int nInputSampleRate,
+									  unsigned int nOutSampleRate, LONG nMode) {
+	MP3_POOL_KEY key;
+
+	key.nBitRate = nBitRate;
+	key.nInputSampleRate = nInputSampleRate;
+	// Zero means no re-sampling, same as asking for the input rate.
+	key.nOutSampleRate = (nOutSampleRate == 0) ? nInputSampleRate : nOutSampleRate;
+	key.nMode = nMode;
+	return key;
+}
+
+CMP3Simple *CMP3EncoderPool::Create(const MP3_POOL_KEY &key) {
+	LONGLONG nStart = QClock::Micros();
+	CMP3Simple *pEnc = new CMP3Simple(key.nBitRate, key.nInputSampleRate, key.nOutSampleRate, key.nMode);
+
+	m_qMutex.Lock();
+	m_nInits++;
+	m_nInitMicros += QClock::Micros() - nStart;
+	m_qMutex.Unlock();
+
+	return pEnc;
+}
+
+LONGLONG CMP3EncoderPool::AverageInitMicros() {
+	return (m_nInits > 0) ? m_nInitMicros / m_nInits : 0;
+}
+
+CMP3Simple *CMP3EncoderPool::Lease(unsigned int nBitRate, unsigned int nInputSampleRate,
+								   unsigned int nOutSampleRate, LONG nMode) {
+	MP3_POOL_KEY key = MakeKey(nBitRate, nInputSampleRate, nOutSampleRate, nMode);
+	map<MP3_POOL_KEY, vector<CMP3Simple*> >::iterator it;
+	CMP3Simple *pEnc = NULL;
+
+	m_qMutex.Lock();
+	it = m_mapIdle.find(key);
+	if ((it != m_mapIdle.end()) && !it->second.empty()) {
+		pEnc = it->second.back();
+		it->second.pop_back();
+		m_nHits++;
+	}
+	else m_nMisses++;
+	m_qMutex.Unlock();
+
+	// Create outside of the mutex, other sessions shouldn't wait for it.
+	if (pEnc == NULL) pEnc = Create(key);
+	return pEnc;
+}
+
+void CMP3EncoderPool::Return(CMP3Simple *pEnc) {
+	MP3_POOL_KEY key;
+	vector<CMP3Simple*> *pIdle;
+	LONGLONG nStart;
+
+	if (pEnc == NULL) return;
+	key = MakeKey(pEnc->BitRate(), pEnc->InSampleRate(), pEnc->OutSampleRate(), pEnc->Mode());
+
+	nStart = QClock::Micros();
+	try {
+		pEnc->Reset();
+	}
+	catch (const char *) {
+		// Broken stream is not worth keeping.
+		delete pEnc;
+		return;
+	}
+
+	m_qMutex.Lock();
+	m_nResets++;
+	m_nResetMicros += QClock::Micros() - nStart;
+
+	pIdle = &m_mapIdle[key];
+	if (pIdle->size() < MP3_POOL_MAX_IDLE) {
+		pIdle->push_back(pEnc);
+		pEnc = NULL;
+	}
+	m_qMutex.Unlock();
+
+	// Enough idle streams of this kind already.
+	delete pEnc;
+}
+
+void CMP3EncoderPool::Prewarm(UINT nCount, unsigned int nBitRate, unsigned int nInputSampleRate,
+							  unsigned int nOutSampleRate, LONG nMode) {
+	MP3_POOL_KEY key = MakeKey(nBitRate, nInputSampleRate, nOutSampleRate, nMode);
+	vector<CMP3Simple*> *pIdle;
+	CMP3Simple *pEnc;
+	UINT i;
+
+	if (nCount > MP3_POOL_MAX_IDLE) nCount = MP3_POOL_MAX_IDLE;
+
+	for (i = 0; i < nCount; i++) {
+		pEnc = Create(key);
+
+		m_qMutex.Lock();
+		pIdle = &m_mapIdle[key];
+		if (pIdle->size() < MP3_POOL_MAX_IDLE) {
+			pIdle->push_back(pEnc);
+			pEnc = NULL;
+		}
+		m_qMutex.Unlock();
+
+		if (pEnc != NULL) {
+			delete pEnc;
+			break;
+		}
+	}
+}
+
+void CMP3EncoderPool::CleanUp() {
+	map<MP3_POOL_KEY, vector<CMP3Simple*> >::iterator it;
+	size_t i;
+
+	m_qMutex.Lock();
+	for (it = m_mapIdle.begin(); it != m_mapIdle.end(); it++) {
+		for (i = 0; i < it->second.size(); i++) delete it->second[i];
+	}
+	m_mapIdle.clear();
+	m_qMutex.Unlock();
+}
+
+LONG CMP3EncoderPool::GetHits() {
+	LONG nHits;
+
+	m_qMutex.Lock();
+	nHits = m_nHits;
+	m_qMutex.Unlock();
+	return nHits;
+}
+
+LONG CMP3EncoderPool::GetMisses() {
+	LONG nMisses;
+
+	m_qMutex.Lock();
+	nMisses = m_nMisses;
+	m_qMutex.Unlock();
+	return nMisses;
+}
+
+LONGLONG CMP3EncoderPool::GetInitMicrosSaved() {
+	LONGLONG nSaved;
+
+	m_qMutex.Lock();
+	nSaved = m_nHits * AverageInitMicros() - m_nResetMicros;
+	m_qMutex.Unlock();
+	return nSaved;
+}
+
+LONGLONG CMP3EncoderPool::GetResetMicros() {
+	LONGLONG nMicros;
+
+	m_qMutex.Lock();
+	nMicros = m_nResetMicros;
+	m_qMutex.Unlock();
+	return nMicros;
+}
+
+void CMP3EncoderPool::PrintStats() {
+	LONG nLeases;
+
+	m_qMutex.Lock();
+	nLeases = m_nHits + m_nMisses;
+	printf("Encoder pool: %d lease(s), %d hit(s) (%.0f%%), %d miss(es), avg. init %.2f ms, "
+		"saved %.1f ms (net of %.1f ms of resets).\n",
+		nLeases, m_nHits, (nLeases > 0) ? 100.0 * m_nHits / nLeases : 0.0, m_nMisses,
+		AverageInitMicros() / 1000.0, (m_nHits * AverageInitMicros() - m_nResetMicros) / 1000.0,
+		m_nResetMicros / 1000.0);
+	m_qMutex.Unlock();
+}
+
+#endif
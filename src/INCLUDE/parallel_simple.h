@@ -0,0 +1,369 @@
+#ifndef ___PARALLEL_SIMPLE_H_INCLUDED___
+#define ___PARALLEL_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <limits.h>
+#include <vector>
+#include <deque>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/mp3_simple.h"
+
+using namespace std;
+
+// Frames of the preceding sound encoded (and thrown away) in front of each
+// segment, so the psychoacoustic model is warmed up at segment's first frame.
+#define PARALLEL_LEAD_FRAMES 2
+
+// Frames of the following sound encoded (and thrown away) after each segment,
+// they cover LAME's look-ahead and the encoder delay.
+#define PARALLEL_TRAIL_FRAMES 3
+
+#define PARALLEL_MAX_THREADS 64
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// One piece of the sound, encoded on its own by one of the workers.
+struct MP3_SEGMENT {
+	// Lead-in + segment's own frames + look-ahead.
+	vector<SHORT>	arrSamples;
+
+	// Output frames to skip (they belong to the previous segment) and
+	// to keep (zero - keep all the rest, used for the last segment).
+	DWORD			nSkipFrames;
+	DWORD			nKeepFrames;
+
+	vector<BYTE>	arrOutput;
+	BE_ERR			err;
+	volatile LONG	isDone;
+};
+
+class CMP3ParallelEncoder;
+
+// Thread with its own LAME stream, encoding segments queued by CMP3ParallelEncoder.
+class CMP3ParallelWorker: public IMP3Receiver {
+	friend class CMP3ParallelEncoder;
+private:
+	CMP3ParallelEncoder *m_pOwner;
+	CMP3Simple	m_mp3Enc;
+	CMP3Chunker	m_mp3Chunker;
+	QThread		m_qThread;
+
+	// Segment being encoded, see ReceiveMP3().
+	MP3_SEGMENT	*m_pSegment;
+
+	CMP3ParallelWorker(CMP3ParallelEncoder *pOwner, unsigned int nBitRate, unsigned int nInputSampleRate, LONG nMode);
+	~CMP3ParallelWorker() {};
+
+	void Encode(MP3_SEGMENT *pSegment);
+
+	static DWORD WINAPI workerProc(LPVOID arg);
+
+public:
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes);
+};
+
+// Class that encodes one MP3 stream on several cores.
+//
+// CMP3Simple encodes with the bit reservoir disabled (bNoRes = TRUE), so
+// every MP3 frame is independent of its neighbours. The incoming sound is
+// cut into segments of nSegmentFrames frames, each segment is encoded by a
+// separate LAME stream (see CMP3ParallelWorker), and the encoded frames are
+// passed to the IMP3Receiver in the original order. Segments overlap by
+// PARALLEL_LEAD_FRAMES + PARALLEL_TRAIL_FRAMES frames, output frames of the
+// overlap are dropped, so the result has exactly the frames (and timing) a
+// single stream would have. It is not bit-exact with a single stream, since
+// the psychoacoustic model restarts at each segment.
+//
+// Re-sampling is not supported (segments could not be cut on frame
+// boundaries of both the input and the output).
+//
+// All public methods must be called from one thread.
+class CMP3ParallelEncoder {
+	friend class CMP3ParallelWorker;
+private:
+	IMP3Receiver *m_pReceiver;
+	vector<CMP3ParallelWorker*> m_arrWorkers;
+
+	// Segments waiting for a worker.
+	deque<MP3_SEGMENT*> m_arrQueue;
+	QMutex		m_qQueueMutex;
+	QSemaphore	m_qQueued;
+	volatile LONG m_isStopping;
+
+	// All segments not yet passed to m_pReceiver, in order.
+	deque<MP3_SEGMENT*> m_arrInFlight;
+	QEvent		m_qSegmentDone;
+
+	// Samples (SHORT) per frame, all channels, and frames per segment.
+	DWORD		m_nFrameSize;
+	DWORD		m_nSegmentFrames;
+
+	// Sound not yet (fully) sent to workers. m_arrPending[0] is the first
+	// sample of frame m_nPendingFrame, and the next segment starts at frame
+	// m_nNextFrame (m_nPendingFrame is less by the lead-in).
+	vector<SHORT> m_arrPending;
+	DWORD		m_nPendingFrame;
+	DWORD		m_nNextFrame;
+
+	BE_ERR		m_err;
+
+	// Queues a segment made of the first nFrames of m_arrPending (nFrames ==
+	// 0 - all of it, for the last segment).
+	void Dispatch(DWORD nFrames, DWORD nKeepFrames);
+
+	// Passes encoded segments to m_pReceiver, in order. If isWait is true,
+	// waits until in-flight segments are not more than nMaxInFlight.
+	void Deliver(bool isWait, size_t nMaxInFlight);
+
+	void Deliver(MP3_SEGMENT *pSegment);
+	void StopWorkers();
+
+public:
+	// nBitRate, nInputSampleRate and nMode - see CMP3Simple.
+	//
+	// pReceiver - receives encoded sound, always on the thread calling Encode()/Flush().
+	//
+	// nThreads - number of workers (LAME streams), zero - one per CPU.
+	//
+	// nSegmentFrames - frames per segment. Longer segments waste less on the
+	// overlap, shorter ones need less memory and deliver sooner.
+	CMP3ParallelEncoder(unsigned int nBitRate, unsigned int nInputSampleRate, IMP3Receiver *pReceiver,
+		unsigned int nThreads = 0, unsigned int nSegmentFrames = 256, LONG nMode = BE_MP3_MODE_JSTEREO);
+	~CMP3ParallelEncoder();
+
+	// Same as CMP3Chunker::Encode, sound may come in pieces of any size.
+	BE_ERR Encode(PSHORT pSamples, DWORD nSamples);
+
+	// Encodes the rest of the sound and waits until everything is passed to
+	// the IMP3Receiver. Call it once, after the last "Encode".
+	BE_ERR Flush();
+
+	DWORD Threads() const { return (DWORD) this->m_arrWorkers.size(); }
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CMP3ParallelWorker::CMP3ParallelWorker(CMP3ParallelEncoder *pOwner, unsigned int nBitRate,
+									   unsigned int nInputSampleRate, LONG nMode):
+		m_mp3Enc(nBitRate, nInputSampleRate, 0, nMode), m_mp3Chunker(m_mp3Enc, this), m_qThread() {
+	this->m_pOwner = pOwner;
+	this->m_pSegment = NULL;
+}
+
+void CMP3ParallelWorker::ReceiveMP3(PBYTE pData, DWORD dwBytes) {
+	this->m_pSegment->arrOutput.insert(this->m_pSegment->arrOutput.end(), pData, pData + dwBytes);
+}
+
+void CMP3ParallelWorker::Encode(MP3_SEGMENT *pSegment) {
+	this->m_pSegment = pSegment;
+
+	pSegment->err = this->m_mp3Chunker.Encode(&pSegment->arrSamples[0], (DWORD) pSegment->arrSamples.size());
+	if (pSegment->err == BE_ERR_SUCCESSFUL) pSegment->err = this->m_mp3Chunker.Flush();
+
+	// Fresh stream for the next segment.
+	try {
+		this->m_mp3Enc.Reset();
+	}
+	catch (const char *) {
+		if (pSegment->err == BE_ERR_SUCCESSFUL) pSegment->err = BE_ERR_INVALID_HANDLE;
+	}
+
+	this->m_pSegment = NULL;
+}
+
+DWORD WINAPI CMP3ParallelWorker::workerProc(LPVOID arg) {
+	CMP3ParallelWorker *_this = (CMP3ParallelWorker *) arg;
+	CMP3ParallelEncoder *pOwner = _this->m_pOwner;
+	MP3_SEGMENT *pSegment;
+
+	for (;;) {
+		// Wait for a segment (or for the stop).
+		pOwner->m_qQueued.Inc();
+
+		pOwner->m_qQueueMutex.Lock();
+		if (pOwner->m_arrQueue.empty()) {
+			pOwner->m_qQueueMutex.Unlock();
+			if (QAtomicLoad(&pOwner->m_isStopping)) break;
+			continue;
+		}
+		pSegment = pOwner->m_arrQueue.front();
+		pOwner->m_arrQueue.pop_front();
+		pOwner->m_qQueueMutex.Unlock();
+
+		_this->Encode(pSegment);
+
+		QAtomicStore(&pSegment->isDone, 1);
+		pOwner->m_qSegmentDone.Set();
+	}
+	return(0);
+}
+///////////////////////////////////////////////////////////////////////////
+CMP3ParallelEncoder::CMP3ParallelEncoder(unsigned int nBitRate, unsigned int nInputSampleRate,
+										 IMP3Receiver *pReceiver, unsigned int nThreads,
+										 unsigned int nSegmentFrames, LONG nMode):
+		m_qQueueMutex(), m_qQueued(LONG_MAX, 0), m_qSegmentDone() {
+	SYSTEM_INFO si;
+	CMP3ParallelWorker *pWorker;
+	unsigned int i;
+
+	this->m_pReceiver = pReceiver;
+	this->m_isStopping = 0;
+	this->m_nPendingFrame = 0;
+	this->m_nNextFrame = 0;
+	this->m_err = BE_ERR_SUCCESSFUL;
+	this->m_nSegmentFrames = (nSegmentFrames > PARALLEL_LEAD_FRAMES) ? nSegmentFrames : PARALLEL_LEAD_FRAMES;
+
+	if (nThreads == 0) {
+		::GetSystemInfo(&si);
+		nThreads = si.dwNumberOfProcessors;
+	}
+	if (nThreads > PARALLEL_MAX_THREADS) nThreads = PARALLEL_MAX_THREADS;
+
+	try {
+		for (i = 0; i < nThreads; i++) {
+			pWorker = new CMP3ParallelWorker(this, nBitRate, nInputSampleRate, nMode);
+			this->m_arrWorkers.push_back(pWorker);
+			pWorker->m_qThread.Start(&CMP3ParallelWorker::workerProc, (LPVOID) pWorker);
+		}
+	}
+	catch (const char *) {
+		this->StopWorkers();
+		throw;
+	}
+
+	this->m_nFrameSize = this->m_arrWorkers[0]->m_mp3Enc.SamplesPerFrame() * this->m_arrWorkers[0]->m_mp3Enc.Channels();
+}
+
+CMP3ParallelEncoder::~CMP3ParallelEncoder() {
+	this->StopWorkers();
+
+	while (!this->m_arrInFlight.empty()) {
+		delete this->m_arrInFlight.front();
+		this->m_arrInFlight.pop_front();
+	}
+}
+
+void CMP3ParallelEncoder::StopWorkers() {
+	size_t i;
+
+	QAtomicStore(&this->m_isStopping, 1);
+	this->m_qQueued.Dec((long) this->m_arrWorkers.size());
+
+	for (i = 0; i < this->m_arrWorkers.size(); i++) {
+		this->m_arrWorkers[i]->m_qThread.Join();
+		delete this->m_arrWorkers[i];
+	}
+	this->m_arrWorkers.clear();
+}
+
+void CMP3ParallelEncoder::Dispatch(DWORD nFrames, DWORD nKeepFrames) {
+	MP3_SEGMENT *pSegment = new MP3_SEGMENT;
+	size_t nSamples = (nFrames > 0) ? nFrames * this->m_nFrameSize : this->m_arrPending.size();
+
+	pSegment->arrSamples.assign(this->m_arrPending.begin(), this->m_arrPending.begin() + nSamples);
+	pSegment->nSkipFrames = this->m_nNextFrame - this->m_nPendingFrame;
+	pSegment->nKeepFrames = nKeepFrames;
+	pSegment->err = BE_ERR_SUCCESSFUL;
+	pSegment->isDone = 0;
+
+	this->m_arrInFlight.push_back(pSegment);
+
+	this->m_qQueueMutex.Lock();
+	this->m_arrQueue.push_back(pSegment);
+	this->m_qQueueMutex.Unlock();
+	this->m_qQueued.Dec();
+}
+
+void CMP3ParallelEncoder::Deliver(MP3_SEGMENT *pSegment) {
+	PBYTE pData = pSegment->arrOutput.empty() ? NULL : &pSegment->arrOutput[0];
+	DWORD dwSize = (DWORD) pSegment->arrOutput.size();
+	DWORD dwOffset = 0, dwStart, dwLength;
+	DWORD nFrame = 0;
+
+	if (pSegment->err != BE_ERR_SUCCESSFUL) {
+		if (this->m_err == BE_ERR_SUCCESSFUL) this->m_err = pSegment->err;
+		return;
+	}
+
+	// Skip the frames of the lead-in...
+	while ((nFrame < pSegment->nSkipFrames) && (dwOffset + 4 <= dwSize)) {
+		dwLength = CMP3Frame::Length(pData + dwOffset);
+		if (dwLength == 0) break;
+		dwOffset += dwLength;
+		nFrame++;
+	}
+	if (nFrame < pSegment->nSkipFrames) return;
+	dwStart = dwOffset;
+
+	// ...and find where the segment's own frames end.
+	while (((pSegment->nKeepFrames == 0) || (nFrame < pSegment->nSkipFrames + pSegment->nKeepFrames)) &&
+		(dwOffset + 4 <= dwSize)) {
+		dwLength = CMP3Frame::Length(pData + dwOffset);
+		if (dwLength == 0) break;
+		dwOffset += dwLength;
+		nFrame++;
+	}
+	if (dwOffset > dwSize) dwOffset = dwSize;
+
+	if ((dwOffset > dwStart) && (this->m_pReceiver != NULL)) {
+		this->m_pReceiver->ReceiveMP3(pData + dwStart, dwOffset - dwStart);
+	}
+}
+
+void CMP3ParallelEncoder::Deliver(bool isWait, size_t nMaxInFlight) {
+	MP3_SEGMENT *pSegment;
+
+	while (!this->m_arrInFlight.empty()) {
+		pSegment = this->m_arrInFlight.front();
+
+		if (!QAtomicLoad(&pSegment->isDone)) {
+			if (!isWait || (this->m_arrInFlight.size() <= nMaxInFlight)) break;
+			this->m_qSegmentDone.Wait();
+			continue;
+		}
+
+		this->m_arrInFlight.pop_front();
+		this->Deliver(pSegment);
+		delete pSegment;
+	}
+}
+
+BE_ERR CMP3ParallelEncoder::Encode(PSHORT pSamples, DWORD nSamples) {
+	DWORD nSegmentEnd, nNextPending;
+
+	this->m_arrPending.insert(this->m_arrPending.end(), pSamples, pSamples + nSamples);
+
+	// Dispatch every segment whose frames and look-ahead are available.
+	for (;;) {
+		nSegmentEnd = this->m_nNextFrame + this->m_nSegmentFrames + PARALLEL_TRAIL_FRAMES;
+		if (this->m_arrPending.size() < (nSegmentEnd - this->m_nPendingFrame) * this->m_nFrameSize) break;
+
+		this->Dispatch(nSegmentEnd - this->m_nPendingFrame, this->m_nSegmentFrames);
+
+		// Keep the lead-in of the next segment.
+		this->m_nNextFrame += this->m_nSegmentFrames;
+		nNextPending = this->m_nNextFrame - PARALLEL_LEAD_FRAMES;
+		this->m_arrPending.erase(this->m_arrPending.begin(),
+			this->m_arrPending.begin() + (nNextPending - this->m_nPendingFrame) * this->m_nFrameSize);
+		this->m_nPendingFrame = nNextPending;
+
+		// Don't let the memory grow if workers can't keep up.
+		this->Deliver(true, 2 * this->m_arrWorkers.size());
+	}
+
+	this->Deliver(false, 0);
+	return this->m_err;
+}
+
+BE_ERR CMP3ParallelEncoder::Flush() {
+	// Last segment, if there is anything after the lead-in.
+	if (this->m_arrPending.size() > (this->m_nNextFrame - this->m_nPendingFrame) * this->m_nFrameSize) {
+		this->Dispatch(0, 0);
+	}
+	this->m_arrPending.clear();
+
+	this->Deliver(true, 0);
+	return this->m_err;
+}
+
+#endif
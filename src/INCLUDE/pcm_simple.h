@@ -0,0 +1,883 @@
+#ifndef ___PCM_SIMPLE_H_INCLUDED___
+#define ___PCM_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <math.h>
+#include "INCLUDE/sync_simple.h"
+
+// SSE2/AVX2 versions of the kernels exist on x86 and x64 only, elsewhere the
+// scalar ones are used.
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define PCM_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang compile an instruction set only for the functions asking for
+// it, so the rest of the program still runs on any CPU. VC compiles them as they are.
+#if defined(PCM_X86) && defined(__GNUC__)
+#define PCM_SSE2_TARGET __attribute__((target("sse2")))
+#define PCM_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define PCM_SSE2_TARGET
+#define PCM_AVX2_TARGET
+#endif
+
+// Implementations of the kernels, see CPCMConvert::SetLevel().
+#define PCM_SIMD_SCALAR 0
+#define PCM_SIMD_SSE2 1
+#define PCM_SIMD_AVX2 2
+
+// Lanes of the dither generator, every implementation draws sample i from lane i % PCM_DITHER_LANES.
+#define PCM_DITHER_LANES 8
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// State of the dither added when sound is reduced to 16 bits (see
+// CPCMConvert::FloatToS16): triangular (TPDF) noise of +-1 LSB, from
+// PCM_DITHER_LANES xorshift generators. The same seed gives the same noise
+// whichever implementation of the kernels is used. Keep one per stream, so
+// consecutive buffers continue the same noise.
+class CPCMDither {
+public:
+	DWORD	arrState[PCM_DITHER_LANES];
+
+	CPCMDither(DWORD dwSeed = 1) { this->Seed(dwSeed); };
+
+	void Seed(DWORD dwSeed);
+};
+///////////////////////////////////////////////////////////////////////////
+// Conversion kernels between the PCM formats a capture source may deliver
+// and what CMP3Simple::Encode takes (interleaved 16-bit). Every kernel comes
+// in a scalar, an SSE2 and an AVX2 version; the best one the CPU supports is
+// picked on first use (see SetLevel()). Input and output must not overlap.
+//
+// Counts are in samples for the sample-wise kernels and in sample frames
+// (one sample per channel) for the channel ones.
+class CPCMConvert {
+private:
+	typedef void (*U8TOS16)(const BYTE *, PSHORT, DWORD);
+	typedef void (*CHANNELS)(const SHORT *, PSHORT, DWORD);
+	typedef void (*SPLIT)(const SHORT *, PSHORT, PSHORT, DWORD);
+	typedef void (*JOIN)(const SHORT *, const SHORT *, PSHORT, DWORD);
+	typedef void (*TOS16)(const void *, float, PSHORT, DWORD, DWORD *);
+	typedef void (*GAIN)(const SHORT *, PSHORT, DWORD, float, float, float);
+	typedef ULONGLONG (*SQUARES)(const SHORT *, DWORD);
+	typedef float (*DOT)(const FLOAT *, const FLOAT *, DWORD);
+	typedef DWORD (*CROSSINGS)(const SHORT *, DWORD, WORD);
+
+	static volatile LONG m_nLevel;
+	static U8TOS16	m_pU8ToS16;
+	static CHANNELS	m_pMonoToStereo;
+	static CHANNELS	m_pStereoToMono;
+	static SPLIT	m_pDeinterleave;
+	static JOIN		m_pInterleave;
+	static TOS16	m_pFloatToS16;
+	static TOS16	m_pS32ToS16;
+	static GAIN		m_pGain;
+	static SQUARES	m_pSumOfSquares;
+	static DOT		m_pDot;
+	static CROSSINGS m_pZeroCrossings;
+
+	// Picks the best kernels on first use. Threads racing here pick the same ones.
+	static void Init() { if (QAtomicLoad(&m_nLevel) < 0) SetLevel(PCM_SIMD_AVX2); };
+
+	// Float (or LONG, scaled by fScale) to 16-bit. pState - PCM_DITHER_LANES
+	// generator states, NULL - no dither, only rounding.
+	static void FloatToS16Scalar(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState);
+	static void S32ToS16Scalar(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState);
+
+	static void U8ToS16Scalar(const BYTE *pIn, PSHORT pOut, DWORD nSamples);
+	static void MonoToStereoScalar(const SHORT *pIn, PSHORT pOut, DWORD nFrames);
+	static void StereoToMonoScalar(const SHORT *pIn, PSHORT pOut, DWORD nFrames);
+	static void DeinterleaveScalar(const SHORT *pIn, PSHORT pLeft, PSHORT pRight, DWORD nFrames);
+	static void InterleaveScalar(const SHORT *pLeft, const SHORT *pRight, PSHORT pOut, DWORD nFrames);
+	static void GainScalar(const SHORT *pIn, PSHORT pOut, DWORD nSamples, float fGain, float fStep, float fKnee);
+	static ULONGLONG SumOfSquaresScalar(const SHORT *pIn, DWORD nSamples);
+	static float DotScalar(const FLOAT *pA, const FLOAT *pB, DWORD n);
+	static DWORD ZeroCrossingsScalar(const SHORT *pIn, DWORD nSamples, WORD nChannels);
+
+#ifdef PCM_X86
+	static void U8ToS16SSE2(const BYTE *pIn, PSHORT pOut, DWORD nSamples);
+	static void MonoToStereoSSE2(const SHORT *pIn, PSHORT pOut, DWORD nFrames);
+	static void StereoToMonoSSE2(const SHORT *pIn, PSHORT pOut, DWORD nFrames);
+	static void DeinterleaveSSE2(const SHORT *pIn, PSHORT pLeft, PSHORT pRight, DWORD nFrames);
+	static void InterleaveSSE2(const SHORT *pLeft, const SHORT *pRight, PSHORT pOut, DWORD nFrames);
+	static void FloatToS16SSE2(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState);
+	static void S32ToS16SSE2(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState);
+	static void GainSSE2(const SHORT *pIn, PSHORT pOut, DWORD nSamples, float fGain, float fStep, float fKnee);
+	static ULONGLONG SumOfSquaresSSE2(const SHORT *pIn, DWORD nSamples);
+	static float DotSSE2(const FLOAT *pA, const FLOAT *pB, DWORD n);
+	static DWORD ZeroCrossingsSSE2(const SHORT *pIn, DWORD nSamples, WORD nChannels);
+
+	static void U8ToS16AVX2(const BYTE *pIn, PSHORT pOut, DWORD nSamples);
+	static void MonoToStereoAVX2(const SHORT *pIn, PSHORT pOut, DWORD nFrames);
+	static void StereoToMonoAVX2(const SHORT *pIn, PSHORT pOut, DWORD nFrames);
+	static void DeinterleaveAVX2(const SHORT *pIn, PSHORT pLeft, PSHORT pRight, DWORD nFrames);
+	static void InterleaveAVX2(const SHORT *pLeft, const SHORT *pRight, PSHORT pOut, DWORD nFrames);
+	static void FloatToS16AVX2(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState);
+	static void S32ToS16AVX2(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState);
+	static void GainAVX2(const SHORT *pIn, PSHORT pOut, DWORD nSamples, float fGain, float fStep, float fKnee);
+	static ULONGLONG SumOfSquaresAVX2(const SHORT *pIn, DWORD nSamples);
+	static float DotAVX2(const FLOAT *pA, const FLOAT *pB, DWORD n);
+	static DWORD ZeroCrossingsAVX2(const SHORT *pIn, DWORD nSamples, WORD nChannels);
+#endif
+
+public:
+	// Returns the best implementation the CPU (and the OS) supports, PCM_SIMD_XXXX.
+	static int DetectLevel();
+
+	// Uses the nLevel implementation (PCM_SIMD_XXXX) of every kernel from now
+	// on, or the best supported one below it. Returns the one chosen. Not to
+	// be called while other threads convert.
+	static int SetLevel(int nLevel);
+
+	// Returns the implementation in use, and its name.
+	static int GetLevel() { Init(); return (int) QAtomicLoad(&m_nLevel); };
+	static const char *LevelName(int nLevel);
+
+	// Unsigned 8-bit (WAVE_FORMAT_xM08/xS08) to 16-bit, (x - 128) * 256.
+	static void U8ToS16(const BYTE *pIn, PSHORT pOut, DWORD nSamples) { Init(); m_pU8ToS16(pIn, pOut, nSamples); };
+
+	// Mono to interleaved stereo, every sample goes to both channels. pOut gets 2 * nFrames samples.
+	static void MonoToStereo(const SHORT *pIn, PSHORT pOut, DWORD nFrames) { Init(); m_pMonoToStereo(pIn, pOut, nFrames); };
+
+	// Interleaved stereo to mono, the average of the channels.
+	static void StereoToMono(const SHORT *pIn, PSHORT pOut, DWORD nFrames) { Init(); m_pStereoToMono(pIn, pOut, nFrames); };
+
+	// Interleaved stereo to two planes, and back.
+	static void Deinterleave(const SHORT *pIn, PSHORT pLeft, PSHORT pRight, DWORD nFrames) {
+		Init(); m_pDeinterleave(pIn, pLeft, pRight, nFrames);
+	};
+	static void Interleave(const SHORT *pLeft, const SHORT *pRight, PSHORT pOut, DWORD nFrames) {
+		Init(); m_pInterleave(pLeft, pRight, pOut, nFrames);
+	};
+
+	// Float (-1.0 .. 1.0, WAVE_FORMAT_IEEE_FLOAT), 32-bit and packed 24-bit
+	// (little endian) integer to 16-bit, saturated. With pDither the dither
+	// is added before rounding (recommended), without it samples are only rounded.
+	static void FloatToS16(const FLOAT *pIn, PSHORT pOut, DWORD nSamples, CPCMDither *pDither = NULL) {
+		Init(); m_pFloatToS16(pIn, 32768.0f, pOut, nSamples, (pDither != NULL) ? pDither->arrState : NULL);
+	};
+	static void S32ToS16(const LONG *pIn, PSHORT pOut, DWORD nSamples, CPCMDither *pDither = NULL) {
+		Init(); m_pS32ToS16(pIn, 1.0f / 65536.0f, pOut, nSamples, (pDither != NULL) ? pDither->arrState : NULL);
+	};
+	static void S24ToS16(const BYTE *pIn, PSHORT pOut, DWORD nSamples, CPCMDither *pDither = NULL);
+
+	// Multiplies 16-bit samples by a gain ramp, sample i by fGain + i * fStep
+	// (fStep zero - a constant gain), and passes them through a soft limiter:
+	// magnitudes up to fKnee stay as they are, above it they are bent smoothly
+	// towards full scale instead of being clipped (fKnee 32768 - hard clipping).
+	// pIn may be pOut.
+	static void Gain(const SHORT *pIn, PSHORT pOut, DWORD nSamples, float fGain, float fStep, float fKnee) {
+		Init(); m_pGain(pIn, pOut, nSamples, fGain, fStep, fKnee);
+	};
+
+	// Sum of the squares of the samples (the power of a buffer), exact.
+	static ULONGLONG SumOfSquares(const SHORT *pIn, DWORD nSamples) { Init(); return m_pSumOfSquares(pIn, nSamples); };
+
+	// Sum of pA[i] * pB[i], e.g. a filter's taps over the sound (see
+	// CResampler). The implementations add in a different order, so their
+	// results may differ in the last bits.
+	static float Dot(const FLOAT *pA, const FLOAT *pB, DWORD n) { Init(); return m_pDot(pA, pB, n); };
+
+	// Number of times the sign changes from a sample to the next one of the
+	// same channel, in interleaved sound of nChannels. Zero counts as positive.
+	static DWORD ZeroCrossings(const SHORT *pIn, DWORD nSamples, WORD nChannels) {
+		Init(); return m_pZeroCrossings(pIn, nSamples, nChannels);
+	};
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+volatile LONG CPCMConvert::m_nLevel = -1;
+CPCMConvert::U8TOS16	CPCMConvert::m_pU8ToS16 = NULL;
+CPCMConvert::CHANNELS	CPCMConvert::m_pMonoToStereo = NULL;
+CPCMConvert::CHANNELS	CPCMConvert::m_pStereoToMono = NULL;
+CPCMConvert::SPLIT		CPCMConvert::m_pDeinterleave = NULL;
+CPCMConvert::JOIN		CPCMConvert::m_pInterleave = NULL;
+CPCMConvert::TOS16		CPCMConvert::m_pFloatToS16 = NULL;
+CPCMConvert::TOS16		CPCMConvert::m_pS32ToS16 = NULL;
+CPCMConvert::GAIN		CPCMConvert::m_pGain = NULL;
+CPCMConvert::SQUARES	CPCMConvert::m_pSumOfSquares = NULL;
+CPCMConvert::DOT		CPCMConvert::m_pDot = NULL;
+CPCMConvert::CROSSINGS	CPCMConvert::m_pZeroCrossings = NULL;
+
+void CPCMDither::Seed(DWORD dwSeed) {
+	int i;
+
+	// Xorshift must not start from zero.
+	for (i = 0; i < PCM_DITHER_LANES; i++) {
+		this->arrState[i] = (dwSeed + i) * 2654435761u;
+		if (this->arrState[i] == 0) this->arrState[i] = 1;
+	}
+}
+
+int CPCMConvert::DetectLevel() {
+#ifdef PCM_X86
+#ifdef _MSC_VER
+	int arrInfo[4];
+
+	__cpuid(arrInfo, 0);
+	if (arrInfo[0] >= 7) {
+		__cpuidex(arrInfo, 7, 0);
+		bool isAVX2 = (arrInfo[1] & (1 << 5)) != 0;
+		__cpuid(arrInfo, 1);
+		// AVX registers must be saved by the OS as well (OSXSAVE, XCR0).
+		if (isAVX2 && (arrInfo[2] & (1 << 27)) && (arrInfo[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6)) return PCM_SIMD_AVX2;
+	}
+	__cpuid(arrInfo, 1);
+	if (arrInfo[3] & (1 << 26)) return PCM_SIMD_SSE2;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return PCM_SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2")) return PCM_SIMD_SSE2;
+#endif
+#endif
+	return PCM_SIMD_SCALAR;
+}
+
+int CPCMConvert::SetLevel(int nLevel) {
+	int nDetected = DetectLevel();
+
+	if (nLevel > nDetected) nLevel = nDetected;
+	if (nLevel < PCM_SIMD_SCALAR) nLevel = PCM_SIMD_SCALAR;
+
+	m_pU8ToS16 = &U8ToS16Scalar;
+	m_pMonoToStereo = &MonoToStereoScalar;
+	m_pStereoToMono = &StereoToMonoScalar;
+	m_pDeinterleave = &DeinterleaveScalar;
+	m_pInterleave = &InterleaveScalar;
+	m_pFloatToS16 = &FloatToS16Scalar;
+	m_pS32ToS16 = &S32ToS16Scalar;
+	m_pGain = &GainScalar;
+	m_pSumOfSquares = &SumOfSquaresScalar;
+	m_pDot = &DotScalar;
+	m_pZeroCrossings = &ZeroCrossingsScalar;
+#ifdef PCM_X86
+	if (nLevel == PCM_SIMD_SSE2) {
+		m_pU8ToS16 = &U8ToS16SSE2;
+		m_pMonoToStereo = &MonoToStereoSSE2;
+		m_pStereoToMono = &StereoToMonoSSE2;
+		m_pDeinterleave = &DeinterleaveSSE2;
+		m_pInterleave = &InterleaveSSE2;
+		m_pFloatToS16 = &FloatToS16SSE2;
+		m_pS32ToS16 = &S32ToS16SSE2;
+		m_pGain = &GainSSE2;
+		m_pSumOfSquares = &SumOfSquaresSSE2;
+		m_pDot = &DotSSE2;
+		m_pZeroCrossings = &ZeroCrossingsSSE2;
+	}
+	else if (nLevel == PCM_SIMD_AVX2) {
+		m_pU8ToS16 = &U8ToS16AVX2;
+		m_pMonoToStereo = &MonoToStereoAVX2;
+		m_pStereoToMono = &StereoToMonoAVX2;
+		m_pDeinterleave = &DeinterleaveAVX2;
+		m_pInterleave = &InterleaveAVX2;
+		m_pFloatToS16 = &FloatToS16AVX2;
+		m_pS32ToS16 = &S32ToS16AVX2;
+		m_pGain = &GainAVX2;
+		m_pSumOfSquares = &SumOfSquaresAVX2;
+		m_pDot = &DotAVX2;
+		m_pZeroCrossings = &ZeroCrossingsAVX2;
+	}
+#endif
+
+	// Kernels are in place before anybody sees the level.
+	QAtomicStore(&m_nLevel, nLevel);
+	return nLevel;
+}
+
+const char *CPCMConvert::LevelName(int nLevel) {
+	switch (nLevel) {
+	case PCM_SIMD_SSE2: return "sse2";
+	case PCM_SIMD_AVX2: return "avx2";
+	}
+	return "scalar";
+}
+
+void CPCMConvert::S24ToS16(const BYTE *pIn, PSHORT pOut, DWORD nSamples, CPCMDither *pDither) {
+	LONG arrWide[256];
+	DWORD i, nChunk;
+
+	// Widened to 32 bits a chunk at a time (a multiple of PCM_DITHER_LANES,
+	// so the dither goes on the same), then reduced as 32-bit samples.
+	while (nSamples > 0) {
+		nChunk = (nSamples < 256) ? nSamples : 256;
+		for (i = 0; i < nChunk; i++, pIn += 3) {
+			arrWide[i] = (LONG) (((DWORD) pIn[0] << 8) | ((DWORD) pIn[1] << 16) | ((DWORD) pIn[2] << 24));
+		}
+		S32ToS16(arrWide, pOut, nChunk, pDither);
+		pOut += nChunk;
+		nSamples -= nChunk;
+	}
+}
+///////////////////////////////////////////////////////////////////////////
+// Scalar kernels, also finish what the vector ones leave (less than a vector).
+
+// Next value of the xorshift generator.
+inline DWORD PCMXorShift(DWORD *pState) {
+	DWORD x = *pState;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*pState = x;
+	return x;
+}
+
+// Rounds and saturates a sample already scaled to 16 bits, adding the dither of its lane.
+inline SHORT PCMToS16(float fValue, DWORD *pLane) {
+	if (pLane != NULL) {
+		// Each draw is uniform in -0.5 .. 0.5 LSB, their sum is triangular.
+		fValue += (float) (LONG) PCMXorShift(pLane) * (1.0f / 4294967296.0f);
+		fValue += (float) (LONG) PCMXorShift(pLane) * (1.0f / 4294967296.0f);
+	}
+	if (fValue >= 32767.0f) return 32767;
+	if (fValue <= -32768.0f) return -32768;
+	// Nearest, ties to even, same as the vector conversions.
+	return (SHORT) lrintf(fValue);
+}
+
+void CPCMConvert::FloatToS16Scalar(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState) {
+	const FLOAT *pSamples = (const FLOAT *) pIn;
+	DWORD i;
+
+	for (i = 0; i < nSamples; i++) {
+		pOut[i] = PCMToS16(pSamples[i] * fScale, (pState != NULL) ? &pState[i % PCM_DITHER_LANES] : NULL);
+	}
+}
+
+void CPCMConvert::S32ToS16Scalar(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState) {
+	const LONG *pSamples = (const LONG *) pIn;
+	DWORD i;
+
+	for (i = 0; i < nSamples; i++) {
+		pOut[i] = PCMToS16((float) pSamples[i] * fScale, (pState != NULL) ? &pState[i % PCM_DITHER_LANES] : NULL);
+	}
+}
+
+void CPCMConvert::U8ToS16Scalar(const BYTE *pIn, PSHORT pOut, DWORD nSamples) {
+	DWORD i;
+
+	for (i = 0; i < nSamples; i++) pOut[i] = (SHORT) (((int) pIn[i] - 128) * 256);
+}
+
+void CPCMConvert::MonoToStereoScalar(const SHORT *pIn, PSHORT pOut, DWORD nFrames) {
+	DWORD i;
+
+	for (i = 0; i < nFrames; i++) pOut[2 * i] = pOut[2 * i + 1] = pIn[i];
+}
+
+void CPCMConvert::StereoToMonoScalar(const SHORT *pIn, PSHORT pOut, DWORD nFrames) {
+	DWORD i;
+
+	for (i = 0; i < nFrames; i++) pOut[i] = (SHORT) (((int) pIn[2 * i] + (int) pIn[2 * i + 1]) >> 1);
+}
+
+void CPCMConvert::DeinterleaveScalar(const SHORT *pIn, PSHORT pLeft, PSHORT pRight, DWORD nFrames) {
+	DWORD i;
+
+	for (i = 0; i < nFrames; i++) {
+		pLeft[i] = pIn[2 * i];
+		pRight[i] = pIn[2 * i + 1];
+	}
+}
+
+void CPCMConvert::InterleaveScalar(const SHORT *pLeft, const SHORT *pRight, PSHORT pOut, DWORD nFrames) {
+	DWORD i;
+
+	for (i = 0; i < nFrames; i++) {
+		pOut[2 * i] = pLeft[i];
+		pOut[2 * i + 1] = pRight[i];
+	}
+}
+
+// Headroom above the knee the limiter bends the samples into, never zero.
+inline float PCMKneeRange(float fKnee) {
+	return (fKnee < 32767.0f) ? 32768.0f - fKnee : 1.0f;
+}
+
+// Soft limiter, see CPCMConvert::Gain(). Magnitude a above the knee k goes to
+// k + r * u / (1 + u), u = (a - k) / r: same slope at the knee, approaching
+// k + r (full scale) but never reaching it.
+inline float PCMLimit(float fValue, float fKnee, float fRange, float fInvRange) {
+	float fAbs = fabsf(fValue), fOver, fOut;
+
+	fOver = fAbs - fKnee;
+	if (fOver < 0.0f) fOver = 0.0f;
+	fOver *= fInvRange;
+	fOut = ((fAbs < fKnee) ? fAbs : fKnee) + fRange * (fOver / (1.0f + fOver));
+	return (fValue < 0.0f) ? -fOut : fOut;
+}
+
+// Samples nFirst .. nSamples - 1 of CPCMConvert::Gain(). The gain of every
+// sample comes from its index, not from adding up the steps, so the vector
+// kernels (which leave the last few samples here) compute exactly the same.
+inline void PCMGain(const SHORT *pIn, PSHORT pOut, DWORD nFirst, DWORD nSamples, float fGain, float fStep, float fKnee) {
+	float fRange = PCMKneeRange(fKnee), fInvRange = 1.0f / fRange;
+	DWORD i;
+
+	for (i = nFirst; i < nSamples; i++) {
+		pOut[i] = PCMToS16(PCMLimit((float) pIn[i] * (fGain + fStep * (float) (LONG) i), fKnee, fRange, fInvRange), NULL);
+	}
+}
+
+void CPCMConvert::GainScalar(const SHORT *pIn, PSHORT pOut, DWORD nSamples, float fGain, float fStep, float fKnee) {
+	PCMGain(pIn, pOut, 0, nSamples, fGain, fStep, fKnee);
+}
+
+ULONGLONG CPCMConvert::SumOfSquaresScalar(const SHORT *pIn, DWORD nSamples) {
+	ULONGLONG nSum = 0;
+	DWORD i;
+
+	for (i = 0; i < nSamples; i++) nSum += (ULONGLONG) ((LONG) pIn[i] * (LONG) pIn[i]);
+	return nSum;
+}
+
+float CPCMConvert::DotScalar(const FLOAT *pA, const FLOAT *pB, DWORD n) {
+	float fSum = 0.0f;
+	DWORD i;
+
+	for (i = 0; i < n; i++) fSum += pA[i] * pB[i];
+	return fSum;
+}
+
+DWORD CPCMConvert::ZeroCrossingsScalar(const SHORT *pIn, DWORD nSamples, WORD nChannels) {
+	DWORD nCount = 0, i;
+
+	for (i = 0; i + nChannels < nSamples; i++) {
+		if ((pIn[i] ^ pIn[i + nChannels]) < 0) nCount++;
+	}
+	return nCount;
+}
+
+#ifdef PCM_X86
+///////////////////////////////////////////////////////////////////////////
+// SSE2 kernels, 8 samples (or frames) per step.
+
+PCM_SSE2_TARGET inline __m128i PCMXorShiftSSE2(__m128i *pState) {
+	__m128i x = *pState;
+
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+	x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+	*pState = x;
+	return x;
+}
+
+// Scaled samples to saturated 16-bit, see PCMToS16().
+PCM_SSE2_TARGET inline __m128i PCMToS16SSE2(__m128 fLow, __m128 fHigh, __m128i *pState) {
+	const __m128 fUnit = _mm_set1_ps(1.0f / 4294967296.0f);
+
+	if (pState != NULL) {
+		fLow = _mm_add_ps(fLow, _mm_mul_ps(_mm_cvtepi32_ps(PCMXorShiftSSE2(&pState[0])), fUnit));
+		fHigh = _mm_add_ps(fHigh, _mm_mul_ps(_mm_cvtepi32_ps(PCMXorShiftSSE2(&pState[1])), fUnit));
+		fLow = _mm_add_ps(fLow, _mm_mul_ps(_mm_cvtepi32_ps(PCMXorShiftSSE2(&pState[0])), fUnit));
+		fHigh = _mm_add_ps(fHigh, _mm_mul_ps(_mm_cvtepi32_ps(PCMXorShiftSSE2(&pState[1])), fUnit));
+	}
+	// Clamped first, out of range floats don't convert to integers.
+	fLow = _mm_max_ps(_mm_min_ps(fLow, _mm_set1_ps(32767.0f)), _mm_set1_ps(-32768.0f));
+	fHigh = _mm_max_ps(_mm_min_ps(fHigh, _mm_set1_ps(32767.0f)), _mm_set1_ps(-32768.0f));
+	return _mm_packs_epi32(_mm_cvtps_epi32(fLow), _mm_cvtps_epi32(fHigh));
+}
+
+void PCM_SSE2_TARGET CPCMConvert::FloatToS16SSE2(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState) {
+	const FLOAT *pSamples = (const FLOAT *) pIn;
+	__m128 fMul = _mm_set1_ps(fScale);
+	__m128i arrState[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+	DWORD i;
+
+	if (pState != NULL) {
+		arrState[0] = _mm_loadu_si128((const __m128i *) &pState[0]);
+		arrState[1] = _mm_loadu_si128((const __m128i *) &pState[4]);
+	}
+	for (i = 0; i + 8 <= nSamples; i += 8) {
+		_mm_storeu_si128((__m128i *) &pOut[i], PCMToS16SSE2(_mm_mul_ps(_mm_loadu_ps(&pSamples[i]), fMul),
+			_mm_mul_ps(_mm_loadu_ps(&pSamples[i + 4]), fMul), (pState != NULL) ? arrState : NULL));
+	}
+	if (pState != NULL) {
+		_mm_storeu_si128((__m128i *) &pState[0], arrState[0]);
+		_mm_storeu_si128((__m128i *) &pState[4], arrState[1]);
+	}
+	FloatToS16Scalar(&pSamples[i], fScale, &pOut[i], nSamples - i, pState);
+}
+
+void PCM_SSE2_TARGET CPCMConvert::S32ToS16SSE2(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState) {
+	const LONG *pSamples = (const LONG *) pIn;
+	__m128 fMul = _mm_set1_ps(fScale);
+	__m128i arrState[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+	DWORD i;
+
+	if (pState != NULL) {
+		arrState[0] = _mm_loadu_si128((const __m128i *) &pState[0]);
+		arrState[1] = _mm_loadu_si128((const __m128i *) &pState[4]);
+	}
+	for (i = 0; i + 8 <= nSamples; i += 8) {
+		_mm_storeu_si128((__m128i *) &pOut[i], PCMToS16SSE2(
+			_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) &pSamples[i])), fMul),
+			_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) &pSamples[i + 4])), fMul),
+			(pState != NULL) ? arrState : NULL));
+	}
+	if (pState != NULL) {
+		_mm_storeu_si128((__m128i *) &pState[0], arrState[0]);
+		_mm_storeu_si128((__m128i *) &pState[4], arrState[1]);
+	}
+	S32ToS16Scalar(&pSamples[i], fScale, &pOut[i], nSamples - i, pState);
+}
+
+void PCM_SSE2_TARGET CPCMConvert::U8ToS16SSE2(const BYTE *pIn, PSHORT pOut, DWORD nSamples) {
+	const __m128i nZero = _mm_setzero_si128();
+	const __m128i nSign = _mm_set1_epi16((short) 0x8000);
+	__m128i v;
+	DWORD i;
+
+	// Byte into the high half of a word is x * 256, flipping the top bit subtracts 128 * 256.
+	for (i = 0; i + 16 <= nSamples; i += 16) {
+		v = _mm_loadu_si128((const __m128i *) &pIn[i]);
+		_mm_storeu_si128((__m128i *) &pOut[i], _mm_xor_si128(_mm_unpacklo_epi8(nZero, v), nSign));
+		_mm_storeu_si128((__m128i *) &pOut[i + 8], _mm_xor_si128(_mm_unpackhi_epi8(nZero, v), nSign));
+	}
+	U8ToS16Scalar(&pIn[i], &pOut[i], nSamples - i);
+}
+
+void PCM_SSE2_TARGET CPCMConvert::MonoToStereoSSE2(const SHORT *pIn, PSHORT pOut, DWORD nFrames) {
+	__m128i v;
+	DWORD i;
+
+	for (i = 0; i + 8 <= nFrames; i += 8) {
+		v = _mm_loadu_si128((const __m128i *) &pIn[i]);
+		_mm_storeu_si128((__m128i *) &pOut[2 * i], _mm_unpacklo_epi16(v, v));
+		_mm_storeu_si128((__m128i *) &pOut[2 * i + 8], _mm_unpackhi_epi16(v, v));
+	}
+	MonoToStereoScalar(&pIn[i], &pOut[2 * i], nFrames - i);
+}
+
+void PCM_SSE2_TARGET CPCMConvert::StereoToMonoSSE2(const SHORT *pIn, PSHORT pOut, DWORD nFrames) {
+	const __m128i nOnes = _mm_set1_epi16(1);
+	__m128i nLow, nHigh;
+	DWORD i;
+
+	// Multiply-add by ones sums each left/right pair into 32 bits.
+	for (i = 0; i + 8 <= nFrames; i += 8) {
+		nLow = _mm_srai_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i *) &pIn[2 * i]), nOnes), 1);
+		nHigh = _mm_srai_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i *) &pIn[2 * i + 8]), nOnes), 1);
+		_mm_storeu_si128((__m128i *) &pOut[i], _mm_packs_epi32(nLow, nHigh));
+	}
+	StereoToMonoScalar(&pIn[2 * i], &pOut[i], nFrames - i);
+}
+
+void PCM_SSE2_TARGET CPCMConvert::DeinterleaveSSE2(const SHORT *pIn, PSHORT pLeft, PSHORT pRight, DWORD nFrames) {
+	__m128i a, b;
+	DWORD i;
+
+	// Left is the low half of each 32-bit frame, right the high half; both fit the packing exactly.
+	for (i = 0; i + 8 <= nFrames; i += 8) {
+		a = _mm_loadu_si128((const __m128i *) &pIn[2 * i]);
+		b = _mm_loadu_si128((const __m128i *) &pIn[2 * i + 8]);
+		_mm_storeu_si128((__m128i *) &pLeft[i], _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+			_mm_srai_epi32(_mm_slli_epi32(b, 16), 16)));
+		_mm_storeu_si128((__m128i *) &pRight[i], _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+	}
+	DeinterleaveScalar(&pIn[2 * i], &pLeft[i], &pRight[i], nFrames - i);
+}
+
+void PCM_SSE2_TARGET CPCMConvert::InterleaveSSE2(const SHORT *pLeft, const SHORT *pRight, PSHORT pOut, DWORD nFrames) {
+	__m128i l, r;
+	DWORD i;
+
+	for (i = 0; i + 8 <= nFrames; i += 8) {
+		l = _mm_loadu_si128((const __m128i *) &pLeft[i]);
+		r = _mm_loadu_si128((const __m128i *) &pRight[i]);
+		_mm_storeu_si128((__m128i *) &pOut[2 * i], _mm_unpacklo_epi16(l, r));
+		_mm_storeu_si128((__m128i *) &pOut[2 * i + 8], _mm_unpackhi_epi16(l, r));
+	}
+	InterleaveScalar(&pLeft[i], &pRight[i], &pOut[2 * i], nFrames - i);
+}
+
+// See PCMLimit().
+PCM_SSE2_TARGET inline __m128 PCMLimitSSE2(__m128 fValue, __m128 fKnee, __m128 fRange, __m128 fInvRange) {
+	const __m128 fSign = _mm_set1_ps(-0.0f);
+	__m128 fAbs = _mm_andnot_ps(fSign, fValue), fOver, fOut;
+
+	fOver = _mm_mul_ps(_mm_max_ps(_mm_sub_ps(fAbs, fKnee), _mm_setzero_ps()), fInvRange);
+	fOut = _mm_add_ps(_mm_min_ps(fAbs, fKnee), _mm_mul_ps(fRange, _mm_div_ps(fOver, _mm_add_ps(_mm_set1_ps(1.0f), fOver))));
+	return _mm_or_ps(fOut, _mm_and_ps(fValue, fSign));
+}
+
+void PCM_SSE2_TARGET CPCMConvert::GainSSE2(const SHORT *pIn, PSHORT pOut, DWORD nSamples, float fGain, float fStep, float fKnee) {
+	__m128 fGainV = _mm_set1_ps(fGain), fStepV = _mm_set1_ps(fStep);
+	__m128 fKneeV = _mm_set1_ps(fKnee), fRangeV = _mm_set1_ps(PCMKneeRange(fKnee)), fInvRangeV = _mm_set1_ps(1.0f / PCMKneeRange(fKnee));
+	__m128i nIndex = _mm_setr_epi32(0, 1, 2, 3), v;
+	__m128 fLow, fHigh;
+	DWORD i;
+
+	for (i = 0; i + 8 <= nSamples; i += 8) {
+		v = _mm_loadu_si128((const __m128i *) &pIn[i]);
+		// Sign extended to 32 bits: the word into the high half, shifted back.
+		fLow = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+		fHigh = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+		fLow = _mm_mul_ps(fLow, _mm_add_ps(fGainV, _mm_mul_ps(fStepV, _mm_cvtepi32_ps(nIndex))));
+		nIndex = _mm_add_epi32(nIndex, _mm_set1_epi32(4));
+		fHigh = _mm_mul_ps(fHigh, _mm_add_ps(fGainV, _mm_mul_ps(fStepV, _mm_cvtepi32_ps(nIndex))));
+		nIndex = _mm_add_epi32(nIndex, _mm_set1_epi32(4));
+		_mm_storeu_si128((__m128i *) &pOut[i], PCMToS16SSE2(PCMLimitSSE2(fLow, fKneeV, fRangeV, fInvRangeV),
+			PCMLimitSSE2(fHigh, fKneeV, fRangeV, fInvRangeV), NULL));
+	}
+	PCMGain(pIn, pOut, i, nSamples, fGain, fStep, fKnee);
+}
+
+ULONGLONG PCM_SSE2_TARGET CPCMConvert::SumOfSquaresSSE2(const SHORT *pIn, DWORD nSamples) {
+	__m128i nSum = _mm_setzero_si128(), v;
+	ULONGLONG arrSum[2];
+	DWORD i;
+
+	// A pair of squares fits 32 bits unsigned (at most 2 * 32768^2), so the
+	// pairs are widened to 64 bits with zeros before they are added up.
+	for (i = 0; i + 8 <= nSamples; i += 8) {
+		v = _mm_loadu_si128((const __m128i *) &pIn[i]);
+		v = _mm_madd_epi16(v, v);
+		nSum = _mm_add_epi64(nSum, _mm_unpacklo_epi32(v, _mm_setzero_si128()));
+		nSum = _mm_add_epi64(nSum, _mm_unpackhi_epi32(v, _mm_setzero_si128()));
+	}
+	_mm_storeu_si128((__m128i *) arrSum, nSum);
+	return arrSum[0] + arrSum[1] + SumOfSquaresScalar(&pIn[i], nSamples - i);
+}
+
+float PCM_SSE2_TARGET CPCMConvert::DotSSE2(const FLOAT *pA, const FLOAT *pB, DWORD n) {
+	__m128 fSum0 = _mm_setzero_ps(), fSum1 = _mm_setzero_ps();
+	FLOAT arrSum[4];
+	DWORD i;
+
+	// Two sums, so the additions don't wait for each other.
+	for (i = 0; i + 8 <= n; i += 8) {
+		fSum0 = _mm_add_ps(fSum0, _mm_mul_ps(_mm_loadu_ps(&pA[i]), _mm_loadu_ps(&pB[i])));
+		fSum1 = _mm_add_ps(fSum1, _mm_mul_ps(_mm_loadu_ps(&pA[i + 4]), _mm_loadu_ps(&pB[i + 4])));
+	}
+	_mm_storeu_ps(arrSum, _mm_add_ps(fSum0, fSum1));
+	return (arrSum[0] + arrSum[1]) + (arrSum[2] + arrSum[3]) + DotScalar(&pA[i], &pB[i], n - i);
+}
+
+DWORD PCM_SSE2_TARGET CPCMConvert::ZeroCrossingsSSE2(const SHORT *pIn, DWORD nSamples, WORD nChannels) {
+	const __m128i nOnes = _mm_set1_epi16(1);
+	__m128i nCount = _mm_setzero_si128(), nSigns;
+	LONG arrCount[4];
+	DWORD i;
+
+	// Signs differ where the top bit of x ^ next is set; the shift makes that
+	// -1, multiply-add by ones sums pairs of them into 32 bits.
+	for (i = 0; i + nChannels + 8 <= nSamples; i += 8) {
+		nSigns = _mm_srai_epi16(_mm_xor_si128(_mm_loadu_si128((const __m128i *) &pIn[i]),
+			_mm_loadu_si128((const __m128i *) &pIn[i + nChannels])), 15);
+		nCount = _mm_sub_epi32(nCount, _mm_madd_epi16(nSigns, nOnes));
+	}
+	_mm_storeu_si128((__m128i *) arrCount, nCount);
+	return (DWORD) (arrCount[0] + arrCount[1] + arrCount[2] + arrCount[3]) +
+		ZeroCrossingsScalar(&pIn[i], nSamples - i, nChannels);
+}
+///////////////////////////////////////////////////////////////////////////
+// AVX2 kernels, 16 samples (or frames) per step. 256-bit packs and unpacks
+// work within the 128-bit halves, the permutes put the halves in order.
+
+PCM_AVX2_TARGET inline __m256i PCMXorShiftAVX2(__m256i *pState) {
+	__m256i x = *pState;
+
+	x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+	x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+	*pState = x;
+	return x;
+}
+
+// Eight scaled samples to saturated 16-bit, see PCMToS16().
+PCM_AVX2_TARGET inline __m128i PCMToS16AVX2(__m256 fValue, __m256i *pState) {
+	const __m256 fUnit = _mm256_set1_ps(1.0f / 4294967296.0f);
+	__m256i n;
+
+	if (pState != NULL) {
+		fValue = _mm256_add_ps(fValue, _mm256_mul_ps(_mm256_cvtepi32_ps(PCMXorShiftAVX2(pState)), fUnit));
+		fValue = _mm256_add_ps(fValue, _mm256_mul_ps(_mm256_cvtepi32_ps(PCMXorShiftAVX2(pState)), fUnit));
+	}
+	fValue = _mm256_max_ps(_mm256_min_ps(fValue, _mm256_set1_ps(32767.0f)), _mm256_set1_ps(-32768.0f));
+	n = _mm256_cvtps_epi32(fValue);
+	return _mm_packs_epi32(_mm256_castsi256_si128(n), _mm256_extracti128_si256(n, 1));
+}
+
+void PCM_AVX2_TARGET CPCMConvert::FloatToS16AVX2(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState) {
+	const FLOAT *pSamples = (const FLOAT *) pIn;
+	__m256 fMul = _mm256_set1_ps(fScale);
+	__m256i nState = _mm256_setzero_si256();
+	DWORD i;
+
+	if (pState != NULL) nState = _mm256_loadu_si256((const __m256i *) pState);
+	for (i = 0; i + 8 <= nSamples; i += 8) {
+		_mm_storeu_si128((__m128i *) &pOut[i], PCMToS16AVX2(_mm256_mul_ps(_mm256_loadu_ps(&pSamples[i]), fMul),
+			(pState != NULL) ? &nState : NULL));
+	}
+	if (pState != NULL) _mm256_storeu_si256((__m256i *) pState, nState);
+	FloatToS16Scalar(&pSamples[i], fScale, &pOut[i], nSamples - i, pState);
+}
+
+void PCM_AVX2_TARGET CPCMConvert::S32ToS16AVX2(const void *pIn, float fScale, PSHORT pOut, DWORD nSamples, DWORD *pState) {
+	const LONG *pSamples = (const LONG *) pIn;
+	__m256 fMul = _mm256_set1_ps(fScale);
+	__m256i nState = _mm256_setzero_si256();
+	DWORD i;
+
+	if (pState != NULL) nState = _mm256_loadu_si256((const __m256i *) pState);
+	for (i = 0; i + 8 <= nSamples; i += 8) {
+		_mm_storeu_si128((__m128i *) &pOut[i], PCMToS16AVX2(
+			_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *) &pSamples[i])), fMul),
+			(pState != NULL) ? &nState : NULL));
+	}
+	if (pState != NULL) _mm256_storeu_si256((__m256i *) pState, nState);
+	S32ToS16Scalar(&pSamples[i], fScale, &pOut[i], nSamples - i, pState);
+}
+
+void PCM_AVX2_TARGET CPCMConvert::U8ToS16AVX2(const BYTE *pIn, PSHORT pOut, DWORD nSamples) {
+	const __m256i nSign = _mm256_set1_epi16((short) 0x8000);
+	__m256i v;
+	DWORD i;
+
+	for (i = 0; i + 16 <= nSamples; i += 16) {
+		v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) &pIn[i]));
+		_mm256_storeu_si256((__m256i *) &pOut[i], _mm256_xor_si256(_mm256_slli_epi16(v, 8), nSign));
+	}
+	U8ToS16Scalar(&pIn[i], &pOut[i], nSamples - i);
+}
+
+void PCM_AVX2_TARGET CPCMConvert::MonoToStereoAVX2(const SHORT *pIn, PSHORT pOut, DWORD nFrames) {
+	__m256i v, nLow, nHigh;
+	DWORD i;
+
+	for (i = 0; i + 16 <= nFrames; i += 16) {
+		v = _mm256_loadu_si256((const __m256i *) &pIn[i]);
+		nLow = _mm256_unpacklo_epi16(v, v);
+		nHigh = _mm256_unpackhi_epi16(v, v);
+		_mm256_storeu_si256((__m256i *) &pOut[2 * i], _mm256_permute2x128_si256(nLow, nHigh, 0x20));
+		_mm256_storeu_si256((__m256i *) &pOut[2 * i + 16], _mm256_permute2x128_si256(nLow, nHigh, 0x31));
+	}
+	MonoToStereoScalar(&pIn[i], &pOut[2 * i], nFrames - i);
+}
+
+void PCM_AVX2_TARGET CPCMConvert::StereoToMonoAVX2(const SHORT *pIn, PSHORT pOut, DWORD nFrames) {
+	const __m256i nOnes = _mm256_set1_epi16(1);
+	__m256i nLow, nHigh;
+	DWORD i;
+
+	for (i = 0; i + 16 <= nFrames; i += 16) {
+		nLow = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_loadu_si256((const __m256i *) &pIn[2 * i]), nOnes), 1);
+		nHigh = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_loadu_si256((const __m256i *) &pIn[2 * i + 16]), nOnes), 1);
+		_mm256_storeu_si256((__m256i *) &pOut[i], _mm256_permute4x64_epi64(_mm256_packs_epi32(nLow, nHigh), 0xD8));
+	}
+	StereoToMonoScalar(&pIn[2 * i], &pOut[i], nFrames - i);
+}
+
+void PCM_AVX2_TARGET CPCMConvert::DeinterleaveAVX2(const SHORT *pIn, PSHORT pLeft, PSHORT pRight, DWORD nFrames) {
+	__m256i a, b;
+	DWORD i;
+
+	for (i = 0; i + 16 <= nFrames; i += 16) {
+		a = _mm256_loadu_si256((const __m256i *) &pIn[2 * i]);
+		b = _mm256_loadu_si256((const __m256i *) &pIn[2 * i + 16]);
+		_mm256_storeu_si256((__m256i *) &pLeft[i], _mm256_permute4x64_epi64(_mm256_packs_epi32(
+			_mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16), _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16)), 0xD8));
+		_mm256_storeu_si256((__m256i *) &pRight[i], _mm256_permute4x64_epi64(_mm256_packs_epi32(
+			_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16)), 0xD8));
+	}
+	DeinterleaveScalar(&pIn[2 * i], &pLeft[i], &pRight[i], nFrames - i);
+}
+
+void PCM_AVX2_TARGET CPCMConvert::InterleaveAVX2(const SHORT *pLeft, const SHORT *pRight, PSHORT pOut, DWORD nFrames) {
+	__m256i l, r, nLow, nHigh;
+	DWORD i;
+
+	for (i = 0; i + 16 <= nFrames; i += 16) {
+		l = _mm256_loadu_si256((const __m256i *) &pLeft[i]);
+		r = _mm256_loadu_si256((const __m256i *) &pRight[i]);
+		nLow = _mm256_unpacklo_epi16(l, r);
+		nHigh = _mm256_unpackhi_epi16(l, r);
+		_mm256_storeu_si256((__m256i *) &pOut[2 * i], _mm256_permute2x128_si256(nLow, nHigh, 0x20));
+		_mm256_storeu_si256((__m256i *) &pOut[2 * i + 16], _mm256_permute2x128_si256(nLow, nHigh, 0x31));
+	}
+	InterleaveScalar(&pLeft[i], &pRight[i], &pOut[2 * i], nFrames - i);
+}
+
+// See PCMLimit().
+PCM_AVX2_TARGET inline __m256 PCMLimitAVX2(__m256 fValue, __m256 fKnee, __m256 fRange, __m256 fInvRange) {
+	const __m256 fSign = _mm256_set1_ps(-0.0f);
+	__m256 fAbs = _mm256_andnot_ps(fSign, fValue), fOver, fOut;
+
+	fOver = _mm256_mul_ps(_mm256_max_ps(_mm256_sub_ps(fAbs, fKnee), _mm256_setzero_ps()), fInvRange);
+	fOut = _mm256_add_ps(_mm256_min_ps(fAbs, fKnee),
+		_mm256_mul_ps(fRange, _mm256_div_ps(fOver, _mm256_add_ps(_mm256_set1_ps(1.0f), fOver))));
+	return _mm256_or_ps(fOut, _mm256_and_ps(fValue, fSign));
+}
+
+void PCM_AVX2_TARGET CPCMConvert::GainAVX2(const SHORT *pIn, PSHORT pOut, DWORD nSamples, float fGain, float fStep, float fKnee) {
+	__m256 fGainV = _mm256_set1_ps(fGain), fStepV = _mm256_set1_ps(fStep);
+	__m256 fKneeV = _mm256_set1_ps(fKnee), fRangeV = _mm256_set1_ps(PCMKneeRange(fKnee));
+	__m256 fInvRangeV = _mm256_set1_ps(1.0f / PCMKneeRange(fKnee)), fValue;
+	__m256i nIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	DWORD i;
+
+	// Separate multiply and add (no FMA), so the result is the scalar one to the bit.
+	for (i = 0; i + 8 <= nSamples; i += 8) {
+		fValue = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &pIn[i])));
+		fValue = _mm256_mul_ps(fValue, _mm256_add_ps(fGainV, _mm256_mul_ps(fStepV, _mm256_cvtepi32_ps(nIndex))));
+		nIndex = _mm256_add_epi32(nIndex, _mm256_set1_epi32(8));
+		_mm_storeu_si128((__m128i *) &pOut[i], PCMToS16AVX2(PCMLimitAVX2(fValue, fKneeV, fRangeV, fInvRangeV), NULL));
+	}
+	PCMGain(pIn, pOut, i, nSamples, fGain, fStep, fKnee);
+}
+
+ULONGLONG PCM_AVX2_TARGET CPCMConvert::SumOfSquaresAVX2(const SHORT *pIn, DWORD nSamples) {
+	__m256i nSum = _mm256_setzero_si256(), v;
+	ULONGLONG arrSum[4];
+	DWORD i;
+
+	for (i = 0; i + 16 <= nSamples; i += 16) {
+		v = _mm256_loadu_si256((const __m256i *) &pIn[i]);
+		v = _mm256_madd_epi16(v, v);
+		nSum = _mm256_add_epi64(nSum, _mm256_unpacklo_epi32(v, _mm256_setzero_si256()));
+		nSum = _mm256_add_epi64(nSum, _mm256_unpackhi_epi32(v, _mm256_setzero_si256()));
+	}
+	_mm256_storeu_si256((__m256i *) arrSum, nSum);
+	return arrSum[0] + arrSum[1] + arrSum[2] + arrSum[3] + SumOfSquaresScalar(&pIn[i], nSamples - i);
+}
+
+float PCM_AVX2_TARGET CPCMConvert::DotAVX2(const FLOAT *pA, const FLOAT *pB, DWORD n) {
+	__m256 fSum = _mm256_setzero_ps();
+	__m128 fHalf;
+	FLOAT arrSum[4];
+	DWORD i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		fSum = _mm256_add_ps(fSum, _mm256_mul_ps(_mm256_loadu_ps(&pA[i]), _mm256_loadu_ps(&pB[i])));
+	}
+	fHalf = _mm_add_ps(_mm256_castps256_ps128(fSum), _mm256_extractf128_ps(fSum, 1));
+	_mm_storeu_ps(arrSum, fHalf);
+	return (arrSum[0] + arrSum[1]) + (arrSum[2] + arrSum[3]) + DotScalar(&pA[i], &pB[i], n - i);
+}
+
+DWORD PCM_AVX2_TARGET CPCMConvert::ZeroCrossingsAVX2(const SHORT *pIn, DWORD nSamples, WORD nChannels) {
+	const __m256i nOnes = _mm256_set1_epi16(1);
+	__m256i nCount = _mm256_setzero_si256(), nSigns;
+	LONG arrCount[8];
+	DWORD i;
+
+	for (i = 0; i + nChannels + 16 <= nSamples; i += 16) {
+		nSigns = _mm256_srai_epi16(_mm256_xor_si256(_mm256_loadu_si256((const __m256i *) &pIn[i]),
+			_mm256_loadu_si256((const __m256i *) &pIn[i + nChannels])), 15);
+		nCount = _mm256_sub_epi32(nCount, _mm256_madd_epi16(nSigns, nOnes));
+	}
+	_mm256_storeu_si256((__m256i *) arrCount, nCount);
+	return (DWORD) (arrCount[0] + arrCount[1] + arrCount[2] + arrCount[3] + arrCount[4] + arrCount[5] +
+		arrCount[6] + arrCount[7]) + ZeroCrossingsScalar(&pIn[i], nSamples - i, nChannels);
+}
+#endif
+
+#endif
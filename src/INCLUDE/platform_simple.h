@@ -0,0 +1,102 @@
+#ifndef ___PLATFORM_SIMPLE_H_INCLUDED___
+#define ___PLATFORM_SIMPLE_H_INCLUDED___
+
+// The few Windows types and functions the portable headers (sync, queue,
+// capture, source, file, stats, etc.) are written with, so they also build on
+// POSIX systems (Linux). On Windows this is just <windows.h>.
+
+#ifdef _WIN32
+
+// Sockets (see stream_simple.h) need winsock2.h ahead of windows.h, which
+// would include the old winsock.h otherwise. FD_SETSIZE is the number of
+// sockets select() takes, 64 by default.
+#ifndef FD_SETSIZE
+#define FD_SETSIZE 1024
+#endif
+#include <winsock2.h>
+#include <windows.h>
+
+// printf length modifier for LONGLONG/ULONGLONG, e.g. "%" QFMT_I64 "d".
+#define QFMT_I64 "I64"
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+
+typedef int					BOOL;
+typedef unsigned char		BYTE;
+typedef BYTE				*PBYTE;
+typedef unsigned short		WORD;
+typedef int32_t				LONG;
+typedef uint32_t			ULONG;
+typedef uint32_t			DWORD;
+typedef DWORD				*PDWORD;
+typedef unsigned int		UINT;
+typedef short				SHORT;
+typedef SHORT				*PSHORT;
+typedef long long			LONGLONG;
+typedef unsigned long long	ULONGLONG;
+typedef size_t				SIZE_T;
+typedef uintptr_t			DWORD_PTR;
+typedef char				CHAR;
+typedef char				TCHAR;
+typedef char				*LPSTR;
+typedef const char			*LPCSTR;
+typedef void				*LPVOID;
+typedef void				*PVOID;
+typedef void				*HANDLE;
+typedef int					INT;
+typedef float				FLOAT;
+typedef FLOAT				*PFLOAT;
+
+#define VOID void
+
+#define TRUE 1
+#define FALSE 0
+#define INFINITE 0xFFFFFFFF
+#define MAX_PATH 260
+#define WINAPI
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID lpThreadParameter);
+
+#define ZeroMemory(p, n) memset((p), 0, (n))
+
+inline void Sleep(DWORD dwMilliseconds) { ::usleep((useconds_t) dwMilliseconds * 1000); }
+
+// Memory of the rings and buffers. Same as VirtualAlloc(), it comes zeroed.
+#define MEM_COMMIT 0x1000
+#define MEM_RELEASE 0x8000
+#define PAGE_READWRITE 0x04
+
+inline LPVOID VirtualAlloc(LPVOID, SIZE_T dwSize, DWORD, DWORD) { return ::calloc(1, dwSize); }
+inline BOOL VirtualFree(LPVOID lpAddress, SIZE_T, DWORD) { ::free(lpAddress); return TRUE; }
+
+// Only the fields the portable headers use.
+typedef struct {
+	DWORD	dwPageSize;
+	DWORD	dwAllocationGranularity;
+	DWORD	dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+inline void GetSystemInfo(SYSTEM_INFO *lpSystemInfo) {
+	lpSystemInfo->dwPageSize = (DWORD) ::sysconf(_SC_PAGESIZE);
+	lpSystemInfo->dwAllocationGranularity = lpSystemInfo->dwPageSize;
+	lpSystemInfo->dwNumberOfProcessors = (DWORD) ::sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+inline BOOL DeleteFile(LPCSTR lpFileName) { return ::unlink(lpFileName) == 0; }
+
+#define _snprintf snprintf
+#define _stricmp strcasecmp
+
+#define QFMT_I64 "ll"
+
+#endif
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef ___POOL_SIMPLE_H_INCLUDED___
+#define ___POOL_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <limits.h>
+#include <vector>
+#include <deque>
+#include "INCLUDE/sync_simple.h"
+
+using namespace std;
+
+#define POOL_MAX_THREADS 64
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// See CWorkStealingPool::Submit(IJob *pJob) below.
+// Instances of any class extending "IJob" can be run by the CWorkStealingPool.
+// Pool deletes the job once "Run" returns.
+class IJob {
+public:
+	virtual ~IJob() {};
+
+	// nWorker - index of the worker thread (0 .. CWorkStealingPool::Threads() - 1)
+	// running the job, e.g. to pick per-thread resources.
+	virtual void Run(UINT nWorker) = 0;
+};
+
+class CWorkStealingPool;
+
+// Worker thread of the CWorkStealingPool, with its own queue of jobs.
+class CPoolWorker {
+	friend class CWorkStealingPool;
+private:
+	CWorkStealingPool *m_pPool;
+	UINT		m_nIndex;
+	QThread		m_qThread;
+
+	// Owner takes jobs from the front, thieves from the back.
+	deque<IJob*> m_arrJobs;
+	QMutex		m_qMutex;
+
+	CPoolWorker(CWorkStealingPool *pPool, UINT nIndex): m_qThread(), m_qMutex() {
+		this->m_pPool = pPool;
+		this->m_nIndex = nIndex;
+	};
+	~CPoolWorker() {};
+
+	IJob *PopBack();
+	IJob *PopFront();
+
+	static DWORD WINAPI workerProc(LPVOID arg);
+};
+
+// Implementation of the work-stealing thread pool.
+// Each worker has its own queue, submitted jobs are spread over the queues
+// round-robin. A worker runs the jobs of its own queue in the order they were
+// submitted, and when it runs out of them it steals from the other end of another
+// worker's queue. So workers mostly touch only their own queue, and no worker
+// stays idle while there is any job waiting. Submit the longest jobs first for
+// the best balance.
+class CWorkStealingPool {
+	friend class CPoolWorker;
+private:
+	vector<CPoolWorker*> m_arrWorkers;
+	UINT		m_nNextWorker;
+
+	// Counts jobs in all the queues, a worker waits here for a job.
+	QSemaphore	m_qQueued;
+	volatile LONG m_isStopping;
+
+	// Jobs submitted and not yet finished, and the event set when it drops to zero.
+	volatile LONG m_nPending;
+	QEvent		m_qIdle;
+
+	// Jobs taken from another worker's queue.
+	volatile LONG m_nSteals;
+
+	IJob *Take(UINT nWorker);
+	void Stop();
+
+public:
+	// nThreads - number of workers, zero - one per CPU.
+	CWorkStealingPool(UINT nThreads = 0);
+	~CWorkStealingPool();
+
+	// Queues the job. Pool takes ownership of it.
+	void Submit(IJob *pJob);
+
+	// Waits until all submitted jobs are finished.
+	void Wait();
+
+	UINT Threads() const { return (UINT) this->m_arrWorkers.size(); }
+	LONG GetSteals() { return QAtomicLoad(&this->m_nSteals); }
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+IJob *CPoolWorker::PopBack() {
+	IJob *pJob = NULL;
+
+	this->m_qMutex.Lock();
+	if (!this->m_arrJobs.empty()) {
+		pJob = this->m_arrJobs.back();
+		this->m_arrJobs.pop_back();
+	}
+	this->m_qMutex.Unlock();
+	return pJob;
+}
+
+IJob *CPoolWorker::PopFront() {
+	IJob *pJob = NULL;
+
+	this->m_qMutex.Lock();
+	if (!this->m_arrJobs.empty()) {
+		pJob = this->m_arrJobs.front();
+		this->m_arrJobs.pop_front();
+	}
+	this->m_qMutex.Unlock();
+	return pJob;
+}
+
+DWORD WINAPI CPoolWorker::workerProc(LPVOID arg) {
+	CPoolWorker *_this = (CPoolWorker *) arg;
+	CWorkStealingPool *pPool = _this->m_pPool;
+	IJob *pJob;
+
+	for (;;) {
+		// Each count of the semaphore is one job waiting in some queue.
+		pPool->m_qQueued.Inc();
+		if (QAtomicLoad(&pPool->m_isStopping)) break;
+
+		pJob = pPool->Take(_this->m_nIndex);
+		pJob->Run(_this->m_nIndex);
+		delete pJob;
+
+		if (QAtomicDec(&pPool->m_nPending) == 0) pPool->m_qIdle.Set();
+	}
+	return(0);
+}
+///////////////////////////////////////////////////////////////////////////
+CWorkStealingPool::CWorkStealingPool(UINT nThreads): m_qQueued(LONG_MAX, 0), m_qIdle() {
+	SYSTEM_INFO si;
+	CPoolWorker *pWorker;
+	UINT i;
+
+	this->m_nNextWorker = 0;
+	this->m_isStopping = 0;
+	this->m_nPending = 0;
+	this->m_nSteals = 0;
+
+	if (nThreads == 0) {
+		::GetSystemInfo(&si);
+		nThreads = si.dwNumberOfProcessors;
+	}
+	if (nThreads > POOL_MAX_THREADS) nThreads = POOL_MAX_THREADS;
+
+	try {
+		for (i = 0; i < nThreads; i++) {
+			pWorker = new CPoolWorker(this, i);
+			this->m_arrWorkers.push_back(pWorker);
+			pWorker->m_qThread.Start(&CPoolWorker::workerProc, (LPVOID) pWorker);
+		}
+	}
+	catch (const char *) {
+		this->Stop();
+		throw;
+	}
+}
+
+CWorkStealingPool::~CWorkStealingPool() {
+	this->Stop();
+}
+
+void CWorkStealingPool::Stop() {
+	size_t i;
+
+	QAtomicStore(&this->m_isStopping, 1);
+	this->m_qQueued.Dec((long) this->m_arrWorkers.size());
+
+	for (i = 0; i < this->m_arrWorkers.size(); i++) {
+		this->m_arrWorkers[i]->m_qThread.Join();
+	}
+
+	// Jobs never run are still owned by the pool.
+	for (i = 0; i < this->m_arrWorkers.size(); i++) {
+		while (!this->m_arrWorkers[i]->m_arrJobs.empty()) {
+			delete this->m_arrWorkers[i]->m_arrJobs.back();
+			this->m_arrWorkers[i]->m_arrJobs.pop_back();
+		}
+		delete this->m_arrWorkers[i];
+	}
+	this->m_arrWorkers.clear();
+}
+
+void CWorkStealingPool::Submit(IJob *pJob) {
+	CPoolWorker *pWorker = this->m_arrWorkers[this->m_nNextWorker];
+
+	this->m_nNextWorker = (this->m_nNextWorker + 1) % this->m_arrWorkers.size();
+
+	QAtomicInc(&this->m_nPending);
+
+	pWorker->m_qMutex.Lock();
+	pWorker->m_arrJobs.push_back(pJob);
+	pWorker->m_qMutex.Unlock();
+
+	this->m_qQueued.Dec();
+}
+
+IJob *CWorkStealingPool::Take(UINT nWorker) {
+	UINT nCount = (UINT) this->m_arrWorkers.size();
+	UINT i;
+	IJob *pJob;
+
+	// The semaphore guarantees a job is waiting for us in some queue, although
+	// another thief may take it first, so look until it is found.
+	for (;;) {
+		pJob = this->m_arrWorkers[nWorker]->PopFront();
+		if (pJob != NULL) return pJob;
+
+		for (i = 1; i < nCount; i++) {
+			pJob = this->m_arrWorkers[(nWorker + i) % nCount]->PopBack();
+			if (pJob != NULL) {
+				QAtomicInc(&this->m_nSteals);
+				return pJob;
+			}
+		}
+	}
+}
+
+void CWorkStealingPool::Wait() {
+	// Event may be left set by an earlier drop to zero, so check the counter.
+	while (QAtomicLoad(&this->m_nPending) > 0) this->m_qIdle.Wait();
+}
+
+#endif
@@ -0,0 +1,440 @@
+#ifndef ___PREROLL_SIMPLE_H_INCLUDED___
+#define ___PREROLL_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <stdio.h>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/mp3_simple.h"
+#include "INCLUDE/sink_simple.h"
+
+// Longest MP3 frame (MPEG-1 at 320Kbps and 32000Hz, or MPEG-2 at 160Kbps
+// and 8000Hz, with the padding slot), the ring has room for two more.
+#define PREROLL_FRAME_MAX 1441
+
+// Fewest samples in a frame (MPEG-2/2.5), sizes the table of frames.
+#define PREROLL_FRAME_SAMPLES 576
+
+// Bytes the helper thread copies out of the ring at once, into the dump.
+#define PREROLL_COPY_BLOCK (64 * 1024)
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Frame kept by a CPrerollSink: where it starts (in bytes of the whole
+// stream) and the samples (per channel) it holds.
+struct PREROLL_FRAME {
+	LONGLONG	nStart;
+	DWORD		nSamples;
+};
+
+// Output which keeps only the last few minutes of the encoded sound, in
+// memory, and writes them to a file when asked to ("instant replay").
+//
+// The sound goes into a ring of bytes and its frames into a table, both
+// allocated for the length asked for up front, so ReceiveMP3() never
+// allocates, never touches the disk and holds the lock only for its own copy.
+// The oldest frames make room for new ones. Dump() writes the frames kept
+// (from a frame boundary, so the file plays on its own) into a new
+// CAsyncFileSink, and from then on everything which comes, for a given time
+// or until EndDump().
+//
+// The dump is written (and closed) by a helper thread, started with the
+// sink, straight from the ring. The ring has a second of sound to spare, so
+// the encoder doesn't overwrite what the helper is copying; should it fall
+// that far behind anyway, the dump goes on from the oldest frame left.
+//
+// Dump() and EndDump() may be called from any thread.
+class CPrerollSink: public IMP3Sink {
+private:
+	QMutex		m_qMutex;
+
+	// The ring, holding the last m_dwRingSize bytes of the stream.
+	PBYTE		m_pRing;
+	DWORD		m_dwRingSize;
+	volatile LONGLONG m_nWritten;
+
+	// Frames in the ring, m_nFrames from m_nFirst, and their samples.
+	PREROLL_FRAME *m_pFrames;
+	DWORD		m_nMaxFrames;
+	DWORD		m_nFirst;
+	DWORD		m_nFrames;
+	ULONGLONG	m_nSamples;
+	ULONGLONG	m_nKeepSamples;
+	DWORD		m_dwSampleRate;
+
+	// Position of the next frame header.
+	LONGLONG	m_nNextFrame;
+
+	// The dump being written: how far the stream went into it, where it ends
+	// (-1 - not known yet), and the samples still to go after the trigger
+	// (if counted). m_isOpening - Dump() is creating the file.
+	IMP3Sink	*m_pDump;
+	LONGLONG	m_nDumped;
+	LONGLONG	m_nDumpEnd;
+	LONGLONG	m_nTrigger;
+	ULONGLONG	m_nPostSamples;
+	bool		m_isPostCounted;
+	bool		m_isOpening;
+
+	// Helper thread writing the dump, woken up by m_qWake.
+	QThread		m_qHelper;
+	QEvent		m_qWake;
+	bool		m_isStopping;
+	PBYTE		m_pBlock;
+
+	// Statistics.
+	LONG		m_nDumps;
+	ULONGLONG	m_nDumpedBytes;
+	ULONGLONG	m_nLostBytes;
+	LONG		m_nDroppedFrames;
+
+	// Adds the frames which start in the bytes just written, drops the
+	// oldest ones beyond the ring or the length kept.
+	void ParseFrames();
+	void DropFrame();
+
+	// Start of the oldest frame kept.
+	LONGLONG WindowStart() const;
+
+	// Writes the dump up to where the stream is (or the dump ends), closes it
+	// at its end. Called on the helper thread.
+	void WriteDump();
+
+	static DWORD WINAPI helperProc(LPVOID arg);
+
+public:
+	// nSeconds - sound kept, at least.
+	//
+	// dwBitRate, dwSampleRate - of the MP3 (CBR), to size the ring and the table.
+	//
+	// Throws if the helper thread can't be started.
+	CPrerollSink(UINT nSeconds, DWORD dwBitRate, DWORD dwSampleRate);
+	~CPrerollSink();
+
+	// Keeps the sound, and wakes up the helper if a dump is being written.
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes);
+
+	// Creates pFileName and writes the sound kept into it, then everything
+	// which comes, for nPostSeconds (zero - until EndDump() or Close()).
+	// Returns false (without creating the file) if a dump is being written
+	// already. Throws if the file can't be created.
+	bool Dump(const char *pFileName, UINT nPostSeconds = 0);
+
+	// Ends the dump being written, at the end of the frame coming.
+	void EndDump();
+
+	// True while a dump is being written.
+	bool IsDumping();
+
+	// Ends the dump being written (with whatever came), waits for it to be
+	// closed and stops the helper. Safe to call more than once.
+	virtual void Close();
+
+	// Sound kept right now, in milliseconds.
+	ULONGLONG GetKeptMillis();
+
+	// Prints the sound kept, the memory used and the dumps written.
+	virtual void PrintStats();
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CPrerollSink::CPrerollSink(UINT nSeconds, DWORD dwBitRate, DWORD dwSampleRate): m_qMutex(), m_qHelper(), m_qWake() {
+	this->m_dwSampleRate = (dwSampleRate > 0) ? dwSampleRate : 44100;
+	this->m_nKeepSamples = (ULONGLONG) nSeconds * this->m_dwSampleRate;
+
+	// The frames of nSeconds (CBR), a frame more on each side, and a second
+	// the helper may lag behind.
+	this->m_dwRingSize = (DWORD) ((ULONGLONG) (nSeconds + 1) * dwBitRate * 1000 / 8 + 3 * PREROLL_FRAME_MAX);
+	this->m_nMaxFrames = (DWORD) (this->m_nKeepSamples / PREROLL_FRAME_SAMPLES + 3);
+
+	this->m_pRing = new BYTE[this->m_dwRingSize];
+	this->m_pFrames = new PREROLL_FRAME[this->m_nMaxFrames];
+	this->m_pBlock = new BYTE[PREROLL_COPY_BLOCK];
+
+	this->m_nWritten = 0;
+	this->m_nFirst = 0;
+	this->m_nFrames = 0;
+	this->m_nSamples = 0;
+	this->m_nNextFrame = 0;
+	this->m_pDump = NULL;
+	this->m_nDumped = 0;
+	this->m_nDumpEnd = -1;
+	this->m_nTrigger = 0;
+	this->m_nPostSamples = 0;
+	this->m_isPostCounted = false;
+	this->m_isOpening = false;
+	this->m_isStopping = false;
+	this->m_nDumps = 0;
+	this->m_nDumpedBytes = 0;
+	this->m_nLostBytes = 0;
+	this->m_nDroppedFrames = 0;
+
+	try {
+		this->m_qHelper.Start(&CPrerollSink::helperProc, (LPVOID) this);
+	}
+	catch (const char *) {
+		delete[] this->m_pBlock;
+		delete[] this->m_pFrames;
+		delete[] this->m_pRing;
+		throw;
+	}
+}
+
+CPrerollSink::~CPrerollSink() {
+	this->Close();
+	delete[] this->m_pBlock;
+	delete[] this->m_pFrames;
+	delete[] this->m_pRing;
+}
+
+void CPrerollSink::DropFrame() {
+	this->m_nSamples -= this->m_pFrames[this->m_nFirst].nSamples;
+	this->m_nFirst = (this->m_nFirst + 1) % this->m_nMaxFrames;
+	this->m_nFrames--;
+}
+
+LONGLONG CPrerollSink::WindowStart() const {
+	if (this->m_nFrames > 0) return this->m_pFrames[this->m_nFirst].nStart;
+	return (this->m_nNextFrame < this->m_nWritten) ? this->m_nNextFrame : this->m_nWritten;
+}
+
+void CPrerollSink::ParseFrames() {
+	PREROLL_FRAME *pFrame;
+	BYTE arrHeader[4];
+	DWORD dwLength;
+	int i;
+
+	// Longer than the ring at once, the headers in between are gone.
+	if (this->m_nWritten - this->m_nNextFrame > this->m_dwRingSize) this->m_nNextFrame = this->m_nWritten - this->m_dwRingSize;
+
+	while (this->m_nNextFrame + 4 <= this->m_nWritten) {
+		for (i = 0; i < 4; i++) arrHeader[i] = this->m_pRing[(this->m_nNextFrame + i) % this->m_dwRingSize];
+
+		dwLength = CMP3Frame::Length(arrHeader);
+		if (dwLength == 0) {
+			// Not a frame (e.g. a tag), look one byte further.
+			this->m_nNextFrame++;
+			continue;
+		}
+
+		// After the trigger, the dump ends once the time asked for is there.
+		if ((this->m_pDump != NULL) && this->m_isPostCounted && (this->m_nNextFrame >= this->m_nTrigger) &&
+			(this->m_nDumpEnd < 0)) {
+			if (this->m_nPostSamples == 0) this->m_nDumpEnd = this->m_nNextFrame;
+			else if (this->m_nPostSamples > CMP3Frame::Samples(arrHeader)) this->m_nPostSamples -= CMP3Frame::Samples(arrHeader);
+			else this->m_nPostSamples = 0;
+		}
+
+		if (this->m_nFrames == this->m_nMaxFrames) this->DropFrame();
+		pFrame = &this->m_pFrames[(this->m_nFirst + this->m_nFrames) % this->m_nMaxFrames];
+		pFrame->nStart = this->m_nNextFrame;
+		pFrame->nSamples = CMP3Frame::Samples(arrHeader);
+		this->m_nFrames++;
+		this->m_nSamples += pFrame->nSamples;
+		this->m_nNextFrame += dwLength;
+	}
+
+	// The oldest frames, overwritten or beyond the length kept.
+	while ((this->m_nFrames > 0) && ((this->m_nWritten - this->m_pFrames[this->m_nFirst].nStart > this->m_dwRingSize) ||
+		(this->m_nSamples - this->m_pFrames[this->m_nFirst].nSamples >= this->m_nKeepSamples))) {
+		if (this->m_nWritten - this->m_pFrames[this->m_nFirst].nStart > this->m_dwRingSize) this->m_nDroppedFrames++;
+		this->DropFrame();
+	}
+}
+
+void CPrerollSink::ReceiveMP3(PBYTE pData, DWORD dwBytes) {
+	LONGLONG nWritten;
+	DWORD dwOffset, dwCopy;
+	bool isDumping;
+
+	this->m_qMutex.Lock();
+
+	nWritten = this->m_nWritten;
+	while (dwBytes > 0) {
+		dwOffset = (DWORD) (nWritten % this->m_dwRingSize);
+		dwCopy = this->m_dwRingSize - dwOffset;
+		if (dwCopy > dwBytes) dwCopy = dwBytes;
+
+		memcpy(this->m_pRing + dwOffset, pData, dwCopy);
+		nWritten += dwCopy;
+		pData += dwCopy;
+		dwBytes -= dwCopy;
+	}
+	// Published after the copy, the helper checks what it copied against it.
+	QAtomicStore64(&this->m_nWritten, nWritten);
+	this->ParseFrames();
+	isDumping = (this->m_pDump != NULL);
+
+	this->m_qMutex.Unlock();
+
+	if (isDumping) this->m_qWake.Set();
+}
+
+bool CPrerollSink::Dump(const char *pFileName, UINT nPostSeconds) {
+	IMP3Sink *pDump;
+
+	this->m_qMutex.Lock();
+	if ((this->m_pDump != NULL) || this->m_isOpening || this->m_isStopping) {
+		this->m_qMutex.Unlock();
+		return false;
+	}
+	this->m_isOpening = true;
+	this->m_qMutex.Unlock();
+
+	// Without the lock, creating the file takes a while.
+	try {
+		pDump = new CAsyncFileSink(pFileName);
+	}
+	catch (const char *) {
+		this->m_qMutex.Lock();
+		this->m_isOpening = false;
+		this->m_qMutex.Unlock();
+		throw;
+	}
+	pDump->SetCounters(this->m_pCounters);
+
+	this->m_qMutex.Lock();
+	this->m_isOpening = false;
+	if (this->m_isStopping) {
+		// Closed meanwhile.
+		this->m_qMutex.Unlock();
+		pDump->Close();
+		delete pDump;
+		::DeleteFile(pFileName);
+		return false;
+	}
+
+	this->m_pDump = pDump;
+	this->m_nDumps++;
+	this->m_nTrigger = this->m_nWritten;
+	this->m_nDumpEnd = -1;
+	this->m_isPostCounted = (nPostSeconds > 0);
+	this->m_nPostSamples = (ULONGLONG) nPostSeconds * this->m_dwSampleRate;
+
+	// The sound kept, from its oldest frame. The helper copies it.
+	this->m_nDumped = this->WindowStart();
+	this->m_qMutex.Unlock();
+
+	this->m_qWake.Set();
+	return true;
+}
+
+void CPrerollSink::EndDump() {
+	this->m_qMutex.Lock();
+	if ((this->m_pDump != NULL) && (this->m_nDumpEnd < 0)) {
+		// The frame being received goes in whole.
+		this->m_nDumpEnd = (this->m_nNextFrame > this->m_nDumped) ? this->m_nNextFrame : this->m_nDumped;
+	}
+	this->m_qMutex.Unlock();
+
+	this->m_qWake.Set();
+}
+
+bool CPrerollSink::IsDumping() {
+	bool isDumping;
+
+	this->m_qMutex.Lock();
+	isDumping = (this->m_pDump != NULL) || this->m_isOpening;
+	this->m_qMutex.Unlock();
+	return isDumping;
+}
+
+void CPrerollSink::WriteDump() {
+	IMP3Sink *pDump;
+	LONGLONG nFrom, nEnd;
+	DWORD dwOffset, dwBytes;
+	bool isFinished;
+
+	for (;;) {
+		this->m_qMutex.Lock();
+		pDump = this->m_pDump;
+		nFrom = this->m_nDumped;
+		nEnd = this->m_nWritten;
+		if (this->m_nDumpEnd >= 0) {
+			if (this->m_nDumpEnd < nEnd) nEnd = this->m_nDumpEnd;
+		}
+		// A header not parsed yet may start the frame the dump ends at.
+		else if (this->m_nNextFrame < nEnd) nEnd = this->m_nNextFrame;
+
+		// All of it written.
+		isFinished = (pDump != NULL) && (this->m_nDumpEnd >= 0) && (nFrom >= this->m_nDumpEnd);
+		if (isFinished) this->m_pDump = NULL;
+		this->m_qMutex.Unlock();
+
+		if (pDump == NULL) return;
+		if (isFinished) {
+			pDump->Close();
+			delete pDump;
+			return;
+		}
+		if (nFrom >= nEnd) return;
+
+		// Only the helper moves m_nDumped and drops the dump, the copy needs no lock.
+		dwOffset = (DWORD) (nFrom % this->m_dwRingSize);
+		dwBytes = this->m_dwRingSize - dwOffset;
+		if (dwBytes > PREROLL_COPY_BLOCK) dwBytes = PREROLL_COPY_BLOCK;
+		if (dwBytes > nEnd - nFrom) dwBytes = (DWORD) (nEnd - nFrom);
+		memcpy(this->m_pBlock, this->m_pRing + dwOffset, dwBytes);
+
+		this->m_qMutex.Lock();
+		if (QAtomicLoad64(&this->m_nWritten) - this->m_dwRingSize > nFrom) {
+			// The encoder went round the ring meanwhile, go on from the oldest frame left.
+			this->m_nDumped = this->WindowStart();
+			this->m_nLostBytes += this->m_nDumped - nFrom;
+			this->m_qMutex.Unlock();
+			continue;
+		}
+		this->m_nDumped = nFrom + dwBytes;
+		this->m_nDumpedBytes += dwBytes;
+		this->m_qMutex.Unlock();
+
+		pDump->ReceiveMP3(this->m_pBlock, dwBytes);
+	}
+}
+
+DWORD WINAPI CPrerollSink::helperProc(LPVOID arg) {
+	CPrerollSink *_this = (CPrerollSink *) arg;
+	bool isStopping;
+
+	for (;;) {
+		_this->m_qWake.Wait();
+		_this->WriteDump();
+
+		_this->m_qMutex.Lock();
+		isStopping = _this->m_isStopping && (_this->m_pDump == NULL);
+		_this->m_qMutex.Unlock();
+		if (isStopping) break;
+	}
+	return(0);
+}
+
+void CPrerollSink::Close() {
+	this->m_qMutex.Lock();
+	this->m_isStopping = true;
+	// Nothing more will come, the dump ends with what is there.
+	if ((this->m_pDump != NULL) && ((this->m_nDumpEnd < 0) || (this->m_nDumpEnd > this->m_nWritten))) {
+		this->m_nDumpEnd = this->m_nWritten;
+	}
+	this->m_qMutex.Unlock();
+
+	this->m_qWake.Set();
+	this->m_qHelper.Join();
+}
+
+ULONGLONG CPrerollSink::GetKeptMillis() {
+	ULONGLONG nMillis;
+
+	this->m_qMutex.Lock();
+	nMillis = this->m_nSamples * 1000 / this->m_dwSampleRate;
+	this->m_qMutex.Unlock();
+	return nMillis;
+}
+
+void CPrerollSink::PrintStats() {
+	printf("Pre-roll: %.1f s kept in %u KB (and %u frames), %d dump(s) of %" QFMT_I64 "u bytes (%" QFMT_I64 "u lost), "
+		"%d frame(s) dropped early.\n",
+		this->GetKeptMillis() / 1000.0, this->m_dwRingSize / 1024, this->m_nMaxFrames, this->m_nDumps,
+		this->m_nDumpedBytes, this->m_nLostBytes, this->m_nDroppedFrames);
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef ___QUEUE_SIMPLE_H_INCLUDED___
+#define ___QUEUE_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/capture_simple.h"
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Lock-free ring of fixed size slots, for exactly one producer thread and
+// exactly one consumer thread. Producer fills the slot returned by BeginWrite()
+// and publishes it with EndWrite(). Consumer gets the oldest published slot
+// via BeginRead() and gives it back with EndRead(). Nobody ever waits here,
+// when the ring is full BeginWrite() simply returns NULL.
+class QSPSCRing {
+private:
+	LPSTR	m_pMemory;
+	DWORD	*m_pSlotBytes;
+	DWORD	m_dwSlotSize;
+
+	// Number of slots is always a power of two, so a slot index is
+	// (counter & m_nMask) even when the counters wrap around.
+	LONG	m_nSlots;
+	LONG	m_nMask;
+
+	// Total number of published (m_nHead) and consumed (m_nTail) slots.
+	// m_nHead is changed only by the producer, m_nTail only by the consumer.
+	volatile LONG m_nHead;
+	volatile LONG m_nTail;
+
+public:
+	// nSlots is rounded up to the next power of two.
+	QSPSCRing(LONG nSlots, DWORD dwSlotSize);
+	~QSPSCRing();
+
+	DWORD SlotSize() const { return this->m_dwSlotSize; }
+	LONG Capacity() const { return this->m_nSlots; }
+
+	// Number of published, not yet consumed, slots.
+	LONG Count() { return (LONG) ((ULONG) QAtomicLoad(&this->m_nHead) - (ULONG) QAtomicLoad(&this->m_nTail)); }
+
+	// Producer side. Returns NULL if there is no free slot.
+	LPSTR BeginWrite();
+	void EndWrite(DWORD dwBytes);
+
+	// Consumer side. Returns NULL if there is nothing to read.
+	LPSTR BeginRead(DWORD *pdwBytes);
+	void EndRead();
+};
+
+// IReceiver which decouples processing of the sound from the capture thread.
+// ReceiveBuffer() (called by the CWaveINSimple's thread) only copies the sound
+// into a QSPSCRing and returns, so the WAVEHDR is re-queued to the driver
+// immediately. A dedicated thread drains the ring and passes the sound to the
+// target IReceiver (e.g. the MP3 encoder), so a slow encode or a disk stall
+// doesn't starve the driver anymore.
+//
+// If the target falls behind and the ring gets full, incoming sound is dropped
+// and counted as an overrun (see GetOverruns()), the capture thread is never blocked.
+class CAsyncReceiver: public IReceiver {
+private:
+	IReceiver	*m_pTarget;
+	QSPSCRing	m_qRing;
+	QEvent		m_qDataReady;
+	QThread		m_qThread;
+	volatile LONG m_isStopping;
+
+	// Statistics, updated by the producer and readable from any thread.
+	volatile LONG m_nBuffers;
+	volatile LONG m_nOverruns;
+	volatile LONG m_nDroppedBytes;
+	volatile LONG m_nHighWater;
+
+	// Main procedure of the consumer thread.
+	static DWORD WINAPI consumerProc(LPVOID arg);
+
+	// Passes all published slots to the target.
+	void Drain();
+
+public:
+	// pTarget - IReceiver that will process the sound on the consumer thread.
+	//
+	// nSlots - how many slots the ring has (rounded up to a power of two).
+	//
+	// dwSlotSize - size (in bytes) of each slot, should be a multiple of the sample
+	// frame size (e.g. 4 for 16-bit stereo). Buffers bigger than a slot are spread
+	// over several slots, see CWaveINSimple::CalcBufferLength().
+	CAsyncReceiver(IReceiver *pTarget, LONG nSlots, DWORD dwSlotSize);
+	~CAsyncReceiver();
+
+	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded);
+
+	// Waits until everything queued so far is processed and stops the consumer
+	// thread. Call it after the producer (CWaveINSimple) was stopped.
+	void Stop();
+
+	// Number of buffers received from the capture thread.
+	LONG GetBuffers() { return QAtomicLoad(&this->m_nBuffers); }
+
+	// Number of received buffers which (partially) didn't fit in the ring.
+	LONG GetOverruns() { return QAtomicLoad(&this->m_nOverruns); }
+
+	// Number of bytes lost due to overruns.
+	LONG GetDroppedBytes() { return QAtomicLoad(&this->m_nDroppedBytes); }
+
+	// Max number of slots waiting in the ring at once.
+	LONG GetHighWater() { return QAtomicLoad(&this->m_nHighWater); }
+	LONG GetCapacity() const { return this->m_qRing.Capacity(); }
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+QSPSCRing::QSPSCRing(LONG nSlots, DWORD dwSlotSize) {
+	this->m_nSlots = 1;
+	while (this->m_nSlots < nSlots) this->m_nSlots <<= 1;
+	this->m_nMask = this->m_nSlots - 1;
+	this->m_dwSlotSize = dwSlotSize;
+	this->m_nHead = this->m_nTail = 0;
+
+	this->m_pMemory = (LPSTR) VirtualAlloc(0, this->m_nSlots * dwSlotSize, MEM_COMMIT, PAGE_READWRITE);
+	if (this->m_pMemory == NULL) throw "Can't allocate memory for the ring.";
+	this->m_pSlotBytes = new DWORD[this->m_nSlots];
+}
+
+QSPSCRing::~QSPSCRing() {
+	delete[] this->m_pSlotBytes;
+	VirtualFree(this->m_pMemory, 0, MEM_RELEASE);
+}
+
+LPSTR QSPSCRing::BeginWrite() {
+	LONG nHead = this->m_nHead;
+
+	if ((ULONG) nHead - (ULONG) QAtomicLoad(&this->m_nTail) >= (ULONG) this->m_nSlots) return NULL;
+	return this->m_pMemory + (nHead & this->m_nMask) * this->m_dwSlotSize;
+}
+
+void QSPSCRing::EndWrite(DWORD dwBytes) {
+	LONG nHead = this->m_nHead;
+
+	this->m_pSlotBytes[nHead & this->m_nMask] = dwBytes;
+	// Publish the slot, consumer sees its content once it sees the new head.
+	QAtomicStore(&this->m_nHead, (LONG) ((ULONG) nHead + 1));
+}
+
+LPSTR QSPSCRing::BeginRead(DWORD *pdwBytes) {
+	LONG nTail = this->m_nTail;
+
+	if (QAtomicLoad(&this->m_nHead) == nTail) return NULL;
+	*pdwBytes = this->m_pSlotBytes[nTail & this->m_nMask];
+	return this->m_pMemory + (nTail & this->m_nMask) * this->m_dwSlotSize;
+}
+
+void QSPSCRing::EndRead() {
+	// Give the slot back to the producer.
+	QAtomicStore(&this->m_nTail, (LONG) ((ULONG) this->m_nTail + 1));
+}
+///////////////////////////////////////////////////////////////////////////
+CAsyncReceiver::CAsyncReceiver(IReceiver *pTarget, LONG nSlots, DWORD dwSlotSize):
+		m_qRing(nSlots, dwSlotSize), m_qDataReady(), m_qThread() {
+	this->m_pTarget = pTarget;
+	this->m_isStopping = 0;
+	this->m_nBuffers = 0;
+	this->m_nOverruns = 0;
+	this->m_nDroppedBytes = 0;
+	this->m_nHighWater = 0;
+
+	this->m_qThread.Start(&CAsyncReceiver::consumerProc, (LPVOID) this);
+}
+
+CAsyncReceiver::~CAsyncReceiver() {
+	this->Stop();
+}
+
+void CAsyncReceiver::Stop() {
+	if (this->m_qThread.IsStarted()) {
+		QAtomicStore(&this->m_isStopping, 1);
+		this->m_qDataReady.Set();
+		this->m_qThread.Join();
+	}
+}
+
+void CAsyncReceiver::ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) {
+	LPSTR pSlot;
+	DWORD dwBytes;
+	LONG nCount;
+
+	QAtomicInc(&this->m_nBuffers);
+
+	while (dwBytesRecorded > 0) {
+		pSlot = this->m_qRing.BeginWrite();
+		if (pSlot == NULL) {
+			// Consumer fell behind, drop what is left.
+			QAtomicInc(&this->m_nOverruns);
+			QAtomicAdd(&this->m_nDroppedBytes, (LONG) dwBytesRecorded);
+			break;
+		}
+
+		dwBytes = (dwBytesRecorded < this->m_qRing.SlotSize()) ? dwBytesRecorded : this->m_qRing.SlotSize();
+		memcpy(pSlot, lpData, dwBytes);
+		this->m_qRing.EndWrite(dwBytes);
+
+		lpData += dwBytes;
+		dwBytesRecorded -= dwBytes;
+	}
+
+	// Only the producer updates the high-water mark, so no CAS loop is needed.
+	nCount = this->m_qRing.Count();
+	if (nCount > this->m_nHighWater) QAtomicStore(&this->m_nHighWater, nCount);
+
+	this->m_qDataReady.Set();
+}
+
+void CAsyncReceiver::Drain() {
+	LPSTR pSlot;
+	DWORD dwBytes;
+
+	while ((pSlot = this->m_qRing.BeginRead(&dwBytes)) != NULL) {
+		if (this->m_pTarget != NULL) this->m_pTarget->ReceiveBuffer(pSlot, dwBytes);
+		this->m_qRing.EndRead();
+	}
+}
+
+DWORD WINAPI CAsyncReceiver::consumerProc(LPVOID arg) {
+	CAsyncReceiver *_this = (CAsyncReceiver *) arg;
+	LONG isStopping;
+
+	for (;;) {
+		// Read the flag before draining, so everything queued before
+		// Stop() was called is still passed to the target.
+		isStopping = QAtomicLoad(&_this->m_isStopping);
+		_this->Drain();
+		if (isStopping) break;
+
+		_this->m_qDataReady.Wait();
+	}
+	return(0);
+}
+
+#endif
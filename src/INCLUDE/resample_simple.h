@@ -0,0 +1,376 @@
+#ifndef ___RESAMPLE_SIMPLE_H_INCLUDED___
+#define ___RESAMPLE_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <math.h>
+#include <vector>
+#include "INCLUDE/capture_simple.h"
+#include "INCLUDE/pcm_simple.h"
+
+using namespace std;
+
+// Qualities of the CResampler, from the cheapest.
+#define RESAMPLE_FAST 0
+#define RESAMPLE_MEDIUM 1
+#define RESAMPLE_BEST 2
+#define RESAMPLE_QUALITIES 3
+
+// Most phases (output rate / GCD of the rates) the filter table is built for,
+// e.g. 44100 -> 32000 takes 320, 22050 -> 32000 takes 640.
+#define RESAMPLE_MAX_PHASES 1024
+
+// Input frames converted at a time.
+#define RESAMPLE_CHUNK 1024
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Polyphase sample rate converter for interleaved 16-bit sound, so the
+// encoder can be given the rate it encodes at (instead of asking LAME to
+// re-sample, see CMP3Simple's nOutSampleRate) and the capture can run at any rate.
+//
+// The output is the input band-limited by a Kaiser windowed sinc and taken
+// at the output rate; for each output sample one phase of the filter (a set
+// of taps) is run over the input around it, with CPCMConvert::Dot(). The
+// quality sets how much of the band passes and how far down the rest is,
+// from the lower Nyquist frequency on; the taps (so the cost per output
+// sample and channel) follow from them and from the rates. Measured at
+// 44100 -> 32000Hz:
+//
+//	RESAMPLE_FAST	passes up to 75% of the lower Nyquist frequency (+-0.06 dB), 44 dB down above it, 32 taps.
+//	RESAMPLE_MEDIUM	85% (+-0.01 dB), 72 dB, 88 taps.
+//	RESAMPLE_BEST	90% (+-0.01 dB), 85 dB (the 16 bits' own noise), 176 taps.
+//
+// The sound is delayed by half the taps (input frames), see Flush(). Results
+// are reduced to 16 bits with dither (see CPCMDither).
+class CResampler {
+private:
+	DWORD	m_nInRate;
+	DWORD	m_nOutRate;
+	WORD	m_nChannels;
+	int		m_nQuality;
+
+	// The rates' ratio is m_nPhases / m_nStep (reduced), m_nTaps per phase.
+	DWORD	m_nPhases;
+	DWORD	m_nStep;
+	DWORD	m_nTaps;
+	vector<FLOAT> m_arrTaps;
+
+	// Input, as floats, one plane of m_nStride frames per channel: the frames
+	// the next outputs still need, and the chunk being converted.
+	vector<FLOAT> m_arrHistory;
+	DWORD	m_nStride;
+	DWORD	m_nCount;
+
+	// Input frame (in the history) and phase of the next output.
+	DWORD	m_nPosition;
+	DWORD	m_nPhase;
+
+	// Outputs of one chunk, interleaved, before they are reduced to 16 bits.
+	vector<FLOAT> m_arrOut;
+	CPCMDither m_Dither;
+
+	// Sound passed as it is, up to this frequency (Hz).
+	DWORD	m_nPassBand;
+
+	// Sizes and fills the table of taps: the sound passes up to dPassBand of
+	// the lower Nyquist frequency, and is dStopDB down from that frequency on.
+	void Design(double dPassBand, double dStopDB);
+
+	// Process() into pOut, or (pOut NULL) ProcessPlanar() into pLeft and pRight.
+	DWORD Run(const SHORT *pIn, DWORD nInFrames, PSHORT pOut, PFLOAT pLeft, PFLOAT pRight);
+
+	static double BesselI0(double x);
+
+public:
+	// nInRate, nOutRate - the rates (Hz). Throws if their ratio needs more than
+	// RESAMPLE_MAX_PHASES phases.
+	//
+	// nChannels - channels of the (interleaved) sound.
+	//
+	// nQuality - RESAMPLE_XXXX.
+	CResampler(DWORD nInRate, DWORD nOutRate, WORD nChannels, int nQuality = RESAMPLE_MEDIUM);
+	~CResampler() {};
+
+	// Returns the most frames Process() makes out of nInFrames, the size of its pOut (times the channels).
+	DWORD MaxOutFrames(DWORD nInFrames) const;
+
+	// Converts nInFrames frames, writes the frames ready into pOut and returns
+	// their number. Frames near the end of the input come out with the next call.
+	DWORD Process(const SHORT *pIn, DWORD nInFrames, PSHORT pOut);
+
+	// The same, for an encoder taking float sound (see the float
+	// CMP3Simple::Encode): the frames are written into a plane per channel (the
+	// sound must be mono or stereo, pRight isn't used for mono) as floats in
+	// the 16 bits range, without dither.
+	DWORD ProcessPlanar(const SHORT *pIn, DWORD nInFrames, PFLOAT pLeft, PFLOAT pRight);
+
+	// Writes the frames still held back (for the input's last frames) into
+	// pOut, at most MaxOutFrames(0). Call it once, after the last Process().
+	DWORD Flush(PSHORT pOut);
+	DWORD FlushPlanar(PFLOAT pLeft, PFLOAT pRight);
+
+	// Forgets the input so far, to convert another, unrelated, sound.
+	void Reset();
+
+	DWORD InRate() const { return this->m_nInRate; };
+	DWORD OutRate() const { return this->m_nOutRate; };
+	WORD Channels() const { return this->m_nChannels; };
+	int Quality() const { return this->m_nQuality; };
+	DWORD Taps() const { return this->m_nTaps; };
+	DWORD PassBand() const { return this->m_nPassBand; };
+
+	// Name of the RESAMPLE_XXXX quality ("fast", "medium", "best"), and back (-1 if unknown).
+	static const char *QualityName(int nQuality);
+	static int ParseQuality(const char *pName);
+};
+///////////////////////////////////////////////////////////////////////////
+// IReceiver which converts the sound to another rate (see CResampler) before
+// passing it to the target IReceiver (e.g. mp3Writer encoding at that rate).
+// The target receives the converted sound in the receiver's own buffer, so it
+// should process it before returning, as mp3Writer does.
+class CResampleReceiver: public IReceiver {
+private:
+	IReceiver	*m_pTarget;
+	CResampler	m_Resampler;
+	vector<SHORT> m_arrSamples;
+
+public:
+	// pTarget - IReceiver that will receive the converted sound.
+	//
+	// nInRate, nOutRate, nChannels, nQuality - see CResampler.
+	CResampleReceiver(IReceiver *pTarget, DWORD nInRate, DWORD nOutRate, WORD nChannels, int nQuality = RESAMPLE_MEDIUM);
+	~CResampleReceiver() {};
+
+	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded);
+
+	// Passes the last frames on, call it after the capture was stopped (and
+	// before the target is closed).
+	void Flush();
+
+	CResampler &GetResampler() { return this->m_Resampler; };
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CResampler::CResampler(DWORD nInRate, DWORD nOutRate, WORD nChannels, int nQuality) {
+	static const double arrPassBand[RESAMPLE_QUALITIES] = {0.75, 0.85, 0.90};
+	static const double arrStopDB[RESAMPLE_QUALITIES] = {45.0, 70.0, 96.0};
+	DWORD a, b, t;
+
+	if ((nInRate == 0) || (nOutRate == 0) || (nChannels == 0)) throw "Wrong format for the resampler.";
+	if ((nQuality < RESAMPLE_FAST) || (nQuality >= RESAMPLE_QUALITIES)) nQuality = RESAMPLE_MEDIUM;
+
+	// Ratio reduced by the greatest common divisor.
+	a = nInRate;
+	b = nOutRate;
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	this->m_nPhases = nOutRate / a;
+	this->m_nStep = nInRate / a;
+	if (this->m_nPhases > RESAMPLE_MAX_PHASES) throw "Sample rates not supported by the resampler.";
+
+	this->m_nInRate = nInRate;
+	this->m_nOutRate = nOutRate;
+	this->m_nChannels = nChannels;
+	this->m_nQuality = nQuality;
+	this->Design(arrPassBand[nQuality], arrStopDB[nQuality]);
+
+	// Memory for the whole life of the resampler, Process() doesn't allocate.
+	this->m_nStride = this->m_nTaps + RESAMPLE_CHUNK;
+	this->m_arrHistory.resize(this->m_nStride * nChannels);
+	this->m_arrOut.resize(this->MaxOutFrames(RESAMPLE_CHUNK) * nChannels);
+	this->Reset();
+}
+
+double CResampler::BesselI0(double x) {
+	double dSum = 1.0, dTerm = 1.0;
+	int k;
+
+	// Power series, converges fast for the betas used.
+	for (k = 1; k < 50; k++) {
+		dTerm *= (x / (2.0 * k)) * (x / (2.0 * k));
+		dSum += dTerm;
+		if (dTerm < dSum * 1e-12) break;
+	}
+	return dSum;
+}
+
+void CResampler::Design(double dPassBand, double dStopDB) {
+	double dNyquist, dCutoff, dBeta, dHalf, dT, dR, dTap, dSum;
+	DWORD p, j;
+
+	// The lower of the two Nyquist frequencies, in cycles per input sample. The
+	// transition band lies between the pass band and it, so nothing above the
+	// output's Nyquist frequency is left to alias back. The cutoff (-6 dB) is
+	// in its middle.
+	dNyquist = 0.5;
+	if (this->m_nOutRate < this->m_nInRate) dNyquist = dNyquist * this->m_nOutRate / this->m_nInRate;
+	dCutoff = dNyquist * (1.0 + dPassBand) / 2.0;
+	this->m_nPassBand = (DWORD) (dPassBand * dNyquist * this->m_nInRate);
+
+	// Kaiser's estimates of the window's beta and the taps the attenuation
+	// takes over that transition band, rounded up to a multiple of 8 (see
+	// CPCMConvert::Dot()).
+	if (dStopDB > 50.0) dBeta = 0.1102 * (dStopDB - 8.7);
+	else dBeta = 0.5842 * pow(dStopDB - 21.0, 0.4) + 0.07886 * (dStopDB - 21.0);
+	this->m_nTaps = (DWORD) ceil((dStopDB - 7.95) / (14.36 * dNyquist * (1.0 - dPassBand))) + 1;
+	this->m_nTaps = (this->m_nTaps + 7) & ~7;
+	dHalf = this->m_nTaps / 2.0;
+
+	this->m_arrTaps.resize(this->m_nPhases * this->m_nTaps);
+	for (p = 0; p < this->m_nPhases; p++) {
+		dSum = 0.0;
+		for (j = 0; j < this->m_nTaps; j++) {
+			// Tap j is input frame i - taps / 2 + 1 + j for the output at i + p / phases.
+			dT = (double) j - dHalf + 1.0 - (double) p / this->m_nPhases;
+			dTap = 2.0 * dCutoff;
+			if (dT != 0.0) dTap = sin(2.0 * 3.14159265358979323846 * dCutoff * dT) / (3.14159265358979323846 * dT);
+			dR = dT / dHalf;
+			dTap *= BesselI0(dBeta * sqrt((dR * dR < 1.0) ? 1.0 - dR * dR : 0.0)) / BesselI0(dBeta);
+			this->m_arrTaps[p * this->m_nTaps + j] = (FLOAT) dTap;
+			dSum += dTap;
+		}
+
+		// Every phase passes DC as it is.
+		for (j = 0; j < this->m_nTaps; j++) this->m_arrTaps[p * this->m_nTaps + j] /= (FLOAT) dSum;
+	}
+}
+
+void CResampler::Reset() {
+	// Silence before the first frame, so the first output is centred on it.
+	ZeroMemory(&this->m_arrHistory[0], this->m_arrHistory.size() * sizeof(FLOAT));
+	this->m_nCount = this->m_nTaps / 2 - 1;
+	this->m_nPosition = this->m_nCount;
+	this->m_nPhase = 0;
+	this->m_Dither.Seed(1);
+}
+
+DWORD CResampler::MaxOutFrames(DWORD nInFrames) const {
+	return (DWORD) (((ULONGLONG) nInFrames + this->m_nTaps) * this->m_nPhases / this->m_nStep + 2);
+}
+
+DWORD CResampler::Process(const SHORT *pIn, DWORD nInFrames, PSHORT pOut) {
+	return this->Run(pIn, nInFrames, pOut, NULL, NULL);
+}
+
+DWORD CResampler::ProcessPlanar(const SHORT *pIn, DWORD nInFrames, PFLOAT pLeft, PFLOAT pRight) {
+	return this->Run(pIn, nInFrames, NULL, pLeft, pRight);
+}
+
+DWORD CResampler::Run(const SHORT *pIn, DWORD nInFrames, PSHORT pOut, PFLOAT pLeft, PFLOAT pRight) {
+	DWORD nHalf = this->m_nTaps / 2, nChunk, nOut, nTotal = 0, nDrop, i;
+	FLOAT *pPlane;
+	const FLOAT *pTaps;
+	FLOAT fValue;
+	WORD c;
+
+	while (nInFrames > 0) {
+		nChunk = (nInFrames < RESAMPLE_CHUNK) ? nInFrames : RESAMPLE_CHUNK;
+
+		// Split into the planes, scaled to -1.0 .. 1.0.
+		for (c = 0; c < this->m_nChannels; c++) {
+			pPlane = &this->m_arrHistory[c * this->m_nStride + this->m_nCount];
+			for (i = 0; i < nChunk; i++) pPlane[i] = pIn[i * this->m_nChannels + c] * (1.0f / 32768.0f);
+		}
+		this->m_nCount += nChunk;
+		pIn += nChunk * this->m_nChannels;
+		nInFrames -= nChunk;
+
+		// Every output whose taps are all in.
+		nOut = 0;
+		while (this->m_nPosition + nHalf < this->m_nCount) {
+			pTaps = &this->m_arrTaps[this->m_nPhase * this->m_nTaps];
+			for (c = 0; c < this->m_nChannels; c++) {
+				fValue = CPCMConvert::Dot(&this->m_arrHistory[c * this->m_nStride + this->m_nPosition + 1 - nHalf],
+					pTaps, this->m_nTaps);
+				if (pOut != NULL) this->m_arrOut[nOut * this->m_nChannels + c] = fValue;
+				else ((c == 0) ? pLeft : pRight)[nTotal + nOut] = fValue * 32768.0f;
+			}
+			nOut++;
+
+			this->m_nPhase += this->m_nStep;
+			this->m_nPosition += this->m_nPhase / this->m_nPhases;
+			this->m_nPhase %= this->m_nPhases;
+		}
+		if (pOut != NULL) {
+			CPCMConvert::FloatToS16(&this->m_arrOut[0], pOut, nOut * this->m_nChannels, &this->m_Dither);
+			pOut += nOut * this->m_nChannels;
+		}
+		nTotal += nOut;
+
+		// Only the frames the next outputs need are kept.
+		nDrop = this->m_nPosition + 1 - nHalf;
+		if (nDrop > this->m_nCount) nDrop = this->m_nCount;
+		for (c = 0; c < this->m_nChannels; c++) {
+			pPlane = &this->m_arrHistory[c * this->m_nStride];
+			memmove(pPlane, pPlane + nDrop, (this->m_nCount - nDrop) * sizeof(FLOAT));
+		}
+		this->m_nCount -= nDrop;
+		this->m_nPosition -= nDrop;
+	}
+	return nTotal;
+}
+
+DWORD CResampler::Flush(PSHORT pOut) {
+	vector<SHORT> arrSilence(this->m_nTaps / 2 * this->m_nChannels, 0);
+
+	// Silence after the last frame brings out the outputs waiting for it.
+	return this->Process(&arrSilence[0], this->m_nTaps / 2, pOut);
+}
+
+DWORD CResampler::FlushPlanar(PFLOAT pLeft, PFLOAT pRight) {
+	vector<SHORT> arrSilence(this->m_nTaps / 2 * this->m_nChannels, 0);
+
+	return this->ProcessPlanar(&arrSilence[0], this->m_nTaps / 2, pLeft, pRight);
+}
+
+const char *CResampler::QualityName(int nQuality) {
+	switch (nQuality) {
+	case RESAMPLE_FAST: return "fast";
+	case RESAMPLE_BEST: return "best";
+	}
+	return "medium";
+}
+
+int CResampler::ParseQuality(const char *pName) {
+	int nQuality;
+
+	for (nQuality = RESAMPLE_FAST; nQuality < RESAMPLE_QUALITIES; nQuality++) {
+		if (::strcmp(pName, QualityName(nQuality)) == 0) return nQuality;
+	}
+	return -1;
+}
+///////////////////////////////////////////////////////////////////////////
+CResampleReceiver::CResampleReceiver(IReceiver *pTarget, DWORD nInRate, DWORD nOutRate, WORD nChannels, int nQuality):
+		m_Resampler(nInRate, nOutRate, nChannels, nQuality) {
+	this->m_pTarget = pTarget;
+}
+
+void CResampleReceiver::ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) {
+	DWORD nChannels = this->m_Resampler.Channels();
+	DWORD nFrames = dwBytesRecorded / (2 * nChannels);
+
+	if (this->m_arrSamples.size() < this->m_Resampler.MaxOutFrames(nFrames) * nChannels) {
+		this->m_arrSamples.resize(this->m_Resampler.MaxOutFrames(nFrames) * nChannels);
+	}
+
+	nFrames = this->m_Resampler.Process((const SHORT *) lpData, nFrames, &this->m_arrSamples[0]);
+	if (nFrames > 0) this->m_pTarget->ReceiveBuffer((LPSTR) &this->m_arrSamples[0], nFrames * 2 * nChannels);
+}
+
+void CResampleReceiver::Flush() {
+	DWORD nChannels = this->m_Resampler.Channels();
+	DWORD nFrames;
+
+	if (this->m_arrSamples.size() < this->m_Resampler.MaxOutFrames(0) * nChannels) {
+		this->m_arrSamples.resize(this->m_Resampler.MaxOutFrames(0) * nChannels);
+	}
+
+	nFrames = this->m_Resampler.Flush(&this->m_arrSamples[0]);
+	if (nFrames > 0) this->m_pTarget->ReceiveBuffer((LPSTR) &this->m_arrSamples[0], nFrames * 2 * nChannels);
+}
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef ___ROTATE_SIMPLE_H_INCLUDED___
+#define ___ROTATE_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <stdio.h>
+#include <string>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/mp3_simple.h"
+#include "INCLUDE/sink_simple.h"
+#include "INCLUDE/index_simple.h"
+
+using namespace std;
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Output which splits one continuous MP3 stream into a sequence of files
+// (segments), e.g. one per hour, while the capture and the encoder keep running.
+//
+// Segments are cut on MP3 frame boundaries, and since CMP3Simple encodes
+// without the bit reservoir every frame is independent, so each file plays
+// on its own and the segments joined back give exactly the original stream.
+// The length of a segment is counted in sound (frames), not in wall time.
+//
+// The next file is always opened ahead, on a helper thread, which also
+// closes (and flushes) the previous one. Rotation itself only swaps pointers.
+class CRotatingSink: public IMP3Sink {
+private:
+	// Pattern of the file names, with one %u for the segment number.
+	string		m_strPattern;
+	UINT		m_nNextIndex;
+
+	// Limits of a segment, zero - no limit.
+	LONGLONG	m_nSegmentMicros;
+	ULONGLONG	m_nSegmentBytes;
+
+	// Settings of the segments' sinks, see CAsyncFileSink, CMappedFileSink
+	// and CIndexingSink (zero - segments aren't indexed).
+	DWORD		m_dwSyncMillis;
+	bool		m_isMapped;
+	DWORD		m_dwIndexMillis;
+
+	// Segment being written and its length so far.
+	IMP3Sink	*m_pCurrent;
+	LONGLONG	m_nCurrentMicros;
+	ULONGLONG	m_nCurrentBytes;
+
+	// Helper thread, opens m_pNext (named m_strNextName) and closes m_pRetired.
+	QThread		m_qHelper;
+	IMP3Sink	*m_pNext;
+	string		m_strNextName;
+	IMP3Sink	*m_pRetired;
+
+	// Frame parsing: bytes of the current frame still to come, and the start
+	// of a frame header split between two ReceiveMP3 calls.
+	DWORD		m_dwInFrame;
+	BYTE		m_arrCarry[4];
+	DWORD		m_dwCarry;
+
+	// Statistics.
+	LONG		m_nSegments;
+	LONG		m_nOpenErrors;
+	LONGLONG	m_nMaxRotateMicros;
+
+	IMP3Sink *CreateSink(const char *pFileName);
+	string NextName();
+
+	// Starts the helper thread (open the next file, close the retired one).
+	void Prepare();
+
+	// Switches to the prepared file, if it is ready.
+	void Rotate();
+
+	// Passes bytes to the current segment.
+	void Write(const BYTE *pData, DWORD dwBytes);
+
+	static DWORD WINAPI helperProc(LPVOID arg);
+
+public:
+	// pPattern - file names, printf-like with one %u (segment number, from 1),
+	// e.g. "music_%04u.mp3".
+	//
+	// nSegmentSeconds, nSegmentMBytes - a segment is cut when it reaches
+	// either of the limits (zero - no limit).
+	//
+	// dwSyncMillis, isMapped - how the segments are written, see mp3Writer.
+	//
+	// dwIndexMillis - if not zero, each segment gets its own index (the
+	// file's name with INDEX_EXTENSION), see CIndexingSink.
+	//
+	// Throws if the first file can't be created.
+	CRotatingSink(const char *pPattern, UINT nSegmentSeconds, UINT nSegmentMBytes,
+		DWORD dwSyncMillis = 0, bool isMapped = false, DWORD dwIndexMillis = 0);
+	~CRotatingSink();
+
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes);
+
+	// Closes the current segment (and removes the file prepared for the next one).
+	virtual void Close();
+
+	// Passed on to every segment.
+	virtual void SetCounters(CStreamCounters *pCounters);
+
+	// Prints number of segments and how long the longest rotation took.
+	virtual void PrintStats();
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CRotatingSink::CRotatingSink(const char *pPattern, UINT nSegmentSeconds, UINT nSegmentMBytes,
+							 DWORD dwSyncMillis, bool isMapped, DWORD dwIndexMillis): m_strPattern(pPattern), m_qHelper() {
+	this->m_nNextIndex = 1;
+	this->m_nSegmentMicros = (LONGLONG) nSegmentSeconds * 1000000;
+	this->m_nSegmentBytes = (ULONGLONG) nSegmentMBytes * 1024 * 1024;
+	this->m_dwSyncMillis = dwSyncMillis;
+	this->m_isMapped = isMapped;
+	this->m_dwIndexMillis = dwIndexMillis;
+	this->m_nCurrentMicros = 0;
+	this->m_nCurrentBytes = 0;
+	this->m_pNext = NULL;
+	this->m_pRetired = NULL;
+	this->m_dwInFrame = 0;
+	this->m_dwCarry = 0;
+	this->m_nSegments = 1;
+	this->m_nOpenErrors = 0;
+	this->m_nMaxRotateMicros = 0;
+
+	// The first file is opened right away, so errors are reported to the caller.
+	this->m_pCurrent = this->CreateSink(this->NextName().c_str());
+	this->Prepare();
+}
+
+CRotatingSink::~CRotatingSink() {
+	this->Close();
+}
+
+IMP3Sink *CRotatingSink::CreateSink(const char *pFileName) {
+	IMP3Sink *pSink;
+
+	if (this->m_isMapped) pSink = new CMappedFileSink(pFileName);
+	else pSink = new CAsyncFileSink(pFileName, SINK_BLOCK_SIZE, this->m_dwSyncMillis);
+	if (this->m_dwIndexMillis > 0) pSink = new CIndexingSink(pSink, (string(pFileName) + INDEX_EXTENSION).c_str(), this->m_dwIndexMillis);
+	else ::DeleteFile((string(pFileName) + INDEX_EXTENSION).c_str());
+	pSink->SetCounters(this->m_pCounters);
+	return pSink;
+}
+
+void CRotatingSink::SetCounters(CStreamCounters *pCounters) {
+	// The helper may be opening the next segment right now.
+	this->m_qHelper.Join();
+	this->m_pCounters = pCounters;
+	if (this->m_pCurrent != NULL) this->m_pCurrent->SetCounters(pCounters);
+	if (this->m_pNext != NULL) this->m_pNext->SetCounters(pCounters);
+}
+
+string CRotatingSink::NextName() {
+	char szName[MAX_PATH];
+
+	_snprintf(szName, MAX_PATH - 1, this->m_strPattern.c_str(), this->m_nNextIndex++);
+	szName[MAX_PATH - 1] = 0;
+	return string(szName);
+}
+
+DWORD WINAPI CRotatingSink::helperProc(LPVOID arg) {
+	CRotatingSink *_this = (CRotatingSink *) arg;
+
+	if (_this->m_pRetired != NULL) {
+		_this->m_pRetired->Close();
+		delete _this->m_pRetired;
+		_this->m_pRetired = NULL;
+	}
+
+	try {
+		_this->m_pNext = _this->CreateSink(_this->m_strNextName.c_str());
+	}
+	catch (const char *) {
+		// Current segment simply goes on, see Rotate().
+		_this->m_pNext = NULL;
+	}
+	return(0);
+}
+
+void CRotatingSink::Prepare() {
+	this->m_strNextName = this->NextName();
+
+	try {
+		this->m_qHelper.Start(&CRotatingSink::helperProc, (LPVOID) this);
+	}
+	catch (const char *) {
+		// No thread, do it here (off the usual path anyway).
+		helperProc((LPVOID) this);
+	}
+}
+
+void CRotatingSink::Rotate() {
+	LONGLONG nStart = QClock::Micros();
+
+	// Normally the helper finished long ago.
+	this->m_qHelper.Join();
+
+	if (this->m_pNext == NULL) {
+		// Next file couldn't be created, keep writing this one for another
+		// segment's length and try again then.
+		this->m_nOpenErrors++;
+		this->m_nNextIndex--;
+		this->m_nCurrentMicros = 0;
+		this->m_nCurrentBytes = 0;
+		this->Prepare();
+		return;
+	}
+
+	this->m_pRetired = this->m_pCurrent;
+	this->m_pCurrent = this->m_pNext;
+	this->m_pNext = NULL;
+	this->m_nCurrentMicros = 0;
+	this->m_nCurrentBytes = 0;
+	this->m_nSegments++;
+
+	this->Prepare();
+
+	if (QClock::Micros() - nStart > this->m_nMaxRotateMicros) this->m_nMaxRotateMicros = QClock::Micros() - nStart;
+}
+
+void CRotatingSink::Write(const BYTE *pData, DWORD dwBytes) {
+	this->m_pCurrent->ReceiveMP3((PBYTE) pData, dwBytes);
+	this->m_nCurrentBytes += dwBytes;
+}
+
+void CRotatingSink::ReceiveMP3(PBYTE pData, DWORD dwBytes) {
+	BYTE arrHeader[4];
+	DWORD dwLength, dwCopy, i;
+
+	if (this->m_pCurrent == NULL) return;
+
+	while (dwBytes > 0) {
+		// Inside a frame, pass it on.
+		if (this->m_dwInFrame > 0) {
+			dwCopy = (dwBytes < this->m_dwInFrame) ? dwBytes : this->m_dwInFrame;
+			this->Write(pData, dwCopy);
+			this->m_dwInFrame -= dwCopy;
+			pData += dwCopy;
+			dwBytes -= dwCopy;
+			continue;
+		}
+
+		// At a frame start, the header may come in pieces.
+		if (this->m_dwCarry + dwBytes < 4) {
+			memcpy(this->m_arrCarry + this->m_dwCarry, pData, dwBytes);
+			this->m_dwCarry += dwBytes;
+			return;
+		}
+		for (i = 0; i < 4; i++) {
+			arrHeader[i] = (i < this->m_dwCarry) ? this->m_arrCarry[i] : pData[i - this->m_dwCarry];
+		}
+
+		dwLength = CMP3Frame::Length(arrHeader);
+		if (dwLength == 0) {
+			// Not a frame (e.g. a tag), pass one byte and look again.
+			dwLength = 1;
+		}
+		else {
+			// Frame boundary, the only place to cut.
+			if (((this->m_nSegmentMicros > 0) && (this->m_nCurrentMicros >= this->m_nSegmentMicros)) ||
+				((this->m_nSegmentBytes > 0) && (this->m_nCurrentBytes >= this->m_nSegmentBytes))) {
+				this->Rotate();
+			}
+			if (CMP3Frame::SampleRate(arrHeader) > 0) {
+				this->m_nCurrentMicros += (LONGLONG) CMP3Frame::Samples(arrHeader) * 1000000 / CMP3Frame::SampleRate(arrHeader);
+			}
+		}
+
+		// Bytes of the header kept from the last call belong to this frame.
+		if (this->m_dwCarry > 0) {
+			dwCopy = (this->m_dwCarry < dwLength) ? this->m_dwCarry : dwLength;
+			this->Write(this->m_arrCarry, dwCopy);
+			memmove(this->m_arrCarry, this->m_arrCarry + dwCopy, this->m_dwCarry - dwCopy);
+			this->m_dwCarry -= dwCopy;
+			dwLength -= dwCopy;
+		}
+		this->m_dwInFrame = dwLength;
+	}
+}
+
+void CRotatingSink::Close() {
+	if (this->m_pCurrent != NULL) {
+		if (this->m_dwCarry > 0) this->Write(this->m_arrCarry, this->m_dwCarry);
+		this->m_dwCarry = 0;
+
+		this->m_qHelper.Join();
+		this->m_pCurrent->Close();
+		delete this->m_pCurrent;
+		this->m_pCurrent = NULL;
+
+		// The file opened ahead was never used.
+		if (this->m_pNext != NULL) {
+			this->m_pNext->Close();
+			delete this->m_pNext;
+			this->m_pNext = NULL;
+			::DeleteFile(this->m_strNextName.c_str());
+			if (this->m_dwIndexMillis > 0) ::DeleteFile((this->m_strNextName + INDEX_EXTENSION).c_str());
+		}
+	}
+}
+
+void CRotatingSink::PrintStats() {
+	printf("Output: %d segment(s), %d failed open(s), longest rotation %.3f ms.\n",
+		this->m_nSegments, this->m_nOpenErrors, this->m_nMaxRotateMicros / 1000.0);
+}
+
+#endif
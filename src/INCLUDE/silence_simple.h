@@ -0,0 +1,482 @@
+#ifndef ___SILENCE_SIMPLE_H_INCLUDED___
+#define ___SILENCE_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/capture_simple.h"
+#include "INCLUDE/mp3_simple.h"
+#include "INCLUDE/pcm_simple.h"
+
+using namespace std;
+
+// What CSilenceReceiver does with silence, see its constructor.
+#define SILENCE_DROP 0
+#define SILENCE_FRAMES 1
+#define SILENCE_GAPS 2
+
+// Sound is judged in blocks of this length.
+#define SILENCE_BLOCK_MS 10
+
+// Level (RMS, dBFS) above which a block is sound, and how much lower it may
+// fall (hysteresis) before sound already going on is taken as silence again.
+#define SILENCE_OPEN_DB -45.0
+#define SILENCE_HYSTERESIS_DB 6.0
+
+// Zero crossings per sample above which a quiet block (between the two
+// levels) opens the sound as well: the hiss of "s", "f", "sh" at word starts.
+#define SILENCE_ZCR 0.25
+
+// Sound kept before the first block of sound (so words aren't clipped at the
+// start), and silence let through after the last one (at the end).
+#define SILENCE_PREROLL_MS 300
+#define SILENCE_HANGOVER_MS 700
+
+// Zeros (sample frames at the output rate) the encoder is given before
+// ready-made silent frames follow sound: two MPEG-1 frames, more than LAME
+// holds back (its encoder delay and the frame being filled, about 1900).
+#define SILENCE_FLUSH_FRAMES 2304
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Receives the silence a CSilenceReceiver (with SILENCE_FRAMES) takes out of
+// the sound, in its place in the stream, e.g. mp3Writer.
+class ISilenceReceiver {
+public:
+	// nFrames sample frames of silence were left out here.
+	virtual void ReceiveSilence(DWORD nFrames) = 0;
+};
+///////////////////////////////////////////////////////////////////////////
+// Stands in for silence in an MP3 stream without encoding it: one frame of
+// silence is encoded up front (on a stream of its own, with the settings of
+// the real one) and written again for every frame's worth of silence. Since
+// CMP3Simple encodes without the bit reservoir, the copies are valid frames
+// wherever they are put.
+class CMP3SilenceWriter {
+private:
+	vector<BYTE> m_arrFrame;
+
+	// One block of the CMP3Chunker, of zeros.
+	vector<SHORT> m_arrZeros;
+
+	// Silence not covered by a frame yet, in input frames times the output
+	// rate, and what a frame covers in the same units.
+	ULONGLONG	m_nCredit;
+	ULONGLONG	m_nFrameCost;
+	DWORD		m_nOutRate;
+	DWORD		m_nChannels;
+
+	// Zeros (samples) the encoder needs after sound, how many it was given
+	// since, and the CMP3Chunker::Samples() it had after them.
+	DWORD		m_nFlushSamples;
+	DWORD		m_nFlushed;
+	ULONGLONG	m_nChunkerSamples;
+
+	LONGLONG	m_nFrames;
+
+public:
+	// mp3Enc - the encoder whose stream the frames go into. Throws if the
+	// frame can't be encoded.
+	CMP3SilenceWriter(const CMP3Simple &mp3Enc);
+	~CMP3SilenceWriter() {};
+
+	// Writes the frames standing for nFrames (sample frames) of silence to
+	// pOutput. After sound, the encoder (fed by mp3Chunker) is given zeros
+	// first, SILENCE_FLUSH_FRAMES and up to the end of a block, so the sound
+	// it still holds back comes out before the ready-made frames, in its place;
+	// those zeros are part of the silence. Less than a frame is carried over
+	// to the next call.
+	void Write(CMP3Chunker &mp3Chunker, IMP3Receiver *pOutput, DWORD nFrames);
+
+	// Number of frames written so far.
+	LONGLONG GetFrames() const { return this->m_nFrames; };
+};
+///////////////////////////////////////////////////////////////////////////
+// IReceiver which keeps silent stretches away from the target IReceiver (e.g.
+// mp3Writer), so hours of a quiet room aren't encoded.
+//
+// Every SILENCE_BLOCK_MS block is measured (energy and zero crossings, by the
+// vector kernels of CPCMConvert). Silence turns into sound at a block louder
+// than dOpenDB, or a hissing one above dOpenDB - SILENCE_HYSTERESIS_DB; sound
+// turns into silence after SILENCE_HANGOVER_MS of blocks below that lower
+// level. While it is silent the latest SILENCE_PREROLL_MS are held back and
+// passed on first if sound comes, only older silence is left out:
+//
+//	SILENCE_DROP - simply dropped, the output gets shorter.
+//	SILENCE_FRAMES - reported to the ISilenceReceiver instead (e.g. mp3Writer
+//	writes ready-made silent frames, see CMP3SilenceWriter), the output keeps its length.
+//	SILENCE_GAPS - dropped, and every gap is listed in a text (sidecar) file,
+//	one "<output_s> <capture_s> <length_s>" line per gap: where it is in the
+//	output, where it started in the captured sound, and how long it was.
+//
+// Sound is 16-bit. The sound passed on points into the capture buffer (or
+// into the receiver's own memory), the target should process it before returning.
+class CSilenceReceiver: public IReceiver {
+private:
+	IReceiver	*m_pTarget;
+	ISilenceReceiver *m_pSilenceTarget;
+	int			m_nPolicy;
+	WORD		m_nChannels;
+	DWORD		m_nSampleRate;
+	DWORD		m_nBlockFrames;
+	DWORD		m_nHangoverFrames;
+	double		m_dOpenDB;
+	double		m_dCloseDB;
+
+	bool		m_isSound;
+	DWORD		m_nQuietFrames;
+
+	// Pre-roll, a ring of up to m_nRingSize frames.
+	vector<SHORT> m_arrRing;
+	DWORD		m_nRingSize;
+	DWORD		m_nRingStart;
+	DWORD		m_nRingFrames;
+
+	// Frames received (passed on or held), and frames in the output.
+	ULONGLONG	m_nInFrames;
+	ULONGLONG	m_nOutFrames;
+
+	// Gap being left out: where it started (in the received sound and in the output) and its length so far.
+	ULONGLONG	m_nGapStart;
+	ULONGLONG	m_nGapOut;
+	ULONGLONG	m_nGapFrames;
+	FILE		*m_pSidecar;
+
+	// Statistics.
+	ULONGLONG	m_nSkippedFrames;
+	LONG		m_nGaps;
+	ULONGLONG	m_nPassedFrames;
+	LONGLONG	m_nTargetMicros;
+	LONGLONG	m_nOwnMicros;
+
+	bool IsSound(const SHORT *pSamples, DWORD nFrames);
+
+	// Passes frames to the target, timing it.
+	void Pass(const SHORT *pSamples, DWORD nFrames);
+
+	// Puts frames into the pre-roll, the oldest ones fall out (are skipped).
+	void Hold(const SHORT *pSamples, DWORD nFrames);
+
+	// Passes the pre-roll on.
+	void Release();
+
+	// Leaves out nFrames of silence, and ends the gap.
+	void Skip(DWORD nFrames);
+	void EndGap();
+
+public:
+	// pTarget - IReceiver that will receive the sound.
+	//
+	// nSampleRate, nChannels - format of the (16-bit) sound.
+	//
+	// nPolicy - SILENCE_XXXX, what happens to the silence (see above).
+	//
+	// pSilenceTarget - receives the silence with SILENCE_FRAMES.
+	//
+	// pSidecar - file of the gaps with SILENCE_GAPS. Throws if it can't be created.
+	//
+	// dOpenDB - level (RMS, dBFS) of sound, see above.
+	CSilenceReceiver(IReceiver *pTarget, DWORD nSampleRate, WORD nChannels, int nPolicy,
+		ISilenceReceiver *pSilenceTarget = NULL, const char *pSidecar = NULL, double dOpenDB = SILENCE_OPEN_DB);
+	~CSilenceReceiver();
+
+	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded);
+
+	// Ends the stream: silence held back is left out (and its gap listed).
+	// Call it after the capture was stopped (and before the target is closed).
+	void Flush();
+
+	// Frames received, and left out.
+	ULONGLONG GetFrames() const { return this->m_nInFrames; };
+	ULONGLONG GetSkippedFrames() const { return this->m_nSkippedFrames; };
+	LONG GetGaps() const { return this->m_nGaps; };
+
+	// Estimated time (microseconds) the target would have spent on the
+	// frames left out, at its average cost per frame passed on, and the time
+	// the detection itself took.
+	LONGLONG GetSavedMicros() const;
+	LONGLONG GetOwnMicros() const { return this->m_nOwnMicros; };
+
+	// Prints how much was left out, and the CPU saved per hour of sound.
+	void PrintStats();
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CMP3SilenceWriter::CMP3SilenceWriter(const CMP3Simple &mp3Enc) {
+	CMP3Simple mp3Silent(mp3Enc.BitRate(), mp3Enc.InSampleRate(),
+		(mp3Enc.OutSampleRate() == mp3Enc.InSampleRate()) ? 0 : mp3Enc.OutSampleRate(), mp3Enc.Mode());
+	vector<BYTE> arrStream, arrOutput(mp3Silent.MinOutBufferSize());
+	DWORD dwOutput, dwPos, dwLength;
+	int nBlock, nFrame;
+
+	this->m_arrZeros.resize(mp3Silent.MaxInBufferSize(), 0);
+	this->m_nCredit = 0;
+	this->m_nOutRate = mp3Enc.OutSampleRate();
+	this->m_nChannels = mp3Enc.Channels();
+	this->m_nFrameCost = 0;
+	this->m_nFrames = 0;
+
+	// In input samples, LAME may re-sample. Nothing to push out before any sound.
+	this->m_nFlushSamples = (DWORD) (((ULONGLONG) SILENCE_FLUSH_FRAMES * mp3Enc.InSampleRate() + this->m_nOutRate - 1) /
+		this->m_nOutRate) * this->m_nChannels;
+	this->m_nFlushed = this->m_nFlushSamples;
+	this->m_nChunkerSamples = 0;
+
+	// Past the encoder's start-up, the second complete frame is taken.
+	for (nBlock = 0; (nBlock < 16) && this->m_arrFrame.empty(); nBlock++) {
+		dwOutput = 0;
+		if (mp3Silent.Encode(&this->m_arrZeros[0], (DWORD) this->m_arrZeros.size(), &arrOutput[0], &dwOutput) != BE_ERR_SUCCESSFUL) break;
+		arrStream.insert(arrStream.end(), arrOutput.begin(), arrOutput.begin() + dwOutput);
+
+		for (dwPos = 0, nFrame = 0; dwPos + 4 <= arrStream.size(); ) {
+			dwLength = CMP3Frame::Length(&arrStream[dwPos]);
+			if (dwLength == 0) { dwPos++; continue; }
+			if (dwPos + dwLength > arrStream.size()) break;
+			if (++nFrame == 2) {
+				this->m_arrFrame.assign(arrStream.begin() + dwPos, arrStream.begin() + dwPos + dwLength);
+				break;
+			}
+			dwPos += dwLength;
+		}
+	}
+	if (this->m_arrFrame.empty()) throw "Can't encode a silent frame.";
+
+	this->m_nFrameCost = (ULONGLONG) CMP3Frame::Samples(&this->m_arrFrame[0]) * mp3Enc.InSampleRate();
+}
+
+void CMP3SilenceWriter::Write(CMP3Chunker &mp3Chunker, IMP3Receiver *pOutput, DWORD nFrames) {
+	DWORD nSamples = nFrames * this->m_nChannels, nBlock = (DWORD) this->m_arrZeros.size(), n;
+
+	// Sound was encoded since the last call.
+	if (mp3Chunker.Samples() != this->m_nChunkerSamples) this->m_nFlushed = 0;
+
+	// Zeros which push it out of the encoder, up to the end of a block.
+	n = (this->m_nFlushed < this->m_nFlushSamples) ? this->m_nFlushSamples - this->m_nFlushed : 0;
+	n += (nBlock - (mp3Chunker.Pending() + n) % nBlock) % nBlock;
+	if (n > nSamples) n = nSamples;
+	nSamples -= n;
+	this->m_nFlushed += n;
+	while (n > 0) {
+		mp3Chunker.Encode(&this->m_arrZeros[0], (n < nBlock) ? n : nBlock);
+		n -= (n < nBlock) ? n : nBlock;
+	}
+	this->m_nChunkerSamples = mp3Chunker.Samples();
+
+	this->m_nCredit += (ULONGLONG) (nSamples / this->m_nChannels) * this->m_nOutRate;
+	while (this->m_nCredit >= this->m_nFrameCost) {
+		pOutput->ReceiveMP3(&this->m_arrFrame[0], (DWORD) this->m_arrFrame.size());
+		this->m_nCredit -= this->m_nFrameCost;
+		this->m_nFrames++;
+	}
+}
+///////////////////////////////////////////////////////////////////////////
+CSilenceReceiver::CSilenceReceiver(IReceiver *pTarget, DWORD nSampleRate, WORD nChannels, int nPolicy,
+								   ISilenceReceiver *pSilenceTarget, const char *pSidecar, double dOpenDB) {
+	this->m_pTarget = pTarget;
+	this->m_pSilenceTarget = pSilenceTarget;
+	this->m_nPolicy = nPolicy;
+	this->m_nChannels = nChannels;
+	this->m_nSampleRate = nSampleRate;
+	this->m_nBlockFrames = nSampleRate * SILENCE_BLOCK_MS / 1000;
+	if (this->m_nBlockFrames == 0) this->m_nBlockFrames = 1;
+	this->m_nHangoverFrames = nSampleRate * SILENCE_HANGOVER_MS / 1000;
+	this->m_dOpenDB = dOpenDB;
+	this->m_dCloseDB = dOpenDB - SILENCE_HYSTERESIS_DB;
+
+	// Starts as silence, the first sound comes with its pre-roll.
+	this->m_isSound = false;
+	this->m_nQuietFrames = 0;
+
+	this->m_nRingSize = nSampleRate * SILENCE_PREROLL_MS / 1000;
+	if (this->m_nRingSize == 0) this->m_nRingSize = 1;
+	this->m_arrRing.resize(this->m_nRingSize * nChannels);
+	this->m_nRingStart = 0;
+	this->m_nRingFrames = 0;
+
+	this->m_nInFrames = 0;
+	this->m_nOutFrames = 0;
+	this->m_nGapStart = 0;
+	this->m_nGapOut = 0;
+	this->m_nGapFrames = 0;
+
+	this->m_nSkippedFrames = 0;
+	this->m_nGaps = 0;
+	this->m_nPassedFrames = 0;
+	this->m_nTargetMicros = 0;
+	this->m_nOwnMicros = 0;
+
+	this->m_pSidecar = NULL;
+	if ((nPolicy == SILENCE_GAPS) && (pSidecar != NULL)) {
+		this->m_pSidecar = fopen(pSidecar, "w");
+		if (this->m_pSidecar == NULL) throw "Can't create the gaps file.";
+		fprintf(this->m_pSidecar, "# output_s capture_s length_s\n");
+		fflush(this->m_pSidecar);
+	}
+}
+
+CSilenceReceiver::~CSilenceReceiver() {
+	if (this->m_pSidecar != NULL) fclose(this->m_pSidecar);
+}
+
+bool CSilenceReceiver::IsSound(const SHORT *pSamples, DWORD nFrames) {
+	DWORD nSamples = nFrames * this->m_nChannels;
+	ULONGLONG nSum = CPCMConvert::SumOfSquares(pSamples, nSamples);
+	double dLevel = (nSum > 0) ? 10.0 * log10((double) nSum / nSamples / (32768.0 * 32768.0)) : -200.0;
+
+	if (dLevel > this->m_dOpenDB) return true;
+	if (dLevel <= this->m_dCloseDB) return false;
+
+	// Between the levels: sound going on goes on, silence opens only for a hiss.
+	if (this->m_isSound) return true;
+	return CPCMConvert::ZeroCrossings(pSamples, nSamples, this->m_nChannels) > SILENCE_ZCR * nSamples;
+}
+
+void CSilenceReceiver::Pass(const SHORT *pSamples, DWORD nFrames) {
+	LONGLONG nStart = QClock::Micros();
+
+	this->m_pTarget->ReceiveBuffer((LPSTR) pSamples, nFrames * this->m_nChannels * 2);
+	this->m_nTargetMicros += QClock::Micros() - nStart;
+	this->m_nPassedFrames += nFrames;
+	this->m_nOutFrames += nFrames;
+}
+
+void CSilenceReceiver::Skip(DWORD nFrames) {
+	if (nFrames == 0) return;
+
+	// Frames left out are always the oldest ones held.
+	if (this->m_nGapFrames == 0) {
+		this->m_nGapStart = this->m_nInFrames - this->m_nRingFrames;
+		this->m_nGapOut = this->m_nOutFrames;
+	}
+	this->m_nGapFrames += nFrames;
+	this->m_nSkippedFrames += nFrames;
+
+	if ((this->m_nPolicy == SILENCE_FRAMES) && (this->m_pSilenceTarget != NULL)) {
+		this->m_pSilenceTarget->ReceiveSilence(nFrames);
+		this->m_nOutFrames += nFrames;
+	}
+}
+
+void CSilenceReceiver::EndGap() {
+	if (this->m_nGapFrames == 0) return;
+
+	this->m_nGaps++;
+	if (this->m_pSidecar != NULL) {
+		fprintf(this->m_pSidecar, "%.3f %.3f %.3f\n", (double) this->m_nGapOut / this->m_nSampleRate,
+			(double) this->m_nGapStart / this->m_nSampleRate, (double) this->m_nGapFrames / this->m_nSampleRate);
+		fflush(this->m_pSidecar);
+	}
+	this->m_nGapFrames = 0;
+}
+
+void CSilenceReceiver::Hold(const SHORT *pSamples, DWORD nFrames) {
+	DWORD nReceived = nFrames, nOver, nDrop, nEnd, nCopy;
+
+	// Room is made from the oldest frames held, then from the block itself.
+	nOver = (this->m_nRingFrames + nFrames > this->m_nRingSize) ? this->m_nRingFrames + nFrames - this->m_nRingSize : 0;
+	nDrop = (nOver < this->m_nRingFrames) ? nOver : this->m_nRingFrames;
+	this->Skip(nDrop);
+	this->m_nRingStart = (this->m_nRingStart + nDrop) % this->m_nRingSize;
+	this->m_nRingFrames -= nDrop;
+
+	nDrop = nOver - nDrop;
+	this->Skip(nDrop);
+	pSamples += nDrop * this->m_nChannels;
+	nFrames -= nDrop;
+
+	while (nFrames > 0) {
+		nEnd = (this->m_nRingStart + this->m_nRingFrames) % this->m_nRingSize;
+		nCopy = this->m_nRingSize - nEnd;
+		if (nCopy > nFrames) nCopy = nFrames;
+		memcpy(&this->m_arrRing[nEnd * this->m_nChannels], pSamples, nCopy * this->m_nChannels * sizeof(SHORT));
+		this->m_nRingFrames += nCopy;
+		pSamples += nCopy * this->m_nChannels;
+		nFrames -= nCopy;
+	}
+	this->m_nInFrames += nReceived;
+}
+
+void CSilenceReceiver::Release() {
+	DWORD nCopy;
+
+	this->EndGap();
+
+	// The ring in (at most) two pieces, oldest first.
+	while (this->m_nRingFrames > 0) {
+		nCopy = this->m_nRingSize - this->m_nRingStart;
+		if (nCopy > this->m_nRingFrames) nCopy = this->m_nRingFrames;
+		this->Pass(&this->m_arrRing[this->m_nRingStart * this->m_nChannels], nCopy);
+		this->m_nRingStart = (this->m_nRingStart + nCopy) % this->m_nRingSize;
+		this->m_nRingFrames -= nCopy;
+	}
+	this->m_nRingStart = 0;
+}
+
+void CSilenceReceiver::ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) {
+	const SHORT *pSamples = (const SHORT *) lpData;
+	const SHORT *pRun = NULL;
+	DWORD nFrames = dwBytesRecorded / (2 * this->m_nChannels), nBlock, nRun = 0;
+	LONGLONG nStart = QClock::Micros(), nTarget = this->m_nTargetMicros;
+	bool isSound;
+
+	while (nFrames > 0) {
+		nBlock = (nFrames < this->m_nBlockFrames) ? nFrames : this->m_nBlockFrames;
+
+		isSound = this->IsSound(pSamples, nBlock);
+		if (isSound) this->m_nQuietFrames = 0;
+		else this->m_nQuietFrames += nBlock;
+
+		if (!this->m_isSound && isSound) {
+			this->m_isSound = true;
+			this->Release();
+		}
+		else if (this->m_isSound && (this->m_nQuietFrames > this->m_nHangoverFrames)) {
+			this->m_isSound = false;
+			if (nRun > 0) this->Pass(pRun, nRun);
+			nRun = 0;
+		}
+
+		// Consecutive blocks of sound go on in one piece.
+		if (this->m_isSound) {
+			if (nRun == 0) pRun = pSamples;
+			nRun += nBlock;
+			this->m_nInFrames += nBlock;
+		}
+		else this->Hold(pSamples, nBlock);
+
+		pSamples += nBlock * this->m_nChannels;
+		nFrames -= nBlock;
+	}
+	if (nRun > 0) this->Pass(pRun, nRun);
+
+	this->m_nOwnMicros += (QClock::Micros() - nStart) - (this->m_nTargetMicros - nTarget);
+}
+
+void CSilenceReceiver::Flush() {
+	if (!this->m_isSound) {
+		this->Skip(this->m_nRingFrames);
+		this->m_nRingFrames = 0;
+		this->m_nRingStart = 0;
+	}
+	this->EndGap();
+}
+
+LONGLONG CSilenceReceiver::GetSavedMicros() const {
+	if (this->m_nPassedFrames == 0) return 0;
+	return (LONGLONG) ((double) this->m_nTargetMicros * this->m_nSkippedFrames / this->m_nPassedFrames);
+}
+
+void CSilenceReceiver::PrintStats() {
+	double dHours = (double) this->m_nInFrames / this->m_nSampleRate / 3600.0;
+
+	printf("Silence: %.1f%% of %.0f s left out in %d gap(s), about %.1f s of CPU saved per hour (detection %.1f s per hour).\n",
+		(this->m_nInFrames > 0) ? 100.0 * this->m_nSkippedFrames / this->m_nInFrames : 0.0,
+		(double) this->m_nInFrames / this->m_nSampleRate, this->m_nGaps,
+		(dHours > 0.0) ? this->GetSavedMicros() / 1000000.0 / dHours : 0.0,
+		(dHours > 0.0) ? this->m_nOwnMicros / 1000000.0 / dHours : 0.0);
+}
+
+#endif
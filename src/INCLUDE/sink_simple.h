@@ -0,0 +1,594 @@
+#ifndef ___SINK_SIMPLE_H_INCLUDED___
+#define ___SINK_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <stdio.h>
+#include <vector>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/mp3_simple.h"
+#include "INCLUDE/stats_simple.h"
+#include "INCLUDE/counters_simple.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+// Default size of the blocks written by CAsyncFileSink.
+#define SINK_BLOCK_SIZE (256 * 1024)
+
+// CMappedFileSink grows the file by extents of this size, and maps this much
+// of it at once.
+#define SINK_MAP_EXTENT (64 * 1024 * 1024)
+#define SINK_MAP_WINDOW (4 * 1024 * 1024)
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Output (file) for the encoded sound, see CAsyncFileSink and CMappedFileSink.
+class IMP3Sink: public IMP3Receiver {
+protected:
+	// Counters of the stream being written, NULL if nobody watches it.
+	CStreamCounters *m_pCounters;
+
+public:
+	IMP3Sink() { this->m_pCounters = NULL; };
+	virtual ~IMP3Sink() {};
+
+	// The sink counts its stalls (see CAsyncFileSink::GetStalls()) into
+	// pCounters as well. Set before the first ReceiveMP3().
+	virtual void SetCounters(CStreamCounters *pCounters) { this->m_pCounters = pCounters; };
+
+	// Writes everything received so far and closes the output. Safe to call more than once.
+	virtual void Close() = 0;
+
+	// Prints sink's statistics.
+	virtual void PrintStats() = 0;
+};
+
+// Write-behind file sink for the encoded (MP3) sound.
+//
+// ReceiveMP3() only appends to an in-memory staging buffer and returns, a
+// background thread writes the staged data to the file in blocks of dwBlockSize
+// bytes (the tail of the stream is written on Close()). Staging is double-
+// buffered: while the writer thread writes one buffer, the other one is filled.
+// If the disk is slower than the encoder the filling buffer simply grows (and
+// GetStalls() is counted), so the caller never waits for the disk.
+//
+// Optionally the file is flushed to the disk (FlushFileBuffers, fdatasync)
+// every dwSyncMillis, so a crash loses at most that much of the recording.
+class CAsyncFileSink: public IMP3Sink {
+private:
+#ifdef _WIN32
+	HANDLE		m_hFile;
+#else
+	int			m_nFile;
+#endif
+	DWORD		m_dwBlockSize;
+	DWORD		m_dwSyncMillis;
+
+	// m_arrStage[m_nFilling] is being filled, the other one is being written
+	// (if m_isWriting). Guarded by m_qMutex.
+	vector<BYTE> m_arrStage[2];
+	int			m_nFilling;
+	bool		m_isWriting;
+	QMutex		m_qMutex;
+
+	QEvent		m_qWork;
+	QThread		m_qThread;
+	volatile LONG m_isStopping;
+
+	// Statistics.
+	CLatencyHistogram m_hWriteLatency;
+	CLatencyHistogram m_hSyncLatency;
+	volatile LONG m_nStalls;
+	volatile LONG m_nErrors;
+	ULONGLONG	m_nBytesWritten;
+
+	// Starts writing the filled buffer, if the writer is idle and enough is staged
+	// (isAll - write whatever is staged). Called with m_qMutex locked.
+	bool Swap(bool isAll);
+
+	// Writes the buffer, measures and counts it.
+	void Write(const BYTE *pData, DWORD dwBytes);
+	void Sync();
+
+	static DWORD WINAPI writerProc(LPVOID arg);
+
+public:
+	// pFileName - file to create (an existing one is overwritten). Throws if it can't be created.
+	//
+	// dwBlockSize - size of each write (SINK_BLOCK_SIZE by default).
+	//
+	// dwSyncMillis - how often to flush the file to the disk, zero - only on Close().
+	CAsyncFileSink(const TCHAR *pFileName, DWORD dwBlockSize = SINK_BLOCK_SIZE, DWORD dwSyncMillis = 0);
+	~CAsyncFileSink();
+
+	// Appends the data to the staging buffer, never waits for the disk.
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes);
+
+	// Writes everything staged, flushes and closes the file. Safe to call more than once.
+	virtual void Close();
+
+	// Latency of each write and each flush, in microseconds.
+	CLatencyHistogram& GetWriteLatency() { return this->m_hWriteLatency; }
+	CLatencyHistogram& GetSyncLatency() { return this->m_hSyncLatency; }
+
+	// Times data arrived while both buffers were busy (disk slower than encoder).
+	LONG GetStalls() { return QAtomicLoad(&this->m_nStalls); }
+
+	// Failed writes, the data of a failed write is lost.
+	LONG GetErrors() { return QAtomicLoad(&this->m_nErrors); }
+
+	// Prints the statistics above.
+	virtual void PrintStats();
+};
+
+// File sink writing the encoded sound straight into a memory-mapped window of
+// the file, which slides forward as the file grows. The file is preallocated
+// in big extents (SINK_MAP_EXTENT), so it stays in few fragments and there is
+// no system call per encoded block, only one per window (SINK_MAP_WINDOW) and
+// per extent. Close() truncates the file to the real length of the sound.
+//
+// If the recorder is killed, the file keeps its preallocated length (the tail
+// being zeros), which MP3 players skip.
+class CMappedFileSink: public IMP3Sink {
+private:
+#ifdef _WIN32
+	HANDLE		m_hFile;
+	HANDLE		m_hMapping;
+#else
+	int			m_nFile;
+#endif
+	DWORD		m_dwGranularity;
+
+	bool IsOpen() const;
+
+	// Size of the file (preallocated) and length of the sound written into it.
+	ULONGLONG	m_nAllocated;
+	ULONGLONG	m_nWritten;
+
+	// Currently mapped window.
+	PBYTE		m_pView;
+	ULONGLONG	m_nViewOffset;
+	DWORD		m_dwViewSize;
+
+	// Statistics.
+	LONG		m_nExtents;
+	LONG		m_nWindows;
+	LONG		m_nErrors;
+
+	// Makes the file at least nSize bytes long (in whole extents) and maps it again.
+	bool Extend(ULONGLONG nSize);
+
+	// Maps the window holding nOffset.
+	bool MapWindow(ULONGLONG nOffset);
+	void Unmap();
+
+public:
+	// pFileName - file to create (an existing one is overwritten). Throws if it
+	// can't be created or preallocated.
+	CMappedFileSink(const TCHAR *pFileName);
+	~CMappedFileSink();
+
+	// Copies the data into the mapped window. Data which can't be written (disk
+	// full) is dropped and counted, see GetErrors().
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes);
+
+	// Unmaps the file and truncates it to the written length.
+	virtual void Close();
+
+	ULONGLONG GetWritten() const { return this->m_nWritten; }
+	LONG GetErrors() const { return this->m_nErrors; }
+
+	// Prints the bytes written, extents allocated and windows mapped.
+	virtual void PrintStats();
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CAsyncFileSink::CAsyncFileSink(const TCHAR *pFileName, DWORD dwBlockSize, DWORD dwSyncMillis):
+		m_qMutex(), m_qWork(), m_qThread(), m_hWriteLatency(), m_hSyncLatency() {
+	this->m_dwBlockSize = (dwBlockSize > 0) ? dwBlockSize : SINK_BLOCK_SIZE;
+	this->m_dwSyncMillis = dwSyncMillis;
+	this->m_nFilling = 0;
+	this->m_isWriting = false;
+	this->m_isStopping = 0;
+	this->m_nStalls = 0;
+	this->m_nErrors = 0;
+	this->m_nBytesWritten = 0;
+
+	// Room for a block plus a bit more, so the buffer rarely grows.
+	this->m_arrStage[0].reserve(2 * this->m_dwBlockSize);
+	this->m_arrStage[1].reserve(2 * this->m_dwBlockSize);
+
+#ifdef _WIN32
+	this->m_hFile = ::CreateFile(pFileName, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (this->m_hFile == INVALID_HANDLE_VALUE) throw "Can't create output file.";
+#else
+	this->m_nFile = ::open(pFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (this->m_nFile < 0) throw "Can't create output file.";
+#endif
+
+	try {
+		this->m_qThread.Start(&CAsyncFileSink::writerProc, (LPVOID) this);
+	}
+	catch (const char *) {
+#ifdef _WIN32
+		::CloseHandle(this->m_hFile);
+#else
+		::close(this->m_nFile);
+#endif
+		throw;
+	}
+}
+
+CAsyncFileSink::~CAsyncFileSink() {
+	this->Close();
+}
+
+bool CAsyncFileSink::Swap(bool isAll) {
+	vector<BYTE> *pFull = &this->m_arrStage[this->m_nFilling];
+	vector<BYTE> *pEmpty = &this->m_arrStage[1 - this->m_nFilling];
+	size_t nWhole;
+
+	if (this->m_isWriting || pFull->empty()) return false;
+	if (!isAll && (pFull->size() < this->m_dwBlockSize)) return false;
+
+	// Filled buffer goes to the writer, the empty one is filled from now on.
+	this->m_nFilling = 1 - this->m_nFilling;
+	this->m_isWriting = true;
+
+	// Only whole blocks are written, the tail goes on filling (small copy, less than a block).
+	if (!isAll) {
+		nWhole = pFull->size() - pFull->size() % this->m_dwBlockSize;
+		pEmpty->assign(pFull->begin() + nWhole, pFull->end());
+		pFull->resize(nWhole);
+	}
+	return true;
+}
+
+void CAsyncFileSink::ReceiveMP3(PBYTE pData, DWORD dwBytes) {
+	vector<BYTE> *pFilling;
+
+	this->m_qMutex.Lock();
+
+	pFilling = &this->m_arrStage[this->m_nFilling];
+	pFilling->insert(pFilling->end(), pData, pData + dwBytes);
+
+	if (pFilling->size() >= this->m_dwBlockSize) {
+		if (this->Swap(false)) this->m_qWork.Set();
+		else {
+			QAtomicInc(&this->m_nStalls);
+			if (this->m_pCounters != NULL) this->m_pCounters->Stalls.Inc();
+		}
+	}
+
+	this->m_qMutex.Unlock();
+}
+
+void CAsyncFileSink::Write(const BYTE *pData, DWORD dwBytes) {
+	LONGLONG nStart = QClock::Micros();
+	DWORD dwWritten = 0;
+#ifdef _WIN32
+
+	if (!::WriteFile(this->m_hFile, pData, dwBytes, &dwWritten, NULL) || (dwWritten != dwBytes)) {
+		QAtomicInc(&this->m_nErrors);
+	}
+#else
+	ssize_t nWritten;
+
+	// write() may take less than asked (e.g. on a signal), the rest goes in another call.
+	while (dwWritten < dwBytes) {
+		nWritten = ::write(this->m_nFile, pData + dwWritten, dwBytes - dwWritten);
+		if (nWritten <= 0) {
+			QAtomicInc(&this->m_nErrors);
+			break;
+		}
+		dwWritten += (DWORD) nWritten;
+	}
+#endif
+	this->m_hWriteLatency.Add(QClock::Micros() - nStart);
+	this->m_nBytesWritten += dwWritten;
+}
+
+void CAsyncFileSink::Sync() {
+	LONGLONG nStart = QClock::Micros();
+
+#ifdef _WIN32
+	::FlushFileBuffers(this->m_hFile);
+#else
+	::fdatasync(this->m_nFile);
+#endif
+	this->m_hSyncLatency.Add(QClock::Micros() - nStart);
+}
+
+DWORD WINAPI CAsyncFileSink::writerProc(LPVOID arg) {
+	CAsyncFileSink *_this = (CAsyncFileSink *) arg;
+	LONGLONG nLastSync = QClock::Micros();
+	vector<BYTE> *pWriting;
+	LONG isStopping;
+	bool isSyncDue;
+
+	for (;;) {
+		// With a sync cadence, wake up in time for the next flush even if nothing comes.
+		_this->m_qWork.Wait((_this->m_dwSyncMillis > 0) ? _this->m_dwSyncMillis : INFINITE);
+		isStopping = QAtomicLoad(&_this->m_isStopping);
+		isSyncDue = (_this->m_dwSyncMillis > 0) &&
+			(QClock::Micros() - nLastSync >= (LONGLONG) _this->m_dwSyncMillis * 1000);
+
+		for (;;) {
+			_this->m_qMutex.Lock();
+			// When stopping or flushing, the tail is written as well.
+			if (!_this->m_isWriting) _this->Swap(isStopping || isSyncDue);
+			pWriting = _this->m_isWriting ? &_this->m_arrStage[1 - _this->m_nFilling] : NULL;
+			_this->m_qMutex.Unlock();
+
+			if (pWriting == NULL) break;
+
+			// The producer doesn't touch this buffer until m_isWriting is cleared.
+			_this->Write(&(*pWriting)[0], (DWORD) pWriting->size());
+
+			_this->m_qMutex.Lock();
+			pWriting->clear();
+			_this->m_isWriting = false;
+			_this->m_qMutex.Unlock();
+		}
+
+		if (isSyncDue) {
+			_this->Sync();
+			nLastSync = QClock::Micros();
+		}
+
+		if (isStopping) break;
+	}
+	return(0);
+}
+
+void CAsyncFileSink::Close() {
+	if (this->m_qThread.IsStarted()) {
+		QAtomicStore(&this->m_isStopping, 1);
+		this->m_qWork.Set();
+		this->m_qThread.Join();
+
+		this->Sync();
+#ifdef _WIN32
+		::CloseHandle(this->m_hFile);
+		this->m_hFile = INVALID_HANDLE_VALUE;
+#else
+		::close(this->m_nFile);
+		this->m_nFile = -1;
+#endif
+	}
+}
+
+void CAsyncFileSink::PrintStats() {
+	printf("Output: %" QFMT_I64 "u bytes, %d stall(s), %d error(s).\n", this->m_nBytesWritten,
+		this->GetStalls(), this->GetErrors());
+	this->m_hWriteLatency.Print("Write latency", "ms", 1000.0);
+	this->m_hSyncLatency.Print("Flush latency", "ms", 1000.0);
+}
+///////////////////////////////////////////////////////////////////////////
+#ifdef _WIN32
+CMappedFileSink::CMappedFileSink(const TCHAR *pFileName) {
+	SYSTEM_INFO si;
+
+	this->m_hMapping = NULL;
+	this->m_nAllocated = 0;
+	this->m_nWritten = 0;
+	this->m_pView = NULL;
+	this->m_nViewOffset = 0;
+	this->m_dwViewSize = 0;
+	this->m_nExtents = 0;
+	this->m_nWindows = 0;
+	this->m_nErrors = 0;
+
+	::GetSystemInfo(&si);
+	this->m_dwGranularity = si.dwAllocationGranularity;
+
+	this->m_hFile = ::CreateFile(pFileName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (this->m_hFile == INVALID_HANDLE_VALUE) throw "Can't create output file.";
+
+	if (!this->Extend(SINK_MAP_WINDOW)) {
+		::CloseHandle(this->m_hFile);
+		this->m_hFile = INVALID_HANDLE_VALUE;
+		throw "Can't preallocate output file.";
+	}
+}
+
+CMappedFileSink::~CMappedFileSink() {
+	this->Close();
+}
+
+bool CMappedFileSink::IsOpen() const {
+	return this->m_hFile != INVALID_HANDLE_VALUE;
+}
+
+void CMappedFileSink::Unmap() {
+	if (this->m_pView != NULL) {
+		::UnmapViewOfFile(this->m_pView);
+		this->m_pView = NULL;
+		this->m_dwViewSize = 0;
+	}
+}
+
+bool CMappedFileSink::Extend(ULONGLONG nSize) {
+	ULONGLONG nAllocated = this->m_nAllocated;
+	LONG lHigh;
+
+	while (nAllocated < nSize) nAllocated += SINK_MAP_EXTENT;
+
+	// The mapping has a fixed size, so it is created again for the bigger file.
+	this->Unmap();
+	if (this->m_hMapping != NULL) {
+		::CloseHandle(this->m_hMapping);
+		this->m_hMapping = NULL;
+	}
+
+	lHigh = (LONG) (nAllocated >> 32);
+	if ((::SetFilePointer(this->m_hFile, (LONG) (nAllocated & 0xFFFFFFFF), &lHigh, FILE_BEGIN) == INVALID_SET_FILE_POINTER) &&
+		(::GetLastError() != NO_ERROR)) return false;
+	if (!::SetEndOfFile(this->m_hFile)) return false;
+
+	this->m_hMapping = ::CreateFileMapping(this->m_hFile, NULL, PAGE_READWRITE,
+		(DWORD) (nAllocated >> 32), (DWORD) (nAllocated & 0xFFFFFFFF), NULL);
+	if (this->m_hMapping == NULL) return false;
+
+	this->m_nAllocated = nAllocated;
+	this->m_nExtents++;
+	return true;
+}
+
+bool CMappedFileSink::MapWindow(ULONGLONG nOffset) {
+	ULONGLONG nStart = nOffset - (nOffset % this->m_dwGranularity);
+	ULONGLONG nEnd = nStart + SINK_MAP_WINDOW;
+
+	this->Unmap();
+	if ((nEnd > this->m_nAllocated) && !this->Extend(nEnd)) return false;
+
+	this->m_pView = (PBYTE) ::MapViewOfFile(this->m_hMapping, FILE_MAP_WRITE,
+		(DWORD) (nStart >> 32), (DWORD) (nStart & 0xFFFFFFFF), SINK_MAP_WINDOW);
+	if (this->m_pView == NULL) return false;
+
+	this->m_nViewOffset = nStart;
+	this->m_dwViewSize = SINK_MAP_WINDOW;
+	this->m_nWindows++;
+	return true;
+}
+
+#else
+CMappedFileSink::CMappedFileSink(const TCHAR *pFileName) {
+	this->m_nAllocated = 0;
+	this->m_nWritten = 0;
+	this->m_pView = NULL;
+	this->m_nViewOffset = 0;
+	this->m_dwViewSize = 0;
+	this->m_nExtents = 0;
+	this->m_nWindows = 0;
+	this->m_nErrors = 0;
+	this->m_dwGranularity = (DWORD) ::sysconf(_SC_PAGESIZE);
+
+	this->m_nFile = ::open(pFileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (this->m_nFile < 0) throw "Can't create output file.";
+
+	if (!this->Extend(SINK_MAP_WINDOW)) {
+		::close(this->m_nFile);
+		this->m_nFile = -1;
+		throw "Can't preallocate output file.";
+	}
+}
+
+CMappedFileSink::~CMappedFileSink() {
+	this->Close();
+}
+
+bool CMappedFileSink::IsOpen() const {
+	return this->m_nFile >= 0;
+}
+
+void CMappedFileSink::Unmap() {
+	if (this->m_pView != NULL) {
+		::munmap(this->m_pView, this->m_dwViewSize);
+		this->m_pView = NULL;
+		this->m_dwViewSize = 0;
+	}
+}
+
+bool CMappedFileSink::Extend(ULONGLONG nSize) {
+	ULONGLONG nAllocated = this->m_nAllocated;
+
+	while (nAllocated < nSize) nAllocated += SINK_MAP_EXTENT;
+
+	// Really allocate the blocks (not only the length), so the file isn't
+	// fragmented and a full disk shows here, not as SIGBUS on a mapped write.
+	// Mapped windows stay valid, the file only grows.
+	if (::posix_fallocate(this->m_nFile, (off_t) this->m_nAllocated, (off_t) (nAllocated - this->m_nAllocated)) != 0) return false;
+
+	this->m_nAllocated = nAllocated;
+	this->m_nExtents++;
+	return true;
+}
+
+bool CMappedFileSink::MapWindow(ULONGLONG nOffset) {
+	ULONGLONG nStart = nOffset - (nOffset % this->m_dwGranularity);
+	ULONGLONG nEnd = nStart + SINK_MAP_WINDOW;
+	void *pView;
+
+	this->Unmap();
+	if ((nEnd > this->m_nAllocated) && !this->Extend(nEnd)) return false;
+
+	pView = ::mmap(NULL, SINK_MAP_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, this->m_nFile, (off_t) nStart);
+	if (pView == MAP_FAILED) return false;
+
+	this->m_pView = (PBYTE) pView;
+	this->m_nViewOffset = nStart;
+	this->m_dwViewSize = SINK_MAP_WINDOW;
+	this->m_nWindows++;
+	return true;
+}
+#endif
+
+void CMappedFileSink::ReceiveMP3(PBYTE pData, DWORD dwBytes) {
+	DWORD dwCopy;
+
+	if (!this->IsOpen()) return;
+
+	while (dwBytes > 0) {
+		// Past the end of the current window?
+		if ((this->m_pView == NULL) || (this->m_nWritten >= this->m_nViewOffset + this->m_dwViewSize)) {
+			if (!this->MapWindow(this->m_nWritten)) {
+				this->m_nErrors++;
+				return;
+			}
+		}
+
+		dwCopy = (DWORD) (this->m_nViewOffset + this->m_dwViewSize - this->m_nWritten);
+		if (dwCopy > dwBytes) dwCopy = dwBytes;
+
+		memcpy(this->m_pView + (this->m_nWritten - this->m_nViewOffset), pData, dwCopy);
+		this->m_nWritten += dwCopy;
+		pData += dwCopy;
+		dwBytes -= dwCopy;
+	}
+}
+
+void CMappedFileSink::Close() {
+#ifdef _WIN32
+	LONG lHigh;
+#endif
+
+	if (this->IsOpen()) {
+		this->Unmap();
+#ifdef _WIN32
+		if (this->m_hMapping != NULL) {
+			::CloseHandle(this->m_hMapping);
+			this->m_hMapping = NULL;
+		}
+
+		// Cut the preallocated tail.
+		lHigh = (LONG) (this->m_nWritten >> 32);
+		::SetFilePointer(this->m_hFile, (LONG) (this->m_nWritten & 0xFFFFFFFF), &lHigh, FILE_BEGIN);
+		::SetEndOfFile(this->m_hFile);
+
+		::CloseHandle(this->m_hFile);
+		this->m_hFile = INVALID_HANDLE_VALUE;
+#else
+		// Cut the preallocated tail.
+		if (::ftruncate(this->m_nFile, (off_t) this->m_nWritten) != 0) this->m_nErrors++;
+
+		::close(this->m_nFile);
+		this->m_nFile = -1;
+#endif
+	}
+}
+
+void CMappedFileSink::PrintStats() {
+	printf("Output: %" QFMT_I64 "u bytes (mapped), %d extent(s) of %d MB, %d window(s) mapped, %d error(s).\n",
+		this->m_nWritten, this->m_nExtents, SINK_MAP_EXTENT / (1024 * 1024), this->m_nWindows, this->m_nErrors);
+}
+
+#endif
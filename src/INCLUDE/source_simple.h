@@ -0,0 +1,541 @@
+#ifndef ___SOURCE_SIMPLE_H_INCLUDED___
+#define ___SOURCE_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <math.h>
+#include <string>
+#include <vector>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/capture_simple.h"
+#include "INCLUDE/file_simple.h"
+#include "INCLUDE/counters_simple.h"
+
+using namespace std;
+
+// Signals of the CSyntheticSource.
+#define SYNTH_TONE 0
+#define SYNTH_NOISE 1
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Capture source without a sound card: a thread fills the buffers of its ring
+// (see Produce()) and passes them to the IReceiver exactly as CWaveINSimple
+// does, as CPCMBuffer's which come back once released. Runs everywhere, so the
+// encoding and output path can be run and measured on any machine.
+//
+// In real-time mode a buffer is delivered when a device would deliver it (i.e.
+// when its sound is "recorded"). If the receiver still holds all the buffers
+// then, the sound is lost, same as with a device, and counted (see
+// GetOverruns()). Otherwise buffers are delivered as fast as the receiver
+// gives them back, which measures the throughput of the pipeline.
+//
+// Subclasses must call Stop() in their destructor (the thread calls Produce()).
+class CPacedSource: public ICaptureSource, public IPCMBufferOwner {
+private:
+	string		m_strName;
+	bool		m_isRealTime;
+
+	// Format of the sound, set by the subclass via SetFormat().
+	DWORD		m_nSamplesPerSec;
+	WORD		m_nChannels;
+	WORD		m_wBitsPerSample;
+	WORD		m_nBlockAlign;
+
+	IReceiver	*m_Receiver;
+	QMutex		m_qLocalMutex;
+
+	// One block of memory for the ring, plus one buffer where the sound lost
+	// in real-time mode goes.
+	LPSTR		m_pBufferMemory;
+	DWORD		m_dwBufferMemorySize;
+	DWORD		m_dwBufferLength;
+	vector<CPCMBuffer> m_arrPCMBuffers;
+
+	// Buffers given back by the receiver, see Recycle(). For each buffer, when
+	// it was passed to the receiver (QClock microseconds).
+	vector<CPCMBuffer*> m_arrFree;
+	vector<LONGLONG> m_arrLentMicros;
+	QMutex		m_qFreeMutex;
+	QEvent		m_qBufferFree;
+
+	QThread		m_qThread;
+	QEvent		m_qWake;
+	QEvent		m_qFinished;
+	volatile LONG m_isStopping;
+
+	// Statistics.
+	volatile LONG m_nBuffers;
+	volatile LONG m_nOverruns;
+	ULONGLONG	m_nFrames;
+	LONGLONG	m_nMaxLateMicros;
+
+	// When the latest recording was started (QClock microseconds), and how
+	// long its start and stop took, see GetStartLatency().
+	LONGLONG	m_nStartMicros;
+	volatile LONG m_nStartLatency;
+	volatile LONG m_nStopLatency;
+
+	// Same as a device's ("capture.<name>"), counted over all recordings.
+	CCaptureCounters m_Counters;
+
+	// Takes a free buffer. Waits for one unless bWait is false, returns NULL
+	// if none is free (or stop was requested).
+	CPCMBuffer *TakeBuffer(bool bWait);
+
+	void _Stop();
+
+	static DWORD WINAPI sourceProc(LPVOID arg);
+
+protected:
+	// pName - name of the source, see GetName().
+	CPacedSource(const TCHAR *pName, bool isRealTime);
+
+	void SetFormat(DWORD nSamplesPerSec, WORD nChannels, WORD wBitsPerSample);
+
+	// Called on the source's thread. Fills up to dwBytes (a multiple of the block
+	// alignment) of lpData, returns how many bytes were filled, zero at the end of
+	// the sound.
+	virtual DWORD Produce(LPSTR lpData, DWORD dwBytes) = 0;
+
+	// Called by Start(), so every recording gives the same sound.
+	virtual void Rewind() = 0;
+
+	// Whether the subclass can produce sound of the format, see SelectFormat().
+	// By default only the format it was given.
+	virtual bool CanProduce(DWORD nSamplesPerSec, WORD nChannels, WORD wBitsPerSample) const;
+
+public:
+	virtual ~CPacedSource();
+
+	virtual const TCHAR *GetName() const { return this->m_strName.c_str(); };
+
+	// See ICaptureSource. Does nothing if the source is already running.
+	virtual void Start(IReceiver *pReceiver, UINT nBuffers = 2, UINT nBufferMillis = 2000);
+	virtual void Stop();
+
+	virtual DWORD CalcBufferLength(UINT nBufferMillis) const;
+
+	virtual DWORD GetSampleRate() const { return this->m_nSamplesPerSec; };
+	virtual WORD GetChannels() const { return this->m_nChannels; };
+	virtual WORD GetBitsPerSample() const { return this->m_wBitsPerSample; };
+
+	// See ICaptureSource.
+	virtual bool SelectFormat(DWORD nSampleRate, WORD nChannels, WORD nBitsPerSample);
+
+	// Called when the last reference to a buffer is released.
+	virtual void Recycle(CPCMBuffer *pBuffer);
+
+	// Waits until the whole sound was delivered (or stop was requested).
+	// Returns FALSE if dwMilliseconds elapsed first.
+	BOOL WaitForEnd(DWORD dwMilliseconds = INFINITE) { return this->m_qFinished.Wait(dwMilliseconds); };
+
+	// Buffers delivered, and buffers lost in real-time mode (the receiver held all of them).
+	LONG GetBuffers() { return QAtomicLoad(&this->m_nBuffers); };
+	LONG GetOverruns() { return QAtomicLoad(&this->m_nOverruns); };
+
+	// Sample frames delivered (or lost) by the last (or current) recording.
+	ULONGLONG GetFrames() const { return this->m_nFrames; };
+
+	// How late (in microseconds) the latest real-time buffer was delivered.
+	LONGLONG GetMaxLateMicros() const { return this->m_nMaxLateMicros; };
+
+	// Same as CWaveINSimple's: microseconds from the latest Start() until its
+	// first buffer reached the receiver, and from the latest Stop() until
+	// every buffer was back (-1 - not yet).
+	LONG GetStartLatency() { return QAtomicLoad(&this->m_nStartLatency); };
+	LONG GetStopLatency() { return QAtomicLoad(&this->m_nStopLatency); };
+
+	// Returns counters of the source, readable while it runs.
+	CCaptureCounters& GetCounters() { return this->m_Counters; };
+};
+///////////////////////////////////////////////////////////////////////////
+// Replays the sound of a WAV (or raw PCM) file, see CWaveFile. Only integer
+// PCM is replayed, it is delivered as it is in the file.
+class CWaveFileSource: public CPacedSource {
+private:
+	CWaveFile	m_File;
+	ULONGLONG	m_nPosition;
+	bool		m_isLooping;
+
+protected:
+	virtual DWORD Produce(LPSTR lpData, DWORD dwBytes);
+	virtual void Rewind() { this->m_nPosition = 0; };
+
+public:
+	// isLooping - if true, the file is replayed over and over until Stop().
+	// Throws if the file can't be opened or isn't PCM.
+	CWaveFileSource(const TCHAR *pFileName, bool isRealTime = true, bool isLooping = false);
+	~CWaveFileSource() { this->Stop(); };
+};
+///////////////////////////////////////////////////////////////////////////
+// Generates sound: a sine tone (SYNTH_TONE) of nFrequency Hz, or white noise
+// (SYNTH_NOISE) from a fixed seed, so every run gives exactly the same
+// samples. Same signal on all channels for the tone, independent noise.
+// 16-bit unless another depth (8 or 24 bits) is selected, see SelectFormat().
+class CSyntheticSource: public CPacedSource {
+private:
+	int			m_nSignal;
+	UINT		m_nFrequency;
+	UINT		m_nSeconds;
+	ULONGLONG	m_nPosition;
+	DWORD		m_dwSeed;
+
+protected:
+	virtual DWORD Produce(LPSTR lpData, DWORD dwBytes);
+	virtual void Rewind() { this->m_nPosition = 0; this->m_dwSeed = 1; };
+	virtual bool CanProduce(DWORD nSamplesPerSec, WORD nChannels, WORD wBitsPerSample) const;
+
+public:
+	// nSeconds - length of the sound, zero - endless (until Stop()).
+	CSyntheticSource(int nSignal = SYNTH_TONE, UINT nFrequency = 440, UINT nSeconds = 0, bool isRealTime = true,
+		DWORD nSamplesPerSec = 44100, WORD nChannels = 2);
+	~CSyntheticSource() { this->Stop(); };
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CPacedSource::CPacedSource(const TCHAR *pName, bool isRealTime): m_strName(pName), m_qLocalMutex(), m_qFreeMutex(),
+		m_qBufferFree(), m_qThread(), m_qWake(), m_qFinished(TRUE, FALSE), m_Counters(pName) {
+	this->m_isRealTime = isRealTime;
+	this->m_Receiver = NULL;
+	this->m_pBufferMemory = NULL;
+	this->m_dwBufferMemorySize = 0;
+	this->m_dwBufferLength = 0;
+	this->m_isStopping = 0;
+	this->m_nBuffers = 0;
+	this->m_nOverruns = 0;
+	this->m_nFrames = 0;
+	this->m_nMaxLateMicros = 0;
+	this->m_nStartMicros = 0;
+	this->m_nStartLatency = -1;
+	this->m_nStopLatency = -1;
+	this->SetFormat(44100, 2, 16);
+}
+
+CPacedSource::~CPacedSource() {
+	this->Stop();
+	if (this->m_pBufferMemory != NULL) VirtualFree(this->m_pBufferMemory, 0, MEM_RELEASE);
+}
+
+void CPacedSource::SetFormat(DWORD nSamplesPerSec, WORD nChannels, WORD wBitsPerSample) {
+	this->m_nSamplesPerSec = nSamplesPerSec;
+	this->m_nChannels = nChannels;
+	this->m_wBitsPerSample = wBitsPerSample;
+	this->m_nBlockAlign = nChannels * ((wBitsPerSample + 7) / 8);
+}
+
+bool CPacedSource::CanProduce(DWORD nSamplesPerSec, WORD nChannels, WORD wBitsPerSample) const {
+	return (nSamplesPerSec == this->m_nSamplesPerSec) && (nChannels == this->m_nChannels) &&
+		(wBitsPerSample == this->m_wBitsPerSample);
+}
+
+bool CPacedSource::SelectFormat(DWORD nSampleRate, WORD nChannels, WORD nBitsPerSample) {
+	bool isSelected = false;
+
+	this->m_qLocalMutex.Lock();
+
+	// A sound which ended on its own counts as stopped, its thread only waits to be joined.
+	if ((!this->m_qThread.IsStarted() || this->m_qFinished.Wait(0)) &&
+		this->CanProduce(nSampleRate, nChannels, nBitsPerSample)) {
+		this->SetFormat(nSampleRate, nChannels, nBitsPerSample);
+		isSelected = true;
+	}
+
+	this->m_qLocalMutex.Unlock();
+	return isSelected;
+}
+
+DWORD CPacedSource::CalcBufferLength(UINT nBufferMillis) const {
+	return BufferLengthOf(this->m_nSamplesPerSec * this->m_nBlockAlign, this->m_nBlockAlign, nBufferMillis);
+}
+
+void CPacedSource::Start(IReceiver *pReceiver, UINT nBuffers, UINT nBufferMillis) {
+	DWORD dwTotal;
+	UINT i;
+
+	this->m_qLocalMutex.Lock();
+
+	// The previous sound may have ended on its own, the thread is still to be joined then.
+	if (this->m_qThread.IsStarted() && this->m_qFinished.Wait(0)) this->_Stop();
+
+	if (!this->m_qThread.IsStarted()) {
+		this->m_nStartMicros = QClock::Micros();
+		QAtomicStore(&this->m_nStartLatency, -1);
+		QAtomicStore(&this->m_nStopLatency, -1);
+
+		if (nBuffers < CAPTURE_MIN_BUFFERS) nBuffers = CAPTURE_MIN_BUFFERS;
+		else if (nBuffers > CAPTURE_MAX_BUFFERS) nBuffers = CAPTURE_MAX_BUFFERS;
+
+		this->m_dwBufferLength = this->CalcBufferLength(nBufferMillis);
+		dwTotal = this->m_dwBufferLength * (nBuffers + 1);
+
+		if (dwTotal > this->m_dwBufferMemorySize) {
+			if (this->m_pBufferMemory != NULL) VirtualFree(this->m_pBufferMemory, 0, MEM_RELEASE);
+			this->m_dwBufferMemorySize = 0;
+
+			this->m_pBufferMemory = (LPSTR) VirtualAlloc(0, dwTotal, MEM_COMMIT, PAGE_READWRITE);
+			if (this->m_pBufferMemory == NULL) {
+				this->m_qLocalMutex.Unlock();
+				throw "Can't allocate memory for PCM buffer.";
+			}
+			this->m_dwBufferMemorySize = dwTotal;
+		}
+
+		// Nothing is lent out, the thread isn't running.
+		this->m_arrPCMBuffers.resize(nBuffers);
+		this->m_arrLentMicros.assign(nBuffers, 0);
+		this->m_arrFree.clear();
+		for (i = 0; i < nBuffers; i++) {
+			this->m_arrPCMBuffers[i].Attach(this, NULL, this->m_pBufferMemory + i * this->m_dwBufferLength);
+			this->m_arrFree.push_back(&this->m_arrPCMBuffers[i]);
+		}
+
+		this->Rewind();
+		this->m_Receiver = pReceiver;
+		this->m_isStopping = 0;
+		this->m_nBuffers = 0;
+		this->m_nOverruns = 0;
+		this->m_nFrames = 0;
+		this->m_nMaxLateMicros = 0;
+		this->m_qWake.Reset();
+		this->m_qFinished.Reset();
+
+		try {
+			this->m_qThread.Start(&CPacedSource::sourceProc, (LPVOID) this);
+		}
+		catch (const char *) {
+			this->m_Receiver = NULL;
+			this->m_qLocalMutex.Unlock();
+			throw;
+		}
+	}
+
+	this->m_qLocalMutex.Unlock();
+}
+
+void CPacedSource::Stop() {
+	this->m_qLocalMutex.Lock();
+	this->_Stop();
+	this->m_qLocalMutex.Unlock();
+}
+
+void CPacedSource::_Stop() {
+	LONGLONG nStart = QClock::Micros();
+
+	if (this->m_qThread.IsStarted()) {
+		QAtomicStore(&this->m_isStopping, 1);
+		this->m_qWake.Set();
+		this->m_qBufferFree.Set();
+		this->m_qThread.Join();
+
+		// Wait for the receiver to give back every buffer, same as CWaveINSimple
+		// waits for its WAVEHDR's.
+		for (;;) {
+			this->m_qFreeMutex.Lock();
+			bool isAllFree = (this->m_arrFree.size() == this->m_arrPCMBuffers.size());
+			this->m_qFreeMutex.Unlock();
+			if (isAllFree) break;
+			this->m_qBufferFree.Wait();
+		}
+		this->m_Receiver = NULL;
+
+		QAtomicStore(&this->m_nStopLatency, (LONG) (QClock::Micros() - nStart));
+		this->m_Counters.Stop.Add(QAtomicLoad(&this->m_nStopLatency));
+	}
+}
+
+void CPacedSource::Recycle(CPCMBuffer *pBuffer) {
+	LONGLONG nStart = QClock::Micros();
+
+	this->m_qFreeMutex.Lock();
+	this->m_arrFree.push_back(pBuffer);
+	this->m_qFreeMutex.Unlock();
+	this->m_qBufferFree.Set();
+
+	this->m_Counters.Requeue.Add(QClock::Micros() - nStart);
+	this->m_Counters.OutsideQueue.Add(QClock::Micros() - this->m_arrLentMicros[pBuffer - &this->m_arrPCMBuffers[0]]);
+}
+
+CPCMBuffer *CPacedSource::TakeBuffer(bool bWait) {
+	CPCMBuffer *pBuffer = NULL;
+
+	for (;;) {
+		this->m_qFreeMutex.Lock();
+		if (!this->m_arrFree.empty()) {
+			pBuffer = this->m_arrFree.back();
+			this->m_arrFree.pop_back();
+		}
+		this->m_qFreeMutex.Unlock();
+
+		if ((pBuffer != NULL) || !bWait || QAtomicLoad(&this->m_isStopping)) return pBuffer;
+		this->m_qBufferFree.Wait();
+	}
+}
+
+DWORD WINAPI CPacedSource::sourceProc(LPVOID arg) {
+	CPacedSource *_this = (CPacedSource *) arg;
+	CPCMBuffer *pBuffer;
+	LONGLONG nStart, nDue, nNow;
+	DWORD dwFrames = _this->m_dwBufferLength / _this->m_nBlockAlign;
+	DWORD dwBytes;
+	LPSTR lpLost = _this->m_pBufferMemory + _this->m_arrPCMBuffers.size() * _this->m_dwBufferLength;
+
+	nStart = QClock::Micros();
+
+	while (!QAtomicLoad(&_this->m_isStopping)) {
+		if (_this->m_isRealTime) {
+			// A device delivers the buffer once its sound is recorded.
+			nDue = nStart + (LONGLONG) ((_this->m_nFrames + dwFrames) * 1000000 / _this->m_nSamplesPerSec);
+			nNow = QClock::Micros();
+			if (nNow < nDue) {
+				_this->m_qWake.Wait((DWORD) ((nDue - nNow + 999) / 1000));
+				continue;
+			}
+			if (nNow - nDue > _this->m_nMaxLateMicros) _this->m_nMaxLateMicros = nNow - nDue;
+
+			pBuffer = _this->TakeBuffer(false);
+			if (pBuffer == NULL) {
+				// Receiver holds everything, this sound is lost.
+				dwBytes = _this->Produce(lpLost, _this->m_dwBufferLength);
+				if (dwBytes == 0) break;
+				QAtomicInc(&_this->m_nOverruns);
+				_this->m_Counters.Overruns.Inc();
+				_this->m_nFrames += dwBytes / _this->m_nBlockAlign;
+				continue;
+			}
+		}
+		else {
+			pBuffer = _this->TakeBuffer(true);
+			if (pBuffer == NULL) break;
+		}
+
+		dwBytes = _this->Produce(pBuffer->Memory(), _this->m_dwBufferLength);
+		// Filled, same as a device's buffer coming back from the driver.
+		_this->m_arrLentMicros[pBuffer - &_this->m_arrPCMBuffers[0]] = QClock::Micros();
+		if (dwBytes == 0) {
+			_this->Recycle(pBuffer);
+			break;
+		}
+		_this->m_nFrames += dwBytes / _this->m_nBlockAlign;
+		QAtomicInc(&_this->m_nBuffers);
+		_this->m_Counters.Buffers.Inc();
+		_this->m_Counters.Bytes.Add(dwBytes);
+
+		// First sound of the recording.
+		if (QAtomicLoad(&_this->m_nStartLatency) < 0) {
+			QAtomicStore(&_this->m_nStartLatency, (LONG) (QClock::Micros() - _this->m_nStartMicros));
+			_this->m_Counters.Start.Add(QAtomicLoad(&_this->m_nStartLatency));
+		}
+
+		// Buffer comes back (via Recycle()) once the receiver releases it.
+		pBuffer->Fill(dwBytes);
+		if (_this->m_Receiver != NULL) _this->m_Receiver->ReceivePCM(pBuffer);
+		pBuffer->Release();
+	}
+
+	_this->m_qFinished.Set();
+	return(0);
+}
+///////////////////////////////////////////////////////////////////////////
+CWaveFileSource::CWaveFileSource(const TCHAR *pFileName, bool isRealTime, bool isLooping):
+		CPacedSource(pFileName, isRealTime), m_File(pFileName) {
+	if ((this->m_File.FormatTag() != WAVE_FILE_PCM) ||
+		(this->m_File.BlockAlign() != this->m_File.Channels() * ((this->m_File.BitsPerSample() + 7) / 8))) {
+		throw "Only integer PCM WAV files can be replayed.";
+	}
+
+	this->SetFormat(this->m_File.SampleRate(), this->m_File.Channels(), this->m_File.BitsPerSample());
+	this->m_nPosition = 0;
+	this->m_isLooping = isLooping;
+}
+
+DWORD CWaveFileSource::Produce(LPSTR lpData, DWORD dwBytes) {
+	DWORD dwDone = 0, dwChunk;
+	const BYTE *pSound;
+
+	while (dwDone < dwBytes) {
+		if (this->m_nPosition >= this->m_File.DataSize()) {
+			if (!this->m_isLooping || (this->m_File.DataSize() == 0)) break;
+			this->m_nPosition = 0;
+		}
+
+		dwChunk = dwBytes - dwDone;
+		if (dwChunk > MAPPED_FILE_WINDOW) dwChunk = MAPPED_FILE_WINDOW;
+		if (dwChunk > this->m_File.DataSize() - this->m_nPosition) dwChunk = (DWORD) (this->m_File.DataSize() - this->m_nPosition);
+
+		pSound = this->m_File.Read(this->m_nPosition, dwChunk);
+		if (pSound == NULL) break;
+		memcpy(lpData + dwDone, pSound, dwChunk);
+
+		this->m_nPosition += dwChunk;
+		dwDone += dwChunk;
+	}
+	return dwDone;
+}
+///////////////////////////////////////////////////////////////////////////
+CSyntheticSource::CSyntheticSource(int nSignal, UINT nFrequency, UINT nSeconds, bool isRealTime,
+								   DWORD nSamplesPerSec, WORD nChannels):
+		CPacedSource((nSignal == SYNTH_NOISE) ? "noise" : "tone", isRealTime) {
+	this->SetFormat(nSamplesPerSec, nChannels, 16);
+	this->m_nSignal = nSignal;
+	this->m_nFrequency = nFrequency;
+	this->m_nSeconds = nSeconds;
+	this->Rewind();
+}
+
+bool CSyntheticSource::CanProduce(DWORD nSamplesPerSec, WORD nChannels, WORD wBitsPerSample) const {
+	return (nSamplesPerSec >= 1000) && (nSamplesPerSec <= 192000) && (nChannels >= 1) && (nChannels <= 8) &&
+		((wBitsPerSample == 8) || (wBitsPerSample == 16) || (wBitsPerSample == 24));
+}
+
+DWORD CSyntheticSource::Produce(LPSTR lpData, DWORD dwBytes) {
+	PBYTE pOut = (PBYTE) lpData;
+	WORD nChannels = this->GetChannels();
+	WORD nBytes = (this->GetBitsPerSample() + 7) / 8;
+	DWORD dwFrames = dwBytes / (nChannels * nBytes);
+	ULONGLONG nTotalFrames = (ULONGLONG) this->m_nSeconds * this->GetSampleRate();
+	DWORD i;
+	WORD c;
+	SHORT nSample = 0;
+	double dStep = 2.0 * 3.14159265358979323846 * this->m_nFrequency / this->GetSampleRate();
+
+	if ((nTotalFrames > 0) && (this->m_nPosition + dwFrames > nTotalFrames)) {
+		dwFrames = (DWORD) (nTotalFrames - this->m_nPosition);
+	}
+
+	for (i = 0; i < dwFrames; i++) {
+		if (this->m_nSignal == SYNTH_TONE) {
+			// Phase from the position (not accumulated), so there is no drift. Half of the full scale.
+			nSample = (SHORT) (16383.0 * sin(dStep * (double) ((this->m_nPosition + i) % this->GetSampleRate())));
+		}
+
+		for (c = 0; c < nChannels; c++) {
+			if (this->m_nSignal != SYNTH_TONE) {
+				// Numerical Recipes' LCG, high bits are the random ones.
+				this->m_dwSeed = this->m_dwSeed * 1664525 + 1013904223;
+				nSample = (SHORT) (this->m_dwSeed >> 16) / 2;
+			}
+
+			// The 16-bit sample, at the other depths its top bits.
+			switch (nBytes) {
+			case 1:
+				*pOut++ = (BYTE) ((nSample >> 8) + 128);
+				break;
+			case 2:
+				*(PSHORT) pOut = nSample;
+				pOut += 2;
+				break;
+			default:
+				*pOut++ = 0;
+				*pOut++ = (BYTE) nSample;
+				*pOut++ = (BYTE) (nSample >> 8);
+				break;
+			}
+		}
+	}
+
+	this->m_nPosition += dwFrames;
+	return dwFrames * nChannels * nBytes;
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef ___STATS_SIMPLE_H_INCLUDED___
+#define ___STATS_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <stdio.h>
+#include "INCLUDE/sync_simple.h"
+
+// Values below this are counted exactly, above it each power of two is
+// split into HISTOGRAM_SUB_BUCKETS equal buckets (so the error is below 12.5%).
+#define HISTOGRAM_LINEAR 16
+#define HISTOGRAM_SUB_BUCKETS 8
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR + (64 - 4) * HISTOGRAM_SUB_BUCKETS)
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Histogram of latencies (or any other non-negative values), e.g. in
+// microseconds measured with QClock. Memory is fixed, adding a value costs a
+// few instructions, percentiles are approximate (see HISTOGRAM_SUB_BUCKETS).
+// Thread safe.
+class CLatencyHistogram {
+private:
+	QMutex		m_qMutex;
+	LONGLONG	m_arrBuckets[HISTOGRAM_BUCKETS];
+	LONGLONG	m_nCount;
+	LONGLONG	m_nSum;
+	LONGLONG	m_nMax;
+
+public:
+	// Bucket of a value, also used by the lock-free CCounterHistogram.
+	static int BucketOf(ULONGLONG nValue);
+
+	// Smallest value which falls into the bucket after nBucket.
+	static ULONGLONG BucketLimit(int nBucket);
+
+	CLatencyHistogram();
+	~CLatencyHistogram() {};
+
+	void Add(LONGLONG nValue);
+	void Clear();
+
+	LONGLONG Count();
+	LONGLONG Max();
+	double Mean();
+
+	// Returns the value below which dPercent (0..100) of the added values are,
+	// rounded up to the end of its bucket (but never above Max()).
+	LONGLONG Percentile(double dPercent);
+
+	// Prints "<pName>: n=..., mean=..., p50=..., p90=..., p99=..., max=..." with values
+	// divided by dScale (e.g. 1000 for microseconds printed as milliseconds).
+	void Print(const char *pName, const char *pUnit = "us", double dScale = 1.0);
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+CLatencyHistogram::CLatencyHistogram(): m_qMutex() {
+	this->Clear();
+}
+
+int CLatencyHistogram::BucketOf(ULONGLONG nValue) {
+	int nExponent = 0;
+
+	if (nValue < HISTOGRAM_LINEAR) return (int) nValue;
+
+	while ((nValue >> nExponent) > 1) nExponent++;
+	// nExponent >= 4 here, top 3 bits below the leading one pick the sub-bucket.
+	return HISTOGRAM_LINEAR + (nExponent - 4) * HISTOGRAM_SUB_BUCKETS +
+		(int) ((nValue >> (nExponent - 3)) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+ULONGLONG CLatencyHistogram::BucketLimit(int nBucket) {
+	int nExponent, nSub;
+
+	if (nBucket < HISTOGRAM_LINEAR) return (ULONGLONG) nBucket + 1;
+
+	nExponent = (nBucket - HISTOGRAM_LINEAR) / HISTOGRAM_SUB_BUCKETS + 4;
+	nSub = (nBucket - HISTOGRAM_LINEAR) % HISTOGRAM_SUB_BUCKETS;
+	return ((ULONGLONG) (HISTOGRAM_SUB_BUCKETS + nSub + 1)) << (nExponent - 3);
+}
+
+void CLatencyHistogram::Add(LONGLONG nValue) {
+	if (nValue < 0) nValue = 0;
+
+	this->m_qMutex.Lock();
+	this->m_arrBuckets[BucketOf((ULONGLONG) nValue)]++;
+	this->m_nCount++;
+	this->m_nSum += nValue;
+	if (nValue > this->m_nMax) this->m_nMax = nValue;
+	this->m_qMutex.Unlock();
+}
+
+void CLatencyHistogram::Clear() {
+	this->m_qMutex.Lock();
+	ZeroMemory(this->m_arrBuckets, sizeof(this->m_arrBuckets));
+	this->m_nCount = 0;
+	this->m_nSum = 0;
+	this->m_nMax = 0;
+	this->m_qMutex.Unlock();
+}
+
+LONGLONG CLatencyHistogram::Count() {
+	LONGLONG nCount;
+
+	this->m_qMutex.Lock();
+	nCount = this->m_nCount;
+	this->m_qMutex.Unlock();
+	return nCount;
+}
+
+LONGLONG CLatencyHistogram::Max() {
+	LONGLONG nMax;
+
+	this->m_qMutex.Lock();
+	nMax = this->m_nMax;
+	this->m_qMutex.Unlock();
+	return nMax;
+}
+
+double CLatencyHistogram::Mean() {
+	double dMean;
+
+	this->m_qMutex.Lock();
+	dMean = (this->m_nCount > 0) ? (double) this->m_nSum / this->m_nCount : 0.0;
+	this->m_qMutex.Unlock();
+	return dMean;
+}
+
+LONGLONG CLatencyHistogram::Percentile(double dPercent) {
+	LONGLONG nRank, nSeen = 0, nValue = 0;
+	int i;
+
+	this->m_qMutex.Lock();
+
+	if (this->m_nCount > 0) {
+		// Rank of the wanted value, 1-based.
+		nRank = (LONGLONG) (dPercent / 100.0 * this->m_nCount + 0.5);
+		if (nRank < 1) nRank = 1;
+		if (nRank > this->m_nCount) nRank = this->m_nCount;
+
+		for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+			nSeen += this->m_arrBuckets[i];
+			if (nSeen >= nRank) {
+				nValue = (LONGLONG) BucketLimit(i) - 1;
+				break;
+			}
+		}
+		if (nValue > this->m_nMax) nValue = this->m_nMax;
+	}
+
+	this->m_qMutex.Unlock();
+	return nValue;
+}
+
+void CLatencyHistogram::Print(const char *pName, const char *pUnit, double dScale) {
+	printf("%s: n=%" QFMT_I64 "d, mean=%.2f%s, p50=%.2f%s, p90=%.2f%s, p99=%.2f%s, max=%.2f%s\n", pName,
+		this->Count(), this->Mean() / dScale, pUnit,
+		this->Percentile(50) / dScale, pUnit, this->Percentile(90) / dScale, pUnit,
+		this->Percentile(99) / dScale, pUnit, this->Max() / dScale, pUnit);
+}
+
+#endif
@@ -0,0 +1,673 @@
+#ifndef ___STREAM_SIMPLE_H_INCLUDED___
+#define ___STREAM_SIMPLE_H_INCLUDED___
+
+#include "INCLUDE/platform_simple.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/mp3_simple.h"
+#include "INCLUDE/stats_simple.h"
+#include "INCLUDE/sink_simple.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+using namespace std;
+
+// Default size of the ring of encoded sound shared by all listeners (about
+// a minute at 128Kbps). A listener further behind than half of it is
+// disconnected.
+#define STREAM_RING_SIZE (1024 * 1024)
+
+// Frames a new listener gets right away, from before it connected, so its
+// player starts without waiting for the buffer to fill (0.2s at 44100Hz).
+#define STREAM_BURST_FRAMES 8
+
+#define STREAM_MAX_CLIENTS 512
+
+// Send buffer of each listener's socket. Kept small, whatever the kernel
+// buffers is latency the listener hears.
+#define STREAM_SNDBUF (64 * 1024)
+
+// Longest the server thread sleeps. New sound (and Close()) wake it up right
+// away, see CMP3StreamServer::Wake(), this is only a safety net.
+#define STREAM_TICK_MS 1000
+
+// Longest HTTP request taken from a listener.
+#define STREAM_REQUEST_SIZE 1024
+
+// States of a listener, see STREAM_CLIENT.
+#define STREAM_CLIENT_FREE 0
+#define STREAM_CLIENT_REQUEST 1
+#define STREAM_CLIENT_RESPONSE 2
+#define STREAM_CLIENT_AUDIO 3
+
+#ifdef _WIN32
+typedef int socklen_t;
+#define STREAM_SEND_FLAGS 0
+#else
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define closesocket ::close
+// A listener gone away is an error of send(), not a SIGPIPE.
+#define STREAM_SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+//---------------------------- CLASS -------------------------------------------------------------
+
+// Small socket helpers shared by the server and its test clients (see mp3_bench -stream).
+class CStreamSocket {
+public:
+	// WSAStartup/WSACleanup on Windows, nothing elsewhere.
+	static bool Startup();
+	static void Cleanup();
+
+	static void SetNonBlocking(SOCKET hSocket);
+
+	// True if the last send()/recv() failed only because it would have blocked.
+	static bool WouldBlock();
+
+	// Connects two non-blocking sockets over the loopback (there is no
+	// socketpair() on Windows), so another thread can wake up a select().
+	// Returns false if that fails.
+	static bool Pair(SOCKET &hRead, SOCKET &hWrite);
+};
+
+// Listener of a CMP3StreamServer. Nothing of the sound is copied per
+// listener, only its position in the shared ring is kept.
+struct STREAM_CLIENT {
+	SOCKET		hSocket;
+	int			nState;
+
+	// STREAM_CLIENT_AUDIO: position (in bytes of the whole stream) of the next
+	// byte to send, -1 until the listener joins at a frame boundary.
+	LONGLONG	nCursor;
+	LONGLONG	nConnectMicros;
+
+	// STREAM_CLIENT_REQUEST: bytes of the request received so far,
+	// STREAM_CLIENT_RESPONSE: bytes of the response sent so far.
+	DWORD		dwDone;
+	char		szRequest[STREAM_REQUEST_SIZE];
+};
+
+// Output serving the encoded sound over HTTP, the way Icecast/SHOUTcast
+// servers do (any GET gets the stream as audio/mpeg), to many listeners at once.
+//
+// ReceiveMP3() only copies the sound into one ring, shared by all listeners,
+// and never waits for the network. One server thread accepts the listeners
+// and sends each one what it hasn't got yet, straight from the ring, on
+// non-blocking sockets multiplexed with select(). A new listener joins at
+// a frame boundary (a few frames back, see STREAM_BURST_FRAMES), which is
+// enough for a player since CMP3Simple encodes every frame on its own.
+//
+// A listener falling behind by more than half of the ring (a slow or stuck
+// connection) is disconnected, so it never holds back the others or the
+// encoder.
+class CMP3StreamServer: public IMP3Sink {
+private:
+	SOCKET		m_hListen;
+	WORD		m_nPort;
+	string		m_strResponse;
+
+	// The ring, and how much of the stream has been written into it (the
+	// ring holds its last m_dwRingSize bytes). Written by ReceiveMP3() only.
+	PBYTE		m_pRing;
+	DWORD		m_dwRingSize;
+	volatile LONGLONG m_nWritten;
+
+	// Start of the frame new listeners join at, -1 before the first frame.
+	volatile LONGLONG m_nJoin;
+
+	// Frame parsing (on the producer's side): position of the next frame
+	// header, and the starts of the last m_nBurstFrames + 1 frames.
+	LONGLONG	m_nNextFrame;
+	vector<LONGLONG> m_arrFrames;
+	DWORD		m_nFrames;
+	DWORD		m_nBurstFrames;
+
+	vector<STREAM_CLIENT> m_arrClients;
+	DWORD		m_nClients;
+
+	QThread		m_qThread;
+	volatile LONG m_isStopping;
+
+	// A byte sent to m_hWakeWrite ends the server thread's select() (it
+	// watches m_hWakeRead). m_isWoken - a byte is on its way, no need for another.
+	SOCKET		m_hWakeRead;
+	SOCKET		m_hWakeWrite;
+	volatile LONG m_isWoken;
+
+	// Wakes the server thread up, from any thread.
+	void Wake();
+
+	// Statistics, updated by the server thread.
+	LONG		m_nAccepted;
+	LONG		m_nRefused;
+	LONG		m_nEvicted;
+	LONG		m_nPeakClients;
+	ULONGLONG	m_nBytesSent;
+	CLatencyHistogram m_hJoinLatency;
+
+	// Returns the byte of the stream at nPosition (still in the ring).
+	BYTE At(LONGLONG nPosition) const { return this->m_pRing[nPosition % this->m_dwRingSize]; }
+
+	// Records the frames which start in the bytes just written.
+	void ParseFrames();
+
+	void Accept();
+	void Drop(STREAM_CLIENT &client, bool isEvicted);
+	void ReadRequest(STREAM_CLIENT &client);
+	void SendResponse(STREAM_CLIENT &client);
+	void SendAudio(STREAM_CLIENT &client, LONGLONG nWritten);
+
+	static DWORD WINAPI serverProc(LPVOID arg);
+
+public:
+	// nPort - TCP port to listen on (all interfaces), zero - any free one (see GetPort()).
+	//
+	// dwBitRate, pName - announced to the listeners (icy-br, icy-name).
+	//
+	// dwRingSize - size of the shared ring (STREAM_RING_SIZE by default).
+	//
+	// nBurstFrames - frames from before a listener connected it gets right
+	// away, zero - it starts at the next frame (the lowest latency).
+	//
+	// nMaxClients - listeners served at once, more are refused.
+	//
+	// Throws if the port can't be listened on.
+	CMP3StreamServer(WORD nPort, DWORD dwBitRate, const char *pName = "mp3_stream",
+		DWORD dwRingSize = STREAM_RING_SIZE, DWORD nBurstFrames = STREAM_BURST_FRAMES,
+		DWORD nMaxClients = STREAM_MAX_CLIENTS);
+	~CMP3StreamServer();
+
+	// Copies the sound into the ring, never waits for the listeners.
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes);
+
+	// Stops serving, disconnects every listener. Safe to call more than once.
+	virtual void Close();
+
+	// Port listened on.
+	WORD GetPort() const { return this->m_nPort; }
+
+	// Bytes of the stream received so far.
+	LONGLONG GetWritten() { return QAtomicLoad64(&this->m_nWritten); }
+
+	// Listeners accepted, refused (too many), disconnected for falling behind,
+	// and the most served at once. Exact after Close().
+	LONG GetAccepted() const { return this->m_nAccepted; }
+	LONG GetRefused() const { return this->m_nRefused; }
+	LONG GetEvicted() const { return this->m_nEvicted; }
+	LONG GetPeakClients() const { return this->m_nPeakClients; }
+
+	// Time from a listener's connection until it joined the stream, in microseconds.
+	CLatencyHistogram& GetJoinLatency() { return this->m_hJoinLatency; }
+
+	// Prints the statistics above.
+	virtual void PrintStats();
+};
+
+//---------------------------- IMPLEMENTATION ----------------------------------------------------
+
+#ifdef _WIN32
+bool CStreamSocket::Startup() {
+	WSADATA wsaData;
+
+	return ::WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+}
+
+void CStreamSocket::Cleanup() {
+	::WSACleanup();
+}
+
+void CStreamSocket::SetNonBlocking(SOCKET hSocket) {
+	u_long nNonBlocking = 1;
+
+	::ioctlsocket(hSocket, FIONBIO, &nNonBlocking);
+}
+
+bool CStreamSocket::WouldBlock() {
+	return ::WSAGetLastError() == WSAEWOULDBLOCK;
+}
+#else
+bool CStreamSocket::Startup() {
+	return true;
+}
+
+void CStreamSocket::Cleanup() {
+}
+
+void CStreamSocket::SetNonBlocking(SOCKET hSocket) {
+	::fcntl(hSocket, F_SETFL, ::fcntl(hSocket, F_GETFL, 0) | O_NONBLOCK);
+}
+
+bool CStreamSocket::WouldBlock() {
+	return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+}
+#endif
+
+bool CStreamSocket::Pair(SOCKET &hRead, SOCKET &hWrite) {
+	struct sockaddr_in addr;
+	socklen_t nAddrLen = sizeof(addr);
+	int nNoDelay = 1;
+	SOCKET hListen;
+
+	hRead = hWrite = INVALID_SOCKET;
+	hListen = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (hListen == INVALID_SOCKET) return false;
+
+	ZeroMemory(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	if ((::bind(hListen, (struct sockaddr *) &addr, sizeof(addr)) != SOCKET_ERROR) &&
+		(::listen(hListen, 1) != SOCKET_ERROR) &&
+		(::getsockname(hListen, (struct sockaddr *) &addr, &nAddrLen) != SOCKET_ERROR)) {
+		hWrite = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if ((hWrite != INVALID_SOCKET) && (::connect(hWrite, (struct sockaddr *) &addr, sizeof(addr)) != SOCKET_ERROR)) {
+			hRead = ::accept(hListen, NULL, NULL);
+		}
+	}
+	closesocket(hListen);
+
+	if (hRead == INVALID_SOCKET) {
+		if (hWrite != INVALID_SOCKET) closesocket(hWrite);
+		hWrite = INVALID_SOCKET;
+		return false;
+	}
+	SetNonBlocking(hRead);
+	SetNonBlocking(hWrite);
+	::setsockopt(hWrite, IPPROTO_TCP, TCP_NODELAY, (const char *) &nNoDelay, sizeof(nNoDelay));
+	return true;
+}
+///////////////////////////////////////////////////////////////////////////
+CMP3StreamServer::CMP3StreamServer(WORD nPort, DWORD dwBitRate, const char *pName,
+								   DWORD dwRingSize, DWORD nBurstFrames, DWORD nMaxClients):
+		m_arrFrames(nBurstFrames + 1, 0), m_arrClients(), m_qThread(), m_hJoinLatency() {
+	struct sockaddr_in addr;
+	socklen_t nAddrLen = sizeof(addr);
+	char szHeader[512];
+	int nReuse = 1;
+	DWORD i;
+
+	this->m_hListen = INVALID_SOCKET;
+	this->m_dwRingSize = (dwRingSize > 0) ? dwRingSize : STREAM_RING_SIZE;
+	this->m_nWritten = 0;
+	this->m_nJoin = -1;
+	this->m_nNextFrame = 0;
+	this->m_nFrames = 0;
+	this->m_nBurstFrames = nBurstFrames;
+	this->m_nClients = 0;
+	this->m_isStopping = 0;
+	this->m_hWakeRead = INVALID_SOCKET;
+	this->m_hWakeWrite = INVALID_SOCKET;
+	this->m_isWoken = 0;
+	this->m_nAccepted = 0;
+	this->m_nRefused = 0;
+	this->m_nEvicted = 0;
+	this->m_nPeakClients = 0;
+	this->m_nBytesSent = 0;
+
+	// select() can't watch more sockets (the listening and the waking one included).
+	if (nMaxClients > FD_SETSIZE - 2) nMaxClients = FD_SETSIZE - 2;
+	this->m_arrClients.resize((nMaxClients > 0) ? nMaxClients : 1);
+	for (i = 0; i < this->m_arrClients.size(); i++) {
+		this->m_arrClients[i].hSocket = INVALID_SOCKET;
+		this->m_arrClients[i].nState = STREAM_CLIENT_FREE;
+	}
+
+	// The same response for everybody, sent before the sound.
+	_snprintf(szHeader, sizeof(szHeader) - 1, "HTTP/1.0 200 OK\r\nContent-Type: audio/mpeg\r\n"
+		"Cache-Control: no-cache\r\nConnection: close\r\nicy-name: %s\r\nicy-br: %u\r\nicy-pub: 0\r\n\r\n",
+		pName, (UINT) dwBitRate);
+	szHeader[sizeof(szHeader) - 1] = 0;
+	this->m_strResponse = szHeader;
+
+	if (!CStreamSocket::Startup()) throw "Can't initialize sockets.";
+
+	this->m_hListen = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (this->m_hListen == INVALID_SOCKET) {
+		CStreamSocket::Cleanup();
+		throw "Can't create the streaming socket.";
+	}
+	::setsockopt(this->m_hListen, SOL_SOCKET, SO_REUSEADDR, (const char *) &nReuse, sizeof(nReuse));
+
+	ZeroMemory(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(nPort);
+	if ((::bind(this->m_hListen, (struct sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR) ||
+		(::listen(this->m_hListen, SOMAXCONN) == SOCKET_ERROR) ||
+		(::getsockname(this->m_hListen, (struct sockaddr *) &addr, &nAddrLen) == SOCKET_ERROR)) {
+		closesocket(this->m_hListen);
+		CStreamSocket::Cleanup();
+		throw "Can't listen on the streaming port.";
+	}
+	this->m_nPort = ntohs(addr.sin_port);
+	CStreamSocket::SetNonBlocking(this->m_hListen);
+
+	if (!CStreamSocket::Pair(this->m_hWakeRead, this->m_hWakeWrite)) {
+		closesocket(this->m_hListen);
+		CStreamSocket::Cleanup();
+		throw "Can't create the streaming server's wake-up sockets.";
+	}
+
+	this->m_pRing = new BYTE[this->m_dwRingSize];
+
+	try {
+		this->m_qThread.Start(&CMP3StreamServer::serverProc, (LPVOID) this);
+	}
+	catch (const char *) {
+		closesocket(this->m_hListen);
+		closesocket(this->m_hWakeRead);
+		closesocket(this->m_hWakeWrite);
+		CStreamSocket::Cleanup();
+		delete[] this->m_pRing;
+		throw;
+	}
+}
+
+CMP3StreamServer::~CMP3StreamServer() {
+	this->Close();
+	delete[] this->m_pRing;
+}
+
+void CMP3StreamServer::ReceiveMP3(PBYTE pData, DWORD dwBytes) {
+	LONGLONG nWritten = this->m_nWritten;
+	DWORD dwOffset, dwCopy;
+
+	while (dwBytes > 0) {
+		dwOffset = (DWORD) (nWritten % this->m_dwRingSize);
+		dwCopy = this->m_dwRingSize - dwOffset;
+		if (dwCopy > dwBytes) dwCopy = dwBytes;
+
+		memcpy(this->m_pRing + dwOffset, pData, dwCopy);
+		nWritten += dwCopy;
+		pData += dwCopy;
+		dwBytes -= dwCopy;
+	}
+
+	// Published after the copy, the server thread never sends beyond it.
+	QAtomicStore64(&this->m_nWritten, nWritten);
+	this->ParseFrames();
+	this->Wake();
+}
+
+void CMP3StreamServer::Wake() {
+	char cWake = 0;
+
+	// The server thread clears m_isWoken only after it took the bytes sent,
+	// and looks at m_nWritten after that, so nothing published before this is missed.
+	if (QAtomicLoad(&this->m_isWoken)) return;
+	QAtomicStore(&this->m_isWoken, 1);
+	::send(this->m_hWakeWrite, &cWake, 1, STREAM_SEND_FLAGS);
+}
+
+void CMP3StreamServer::ParseFrames() {
+	LONGLONG nWritten = this->m_nWritten;
+	BYTE arrHeader[4];
+	DWORD dwLength, nSlots = (DWORD) this->m_arrFrames.size();
+	int i;
+
+	// Headers are read back from the ring, so one split between two calls needs no carry.
+	while (this->m_nNextFrame + 4 <= nWritten) {
+		for (i = 0; i < 4; i++) arrHeader[i] = this->At(this->m_nNextFrame + i);
+
+		dwLength = CMP3Frame::Length(arrHeader);
+		if (dwLength == 0) {
+			// Not a frame (e.g. a tag), look one byte further.
+			this->m_nNextFrame++;
+			continue;
+		}
+
+		this->m_arrFrames[this->m_nFrames % nSlots] = this->m_nNextFrame;
+		this->m_nFrames++;
+		this->m_nNextFrame += dwLength;
+
+		// The oldest of the last nSlots frames.
+		QAtomicStore64(&this->m_nJoin, this->m_arrFrames[(this->m_nFrames < nSlots) ? 0 : this->m_nFrames % nSlots]);
+	}
+}
+
+void CMP3StreamServer::Accept() {
+	SOCKET hSocket;
+	int nNoDelay = 1, nSendBuffer = STREAM_SNDBUF;
+	DWORD i;
+
+	for (;;) {
+		hSocket = ::accept(this->m_hListen, NULL, NULL);
+		if (hSocket == INVALID_SOCKET) return;
+
+#ifndef _WIN32
+		// select() can't watch it.
+		if (hSocket >= FD_SETSIZE) {
+			closesocket(hSocket);
+			this->m_nRefused++;
+			continue;
+		}
+#endif
+		for (i = 0; i < this->m_arrClients.size(); i++) {
+			if (this->m_arrClients[i].nState == STREAM_CLIENT_FREE) break;
+		}
+		if (i == this->m_arrClients.size()) {
+			closesocket(hSocket);
+			this->m_nRefused++;
+			continue;
+		}
+
+		CStreamSocket::SetNonBlocking(hSocket);
+		::setsockopt(hSocket, IPPROTO_TCP, TCP_NODELAY, (const char *) &nNoDelay, sizeof(nNoDelay));
+		::setsockopt(hSocket, SOL_SOCKET, SO_SNDBUF, (const char *) &nSendBuffer, sizeof(nSendBuffer));
+
+		STREAM_CLIENT &client = this->m_arrClients[i];
+		client.hSocket = hSocket;
+		client.nState = STREAM_CLIENT_REQUEST;
+		client.nCursor = -1;
+		client.nConnectMicros = QClock::Micros();
+		client.dwDone = 0;
+
+		this->m_nAccepted++;
+		this->m_nClients++;
+		if ((LONG) this->m_nClients > this->m_nPeakClients) this->m_nPeakClients = (LONG) this->m_nClients;
+	}
+}
+
+void CMP3StreamServer::Drop(STREAM_CLIENT &client, bool isEvicted) {
+	closesocket(client.hSocket);
+	client.hSocket = INVALID_SOCKET;
+	client.nState = STREAM_CLIENT_FREE;
+	this->m_nClients--;
+	if (isEvicted) this->m_nEvicted++;
+}
+
+void CMP3StreamServer::ReadRequest(STREAM_CLIENT &client) {
+	char arrDiscard[256];
+	int nRead;
+
+	if (client.nState != STREAM_CLIENT_REQUEST) {
+		// Nothing more is expected, only the end of the connection.
+		nRead = ::recv(client.hSocket, arrDiscard, sizeof(arrDiscard), 0);
+		if ((nRead == 0) || ((nRead < 0) && !CStreamSocket::WouldBlock())) this->Drop(client, false);
+		return;
+	}
+
+	nRead = ::recv(client.hSocket, client.szRequest + client.dwDone, STREAM_REQUEST_SIZE - 1 - client.dwDone, 0);
+	if ((nRead == 0) || ((nRead < 0) && !CStreamSocket::WouldBlock())) {
+		this->Drop(client, false);
+		return;
+	}
+	if (nRead < 0) return;
+
+	client.dwDone += nRead;
+	client.szRequest[client.dwDone] = 0;
+	if (::strstr(client.szRequest, "\r\n\r\n") == NULL) {
+		// Too long to be a player's request.
+		if (client.dwDone == STREAM_REQUEST_SIZE - 1) this->Drop(client, false);
+		return;
+	}
+
+	if (::strncmp(client.szRequest, "GET ", 4) != 0) {
+		this->Drop(client, false);
+		return;
+	}
+	client.nState = STREAM_CLIENT_RESPONSE;
+	client.dwDone = 0;
+}
+
+void CMP3StreamServer::SendResponse(STREAM_CLIENT &client) {
+	int nSent;
+
+	nSent = ::send(client.hSocket, this->m_strResponse.c_str() + client.dwDone,
+		(int) this->m_strResponse.size() - client.dwDone, STREAM_SEND_FLAGS);
+	if (nSent < 0) {
+		if (!CStreamSocket::WouldBlock()) this->Drop(client, false);
+		return;
+	}
+
+	client.dwDone += nSent;
+	if (client.dwDone == this->m_strResponse.size()) client.nState = STREAM_CLIENT_AUDIO;
+}
+
+void CMP3StreamServer::SendAudio(STREAM_CLIENT &client, LONGLONG nWritten) {
+	LONGLONG nStart;
+	DWORD dwOffset, dwSend;
+	int nSent;
+
+	while (client.nCursor < nWritten) {
+		nStart = client.nCursor;
+		dwOffset = (DWORD) (client.nCursor % this->m_dwRingSize);
+		dwSend = this->m_dwRingSize - dwOffset;
+		if (dwSend > nWritten - client.nCursor) dwSend = (DWORD) (nWritten - client.nCursor);
+
+		nSent = ::send(client.hSocket, (const char *) this->m_pRing + dwOffset, (int) dwSend, STREAM_SEND_FLAGS);
+		if (nSent < 0) {
+			if (!CStreamSocket::WouldBlock()) this->Drop(client, false);
+			return;
+		}
+
+		// The encoder went round the ring meanwhile, what was sent may be torn.
+		if (QAtomicLoad64(&this->m_nWritten) - this->m_dwRingSize > nStart) {
+			this->Drop(client, true);
+			return;
+		}
+
+		client.nCursor += nSent;
+		this->m_nBytesSent += nSent;
+		if ((DWORD) nSent < dwSend) return;
+	}
+}
+
+DWORD WINAPI CMP3StreamServer::serverProc(LPVOID arg) {
+	CMP3StreamServer *_this = (CMP3StreamServer *) arg;
+	fd_set setRead, setWrite;
+	struct timeval tv;
+	LONGLONG nWritten, nJoin;
+	char arrWake[64];
+	SOCKET hMax;
+	DWORD i;
+
+	while (!QAtomicLoad(&_this->m_isStopping)) {
+		nWritten = QAtomicLoad64(&_this->m_nWritten);
+		nJoin = QAtomicLoad64(&_this->m_nJoin);
+
+		FD_ZERO(&setRead);
+		FD_ZERO(&setWrite);
+		FD_SET(_this->m_hListen, &setRead);
+		FD_SET(_this->m_hWakeRead, &setRead);
+		hMax = (_this->m_hListen > _this->m_hWakeRead) ? _this->m_hListen : _this->m_hWakeRead;
+
+		for (i = 0; i < _this->m_arrClients.size(); i++) {
+			STREAM_CLIENT &client = _this->m_arrClients[i];
+
+			if (client.nState == STREAM_CLIENT_FREE) continue;
+
+			// Joins at a frame boundary, as soon as there is one. A listener
+			// there before the sound gets all of it.
+			if ((client.nState == STREAM_CLIENT_AUDIO) && (client.nCursor < 0) && ((nJoin >= 0) || (nWritten == 0))) {
+				client.nCursor = (nJoin >= 0) ? nJoin : 0;
+				_this->m_hJoinLatency.Add(QClock::Micros() - client.nConnectMicros);
+			}
+
+			// Too far behind (even if its socket is stuck), the ring will soon
+			// overwrite what it hasn't got yet.
+			if ((client.nState == STREAM_CLIENT_AUDIO) && (client.nCursor >= 0) &&
+				(nWritten - client.nCursor > _this->m_dwRingSize / 2)) {
+				_this->Drop(client, true);
+				continue;
+			}
+
+			FD_SET(client.hSocket, &setRead);
+			if ((client.nState == STREAM_CLIENT_RESPONSE) ||
+				((client.nState == STREAM_CLIENT_AUDIO) && (client.nCursor >= 0) && (client.nCursor < nWritten))) {
+				FD_SET(client.hSocket, &setWrite);
+			}
+			if (client.hSocket > hMax) hMax = client.hSocket;
+		}
+
+		// Wakes up for the sockets, or as soon as there is new sound (see Wake()).
+		tv.tv_sec = STREAM_TICK_MS / 1000;
+		tv.tv_usec = (STREAM_TICK_MS % 1000) * 1000;
+		if (::select((int) hMax + 1, &setRead, &setWrite, NULL, &tv) <= 0) continue;
+
+		if (FD_ISSET(_this->m_hWakeRead, &setRead)) {
+			while (::recv(_this->m_hWakeRead, arrWake, sizeof(arrWake), 0) > 0);
+			QAtomicStore(&_this->m_isWoken, 0);
+		}
+		if (FD_ISSET(_this->m_hListen, &setRead)) _this->Accept();
+
+		for (i = 0; i < _this->m_arrClients.size(); i++) {
+			STREAM_CLIENT &client = _this->m_arrClients[i];
+
+			// Listeners accepted just now aren't in the sets yet.
+			if (client.nState == STREAM_CLIENT_FREE) continue;
+
+			if (FD_ISSET(client.hSocket, &setRead)) _this->ReadRequest(client);
+			if (client.nState == STREAM_CLIENT_FREE) continue;
+
+			if (FD_ISSET(client.hSocket, &setWrite)) {
+				if (client.nState == STREAM_CLIENT_RESPONSE) _this->SendResponse(client);
+				else if (client.nState == STREAM_CLIENT_AUDIO) _this->SendAudio(client, QAtomicLoad64(&_this->m_nWritten));
+			}
+		}
+	}
+	return(0);
+}
+
+void CMP3StreamServer::Close() {
+	DWORD i;
+
+	if (this->m_qThread.IsStarted()) {
+		QAtomicStore(&this->m_isStopping, 1);
+		QAtomicStore(&this->m_isWoken, 0);
+		this->Wake();
+		this->m_qThread.Join();
+
+		for (i = 0; i < this->m_arrClients.size(); i++) {
+			if (this->m_arrClients[i].nState != STREAM_CLIENT_FREE) this->Drop(this->m_arrClients[i], false);
+		}
+		closesocket(this->m_hListen);
+		this->m_hListen = INVALID_SOCKET;
+		closesocket(this->m_hWakeRead);
+		closesocket(this->m_hWakeWrite);
+		this->m_hWakeRead = this->m_hWakeWrite = INVALID_SOCKET;
+		CStreamSocket::Cleanup();
+	}
+}
+
+void CMP3StreamServer::PrintStats() {
+	printf("Streaming: %" QFMT_I64 "u bytes sent, %d listener(s) (at most %d at once), %d refused, %d disconnected for falling behind.\n",
+		this->m_nBytesSent, this->m_nAccepted, this->m_nPeakClients, this->m_nRefused, this->m_nEvicted);
+	this->m_hJoinLatency.Print("Join latency", "ms", 1000.0);
+}
+
+#endif
@@ -1,8 +1,21 @@
 #ifndef ___SYNC_SIMPLE_H_INCLUDED___
 #define ___SYNC_SIMPLE_H_INCLUDED___
 
+#include "INCLUDE/platform_simple.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+#endif
+
+// Each class below has a Win32 implementation and a POSIX (pthreads) one,
+// with the same behaviour, so code using them builds on both.
+
 //---------------------------- CLASS -------------------------------------------------------------
 
+#ifdef _WIN32
+
 // Implementation of the critical section
 class QMutex {
 private:
@@ -30,6 +43,15 @@ public:
 		this->m_lMaximumCount = lMaximumCount;
 	}
 
+	// Semaphore with lInitialCount free slots, e.g. QSemaphore(LONG_MAX, 0) counts
+	// queued jobs: producer calls Dec() per job, consumer waits in Inc().
+	QSemaphore(long lMaximumCount, long lInitialCount) {
+		this->m_hSemaphore = ::CreateSemaphore(NULL, lInitialCount, lMaximumCount, NULL);
+
+		if (this->m_hSemaphore == NULL) throw "Can't create semaphore.";
+		this->m_lMaximumCount = lMaximumCount;
+	}
+
 	~QSemaphore() { ::CloseHandle(this->m_hSemaphore); }
 
 	long GetMaximumCount() const { return this->m_lMaximumCount; }
@@ -38,6 +60,78 @@ public:
 	void Dec(long lCount) { ::ReleaseSemaphore(this->m_hSemaphore, lCount, NULL); }
 };
 
+#else
+
+// Implementation of the critical section (recursive, same as on Windows).
+class QMutex {
+private:
+	pthread_mutex_t	m_Mutex;
+
+public:
+	QMutex() {
+		pthread_mutexattr_t attr;
+
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&this->m_Mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+	~QMutex() { pthread_mutex_destroy(&this->m_Mutex); }
+	void Lock() { pthread_mutex_lock(&this->m_Mutex); }
+	BOOL TryLock() { return pthread_mutex_trylock(&this->m_Mutex) == 0; }
+	void Unlock() { pthread_mutex_unlock(&this->m_Mutex); }
+};
+
+// Implementation of the semaphore, same counting as the Win32 one.
+class QSemaphore {
+private:
+	pthread_mutex_t	m_Mutex;
+	pthread_cond_t	m_Cond;
+	long m_lCount;
+	long m_lMaximumCount;
+
+	void Init(long lMaximumCount, long lInitialCount) {
+		pthread_mutex_init(&this->m_Mutex, NULL);
+		pthread_cond_init(&this->m_Cond, NULL);
+		this->m_lCount = lInitialCount;
+		this->m_lMaximumCount = lMaximumCount;
+	}
+
+public:
+	QSemaphore(long lMaximumCount) { this->Init(lMaximumCount, lMaximumCount); }
+
+	// See the Win32 version.
+	QSemaphore(long lMaximumCount, long lInitialCount) { this->Init(lMaximumCount, lInitialCount); }
+
+	~QSemaphore() {
+		pthread_cond_destroy(&this->m_Cond);
+		pthread_mutex_destroy(&this->m_Mutex);
+	}
+
+	long GetMaximumCount() const { return this->m_lMaximumCount; }
+
+	void Inc() {
+		pthread_mutex_lock(&this->m_Mutex);
+		while (this->m_lCount == 0) pthread_cond_wait(&this->m_Cond, &this->m_Mutex);
+		this->m_lCount--;
+		pthread_mutex_unlock(&this->m_Mutex);
+	}
+
+	void Dec() { this->Dec(1); }
+
+	void Dec(long lCount) {
+		pthread_mutex_lock(&this->m_Mutex);
+		// Same as ReleaseSemaphore, nothing is released beyond the maximum.
+		if (this->m_lCount + lCount <= this->m_lMaximumCount) {
+			this->m_lCount += lCount;
+			pthread_cond_broadcast(&this->m_Cond);
+		}
+		pthread_mutex_unlock(&this->m_Mutex);
+	}
+};
+
+#endif
+
 
 // Implementation of the read-write mutex.
 // Multiple threads can have read access at the same time.
@@ -63,6 +157,265 @@ public:
 	int maxReaders() const { return m_qSemaphore.GetMaximumCount(); }
 };
 
+#ifdef _WIN32
+
+// Implementation of the event (auto-reset by default).
+// Used to wake up a worker thread instead of polling with Sleep().
+class QEvent {
+private:
+	HANDLE	m_hEvent;
+
+public:
+	QEvent(BOOL bManualReset = FALSE, BOOL bInitialState = FALSE) {
+		this->m_hEvent = ::CreateEvent(NULL, bManualReset, bInitialState, NULL);
+
+		if (this->m_hEvent == NULL) throw "Can't create event.";
+	}
+
+	~QEvent() { ::CloseHandle(this->m_hEvent); }
+
+	void Set() { ::SetEvent(this->m_hEvent); }
+	void Reset() { ::ResetEvent(this->m_hEvent); }
+
+	// Returns TRUE if event was signaled, FALSE if dwMilliseconds elapsed.
+	BOOL Wait(DWORD dwMilliseconds = INFINITE) {
+		return ::WaitForSingleObject(this->m_hEvent, dwMilliseconds) == WAIT_OBJECT_0;
+	}
+};
+
+// Implementation of the joinable worker thread.
+class QThread {
+private:
+	HANDLE	m_hThread;
+
+public:
+	QThread(): m_hThread(NULL) {}
+	~QThread() { this->Join(); }
+
+	// Starts pRoutine(arg) in a new thread. Throws if thread can't be created.
+	void Start(LPTHREAD_START_ROUTINE pRoutine, LPVOID arg) {
+		DWORD dwThreadID;
+
+		if (this->m_hThread != NULL) throw "Thread is already running.";
+		this->m_hThread = ::CreateThread(NULL, 0, pRoutine, arg, 0, &dwThreadID);
+		if (this->m_hThread == NULL) throw "Can't create thread.";
+	}
+
+	// Waits for the thread to finish. Safe to call more than once.
+	void Join() {
+		if (this->m_hThread != NULL) {
+			::WaitForSingleObject(this->m_hThread, INFINITE);
+			::CloseHandle(this->m_hThread);
+			this->m_hThread = NULL;
+		}
+	}
+
+	bool IsStarted() const { return this->m_hThread != NULL; }
+};
+
+#else
+
+// Implementation of the event (auto-reset by default), see the Win32 version.
+class QEvent {
+private:
+	pthread_mutex_t	m_Mutex;
+	pthread_cond_t	m_Cond;
+	bool	m_isManualReset;
+	bool	m_isSignaled;
+
+public:
+	QEvent(BOOL bManualReset = FALSE, BOOL bInitialState = FALSE) {
+		pthread_mutex_init(&this->m_Mutex, NULL);
+		pthread_cond_init(&this->m_Cond, NULL);
+		this->m_isManualReset = (bManualReset != FALSE);
+		this->m_isSignaled = (bInitialState != FALSE);
+	}
+
+	~QEvent() {
+		pthread_cond_destroy(&this->m_Cond);
+		pthread_mutex_destroy(&this->m_Mutex);
+	}
+
+	void Set() {
+		pthread_mutex_lock(&this->m_Mutex);
+		this->m_isSignaled = true;
+		// Manual-reset wakes everybody, auto-reset only one waiter.
+		if (this->m_isManualReset) pthread_cond_broadcast(&this->m_Cond);
+		else pthread_cond_signal(&this->m_Cond);
+		pthread_mutex_unlock(&this->m_Mutex);
+	}
+
+	void Reset() {
+		pthread_mutex_lock(&this->m_Mutex);
+		this->m_isSignaled = false;
+		pthread_mutex_unlock(&this->m_Mutex);
+	}
+
+	// Returns TRUE if event was signaled, FALSE if dwMilliseconds elapsed.
+	BOOL Wait(DWORD dwMilliseconds = INFINITE) {
+		struct timespec tsDeadline;
+		struct timeval tv;
+		BOOL bSignaled;
+
+		if (dwMilliseconds != INFINITE) {
+			::gettimeofday(&tv, NULL);
+			tsDeadline.tv_sec = tv.tv_sec + dwMilliseconds / 1000;
+			tsDeadline.tv_nsec = tv.tv_usec * 1000 + (long) (dwMilliseconds % 1000) * 1000000;
+			if (tsDeadline.tv_nsec >= 1000000000) {
+				tsDeadline.tv_sec++;
+				tsDeadline.tv_nsec -= 1000000000;
+			}
+		}
+
+		pthread_mutex_lock(&this->m_Mutex);
+		while (!this->m_isSignaled) {
+			if (dwMilliseconds == INFINITE) pthread_cond_wait(&this->m_Cond, &this->m_Mutex);
+			else if (pthread_cond_timedwait(&this->m_Cond, &this->m_Mutex, &tsDeadline) == ETIMEDOUT) break;
+		}
+		bSignaled = this->m_isSignaled;
+		if (bSignaled && !this->m_isManualReset) this->m_isSignaled = false;
+		pthread_mutex_unlock(&this->m_Mutex);
+
+		return bSignaled;
+	}
+};
+
+// Implementation of the joinable worker thread, see the Win32 version.
+class QThread {
+private:
+	pthread_t	m_Thread;
+	bool		m_isStarted;
+
+	// pthreads want void *(*)(void *), so the routine and its argument are
+	// passed through this.
+	struct START_ARGS {
+		LPTHREAD_START_ROUTINE pRoutine;
+		LPVOID arg;
+	};
+
+	static void *startProc(void *pArgs) {
+		START_ARGS args = *(START_ARGS *) pArgs;
+
+		delete (START_ARGS *) pArgs;
+		args.pRoutine(args.arg);
+		return NULL;
+	}
+
+public:
+	QThread(): m_isStarted(false) {}
+	~QThread() { this->Join(); }
+
+	// Starts pRoutine(arg) in a new thread. Throws if thread can't be created.
+	void Start(LPTHREAD_START_ROUTINE pRoutine, LPVOID arg) {
+		START_ARGS *pArgs;
+
+		if (this->m_isStarted) throw "Thread is already running.";
+		pArgs = new START_ARGS;
+		pArgs->pRoutine = pRoutine;
+		pArgs->arg = arg;
+		if (pthread_create(&this->m_Thread, NULL, &QThread::startProc, pArgs) != 0) {
+			delete pArgs;
+			throw "Can't create thread.";
+		}
+		this->m_isStarted = true;
+	}
+
+	// Waits for the thread to finish. Safe to call more than once.
+	void Join() {
+		if (this->m_isStarted) {
+			pthread_join(this->m_Thread, NULL);
+			this->m_isStarted = false;
+		}
+	}
+
+	bool IsStarted() const { return this->m_isStarted; }
+};
+
+#endif
+
+// High resolution clock, for timing and statistics.
+class QClock {
+public:
+#ifndef _WIN32
+	static LONGLONG Micros() {
+		struct timespec ts;
+
+		::clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (LONGLONG) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+#else
+	// Returns microseconds elapsed since some fixed moment (e.g. system start).
+	static LONGLONG Micros() {
+		static LONGLONG nFrequency = 0;
+		LARGE_INTEGER li;
+
+		if (nFrequency == 0) {
+			::QueryPerformanceFrequency(&li);
+			nFrequency = li.QuadPart;
+		}
+		::QueryPerformanceCounter(&li);
+		return (LONGLONG) (li.QuadPart / nFrequency) * 1000000 + ((li.QuadPart % nFrequency) * 1000000) / nFrequency;
+	}
+#endif
+};
+
+// Atomic access to a LONG shared between threads. Interlocked functions
+// are full memory barriers, so a QAtomicStore() by one thread "releases"
+// everything written before it to the thread doing the QAtomicLoad().
+// The POSIX version uses the sequentially consistent GCC/Clang builtins.
+#ifdef _WIN32
+inline LONG QAtomicLoad(volatile LONG *pValue) { return ::InterlockedCompareExchange(pValue, 0, 0); }
+inline void QAtomicStore(volatile LONG *pValue, LONG lValue) { ::InterlockedExchange(pValue, lValue); }
+inline LONG QAtomicInc(volatile LONG *pValue) { return ::InterlockedIncrement(pValue); }
+inline LONG QAtomicDec(volatile LONG *pValue) { return ::InterlockedDecrement(pValue); }
+inline LONG QAtomicAdd(volatile LONG *pValue, LONG lValue) { return ::InterlockedExchangeAdd(pValue, lValue) + lValue; }
+#else
+inline LONG QAtomicLoad(volatile LONG *pValue) { return __atomic_load_n(pValue, __ATOMIC_SEQ_CST); }
+inline void QAtomicStore(volatile LONG *pValue, LONG lValue) { __atomic_store_n(pValue, lValue, __ATOMIC_SEQ_CST); }
+inline LONG QAtomicInc(volatile LONG *pValue) { return __atomic_add_fetch(pValue, 1, __ATOMIC_SEQ_CST); }
+inline LONG QAtomicDec(volatile LONG *pValue) { return __atomic_sub_fetch(pValue, 1, __ATOMIC_SEQ_CST); }
+inline LONG QAtomicAdd(volatile LONG *pValue, LONG lValue) { return __atomic_add_fetch(pValue, lValue, __ATOMIC_SEQ_CST); }
+#endif
+
+// Same for a LONGLONG (e.g. byte counts and sums of microseconds, which
+// overflow a LONG). On 32-bit Windows only the compare-exchange is atomic
+// for 64 bits, so the rest is built on it.
+#ifdef _WIN32
+inline LONGLONG QAtomicLoad64(volatile LONGLONG *pValue) { return ::InterlockedCompareExchange64(pValue, 0, 0); }
+inline LONGLONG QAtomicAdd64(volatile LONGLONG *pValue, LONGLONG lValue) {
+	LONGLONG lOld;
+
+	do {
+		lOld = *pValue;
+	} while (::InterlockedCompareExchange64(pValue, lOld + lValue, lOld) != lOld);
+	return lOld + lValue;
+}
+inline bool QAtomicCAS64(volatile LONGLONG *pValue, LONGLONG lExpected, LONGLONG lValue) {
+	return ::InterlockedCompareExchange64(pValue, lValue, lExpected) == lExpected;
+}
+inline void QAtomicStore64(volatile LONGLONG *pValue, LONGLONG lValue) {
+	LONGLONG lOld;
+
+	do {
+		lOld = *pValue;
+	} while (::InterlockedCompareExchange64(pValue, lValue, lOld) != lOld);
+}
+#else
+inline LONGLONG QAtomicLoad64(volatile LONGLONG *pValue) { return __atomic_load_n(pValue, __ATOMIC_SEQ_CST); }
+inline LONGLONG QAtomicAdd64(volatile LONGLONG *pValue, LONGLONG lValue) { return __atomic_add_fetch(pValue, lValue, __ATOMIC_SEQ_CST); }
+inline bool QAtomicCAS64(volatile LONGLONG *pValue, LONGLONG lExpected, LONGLONG lValue) {
+	return __atomic_compare_exchange_n(pValue, &lExpected, lValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+inline void QAtomicStore64(volatile LONGLONG *pValue, LONGLONG lValue) { __atomic_store_n(pValue, lValue, __ATOMIC_SEQ_CST); }
+#endif
+
+// Raises *pValue to lValue, if lValue is bigger.
+inline void QAtomicMax64(volatile LONGLONG *pValue, LONGLONG lValue) {
+	LONGLONG lOld = QAtomicLoad64(pValue);
+
+	while ((lValue > lOld) && !QAtomicCAS64(pValue, lOld, lValue)) lOld = QAtomicLoad64(pValue);
+}
+
 //---------------------------- IMPLEMENTATION ----------------------------------------------------
 
 #endif
\ No newline at end of file
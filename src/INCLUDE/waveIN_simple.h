@@ -3,6 +3,10 @@
 
 #include <windows.h>
 #include <mmsystem.h>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/capture_simple.h"
+#include "INCLUDE/queue_simple.h"
+#include "INCLUDE/counters_simple.h"
 #include <vector>
 
 using namespace std;
@@ -11,20 +15,46 @@ using namespace std;
 #define CONTINUE_SIG 1
 #define EXIT_SIG 2
 
-//---------------------------- CLASS -------------------------------------------------------------
+// Limits for the capture ring, see CWaveINSimple::Start().
+#define WAVEIN_MIN_BUFFERS CAPTURE_MIN_BUFFERS
+#define WAVEIN_MAX_BUFFERS CAPTURE_MAX_BUFFERS
+#define WAVEIN_MIN_BUFFER_MS CAPTURE_MIN_BUFFER_MS
+#define WAVEIN_MAX_BUFFER_MS CAPTURE_MAX_BUFFER_MS
 
-// See CWaveINSimple::Start(IReceiver *pReceiver) below.
-// Instances of any class extending "IReceiver" will be able to receive raw (PCM)
-// sound from an instance of the CWaveINSimple and process sound via own
-// implementation of the "ReceiveBuffer" method.
+// Limit for the capture I/O threads, see CWaveINSimple::SetIOThreads().
+#define WAVEIN_MAX_IO_THREADS 16
 
-class IReceiver {
-public:
-	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) = 0;
-};
+//---------------------------- CLASS -------------------------------------------------------------
 
 class CWaveINSimple;
 class CMixer;
+
+// Capture I/O thread. WaveIN devices are opened with CALLBACK_THREAD pointing
+// to one of these threads, which receives MM_WIM_DATA and passes every filled
+// WAVEHDR to the device owning it (see WAVEHDR::dwUser). The device only
+// queues it for its own delivery thread, which runs the IReceiver, so all
+// the devices share a few of these threads (see CWaveINSimple::SetIOThreads())
+// and a slow receiver (e.g. encoding in mp3Writer) holds up nothing but its
+// own device. A device is always served by the same thread, so its buffers
+// still reach its IReceiver in the order they were recorded.
+class CWaveINIOThread {
+	friend class CWaveINSimple;
+private:
+	QThread	m_qThread;
+	QEvent	m_qReady;
+	volatile DWORD m_dwThreadID;
+
+	CWaveINIOThread(): m_qThread(), m_qReady(TRUE, FALSE) { this->m_dwThreadID = 0; };
+	~CWaveINIOThread() { this->Stop(); };
+
+	// Starts the thread and waits until its message queue exists, so
+	// waveInOpen() can post to it right away. Throws if that fails.
+	void Start();
+	void Stop();
+
+	// Thread's routine procedure, runs the GetMessage loop.
+	static DWORD WINAPI ioProc(LPVOID arg);
+};
 ///////////////////////////////////////////////////////////////////////////
 // Implementation of the Mixer's Line
 class CMixerLine {
@@ -117,8 +147,10 @@ public:
 ///////////////////////////////////////////////////////////////////////////
 // Via implementation of the CWaveINSimple we get access to the WaveIN
 // devices, or, better saying, to the Wave input devices (capable of
-// recording sound).
-class CWaveINSimple {
+// recording sound). This is the Windows (winmm) implementation of the
+// ICaptureSource, see source_simple.h for the others.
+class CWaveINSimple: public ICaptureSource, public IPCMBufferOwner {
+	friend class CWaveINIOThread;
 private:
 	// Static collection where all WaveIN devices, present in the system,
 	// are saved. See CWaveINSimple::GetDevices()
@@ -126,12 +158,31 @@ private:
 	static QMutex m_qGlobalMutex;
 	static volatile bool m_isDeviceListLoaded;
 
-	// This is thread's routine procedure to which the Windows Low Level
-	// WAVE API passes messages regarding digital audio recording (such
-	// as MM_WIM_DATA, MM_WIM_OPEN, and MM_WIM_CLOSE). Mind that "waveInOpen"
-	// (in CWaveINSimple::_Start()) is called with CALLBACK_THREAD.
-	// Thread is created inside the CWaveINSimple::_Start() call.
-	static DWORD WINAPI waveInProc(LPVOID arg);
+	// Capture I/O threads (NULL - not started yet), m_nIOThreads of them (zero -
+	// one per CPU, up to WAVEIN_MAX_IO_THREADS). Each is created on the first
+	// CWaveINSimple::Start() needing it and stopped by CWaveINSimple::CleanUp().
+	static vector<CWaveINIOThread*> m_arrIOThreads;
+	static UINT m_nIOThreads;
+
+	// Returns the I/O thread serving the device, starting the threads if needed.
+	static CWaveINIOThread& GetIOThread(UINT nWaveDeviceID);
+
+	// Called by the I/O thread for each WAVEHDR returned by the driver (MM_WIM_DATA),
+	// queues it for the delivery thread.
+	void BufferDone(WAVEHDR *pWaveHeader);
+
+	// Passes every queued buffer to the receiver. Called on the delivery thread.
+	void Deliver();
+
+	// Delivery thread's routine procedure, runs while the device records.
+	static DWORD WINAPI deliveryProc(LPVOID arg);
+
+	// Delivers what is still queued and stops the delivery thread.
+	void StopDelivery();
+
+	// Gives the WAVEHDR back to the driver (or counts it as done, if recording
+	// was stopped). Called when the last reference to its CPCMBuffer is released.
+	virtual void Recycle(CPCMBuffer *pBuffer);
 
 	// WaveIN Device's ID. It is used as input parameter for the CMixer
 	// constructor. With this ID we can access Mixer without actually opening
@@ -145,11 +196,31 @@ private:
 	HWAVEIN	m_WaveInHandle;
 
 	// Structure to keep sound's quality settings. Also used when opening WaveIN
-	// device, see CWaveINSimple::_Start().
+	// device, see CWaveINSimple::_Start(). 16-bit, 44KHz, stereo unless
+	// another format is selected, see CWaveINSimple::SelectFormat().
 	WAVEFORMATEX m_waveFormat;
 
-	// Two WAVEHDR's are used for recording (ie, double-buffering).
-	WAVEHDR	m_WaveHeader[2];
+	// Fills the WAVEFORMATEX for integer PCM of the given format.
+	static void InitFormat(WAVEFORMATEX *pFormat, DWORD nSampleRate, WORD nChannels, WORD nBitsPerSample);
+
+	// WAVEHDR's used for recording. By default there are two of them (ie, 
+	// double-buffering), but any number between WAVEIN_MIN_BUFFERS and 
+	// WAVEIN_MAX_BUFFERS may be requested via CWaveINSimple::Start().
+	// Collection is only resized while the device is closed, since the driver
+	// keeps pointers to the queued WAVEHDR's.
+	vector<WAVEHDR> m_arrWaveHeaders;
+
+	// Views of the WAVEHDR's passed to the IReceiver, one per WAVEHDR.
+	vector<CPCMBuffer> m_arrPCMBuffers;
+
+	// How many of the m_arrWaveHeaders were successfully prepared, so
+	// CWaveINSimple::Close() knows how many of them to unprepare.
+	UINT m_nPrepared;
+
+	// One block of memory shared by all WAVEHDR's. It is allocated on first
+	// CWaveINSimple::Start() and re-allocated only if a bigger ring is requested.
+	LPSTR m_pBufferMemory;
+	DWORD m_dwBufferMemorySize;
 
 	// Pointer to a IReceiver object, passed via 
 	// CWaveINSimple::Start(IReceiver *pReceiver), that will be responsible for 
@@ -158,9 +229,37 @@ private:
 	CMixer m_Mixer;
 	QMutex m_qLocalMutex;
 
+	// Counters of the device ("capture.<name>"), see CCaptureCounters. For
+	// each WAVEHDR, when the driver returned it (QClock microseconds).
+	CCaptureCounters m_Counters;
+	vector<LONGLONG> m_arrDoneMicros;
+
+	// WAVEHDR's in the driver's queue right now.
+	volatile LONG m_nQueued;
+
+	// Filled buffers (CPCMBuffer pointers) on their way from the I/O thread to
+	// the delivery thread, a slot for each WAVEHDR there can be.
+	QSPSCRing m_qFilled;
+	QEvent m_qFilledReady;
+	QThread m_qDelivery;
+	volatile LONG m_isDeliveryStopping;
+
 	// These class' attributes are used for communication with thread's routine.
-	volatile int m_SIG;
-	volatile unsigned char m_BuffersDone;
+	volatile LONG m_SIG;
+	// Held by Recycle() from its look at m_SIG until the WAVEHDR is queued, and
+	// by _Stop() around setting EXIT_SIG, so no WAVEHDR reaches the driver
+	// after its waveInReset() (it would never come back).
+	QMutex m_qRequeueMutex;
+	// Counted by whichever thread releases the last reference of a buffer,
+	// which also sets the event, see CWaveINSimple::_Stop().
+	volatile LONG m_BuffersDone;
+	QEvent m_qBufferDone;
+
+	// When the latest recording was started (QClock microseconds), and how
+	// long its start and stop took, see CWaveINSimple::GetStartLatency().
+	LONGLONG m_nStartMicros;
+	volatile LONG m_nStartLatency;
+	volatile LONG m_nStopLatency;
 
 	// Constructor and destructor are declared private (due design). So, there 
 	// is no way to instantiate CWaveINSimple objects directly. To obtain a 
@@ -171,9 +270,13 @@ private:
 
 	void Close(int iLevel);
 
+	// Resizes m_arrWaveHeaders and (re)allocates the sound buffers for the requested
+	// ring. Must be called only while the device is closed.
+	void InitBuffers(UINT nBuffers, UINT nBufferMillis);
+
 	// This method starts recording sound from the WaveIN device. Passed object (derivate from 
 	// IReceiver) will be responsible for further processing of the sound data.
-	void _Start(IReceiver *pReceiver);
+	void _Start(IReceiver *pReceiver, UINT nBuffers, UINT nBufferMillis);
 
 	// This method stops recording.
 	void _Stop();
@@ -191,16 +294,68 @@ public:
 	// no more recording is needed.
 	static void CleanUp();
 
+	// This static method makes the recording devices share this many I/O threads
+	// (1 .. WAVEIN_MAX_IO_THREADS), zero gives one per CPU (the default). They
+	// only hand the buffers over, receivers run on a thread of each device's
+	// own, so even one I/O thread serves dozens of devices. Takes effect from
+	// the next Start() of a device.
+	static void SetIOThreads(UINT nThreads);
+
 	// Wrapper of the _Start() method, for the multithreading version.
 	// This is the actual starter.
-	void Start(IReceiver *pReceiver);
+	//
+	// nBuffers - how many WAVEHDR's are queued to the driver (WAVEIN_MIN_BUFFERS ..
+	// WAVEIN_MAX_BUFFERS).
+	//
+	// nBufferMillis - duration of the sound kept by each WAVEHDR, in milliseconds
+	// (WAVEIN_MIN_BUFFER_MS .. WAVEIN_MAX_BUFFER_MS). Receiver gets the first
+	// buffer only after this time, so keep it small for live monitoring, e.g.
+	// Start(pReceiver, 8, 20) gives 20ms buffers with 160ms of queued head-room.
+	//
+	// Defaults are the classic double-buffering with two seconds per buffer.
+	virtual void Start(IReceiver *pReceiver, UINT nBuffers = 2, UINT nBufferMillis = 2000);
 
 	// Wrapper of the _Stop() method, for the multithreading version
 	// This is the actual stopper.
-	void Stop();
+	virtual void Stop();
 
 	// Returns name of the Device
-	const TCHAR *GetName() const { return this->m_wic.szPname; };
+	virtual const TCHAR *GetName() const { return this->m_wic.szPname; };
+
+	// Returns size (in bytes) of each WAVEHDR's buffer for the given buffer
+	// duration, exactly as CWaveINSimple::Start() will allocate it.
+	virtual DWORD CalcBufferLength(UINT nBufferMillis) const;
+
+	// Format of the recorded sound (16-bit, 44100Hz, stereo by default).
+	virtual DWORD GetSampleRate() const { return this->m_waveFormat.nSamplesPerSec; };
+	virtual WORD GetChannels() const { return this->m_waveFormat.nChannels; };
+	virtual WORD GetBitsPerSample() const { return this->m_waveFormat.wBitsPerSample; };
+
+	// Asks the driver whether the device can record the format, without opening it.
+	bool SupportsFormat(DWORD nSampleRate, WORD nChannels, WORD nBitsPerSample) const;
+
+	// Records the format from the next Start() on, if the device supports it
+	// (see SupportsFormat()) and isn't recording. E.g. 16000Hz, mono, 16-bit
+	// for a voice line moves a sixth of the bytes of the default format.
+	// Use ICaptureSource::MatchFormat() for the nearest supported one.
+	virtual bool SelectFormat(DWORD nSampleRate, WORD nChannels, WORD nBitsPerSample);
+
+	// Returns number of WAVEHDR's used by the last (or current) recording.
+	UINT GetBufferCount() const { return (UINT) this->m_arrWaveHeaders.size(); };
+
+	// Returns size (in bytes) of each WAVEHDR's buffer used by the last (or current) recording.
+	DWORD GetBufferLength() const {
+		return this->m_arrWaveHeaders.empty() ? 0 : this->m_arrWaveHeaders[0].dwBufferLength;
+	};
+
+	// Returns counters of the device, readable while it records.
+	CCaptureCounters& GetCounters() { return this->m_Counters; };
+
+	// Microseconds from the latest Start() until its first buffer reached the
+	// receiver (-1 - not yet), and from the latest Stop() until every buffer
+	// was back and the device closed (-1 - not stopped yet). Any thread.
+	LONG GetStartLatency() { return QAtomicLoad(&this->m_nStartLatency); };
+	LONG GetStopLatency() { return QAtomicLoad(&this->m_nStopLatency); };
 
 	// This method returns and opens Mixer associated with the Device.
 	CMixer& OpenMixer();
@@ -211,6 +366,44 @@ public:
 vector<CWaveINSimple*> CWaveINSimple::m_arrWaveINDevices;
 QMutex CWaveINSimple::m_qGlobalMutex;
 volatile bool CWaveINSimple::m_isDeviceListLoaded = false;
+vector<CWaveINIOThread*> CWaveINSimple::m_arrIOThreads;
+UINT CWaveINSimple::m_nIOThreads = 0;
+
+///////////////////////////////////////////////////////////////////////////
+void CWaveINIOThread::Start() {
+	this->m_qThread.Start(&CWaveINIOThread::ioProc, (LPVOID) this);
+	this->m_qReady.Wait();
+}
+
+void CWaveINIOThread::Stop() {
+	if (this->m_qThread.IsStarted()) {
+		::PostThreadMessage(this->m_dwThreadID, WM_QUIT, 0, 0);
+		this->m_qThread.Join();
+	}
+}
+
+DWORD WINAPI CWaveINIOThread::ioProc(LPVOID arg) {
+	MSG		msg;
+	WAVEHDR	*pWaveHeader;
+	CWaveINIOThread *_this = (CWaveINIOThread *) arg;
+
+	// A thread gets its message queue on the first call to a message function,
+	// make sure it exists before anybody posts to it.
+	::PeekMessage(&msg, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+	_this->m_dwThreadID = ::GetCurrentThreadId();
+	_this->m_qReady.Set();
+
+	while (GetMessage(&msg, 0, 0, 0) == 1) {
+		// A buffer has been filled by the driver, msg.lParam contains a
+		// pointer to the WAVEHDR structure for the filled buffer. MM_WIM_OPEN
+		// and MM_WIM_CLOSE need nothing, see CWaveINSimple::_Start().
+		if (msg.message == MM_WIM_DATA) {
+			pWaveHeader = (WAVEHDR *) msg.lParam;
+			if (pWaveHeader->dwUser != 0) ((CWaveINSimple *) pWaveHeader->dwUser)->BufferDone(pWaveHeader);
+		}
+	}
+	return(0);
+}
 
 ///////////////////////////////////////////////////////////////////////////
 CMixerLine::CMixerLine(HMIXER MixerHandle, MIXERLINE *pMxLine) {
@@ -503,20 +696,26 @@ CWaveINSimple& CWaveINSimple::GetDevice(const TCHAR *pDeviceName) {
 CWaveINSimple::~CWaveINSimple() {
 	this->m_qLocalMutex.Lock();
 	this->_Stop();
-	if (this->m_WaveHeader[0].lpData != NULL) VirtualFree(this->m_WaveHeader[0].lpData, 0, MEM_RELEASE);
+	if (this->m_pBufferMemory != NULL) VirtualFree(this->m_pBufferMemory, 0, MEM_RELEASE);
 	this->m_qLocalMutex.Unlock();
 }
 
 void CWaveINSimple::Close(int iLevel) {
 	switch(iLevel) {
 	case 1:
-		waveInUnprepareHeader(this->m_WaveInHandle, &this->m_WaveHeader[1], sizeof(WAVEHDR));
+		// Unprepare (in reverse order) all WAVEHDR's prepared in _Start().
+		while (this->m_nPrepared > 0) {
+			--this->m_nPrepared;
+			waveInUnprepareHeader(this->m_WaveInHandle, &this->m_arrWaveHeaders[this->m_nPrepared], sizeof(WAVEHDR));
+		}
 	case 2:
-		waveInUnprepareHeader(this->m_WaveInHandle, &this->m_WaveHeader[0], sizeof(WAVEHDR));
+		// Close the WaveIN device. Every WAVEHDR is back by now (see _Stop()),
+		// should the driver still hold one anyway, a reset returns it.
+		if (waveInClose(this->m_WaveInHandle) == WAVERR_STILLPLAYING) {
+			waveInReset(this->m_WaveInHandle);
+			waveInClose(this->m_WaveInHandle);
+		}
 	case 3:
-		// Close the WaveIN device.
-		while ((waveInClose(this->m_WaveInHandle)) != MMSYSERR_NOERROR) ::Sleep(1);
-	case 4:
 		this->m_WaveInHandle = NULL;
 		this->m_Receiver = NULL;
 	}
@@ -530,9 +729,14 @@ void CWaveINSimple::Stop() {
 }
 
 void CWaveINSimple::_Stop() {
+	LONGLONG nStart = QClock::Micros();
+
 	if (this->m_WaveInHandle != NULL) {
-		// Say to Thread that stop recording is requested.
-		this->m_SIG = EXIT_SIG;
+		// Say to Thread that stop recording is requested. A requeue under
+		// way (on whichever thread released the buffer) is finished first.
+		this->m_qRequeueMutex.Lock();
+		QAtomicStore(&this->m_SIG, EXIT_SIG);
+		this->m_qRequeueMutex.Unlock();
 
 		// Stop recording and tell the driver to unqueue/return all of
 		// our WAVEHDRs (via MM_WIM_DONE). The driver will return any
@@ -540,22 +744,33 @@ void CWaveINSimple::_Stop() {
 		waveInReset(this->m_WaveInHandle);
 
 		// Wait for the recording Thread to receive the MM_WIM_DONE for
-		// each queued WAVEHDRs.
-		while (this->m_BuffersDone < 2) ::Sleep(1);
+		// each queued WAVEHDRs (and the receiver to release it), every one
+		// of them sets the event.
+		while ((UINT) QAtomicLoad(&this->m_BuffersDone) < this->m_arrWaveHeaders.size()) this->m_qBufferDone.Wait();
+		// The last Recycle() may still be setting the event, the device (and
+		// the event) may be deleted right after we return.
+		this->m_qRequeueMutex.Lock();
+		this->m_qRequeueMutex.Unlock();
+		this->StopDelivery();
 		this->Close(1);
 
-		this->m_WaveHeader[1].dwFlags = this->m_WaveHeader[0].dwFlags = 0;
+		QAtomicStore(&this->m_nStopLatency, (LONG) (QClock::Micros() - nStart));
+		this->m_Counters.Stop.Add(QAtomicLoad(&this->m_nStopLatency));
+
+		for (UINT i = 0; i < this->m_arrWaveHeaders.size(); i++) {
+			this->m_arrWaveHeaders[i].dwFlags = 0;
+		}
 	}
 }
 
 // Wrapper for the multithreading version
-void CWaveINSimple::Start(IReceiver *pReceiver) {
+void CWaveINSimple::Start(IReceiver *pReceiver, UINT nBuffers, UINT nBufferMillis) {
 	const char *message = NULL;
 
 	this->m_qLocalMutex.Lock();
 
 	try {
-		this->_Start(pReceiver);
+		this->_Start(pReceiver, nBuffers, nBufferMillis);
 	}
 	catch (const char *msg) {
 		message = msg;
@@ -565,73 +780,112 @@ void CWaveINSimple::Start(IReceiver *pReceiver) {
 	if (message != NULL) throw message;
 }
 
-void CWaveINSimple::_Start(IReceiver *pReceiver) {
-	HANDLE	waveInThread;
-	LPTHREAD_START_ROUTINE pStartRoutine = &CWaveINSimple::waveInProc;
-	DWORD	dwThreadID;
+DWORD CWaveINSimple::CalcBufferLength(UINT nBufferMillis) const {
+	// Buffer length must be a multiple of the block alignment, so the
+	// driver never splits a sample frame between two WAVEHDR's.
+	return BufferLengthOf(this->m_waveFormat.nAvgBytesPerSec, this->m_waveFormat.nBlockAlign, nBufferMillis);
+}
+
+void CWaveINSimple::InitBuffers(UINT nBuffers, UINT nBufferMillis) {
+	DWORD dwBufferLength, dwTotal;
+	UINT i;
+
+	if (nBuffers < WAVEIN_MIN_BUFFERS) nBuffers = WAVEIN_MIN_BUFFERS;
+	else if (nBuffers > WAVEIN_MAX_BUFFERS) nBuffers = WAVEIN_MAX_BUFFERS;
+
+	dwBufferLength = this->CalcBufferLength(nBufferMillis);
+	dwTotal = dwBufferLength * nBuffers;
+
+	if (dwTotal > this->m_dwBufferMemorySize) {
+		if (this->m_pBufferMemory != NULL) VirtualFree(this->m_pBufferMemory, 0, MEM_RELEASE);
+		this->m_dwBufferMemorySize = 0;
+
+		this->m_pBufferMemory = (LPSTR) VirtualAlloc(0, dwTotal, MEM_COMMIT, PAGE_READWRITE);
+		if (this->m_pBufferMemory == NULL) throw "Can't allocate memory for WAVE buffer.";
+		this->m_dwBufferMemorySize = dwTotal;
+	}
+
+	this->m_arrWaveHeaders.resize(nBuffers);
+	ZeroMemory(&this->m_arrWaveHeaders[0], sizeof(WAVEHDR) * nBuffers);
+	for (i = 0; i < nBuffers; i++) {
+		this->m_arrWaveHeaders[i].dwBufferLength = dwBufferLength;
+		this->m_arrWaveHeaders[i].lpData = this->m_pBufferMemory + i * dwBufferLength;
+		// Tells the I/O thread which device the WAVEHDR belongs to.
+		this->m_arrWaveHeaders[i].dwUser = (DWORD_PTR) this;
+	}
+
+	this->m_arrPCMBuffers.resize(nBuffers);
+	for (i = 0; i < nBuffers; i++) {
+		this->m_arrPCMBuffers[i].Attach(this, &this->m_arrWaveHeaders[i], this->m_arrWaveHeaders[i].lpData);
+	}
+	this->m_arrDoneMicros.assign(nBuffers, 0);
+}
+
+void CWaveINSimple::_Start(IReceiver *pReceiver, UINT nBuffers, UINT nBufferMillis) {
 	MMRESULT	err;
+	UINT	i;
 
 	if (this->m_WaveInHandle == NULL) {
-		this->m_Receiver = pReceiver;
-		this->m_SIG = WAIT_SIG;
-
-		// Create the Thread that will receive incoming "blocks" of digital audio data
-		// (sent from the driver). The main procedure of this thread is
-		// CWaveINSimple::waveInProc(). We need to get the threadID and pass that
-		// to waveInOpen().
-		waveInThread = CreateThread(NULL, 0, pStartRoutine, (PVOID) this, 0, &dwThreadID);
-		if (!waveInThread) {
-			this->m_Receiver = NULL;
-			throw "Can't create WAVE recording thread.";
-		}
-		CloseHandle(waveInThread);
+		this->m_nStartMicros = QClock::Micros();
+		QAtomicStore(&this->m_nStartLatency, -1);
+		QAtomicStore(&this->m_nStopLatency, -1);
 
-		// Open the WaveIN Device, specifying Thread's ID as a callback.
-		err = waveInOpen(&this->m_WaveInHandle, this->m_nWaveDeviceID, &this->m_waveFormat, dwThreadID, 0, CALLBACK_THREAD);
-		if (err) {
-			// Open failed, say to Thread to stop.
-			this->m_SIG = EXIT_SIG;
-			this->Close(4);
-			throw "Can't open WaveIN Device.";
-		}
-		this->m_SIG = CONTINUE_SIG;
-
-		// Allocate, prepare, and queue two buffers that the driver can
-		// use to record blocks of audio data. Alloc buffers only one
-		// time and use them until object is deleted.
-		// Double-buffering is used.
-		if (this->m_WaveHeader[0].lpData == NULL) {
-			this->m_WaveHeader[0].lpData = (char *)VirtualAlloc(0, this->m_WaveHeader[0].dwBufferLength * 2, MEM_COMMIT, PAGE_READWRITE);
-			if (this->m_WaveHeader[0].lpData == NULL) {
-				this->Close(3);
-				throw "Can't allocate memory for WAVE buffer.";
-			}
-		}
-		this->m_WaveHeader[1].lpData = this->m_WaveHeader[0].lpData + this->m_WaveHeader[0].dwBufferLength;
+		// Allocate buffers before anything else, so there is nothing to clean
+		// up if memory is not available. Buffers are re-used by subsequent
+		// recordings, until object is deleted.
+		this->InitBuffers(nBuffers, nBufferMillis);
+		nBuffers = (UINT) this->m_arrWaveHeaders.size();
 
-		err = waveInPrepareHeader(this->m_WaveInHandle, &this->m_WaveHeader[0], sizeof(WAVEHDR));
+		// The I/O thread that will receive incoming "blocks" of digital audio data
+		// (sent from the driver), shared with other devices.
+		CWaveINIOThread& ioThread = GetIOThread(this->m_nWaveDeviceID);
+
+		// Nothing is queued yet, so the I/O thread can't be touching these.
+		this->m_Receiver = pReceiver;
+		this->m_BuffersDone = 0;
+		this->m_nQueued = 0;
+		this->m_qBufferDone.Reset();
+		QAtomicStore(&this->m_SIG, CONTINUE_SIG);
+
+		// Open the WaveIN Device, specifying I/O thread's ID as a callback.
+		err = waveInOpen(&this->m_WaveInHandle, this->m_nWaveDeviceID, &this->m_waveFormat,
+			(DWORD_PTR) ioThread.m_dwThreadID, 0, CALLBACK_THREAD);
 		if (err) {
 			this->Close(3);
-			throw "Error preparing WAVEHDR 1.";
+			throw "Can't open WaveIN Device.";
 		}
 
-		err = waveInPrepareHeader(this->m_WaveInHandle, &this->m_WaveHeader[1], sizeof(WAVEHDR));
-		if (err) {
-			this->Close(2);
-			throw "Error preparing WAVEHDR 2.";
+		// Prepare and queue all buffers that the driver can use to record
+		// blocks of audio data.
+		for (i = 0; i < nBuffers; i++) {
+			err = waveInPrepareHeader(this->m_WaveInHandle, &this->m_arrWaveHeaders[i], sizeof(WAVEHDR));
+			if (err) {
+				this->Close(1);
+				throw "Error preparing WAVEHDR.";
+			}
+			this->m_nPrepared++;
 		}
 
-		err = waveInAddBuffer(this->m_WaveInHandle, &this->m_WaveHeader[0], sizeof(WAVEHDR));
-		if (err) {
+		// The thread running the receiver, nothing is queued for it yet.
+		try {
+			QAtomicStore(&this->m_isDeliveryStopping, 0);
+			this->m_qDelivery.Start(&CWaveINSimple::deliveryProc, (LPVOID) this);
+		}
+		catch (const char *) {
 			this->Close(1);
-			throw "Error queueing WAVEHDR 1.";
+			throw;
 		}
 
-		err = waveInAddBuffer(this->m_WaveInHandle, &this->m_WaveHeader[1], sizeof(WAVEHDR));
-		if (err) {
-			this->m_BuffersDone = 1;
-			this->Stop();
-			throw "Error queueing WAVEHDR 2.";
+		for (i = 0; i < nBuffers; i++) {
+			err = waveInAddBuffer(this->m_WaveInHandle, &this->m_arrWaveHeaders[i], sizeof(WAVEHDR));
+			if (err) {
+				// WAVEHDR's which never reached the driver won't be
+				// returned, so count them as done already.
+				QAtomicStore(&this->m_BuffersDone, (LONG) (nBuffers - i));
+				this->Stop();
+				throw "Error queueing WAVEHDR.";
+			}
+			QAtomicInc(&this->m_nQueued);
 		}
 
 		// Start recording. Thread will now be receiving audio data.
@@ -643,82 +897,222 @@ void CWaveINSimple::_Start(IReceiver *pReceiver) {
 	}
 }
 
-CWaveINSimple::CWaveINSimple(UINT nWaveDeviceID, WAVEINCAPS *pWIC): m_Mixer(nWaveDeviceID), m_qLocalMutex() {
+CWaveINSimple::CWaveINSimple(UINT nWaveDeviceID, WAVEINCAPS *pWIC): m_Mixer(nWaveDeviceID), m_qLocalMutex(),
+		m_Counters(pWIC->szPname), m_qFilled(WAVEIN_MAX_BUFFERS, sizeof(CPCMBuffer *)), m_qFilledReady(), m_qDelivery(),
+		m_qRequeueMutex(), m_qBufferDone() {
 	this->m_nWaveDeviceID = nWaveDeviceID;
 	memcpy(&this->m_wic, pWIC, sizeof(WAVEINCAPS));
 	this->m_WaveInHandle = NULL;
 	this->m_Receiver = NULL;
+	this->m_nPrepared = 0;
+	this->m_pBufferMemory = NULL;
+	this->m_dwBufferMemorySize = 0;
+	this->m_nQueued = 0;
+	this->m_isDeliveryStopping = 0;
+	this->m_SIG = EXIT_SIG;
+	this->m_BuffersDone = 0;
+	this->m_nStartMicros = 0;
+	this->m_nStartLatency = -1;
+	this->m_nStopLatency = -1;
 
 	//Initialize the WAVEFORMATEX for 16-bit, 44KHz, stereo.
-	ZeroMemory(&this->m_waveFormat, sizeof(WAVEFORMATEX));
-	this->m_waveFormat.wFormatTag = WAVE_FORMAT_PCM;
-	this->m_waveFormat.nChannels = 2;
-	this->m_waveFormat.nSamplesPerSec = 44100;
-	this->m_waveFormat.wBitsPerSample = 16;
-	this->m_waveFormat.nBlockAlign = this->m_waveFormat.nChannels * (this->m_waveFormat.wBitsPerSample/8);
-	this->m_waveFormat.nAvgBytesPerSec = this->m_waveFormat.nSamplesPerSec * this->m_waveFormat.nBlockAlign;
-	this->m_waveFormat.cbSize = 0;
+	InitFormat(&this->m_waveFormat, 44100, 2, 16);
 
-	//Initialize the sound buffers, but don't allocate memory yet.
-	ZeroMemory(this->m_WaveHeader, sizeof(WAVEHDR) * 2);
-	this->m_WaveHeader[1].dwBufferLength = this->m_WaveHeader[0].dwBufferLength = this->m_waveFormat.nAvgBytesPerSec << 1;
+	// Sound buffers are allocated on the first CWaveINSimple::Start(), when
+	// we know how many of them, and how big, are requested.
 }
 
-DWORD WINAPI CWaveINSimple::waveInProc(LPVOID arg) {
-	MSG		msg;
-	CWaveINSimple *_this = (CWaveINSimple *) arg;
+void CWaveINSimple::InitFormat(WAVEFORMATEX *pFormat, DWORD nSampleRate, WORD nChannels, WORD nBitsPerSample) {
+	ZeroMemory(pFormat, sizeof(WAVEFORMATEX));
+	pFormat->wFormatTag = WAVE_FORMAT_PCM;
+	pFormat->nChannels = nChannels;
+	pFormat->nSamplesPerSec = nSampleRate;
+	pFormat->wBitsPerSample = nBitsPerSample;
+	pFormat->nBlockAlign = nChannels * ((nBitsPerSample + 7) / 8);
+	pFormat->nAvgBytesPerSec = nSampleRate * pFormat->nBlockAlign;
+	pFormat->cbSize = 0;
+}
+
+bool CWaveINSimple::SupportsFormat(DWORD nSampleRate, WORD nChannels, WORD nBitsPerSample) const {
+	WAVEFORMATEX waveFormat;
+
+	if ((nSampleRate == 0) || (nChannels == 0) || (nBitsPerSample == 0)) return false;
+
+	// WAVEINCAPS::dwFormats lists a few standard formats only, the driver
+	// (or the mapper in front of it) knows about the others.
+	InitFormat(&waveFormat, nSampleRate, nChannels, nBitsPerSample);
+	return waveInOpen(NULL, this->m_nWaveDeviceID, &waveFormat, 0, 0, WAVE_FORMAT_QUERY) == MMSYSERR_NOERROR;
+}
 
-	if (_this == NULL) return(0);
+bool CWaveINSimple::SelectFormat(DWORD nSampleRate, WORD nChannels, WORD nBitsPerSample) {
+	bool isSelected = false;
 
-	while (_this->m_SIG == WAIT_SIG) ::Sleep(1);
-	if (_this->m_SIG == EXIT_SIG) {
-		// Call to waveInOpen failed.
-		return(0);
+	this->m_qLocalMutex.Lock();
+
+	// Buffers are sized from the format, it can't change under a recording.
+	if ((this->m_WaveInHandle == NULL) && this->SupportsFormat(nSampleRate, nChannels, nBitsPerSample)) {
+		InitFormat(&this->m_waveFormat, nSampleRate, nChannels, nBitsPerSample);
+		isSelected = true;
 	}
 
-	while (GetMessage(&msg, 0, 0, 0) == 1) 	{
-		switch (msg.message) {
-			// A buffer has been filled by the driver
-			case MM_WIM_DATA:
-				// msg.lParam contains a pointer to the WAVEHDR structure
-				// for the filled buffer.
-				if ((((WAVEHDR *)msg.lParam)->dwBytesRecorded) && (_this->m_Receiver)) {
-
-					// Send buffer to the m_Receiver (instance of the IReceiver)
-					// for further processing
-					_this->m_Receiver->ReceiveBuffer(((WAVEHDR *)msg.lParam)->lpData,
-						((WAVEHDR *)msg.lParam)->dwBytesRecorded);
-				}
+	this->m_qLocalMutex.Unlock();
+	return isSelected;
+}
 
-				// Still recording?
-				if (_this->m_SIG != EXIT_SIG) {
-					// Yes. Then requeue this buffer so the driver can
-					// use it for another block of audio data.
-					waveInAddBuffer(_this->m_WaveInHandle, (WAVEHDR *)msg.lParam, sizeof(WAVEHDR));
-				}
-				else {
-					// No, so another WAVEHDR has been returned after
-					// recording has stopped. When we get all of them back,
-					// m_BuffersDone will be equal to how many WAVEHDRs
-					// we queued.
-					++_this->m_BuffersDone;
-				}
-				break;
+void CWaveINSimple::BufferDone(WAVEHDR *pWaveHeader) {
+	CPCMBuffer *pBuffer = &this->m_arrPCMBuffers[pWaveHeader - &this->m_arrWaveHeaders[0]];
+	LPSTR pSlot;
 
-			// Main thread is opening the WAVE device.
-			case MM_WIM_OPEN:
-				_this->m_BuffersDone = 0;
-				break;
+	this->m_arrDoneMicros[pWaveHeader - &this->m_arrWaveHeaders[0]] = QClock::Micros();
 
-			// Main thread is closing the WAVE device.
-			case MM_WIM_CLOSE:
-				return(0);
-				break;
+	// Last empty WAVEHDR came back, the driver has nowhere to record until one is requeued.
+	if ((QAtomicDec(&this->m_nQueued) == 0) && (QAtomicLoad(&this->m_SIG) != EXIT_SIG)) this->m_Counters.Overruns.Inc();
+
+	if ((pWaveHeader->dwBytesRecorded) && (this->m_Receiver)) {
+		this->m_Counters.Buffers.Inc();
+		this->m_Counters.Bytes.Add(pWaveHeader->dwBytesRecorded);
+		pBuffer->Fill(pWaveHeader->dwBytesRecorded);
+
+		// Hand it over to the delivery thread. This I/O thread is the only
+		// producer, and a WAVEHDR is queued once at a time, so there is
+		// always a free slot.
+		pSlot = this->m_qFilled.BeginWrite();
+		if (pSlot != NULL) {
+			*(CPCMBuffer **) pSlot = pBuffer;
+			this->m_qFilled.EndWrite(sizeof(CPCMBuffer *));
+			this->m_qFilledReady.Set();
+		}
+		else pBuffer->Release();
+	}
+	else this->Recycle(pBuffer);
+}
+
+void CWaveINSimple::Deliver() {
+	CPCMBuffer *pBuffer;
+	LPSTR pSlot;
+	DWORD dwBytes;
+
+	while ((pSlot = this->m_qFilled.BeginRead(&dwBytes)) != NULL) {
+		pBuffer = *(CPCMBuffer **) pSlot;
+		this->m_qFilled.EndRead();
+
+		// First sound of the recording.
+		if (QAtomicLoad(&this->m_nStartLatency) < 0) {
+			QAtomicStore(&this->m_nStartLatency, (LONG) (QClock::Micros() - this->m_nStartMicros));
+			this->m_Counters.Start.Add(QAtomicLoad(&this->m_nStartLatency));
 		}
+
+		// Send buffer to the m_Receiver (instance of the IReceiver)
+		// for further processing. WAVEHDR is recycled once the receiver
+		// (and whoever it shared the buffer with) releases it.
+		this->m_Receiver->ReceivePCM(pBuffer);
+		pBuffer->Release();
+	}
+}
+
+DWORD WINAPI CWaveINSimple::deliveryProc(LPVOID arg) {
+	CWaveINSimple *_this = (CWaveINSimple *) arg;
+	LONG isStopping;
+
+	for (;;) {
+		// Read the flag before delivering, so nothing queued before
+		// StopDelivery() is left behind.
+		isStopping = QAtomicLoad(&_this->m_isDeliveryStopping);
+		_this->Deliver();
+		if (isStopping) break;
+
+		_this->m_qFilledReady.Wait();
 	}
 	return(0);
 }
 
+void CWaveINSimple::StopDelivery() {
+	if (this->m_qDelivery.IsStarted()) {
+		QAtomicStore(&this->m_isDeliveryStopping, 1);
+		this->m_qFilledReady.Set();
+		this->m_qDelivery.Join();
+	}
+}
+
+void CWaveINSimple::Recycle(CPCMBuffer *pBuffer) {
+	WAVEHDR *pWaveHeader = (WAVEHDR *) pBuffer->Context();
+	// Read before the requeue, the I/O thread sets it again once the driver is done.
+	LONGLONG nDoneMicros = this->m_arrDoneMicros[pWaveHeader - &this->m_arrWaveHeaders[0]];
+	LONGLONG nStart = 0;
+	bool isQueued = false;
+
+	// Still recording? The check and the requeue can't be split by _Stop(),
+	// which also waits for the lock before the device may go away.
+	this->m_qRequeueMutex.Lock();
+	if (QAtomicLoad(&this->m_SIG) != EXIT_SIG) {
+		// Yes. Then requeue this buffer so the driver can
+		// use it for another block of audio data.
+		nStart = QClock::Micros();
+		if (waveInAddBuffer(this->m_WaveInHandle, pWaveHeader, sizeof(WAVEHDR)) == MMSYSERR_NOERROR) {
+			QAtomicInc(&this->m_nQueued);
+			isQueued = true;
+			this->m_Counters.Requeue.Add(QClock::Micros() - nStart);
+			this->m_Counters.OutsideQueue.Add(QClock::Micros() - nDoneMicros);
+		}
+	}
+
+	if (!isQueued) {
+		// No (or the driver refused it, and won't return it), so
+		// another WAVEHDR is done. When we get all of them back,
+		// m_BuffersDone will be equal to how many WAVEHDRs
+		// we queued.
+		QAtomicInc(&this->m_BuffersDone);
+		this->m_qBufferDone.Set();
+	}
+	this->m_qRequeueMutex.Unlock();
+}
+
+CWaveINIOThread& CWaveINSimple::GetIOThread(UINT nWaveDeviceID) {
+	CWaveINIOThread *pIOThread = NULL;
+	const char *message = NULL;
+	SYSTEM_INFO si;
+	UINT nThreads, nIndex;
+
+	m_qGlobalMutex.Lock();
+
+	nThreads = m_nIOThreads;
+	if (nThreads == 0) {
+		::GetSystemInfo(&si);
+		nThreads = (si.dwNumberOfProcessors > 0) ? si.dwNumberOfProcessors : 1;
+		if (nThreads > WAVEIN_MAX_IO_THREADS) nThreads = WAVEIN_MAX_IO_THREADS;
+	}
+
+	// Same device, same thread, see CWaveINIOThread.
+	nIndex = nWaveDeviceID % nThreads;
+	if (m_arrIOThreads.size() <= nIndex) m_arrIOThreads.resize(nIndex + 1, NULL);
+
+	if (m_arrIOThreads[nIndex] == NULL) {
+		try {
+			pIOThread = new CWaveINIOThread();
+			pIOThread->Start();
+			m_arrIOThreads[nIndex] = pIOThread;
+		}
+		catch (const char *msg) {
+			delete pIOThread;
+			message = msg;
+		}
+	}
+	pIOThread = m_arrIOThreads[nIndex];
+
+	m_qGlobalMutex.Unlock();
+
+	if (message != NULL) throw message;
+	return *pIOThread;
+}
+
+void CWaveINSimple::SetIOThreads(UINT nThreads) {
+	if (nThreads > WAVEIN_MAX_IO_THREADS) nThreads = WAVEIN_MAX_IO_THREADS;
+
+	m_qGlobalMutex.Lock();
+	m_nIOThreads = nThreads;
+	m_qGlobalMutex.Unlock();
+}
+
 const vector<CWaveINSimple*>& CWaveINSimple::GetDevices() {
 	UINT nInDev, i;
 	WAVEINCAPS wic;
@@ -732,12 +1126,10 @@ const vector<CWaveINSimple*>& CWaveINSimple::GetDevices() {
 		for (i = 0; i < nInDev; i++) {
 			if (!waveInGetDevCaps(i, &wic, sizeof(WAVEINCAPS))) {
 
-				// We are only interested in devices supporting
-				// 44.1 kHz, stereo, 16-bit, stereo input
-				if (wic.dwFormats & WAVE_FORMAT_4S16) {
-					pWaveIn = new CWaveINSimple(i, &wic);
-					m_arrWaveINDevices.push_back(pWaveIn);
-				}
+				// Every device is listed, whatever formats it records,
+				// see CWaveINSimple::SelectFormat().
+				pWaveIn = new CWaveINSimple(i, &wic);
+				m_arrWaveINDevices.push_back(pWaveIn);
 			}
 		}
 
@@ -750,17 +1142,23 @@ const vector<CWaveINSimple*>& CWaveINSimple::GetDevices() {
 }
 
 void CWaveINSimple::CleanUp() {
-	m_qGlobalMutex.Lock();
-
-	vector<CWaveINSimple*>::iterator itPos = m_arrWaveINDevices.begin();
-	for (; itPos < m_arrWaveINDevices.end(); itPos++) {
-		delete *itPos;
-	}
+	vector<CWaveINSimple*> arrDevices;
+	vector<CWaveINIOThread*> arrIOThreads;
+	UINT i;
 
-	m_arrWaveINDevices.clear();
+	m_qGlobalMutex.Lock();
+	arrDevices.swap(m_arrWaveINDevices);
 	m_isDeviceListLoaded = false;
-
+	arrIOThreads.swap(m_arrIOThreads);
 	m_qGlobalMutex.Unlock();
+
+	// Deleted without m_qGlobalMutex, a device takes its m_qLocalMutex first
+	// (Start() goes on to GetIOThread()), so holding both here could deadlock.
+	for (i = 0; i < arrDevices.size(); i++) delete arrDevices[i];
+
+	// All devices are stopped (with their delivery threads), nothing is posted
+	// to the I/O threads anymore.
+	for (i = 0; i < arrIOThreads.size(); i++) delete arrIOThreads[i];
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,815 @@
+// mp3_bench.cpp : Encoding throughput and latency benchmark.
+//
+// Feeds the same sound (a CSyntheticSource, unthrottled, so every run gets
+// exactly the same samples) through the encoder for every combination of
+// bitrate, output sample rate and capture buffer duration, and prints the
+// results as JSON, so they can be compared between releases:
+//
+//	"encode" - CMP3Chunker over CMP3Simple::Encode, the encoded sound is dropped.
+//	"writer" - the same as mp3Writer records it: CMP3Chunker into a CAsyncFileSink.
+//
+// With -rs the output sample rates are also reached through the built-in
+// resampler (see CResampler) instead of LAME, to compare the two paths. With
+// -float the resampler hands its float output to the encoder split into
+// channels (see CResampler::ProcessPlanar), instead of as interleaved 16 bits.
+//
+// With -kernels it measures the PCM conversion kernels (see CPCMConvert)
+// and the resampler's qualities instead, every implementation the CPU supports.
+//
+// Not part of the mp3_stream project, build it on its own from this directory:
+//	cl /EHsc /O2 /I. mp3_bench.cpp				(lame_enc.dll next to the exe)
+//	g++ -O2 -I. mp3_bench.cpp -o mp3_bench -lpthread -ldl	(needs libmp3lame)
+
+#include "INCLUDE/platform_simple.h"
+#include <stdio.h>
+#include <new>
+#include <string>
+#include <vector>
+#include "INCLUDE/sync_simple.h"
+#include "INCLUDE/stats_simple.h"
+#include "INCLUDE/mp3_simple.h"
+#include "INCLUDE/sink_simple.h"
+#include "INCLUDE/capture_simple.h"
+#include "INCLUDE/source_simple.h"
+#include "INCLUDE/pcm_simple.h"
+#include "INCLUDE/resample_simple.h"
+#include "INCLUDE/stream_simple.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// Every "new" of the process is counted, so allocations on the encoding path
+// show up (LAME's own malloc's don't, they are outside of this code).
+static volatile LONG gAllocations = 0;
+
+// The replacements pair up only as a whole: inlined into a caller, gcc would
+// see free() of what operator new returned (-Wmismatched-new-delete).
+#ifdef _MSC_VER
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+BENCH_NOINLINE void *operator new(size_t nSize) {
+	void *p;
+
+	QAtomicInc(&gAllocations);
+	p = ::malloc(nSize > 0 ? nSize : 1);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+BENCH_NOINLINE void *operator new[](size_t nSize) {
+	return operator new(nSize);
+}
+
+BENCH_NOINLINE void operator delete(void *p) throw() {
+	::free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void *p) throw() {
+	::free(p);
+}
+
+#if __cplusplus >= 201402L
+// C++14 compilers call these for objects of known size.
+BENCH_NOINLINE void operator delete(void *p, size_t) throw() {
+	operator delete(p);
+}
+
+BENCH_NOINLINE void operator delete[](void *p, size_t) throw() {
+	operator delete[](p);
+}
+#endif
+
+// Where runKernels() leaves its results, which nobody reads.
+static volatile ULONGLONG gKernelSink = 0;
+
+// Returns peak resident memory of the process so far, in KB.
+static ULONGLONG peakRSS() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+
+	if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+	return (ULONGLONG) pmc.PeakWorkingSetSize / 1024;
+#else
+	struct rusage usage;
+
+	if (::getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return (ULONGLONG) usage.ru_maxrss;
+#endif
+}
+
+// Counts the encoded sound instead of keeping it.
+class nullSink: public IMP3Receiver {
+public:
+	ULONGLONG nBytes;
+
+	nullSink() { nBytes = 0; };
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes) { nBytes += dwBytes; };
+};
+
+// Receives the capture buffers and encodes them, timing each buffer.
+class benchReceiver: public IReceiver, public IMP3Receiver {
+private:
+	CMP3Chunker	m_mp3Chunker;
+	IMP3Receiver *m_pOutput;
+
+	// If set, the sound is converted to the encoder's rate first, with
+	// m_isFloat into float planes.
+	CResampler	*m_pResampler;
+	vector<SHORT> m_arrResampled;
+	bool		m_isFloat;
+	vector<FLOAT> m_arrLeft;
+	vector<FLOAT> m_arrRight;
+
+public:
+	CLatencyHistogram hLatency;
+	LONGLONG	nBusyMicros;
+	LONG		nBuffers;
+	LONG		nAllocations;
+	ULONGLONG	nSamples;
+	ULONGLONG	nBytes;
+
+	// dwMaxFrames - longest buffer, the resampler's output is allocated for it up front.
+	benchReceiver(CMP3Simple &mp3Enc, IMP3Receiver *pOutput, CResampler *pResampler, DWORD dwMaxFrames, bool isFloat):
+			m_mp3Chunker(mp3Enc, this), hLatency() {
+		m_pOutput = pOutput;
+		m_pResampler = pResampler;
+		m_isFloat = isFloat && (pResampler != NULL);
+		if (m_isFloat) {
+			m_arrLeft.resize(pResampler->MaxOutFrames(dwMaxFrames));
+			m_arrRight.resize(pResampler->MaxOutFrames(dwMaxFrames));
+		}
+		else if (pResampler != NULL) m_arrResampled.resize(pResampler->MaxOutFrames(dwMaxFrames) * 2);
+		nBusyMicros = 0;
+		nBuffers = 0;
+		nAllocations = 0;
+		nSamples = 0;
+		nBytes = 0;
+	};
+
+	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) {
+		LONG nAllocs = QAtomicLoad(&gAllocations);
+		LONGLONG nStart = QClock::Micros();
+		LONGLONG nTime;
+		DWORD nFrames;
+
+		if (m_isFloat) {
+			nFrames = m_pResampler->ProcessPlanar((const SHORT *) lpData, dwBytesRecorded / 4, &m_arrLeft[0], &m_arrRight[0]);
+			m_mp3Chunker.Encode(&m_arrLeft[0], &m_arrRight[0], nFrames);
+		}
+		else if (m_pResampler != NULL) {
+			nFrames = m_pResampler->Process((const SHORT *) lpData, dwBytesRecorded / 4, &m_arrResampled[0]);
+			m_mp3Chunker.Encode(&m_arrResampled[0], nFrames * 2);
+		}
+		else m_mp3Chunker.Encode((PSHORT) lpData, dwBytesRecorded / 2);
+
+		nTime = QClock::Micros() - nStart;
+		hLatency.Add(nTime);
+		nBusyMicros += nTime;
+		nAllocations += QAtomicLoad(&gAllocations) - nAllocs;
+		nBuffers++;
+		nSamples += dwBytesRecorded / 2;
+	};
+
+	// Encodes the last block, counted as busy time (but not as a buffer).
+	void flush() {
+		LONGLONG nStart = QClock::Micros();
+		DWORD nFrames;
+
+		if (m_isFloat) {
+			nFrames = m_pResampler->FlushPlanar(&m_arrLeft[0], &m_arrRight[0]);
+			m_mp3Chunker.Encode(&m_arrLeft[0], &m_arrRight[0], nFrames);
+		}
+		else if (m_pResampler != NULL) {
+			nFrames = m_pResampler->Flush(&m_arrResampled[0]);
+			m_mp3Chunker.Encode(&m_arrResampled[0], nFrames * 2);
+		}
+		m_mp3Chunker.Flush();
+		nBusyMicros += QClock::Micros() - nStart;
+	};
+
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes) {
+		nBytes += dwBytes;
+		m_pOutput->ReceiveMP3(pData, dwBytes);
+	};
+};
+
+// Runs one combination, appends its JSON object to strJSON. Returns false if
+// LAME doesn't accept the combination (e.g. 320Kbps at 22050Hz).
+//
+// nResampler - RESAMPLE_XXXX to re-sample with the CResampler, -1 - by LAME.
+//
+// isFloat - the CResampler's output goes to the encoder as float planes.
+static bool runOne(string &strJSON, bool isWriter, int nSignal, UINT nSeconds,
+				   UINT nBitRate, UINT nOutSampleRate, UINT nBufferMillis, int nResampler, bool isFloat) {
+	CMP3Simple *pMp3Enc;
+	CResampler *pResampler = NULL;
+	IMP3Sink *pSink = NULL;
+	nullSink nullOut;
+	LONGLONG nWallMicros;
+	double dAudioSeconds, dSamples;
+	char szLine[1024];
+
+	try {
+		if (nResampler < 0) pMp3Enc = new CMP3Simple(nBitRate, 44100, nOutSampleRate);
+		else pMp3Enc = new CMP3Simple(nBitRate, nOutSampleRate, 0);
+	}
+	catch (const char *) {
+		return false;
+	}
+	if (nResampler >= 0) pResampler = new CResampler(44100, nOutSampleRate, 2, nResampler);
+
+	if (isWriter) pSink = new CAsyncFileSink("mp3_bench.mp3", SINK_BLOCK_SIZE, 0);
+
+	CSyntheticSource source(nSignal, 440, nSeconds, false);
+	benchReceiver receiver(*pMp3Enc, isWriter ? (IMP3Receiver *) pSink : (IMP3Receiver *) &nullOut,
+		pResampler, source.CalcBufferLength(nBufferMillis) / 4, isFloat);
+
+	nWallMicros = QClock::Micros();
+	source.Start(&receiver, 2, nBufferMillis);
+	source.WaitForEnd();
+	source.Stop();
+	receiver.flush();
+	if (pSink != NULL) pSink->Close();
+	nWallMicros = QClock::Micros() - nWallMicros;
+
+	delete pSink;
+	delete pResampler;
+	delete pMp3Enc;
+	if (isWriter) ::DeleteFile("mp3_bench.mp3");
+
+	dAudioSeconds = (double) source.GetFrames() / source.GetSampleRate();
+	dSamples = (receiver.nSamples > 0) ? (double) receiver.nSamples : 1.0;
+
+	// x_realtime from the time spent encoding (and writing), wall_ms also
+	// counts generating the sound.
+	_snprintf(szLine, sizeof(szLine) - 1,
+		"%s\n    {\"path\": \"%s\", \"bitrate\": %u, \"in_rate\": 44100, \"out_rate\": %u, \"resampler\": \"%s\", \"input\": \"%s\", \"buffer_ms\": %u, "
+		"\"buffers\": %d, \"audio_s\": %.3f, \"wall_ms\": %.3f, \"start_us\": %d, \"stop_us\": %d, \"busy_ms\": %.3f, \"x_realtime\": %.2f, "
+		"\"ns_per_sample\": %.2f, \"latency_us\": {\"p50\": %" QFMT_I64 "d, \"p99\": %" QFMT_I64 "d, "
+		"\"p999\": %" QFMT_I64 "d, \"max\": %" QFMT_I64 "d}, \"allocs_per_buffer\": %.3f, "
+		"\"mp3_bytes\": %" QFMT_I64 "u, \"peak_rss_kb\": %" QFMT_I64 "u}",
+		strJSON.empty() ? "" : ",", isWriter ? "writer" : "encode", nBitRate,
+		(nOutSampleRate == 0) ? 44100 : nOutSampleRate,
+		(nOutSampleRate == 0) ? "none" : (nResampler < 0) ? "lame" : CResampler::QualityName(nResampler),
+		(isFloat && (pResampler != NULL)) ? "float" : "s16", nBufferMillis,
+		receiver.nBuffers, dAudioSeconds, nWallMicros / 1000.0, (int) source.GetStartLatency(), (int) source.GetStopLatency(),
+		receiver.nBusyMicros / 1000.0,
+		(receiver.nBusyMicros > 0) ? dAudioSeconds * 1000000.0 / receiver.nBusyMicros : 0.0,
+		receiver.nBusyMicros * 1000.0 / dSamples,
+		receiver.hLatency.Percentile(50), receiver.hLatency.Percentile(99),
+		receiver.hLatency.Percentile(99.9), receiver.hLatency.Max(),
+		(receiver.nBuffers > 0) ? (double) receiver.nAllocations / receiver.nBuffers : 0.0,
+		receiver.nBytes, peakRSS());
+	szLine[sizeof(szLine) - 1] = 0;
+	strJSON += szLine;
+	return true;
+}
+
+// Loopback listener of runStream(), counts what it gets from the server.
+// Listeners and their server connections are both sockets of this process, and
+// the listeners' are watched with select(), so every socket must stay below
+// FD_SETSIZE (with a few left for the rest).
+#define BENCH_MAX_STREAM_CLIENTS ((FD_SETSIZE - 16) / 2)
+
+struct streamClient {
+	SOCKET		hSocket;
+	bool		isReading;
+	bool		isClosed;
+	string		strHeader;
+	bool		isHeader;
+	BYTE		arrFirst[4];
+	DWORD		dwFirst;
+	ULONGLONG	nBytes;
+};
+
+// Connects a listener to the server at 127.0.0.1:nPort and asks for the
+// stream. A listener which won't read gets a small receive buffer, so it
+// stalls soon.
+static bool connectClient(streamClient &client, WORD nPort, bool isReading) {
+	struct sockaddr_in addr;
+	const char *pRequest = "GET /stream.mp3 HTTP/1.0\r\nIcy-MetaData: 0\r\n\r\n";
+	int nReceiveBuffer = 4096;
+
+	client.hSocket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	client.isReading = isReading;
+	client.isClosed = false;
+	client.isHeader = true;
+	client.dwFirst = 0;
+	client.nBytes = 0;
+	if (client.hSocket == INVALID_SOCKET) return false;
+	if (!isReading) ::setsockopt(client.hSocket, SOL_SOCKET, SO_RCVBUF, (const char *) &nReceiveBuffer, sizeof(nReceiveBuffer));
+
+	ZeroMemory(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(nPort);
+	if ((::connect(client.hSocket, (struct sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR) ||
+		(::send(client.hSocket, pRequest, (int) strlen(pRequest), STREAM_SEND_FLAGS) != (int) strlen(pRequest))) {
+		closesocket(client.hSocket);
+		client.hSocket = INVALID_SOCKET;
+		return false;
+	}
+	CStreamSocket::SetNonBlocking(client.hSocket);
+	return true;
+}
+
+// Reads whatever the listener has got, returns false once the server closed it.
+static bool readClient(streamClient &client) {
+	char arrBuffer[16 * 1024];
+	size_t nEnd;
+	int nRead, nAudio;
+
+	for (;;) {
+		nRead = ::recv(client.hSocket, arrBuffer, sizeof(arrBuffer), 0);
+		if (nRead == 0 || ((nRead < 0) && !CStreamSocket::WouldBlock())) {
+			client.isClosed = true;
+			return false;
+		}
+		if (nRead < 0) return true;
+
+		nAudio = nRead;
+		if (client.isHeader) {
+			client.strHeader.append(arrBuffer, nRead);
+			nEnd = client.strHeader.find("\r\n\r\n");
+			if (nEnd == string::npos) continue;
+
+			// The sound starts right after the response.
+			nAudio = (int) (client.strHeader.size() - nEnd - 4);
+			client.isHeader = false;
+		}
+		for (int i = nRead - nAudio; (i < nRead) && (client.dwFirst < 4); i++) client.arrFirst[client.dwFirst++] = (BYTE) arrBuffer[i];
+		client.nBytes += nAudio;
+	}
+}
+
+// Encodes nSeconds of a tone (as fast as it can) into a CMP3StreamServer on the loopback, with
+// nClients listeners connected before the sound starts (nSlow of them never
+// read, so they should be disconnected), and appends a JSON object like
+// runOne() does:
+//	complete - listeners which got the whole stream.
+//	aligned - listeners whose sound starts with a valid frame header.
+//	evicted - listeners the server disconnected for falling behind.
+static void runStream(string &strJSON, UINT nClients, UINT nSlow, UINT nSeconds, UINT nBitRate) {
+	CMP3Simple mp3Enc(nBitRate, 44100, 0);
+	// A ring of a few seconds, so the stalled listeners are soon too far behind.
+	CMP3StreamServer server(0, nBitRate, "mp3_bench", 256 * 1024, 0, nClients);
+	vector<streamClient> arrClients(nClients);
+	LONGLONG nWallMicros, nDrainMicros = 0;
+	fd_set setRead;
+	struct timeval tv;
+	SOCKET hMax;
+	UINT i, nComplete = 0, nAligned = 0, nOpen;
+	char szLine[512];
+
+	for (i = 0; i < nClients; i++) {
+		if (!connectClient(arrClients[i], server.GetPort(), i < nClients - nSlow)) throw "Can't connect to the streaming server.";
+	}
+	// Every listener accepted (and answered) before the sound starts.
+	while (server.GetAccepted() + server.GetRefused() < (LONG) nClients) ::Sleep(1);
+	::Sleep(100);
+
+	nWallMicros = QClock::Micros();
+	{
+		CSyntheticSource source(SYNTH_TONE, 440, nSeconds, false);
+		benchReceiver receiver(mp3Enc, &server, NULL, source.CalcBufferLength(100) / 4, false);
+
+		source.Start(&receiver, 2, 100);
+		// The listeners read on this thread meanwhile.
+		for (;;) {
+			FD_ZERO(&setRead);
+			hMax = 0;
+			nOpen = 0;
+			for (i = 0; i < nClients; i++) {
+				if (!arrClients[i].isReading || arrClients[i].isClosed) continue;
+				FD_SET(arrClients[i].hSocket, &setRead);
+				if (arrClients[i].hSocket > hMax) hMax = arrClients[i].hSocket;
+				nOpen++;
+			}
+
+			// Until the sound ends and every listener has got it (or a second more).
+			if (source.WaitForEnd(0)) {
+				nDrainMicros = QClock::Micros();
+				source.Stop();
+				receiver.flush();
+				break;
+			}
+
+			tv.tv_sec = 0;
+			tv.tv_usec = 10000;
+			if ((nOpen > 0) && (::select((int) hMax + 1, &setRead, NULL, NULL, &tv) > 0)) {
+				for (i = 0; i < nClients; i++) {
+					if (arrClients[i].isReading && !arrClients[i].isClosed && FD_ISSET(arrClients[i].hSocket, &setRead)) readClient(arrClients[i]);
+				}
+			}
+			else if (nOpen == 0) ::Sleep(10);
+		}
+	}
+
+	// The tail of the stream.
+	while (QClock::Micros() - nDrainMicros < 1000000) {
+		nComplete = 0;
+		for (i = 0; i < nClients; i++) {
+			if (arrClients[i].isReading && !arrClients[i].isClosed) readClient(arrClients[i]);
+			if (arrClients[i].nBytes == (ULONGLONG) server.GetWritten()) nComplete++;
+		}
+		if (nComplete == nClients - nSlow) break;
+		::Sleep(1);
+	}
+	nWallMicros = QClock::Micros() - nWallMicros;
+	server.Close();
+
+	for (i = 0; i < nClients; i++) {
+		if ((arrClients[i].dwFirst == 4) && (CMP3Frame::Length(arrClients[i].arrFirst) > 0)) nAligned++;
+		closesocket(arrClients[i].hSocket);
+	}
+
+	_snprintf(szLine, sizeof(szLine) - 1,
+		"%s\n    {\"path\": \"stream\", \"bitrate\": %u, \"clients\": %u, \"slow\": %u, \"audio_s\": %u, \"wall_ms\": %.3f, "
+		"\"mp3_bytes\": %" QFMT_I64 "d, \"complete\": %u, \"aligned\": %u, \"evicted\": %d, \"refused\": %d, "
+		"\"join_us\": {\"p50\": %" QFMT_I64 "d, \"max\": %" QFMT_I64 "d}, \"peak_rss_kb\": %" QFMT_I64 "u}",
+		strJSON.empty() ? "" : ",", nBitRate, nClients, nSlow, nSeconds, nWallMicros / 1000.0, server.GetWritten(),
+		nComplete, nAligned, server.GetEvicted(), server.GetRefused(),
+		server.GetJoinLatency().Percentile(50), server.GetJoinLatency().Max(), peakRSS());
+	szLine[sizeof(szLine) - 1] = 0;
+	strJSON += szLine;
+}
+
+// Kernels measured by runKernels().
+#define KERNEL_U8_S16 0
+#define KERNEL_MONO_STEREO 1
+#define KERNEL_STEREO_MONO 2
+#define KERNEL_DEINTERLEAVE 3
+#define KERNEL_INTERLEAVE 4
+#define KERNEL_FLOAT_S16 5
+#define KERNEL_S32_S16 6
+#define KERNEL_S24_S16 7
+#define KERNEL_GAIN 8
+#define KERNEL_SUM_OF_SQUARES 9
+#define KERNEL_ZERO_CROSSINGS 10
+#define KERNELS 11
+
+// Converts nSamples samples (or frames, for the channel kernels) nRepeat
+// times with every kernel and every implementation of it, appends a JSON
+// object per kernel and implementation to strJSON.
+static void runKernels(string &strJSON, DWORD nSamples, UINT nRepeat) {
+	static const char *arrNames[KERNELS] = {"u8_s16", "mono_stereo", "stereo_mono", "deinterleave",
+		"interleave", "float_s16", "s32_s16", "s24_s16", "gain", "sum_of_squares", "zero_crossings"};
+	vector<BYTE> arrBytes(3 * nSamples);
+	vector<SHORT> arrIn(2 * nSamples), arrOut(2 * nSamples), arrLeft(nSamples), arrRight(nSamples);
+	vector<LONG> arrLongs(nSamples);
+	vector<FLOAT> arrFloats(nSamples);
+	CPCMDither dither;
+	ULONGLONG nSquares = 0;
+	DWORD dwSeed = 1, i;
+	LONGLONG nStart, nMicros;
+	int nLevel, nKernel;
+	UINT r;
+	char szLine[256];
+
+	// Noise, so nothing is predictable.
+	for (i = 0; i < 3 * nSamples; i++) {
+		dwSeed = dwSeed * 1664525 + 1013904223;
+		arrBytes[i] = (BYTE) (dwSeed >> 24);
+		if (i < 2 * nSamples) arrIn[i] = (SHORT) (dwSeed >> 16);
+		if (i < nSamples) {
+			arrLongs[i] = (LONG) dwSeed;
+			arrFloats[i] = (FLOAT) ((LONG) dwSeed / 2147483648.0);
+		}
+	}
+
+	for (nLevel = PCM_SIMD_SCALAR; nLevel <= CPCMConvert::DetectLevel(); nLevel++) {
+		CPCMConvert::SetLevel(nLevel);
+
+		for (nKernel = 0; nKernel < KERNELS; nKernel++) {
+			nStart = QClock::Micros();
+			for (r = 0; r < nRepeat; r++) {
+				switch (nKernel) {
+				case KERNEL_U8_S16: CPCMConvert::U8ToS16(&arrBytes[0], &arrOut[0], nSamples); break;
+				case KERNEL_MONO_STEREO: CPCMConvert::MonoToStereo(&arrIn[0], &arrOut[0], nSamples); break;
+				case KERNEL_STEREO_MONO: CPCMConvert::StereoToMono(&arrIn[0], &arrOut[0], nSamples); break;
+				case KERNEL_DEINTERLEAVE: CPCMConvert::Deinterleave(&arrIn[0], &arrLeft[0], &arrRight[0], nSamples); break;
+				case KERNEL_INTERLEAVE: CPCMConvert::Interleave(&arrLeft[0], &arrRight[0], &arrOut[0], nSamples); break;
+				case KERNEL_FLOAT_S16: CPCMConvert::FloatToS16(&arrFloats[0], &arrOut[0], nSamples, &dither); break;
+				case KERNEL_S32_S16: CPCMConvert::S32ToS16(&arrLongs[0], &arrOut[0], nSamples, &dither); break;
+				case KERNEL_S24_S16: CPCMConvert::S24ToS16(&arrBytes[0], &arrOut[0], nSamples, &dither); break;
+				// A ramp from +6 dB, limited at -3 dBFS, as CGainReceiver does.
+				case KERNEL_GAIN: CPCMConvert::Gain(&arrIn[0], &arrOut[0], nSamples, 2.0f, -1.0f / nSamples, 23197.0f); break;
+				case KERNEL_SUM_OF_SQUARES: nSquares += CPCMConvert::SumOfSquares(&arrIn[0], nSamples); break;
+				case KERNEL_ZERO_CROSSINGS: nSquares += CPCMConvert::ZeroCrossings(&arrIn[0], nSamples, 2); break;
+				}
+			}
+			nMicros = QClock::Micros() - nStart;
+			if (nMicros < 1) nMicros = 1;
+
+			_snprintf(szLine, sizeof(szLine) - 1,
+				"%s\n    {\"kernel\": \"%s\", \"impl\": \"%s\", \"samples\": %u, \"ns_per_sample\": %.3f, "
+				"\"msamples_per_s\": %.1f}", strJSON.empty() ? "" : ",", arrNames[nKernel],
+				CPCMConvert::LevelName(nLevel), nSamples, nMicros * 1000.0 / ((double) nSamples * nRepeat),
+				(double) nSamples * nRepeat / nMicros);
+			szLine[sizeof(szLine) - 1] = 0;
+			strJSON += szLine;
+		}
+	}
+
+	CPCMConvert::SetLevel(PCM_SIMD_AVX2);
+	// Stored, so the sums (and counts) aren't optimised away.
+	gKernelSink = nSquares;
+}
+
+// Fills arrSamples with nFrames of a stereo tone (half of the full scale).
+static void makeTone(vector<SHORT> &arrSamples, double dFrequency, DWORD nSampleRate, DWORD nFrames) {
+	DWORD i;
+
+	arrSamples.resize(2 * nFrames);
+	for (i = 0; i < nFrames; i++) {
+		arrSamples[2 * i] = arrSamples[2 * i + 1] = (SHORT) (16384.0 * sin(2.0 * 3.14159265358979323846 * dFrequency * i / nSampleRate));
+	}
+}
+
+// Level (dB, relative to the tone) of what the resampler makes out of a
+// 44100Hz tone of nFrames, the edges (where the filter sees silence) left out.
+static double resampledLevel(CResampler &resampler, double dFrequency, DWORD nFrames, vector<SHORT> &arrOut) {
+	vector<SHORT> arrTone;
+	double dPower = 0.0;
+	DWORD i, n;
+
+	makeTone(arrTone, dFrequency, 44100, nFrames);
+	resampler.Reset();
+	n = resampler.Process(&arrTone[0], nFrames, &arrOut[0]);
+	for (i = resampler.Taps(); i + resampler.Taps() < n; i++) dPower += (double) arrOut[2 * i] * arrOut[2 * i];
+	dPower = (n > 2 * resampler.Taps()) ? dPower / (n - 2 * resampler.Taps()) : 0.0;
+	return (dPower > 0.0) ? 10.0 * log10(dPower / (16384.0 * 16384.0 / 2.0)) : -200.0;
+}
+
+// Measures the CResampler (44100Hz to 32000Hz, stereo) at every quality and
+// with every implementation of the kernels, appends a JSON object like
+// runKernels() does, with the quality of the conversion:
+//	snr_db - a 1kHz tone against the exact one at the output rate.
+//	pass_db - level of a tone at the edge of the pass band (see
+//	CResampler::PassBand()), relative to the tone, should be about 0.
+//	edge_alias_db, alias_db - what is left of a 16.5kHz and a 17kHz tone
+//	(above the output's Nyquist frequency, they should be removed, the
+//	first one aliases right below it), relative to the tone.
+static void runResampler(string &strJSON, DWORD nFrames, UINT nRepeat) {
+	vector<SHORT> arrTone, arrNoise(2 * nFrames), arrOut;
+	DWORD dwSeed = 1, i, n = 0;
+	double dSignal, dNoise, dExact, dSNR, dPass, dEdgeAlias, dAlias;
+	LONGLONG nStart, nMicros;
+	int nLevel, nQuality;
+	UINT r;
+	char szLine[320];
+
+	makeTone(arrTone, 1000.0, 44100, nFrames);
+	for (i = 0; i < 2 * nFrames; i++) {
+		dwSeed = dwSeed * 1664525 + 1013904223;
+		arrNoise[i] = (SHORT) (dwSeed >> 16);
+	}
+
+	for (nQuality = RESAMPLE_FAST; nQuality < RESAMPLE_QUALITIES; nQuality++) {
+		CResampler resampler(44100, 32000, 2, nQuality);
+
+		arrOut.resize(resampler.MaxOutFrames(nFrames) * 2);
+
+		// Quality, the edges (where the filter sees silence) left out.
+		n = resampler.Process(&arrTone[0], nFrames, &arrOut[0]);
+		dSignal = dNoise = 0.0;
+		for (i = resampler.Taps(); i + resampler.Taps() < n; i++) {
+			dExact = 16384.0 * sin(2.0 * 3.14159265358979323846 * 1000.0 * i / 32000);
+			dSignal += dExact * dExact;
+			dNoise += (arrOut[2 * i] - dExact) * (arrOut[2 * i] - dExact);
+		}
+		dSNR = (dNoise > 0.0) ? 10.0 * log10(dSignal / dNoise) : 200.0;
+
+		dPass = resampledLevel(resampler, resampler.PassBand(), nFrames, arrOut);
+		dEdgeAlias = resampledLevel(resampler, 16500.0, nFrames, arrOut);
+		dAlias = resampledLevel(resampler, 17000.0, nFrames, arrOut);
+
+		for (nLevel = PCM_SIMD_SCALAR; nLevel <= CPCMConvert::DetectLevel(); nLevel++) {
+			CPCMConvert::SetLevel(nLevel);
+			resampler.Reset();
+
+			nStart = QClock::Micros();
+			for (r = 0; r < nRepeat; r++) n = resampler.Process(&arrNoise[0], nFrames, &arrOut[0]);
+			nMicros = QClock::Micros() - nStart;
+			if (nMicros < 1) nMicros = 1;
+
+			// Per output sample.
+			_snprintf(szLine, sizeof(szLine) - 1,
+				"%s\n    {\"kernel\": \"resample_%s\", \"impl\": \"%s\", \"samples\": %u, \"ns_per_sample\": %.3f, "
+				"\"msamples_per_s\": %.1f, \"snr_db\": %.1f, \"pass_db\": %.2f, \"edge_alias_db\": %.1f, \"alias_db\": %.1f}",
+				strJSON.empty() ? "" : ",", CResampler::QualityName(nQuality), CPCMConvert::LevelName(nLevel), 2 * n,
+				nMicros * 1000.0 / (2.0 * n * nRepeat), 2.0 * n * nRepeat / nMicros, dSNR, dPass, dEdgeAlias, dAlias);
+			szLine[sizeof(szLine) - 1] = 0;
+			strJSON += szLine;
+		}
+	}
+
+	CPCMConvert::SetLevel(PCM_SIMD_AVX2);
+}
+
+// Parses a comma separated list of numbers, e.g. "64,128,320".
+static vector<UINT> parseList(const char *pList) {
+	vector<UINT> arrValues;
+
+	while (*pList != 0) {
+		arrValues.push_back((UINT) atoi(pList));
+		while ((*pList != 0) && (*pList != ',')) pList++;
+		if (*pList == ',') pList++;
+	}
+	return arrValues;
+}
+
+// Prints the benchmark's help.
+void printHelp(char *progname) {
+	printf("%s [-br=<list>] [-sr=<list>] [-bl=<list>] [-len=<seconds>] [-signal=<tone|noise>]\n", progname);
+	printf("\t[-path=<encode|writer|all>] [-rs=<resamplers>] [-float] [-json=<file>]\n");
+	printf("\tWill encode <seconds> of a generated sound for every combination of the lists\n");
+	printf("\tand print the results as JSON (or write them into the <file>).\n\n");
+	printf("\t<list> - comma separated values, e.g. -br=64,128.\n");
+	printf("\t-br - bitrates (in Kbps), defaults to 16,32,64,128,192,256,320.\n");
+	printf("\t-sr - output sample rates (in Hz), defaults to 44100,32000,22050.\n");
+	printf("\t-bl - capture buffer durations (in ms), defaults to 20,100,500,2000.\n");
+	printf("\t<seconds> - length of the sound, defaults to 30.\n");
+	printf("\t<tone|noise> - 440Hz tone or white noise (the default), both from a fixed seed.\n");
+	printf("\t-path - encoding only, encoding into a file (as mp3Writer), or both (the default).\n");
+	printf("\t<resamplers> - how the output sample rates are reached, comma separated: lame (the\n");
+	printf("\tdefault) and the built-in resampler's fast, medium, best.\n");
+	printf("\t-float - if set, the built-in resampler passes float sound to the encoder (beEncodeChunkFloatS16NI).\n\n");
+	printf("%s -kernels [-json=<file>]\n", progname);
+	printf("\tWill measure every implementation (scalar, SSE2, AVX2) of the PCM conversion kernels,\n");
+	printf("\tand the speed and quality of the resampler's qualities (44100Hz to 32000Hz).\n\n");
+	printf("%s -stream=<clients> [-slow=<clients>] [-br=<bitrate>] [-len=<seconds>] [-json=<file>]\n", progname);
+	printf("\tWill serve <seconds> of a tone through the HTTP streaming server (see CMP3StreamServer)\n");
+	printf("\tto <clients> listeners (at most %d) on the loopback, <slow> of them never reading.\n",
+		(int) BENCH_MAX_STREAM_CLIENTS);
+}
+
+int main(int argc, char* argv[])
+{
+	vector<UINT> arrBitRates = parseList("16,32,64,128,192,256,320");
+	vector<UINT> arrSampleRates = parseList("44100,32000,22050");
+	vector<UINT> arrBufferMillis = parseList("20,100,500,2000");
+	vector<int> arrResamplers(1, -1);
+	UINT nSeconds = 30;
+	int nSignal = SYNTH_NOISE;
+	bool isEncode = true, isWriter = true;
+	bool isKernels = false;
+	bool isFloat = false;
+	UINT nStreamClients = 0;
+	UINT nSlowClients = 0;
+	char *strJSONFile = NULL;
+	char *strTemp = NULL;
+	string strJSON;
+	BE_VERSION beVer;
+	FILE *f = stdout;
+	UINT b, s, l, q;
+	int nPath, nSkipped = 0;
+
+	for (int i = 1; i < argc; i ++) {
+		if ((strTemp = ::strstr(argv[i],"-br=")) == argv[i]) {
+			arrBitRates = parseList(&strTemp[4]);
+		}
+		else if ((strTemp = ::strstr(argv[i],"-sr=")) == argv[i]) {
+			arrSampleRates = parseList(&strTemp[4]);
+		}
+		else if ((strTemp = ::strstr(argv[i],"-bl=")) == argv[i]) {
+			arrBufferMillis = parseList(&strTemp[4]);
+		}
+		else if ((strTemp = ::strstr(argv[i],"-len=")) == argv[i]) {
+			nSeconds = (UINT) atoi(&strTemp[5]);
+		}
+		else if (::strcmp(argv[i],"-signal=tone") == 0) {
+			nSignal = SYNTH_TONE;
+		}
+		else if (::strcmp(argv[i],"-signal=noise") == 0) {
+			nSignal = SYNTH_NOISE;
+		}
+		else if (::strcmp(argv[i],"-path=encode") == 0) {
+			isEncode = true; isWriter = false;
+		}
+		else if (::strcmp(argv[i],"-path=writer") == 0) {
+			isEncode = false; isWriter = true;
+		}
+		else if (::strcmp(argv[i],"-path=all") == 0) {
+			isEncode = true; isWriter = true;
+		}
+		else if ((strTemp = ::strstr(argv[i],"-rs=")) == argv[i]) {
+			// Names, not numbers; -1 - LAME.
+			arrResamplers.clear();
+			for (strTemp = ::strtok(&strTemp[4], ","); strTemp != NULL; strTemp = ::strtok(NULL, ",")) {
+				if (::strcmp(strTemp, "lame") == 0) arrResamplers.push_back(-1);
+				else if (CResampler::ParseQuality(strTemp) >= 0) arrResamplers.push_back(CResampler::ParseQuality(strTemp));
+				else {
+					printHelp(argv[0]);
+					return 0;
+				}
+			}
+		}
+		else if (::strcmp(argv[i],"-float") == 0) {
+			isFloat = true;
+		}
+		else if ((strTemp = ::strstr(argv[i],"-stream=")) == argv[i]) {
+			nStreamClients = (UINT) atoi(&strTemp[8]);
+		}
+		else if ((strTemp = ::strstr(argv[i],"-slow=")) == argv[i]) {
+			nSlowClients = (UINT) atoi(&strTemp[6]);
+		}
+		else if (::strcmp(argv[i],"-kernels") == 0) {
+			isKernels = true;
+		}
+		else if ((strTemp = ::strstr(argv[i],"-json=")) == argv[i]) {
+			strJSONFile = &strTemp[6];
+		}
+		else {
+			printHelp(argv[0]);
+			return 0;
+		}
+	}
+	if (nSeconds == 0) nSeconds = 1;
+	if (nStreamClients > BENCH_MAX_STREAM_CLIENTS) {
+		fprintf(stderr, "At most %d listeners, select() can't watch more sockets.\n", (int) BENCH_MAX_STREAM_CLIENTS);
+		nStreamClients = BENCH_MAX_STREAM_CLIENTS;
+	}
+	if (nSlowClients > nStreamClients) nSlowClients = nStreamClients;
+
+	if (isKernels) {
+		runKernels(strJSON, 1024 * 1024, 50);
+		runResampler(strJSON, 44100, 20);
+	}
+	else if (nStreamClients > 0) try {
+		runStream(strJSON, nStreamClients, nSlowClients, nSeconds, arrBitRates.empty() ? 128 : arrBitRates[0]);
+	}
+	catch (const char *err) {
+		fprintf(stderr, "%s\n", err);
+		return 1;
+	}
+	else try {
+		CMP3Simple::LoadLIBS();
+		ZeroMemory(&beVer, sizeof(beVer));
+		beVersion(&beVer);
+
+		for (nPath = 0; nPath < 2; nPath++) {
+			if (!(nPath == 0 ? isEncode : isWriter)) continue;
+
+			for (b = 0; b < arrBitRates.size(); b++) {
+				for (s = 0; s < arrSampleRates.size(); s++) {
+					for (l = 0; l < arrBufferMillis.size(); l++) {
+						for (q = 0; q < arrResamplers.size(); q++) {
+							// Nothing to re-sample, measured once.
+							if ((arrSampleRates[s] == 44100) && (q > 0)) continue;
+
+							fprintf(stderr, "%s %uKbps %uHz %ums %s ...\n", (nPath == 0) ? "encode" : "writer",
+								arrBitRates[b], arrSampleRates[s], arrBufferMillis[l],
+								(arrResamplers[q] < 0) ? "lame" : CResampler::QualityName(arrResamplers[q]));
+
+							// Output at the input rate is asked for as "no re-sampling", as mp3Writer does.
+							if (!runOne(strJSON, nPath == 1, nSignal, nSeconds, arrBitRates[b],
+								(arrSampleRates[s] == 44100) ? 0 : arrSampleRates[s], arrBufferMillis[l],
+								(arrSampleRates[s] == 44100) ? -1 : arrResamplers[q], isFloat)) {
+								fprintf(stderr, "\tnot supported by LAME, skipped.\n");
+								nSkipped++;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	catch (const char *err) {
+		fprintf(stderr, "%s\n", err);
+		return 1;
+	}
+
+	if (strJSONFile != NULL) {
+		f = fopen(strJSONFile, "w");
+		if (f == NULL) {
+			fprintf(stderr, "Can't create JSON file.\n");
+			return 1;
+		}
+	}
+
+	if (isKernels) {
+		fprintf(f, "{\n  \"benchmark\": \"mp3_bench_kernels\",\n  \"detected\": \"%s\",\n  \"results\": [%s\n  ]\n}\n",
+			CPCMConvert::LevelName(CPCMConvert::DetectLevel()), strJSON.c_str());
+	}
+	else if (nStreamClients > 0) {
+		fprintf(f, "{\n  \"benchmark\": \"mp3_bench_stream\",\n  \"results\": [%s\n  ]\n}\n", strJSON.c_str());
+	}
+	else fprintf(f, "{\n  \"benchmark\": \"mp3_bench\",\n  \"lame\": \"%u.%u\",\n  \"float_encode\": \"%s\",\n"
+		"  \"signal\": \"%s\",\n  \"seconds\": %u,\n  \"skipped\": %d,\n  \"results\": [%s\n  ]\n}\n",
+		beVer.byMajorVersion, beVer.byMinorVersion, CMP3Simple::HasFloatEncode() ? "native" : "converted",
+		(nSignal == SYNTH_TONE) ? "tone" : "noise",
+		nSeconds, nSkipped, strJSON.c_str());
+
+	if (f != stdout) fclose(f);
+	return 0;
+}
@@ -5,7 +5,23 @@
 
 #include "stdafx.h"
 #include "INCLUDE/mp3_simple.h"
+#include "INCLUDE/mp3pool_simple.h"
 #include "INCLUDE/waveIN_simple.h"
+#include "INCLUDE/source_simple.h"
+#include "INCLUDE/queue_simple.h"
+#include "INCLUDE/fanout_simple.h"
+#include "INCLUDE/sink_simple.h"
+#include "INCLUDE/rotate_simple.h"
+#include "INCLUDE/parallel_simple.h"
+#include "INCLUDE/batch_simple.h"
+#include "INCLUDE/counters_simple.h"
+#include "INCLUDE/gain_simple.h"
+#include "INCLUDE/resample_simple.h"
+#include "INCLUDE/silence_simple.h"
+#include "INCLUDE/format_simple.h"
+#include "INCLUDE/stream_simple.h"
+#include "INCLUDE/index_simple.h"
+#include "INCLUDE/preroll_simple.h"
 #include <conio.h>
 #include <Windows.h>
 #include "MinHook.h"
@@ -181,49 +197,275 @@ private:
 
 KCriticalSesion gCriticalSesion;
 // An example of the IReceiver implementation.
-class mp3Writer: public IReceiver {
+class mp3Writer: public IReceiver, public IMP3Receiver, public ISilenceReceiver {
 private:
-	CMP3Simple	m_mp3Enc;
-	FILE *f;
+	// Leased from the CMP3EncoderPool, so a new recording starts without LAME's set-up.
+	CMP3Simple	*m_pMp3Enc;
+	CMP3Chunker	m_mp3Chunker;
+	CMP3ParallelEncoder *m_pParallel;
+
+	// Writes ready-made frames for the silence a CSilenceReceiver leaves out, see useSilentFrames().
+	CMP3SilenceWriter *m_pSilence;
+
+	// Encoded sound goes to the disk on the sink's own thread (or into a
+	// mapped window of the file), so a slow disk never holds gCriticalSesion
+	// (and the capture).
+	IMP3Sink *m_pSink;
+	bool isOpen;
+
+	// The same sink as m_pSink when only the last minutes are kept, see dumpPreroll().
+	CPrerollSink *m_pPreroll;
+	unsigned int m_nDumps;
+
+	// Serves the encoded sound to listeners over HTTP as well, see useStreaming().
+	CMP3StreamServer *m_pStream;
+
+	// Printed with the other counters when <s> is hit, see CCounterSet::Snapshot().
+	CStreamCounters m_Counters;
 
 public:
-	mp3Writer(unsigned int bitrate = 128, unsigned int finalSimpleRate = 0): 
-			m_mp3Enc(bitrate, 44100, finalSimpleRate) {
-		f = fopen("music.mp3", "wb");
-		if (f == NULL) throw "Can't create MP3 file.";
+	// threads - if not zero, encoding is spread over this many cores (see
+	// CMP3ParallelEncoder), at the cost of a few seconds of extra latency.
+	//
+	// syncMillis - if not zero, the MP3 file is flushed to the disk this often.
+	//
+	// mapped - if true, the MP3 file is preallocated and written via memory
+	// mapping (see CMappedFileSink). Can't be combined with syncMillis.
+	//
+	// segSeconds, segMBytes - if any of them is set, the sound is split into
+	// music_0001.mp3, music_0002.mp3, etc. of that length or size (see CRotatingSink).
+	//
+	// sampleRate - rate of the sound received, e.g. already converted by a CResampleReceiver.
+	//
+	// channels - 1 (encoded as mono) or 2 (joint stereo), channels of the sound received.
+	//
+	// indexMillis - if not zero, the MP3 file (each segment) gets an index
+	// with an entry per indexMillis of sound, music.mp3.idx (see CIndexingSink).
+	//
+	// prerollSeconds - if not zero, nothing is written to the disk but the last
+	// prerollSeconds of sound are kept in memory, see dumpPreroll(). Can't be
+	// combined with mapped, segSeconds, segMBytes or indexMillis.
+	mp3Writer(unsigned int bitrate = 128, unsigned int finalSimpleRate = 0, unsigned int threads = 0,
+		unsigned int syncMillis = 0, bool mapped = false, unsigned int segSeconds = 0, unsigned int segMBytes = 0,
+		unsigned int sampleRate = 44100, unsigned int channels = 2, unsigned int indexMillis = 0,
+		unsigned int prerollSeconds = 0): 
+			m_pMp3Enc(CMP3EncoderPool::Lease(bitrate, sampleRate, finalSimpleRate,
+				(channels == 1) ? BE_MP3_MODE_MONO : BE_MP3_MODE_JSTEREO)), m_mp3Chunker(*m_pMp3Enc, this),
+			m_Counters("music.mp3") {
+		m_pParallel = NULL;
+		m_pSilence = NULL;
+		m_pSink = NULL;
+		m_pStream = NULL;
+		m_pPreroll = NULL;
+		m_nDumps = 0;
+		isOpen = false;
+		try {
+			// A mapped file is flushed by the system, see CMappedFileSink.
+			if (mapped && (syncMillis > 0)) throw "Memory mapping can't be combined with periodic flushing (-fs).";
+			if (threads > 0) {
+				if ((finalSimpleRate != 0) && (finalSimpleRate != sampleRate)) throw "Parallel encoding doesn't support re-sampling.";
+				m_pParallel = new CMP3ParallelEncoder(bitrate, sampleRate, this, threads, 256, m_pMp3Enc->Mode());
+			}
+
+			if (prerollSeconds > 0) {
+				if (mapped || (segSeconds > 0) || (segMBytes > 0) || (indexMillis > 0)) {
+					throw "Pre-roll can't be combined with memory mapping, segments or an index.";
+				}
+				m_pPreroll = new CPrerollSink(prerollSeconds, bitrate, (finalSimpleRate != 0) ? finalSimpleRate : sampleRate);
+				m_pSink = m_pPreroll;
+			}
+			else if ((segSeconds > 0) || (segMBytes > 0)) {
+				m_pSink = new CRotatingSink("music_%04u.mp3", segSeconds, segMBytes, syncMillis, mapped, indexMillis);
+			}
+			else {
+				if (mapped) m_pSink = new CMappedFileSink("music.mp3");
+				else m_pSink = new CAsyncFileSink("music.mp3", SINK_BLOCK_SIZE, syncMillis);
+				if (indexMillis > 0) m_pSink = new CIndexingSink(m_pSink, "music.mp3" INDEX_EXTENSION, indexMillis);
+				// An index of an earlier recording would describe another file.
+				else ::DeleteFile("music.mp3" INDEX_EXTENSION);
+			}
+			m_pSink->SetCounters(&m_Counters);
+			isOpen = true;
+		}
+		catch (const char *) {
+			delete m_pParallel;
+			CMP3EncoderPool::Return(m_pMp3Enc);
+			throw;
+		}
 	};
 
 	~mp3Writer()
 	{
-		KLocker temp(gCriticalSesion);
-		if (f != NULL)
-		{
-			fclose(f);
-		}
+		close();
+		delete m_pSink;
+		delete m_pStream;
+		delete m_pSilence;
+		delete m_pParallel;
+		CMP3EncoderPool::Return(m_pMp3Enc);
 	};
 
 	void close()
 	{
 		KLocker temp(gCriticalSesion);
-		if (f != NULL)
+		if (isOpen)
 		{
-			fclose(f);
+			// Encode the samples still waiting for a full block, and the last frame.
+			if (m_pParallel != NULL) m_pParallel->Flush();
+			else m_mp3Chunker.Flush();
+			m_pSink->Close();
+			if (m_pStream != NULL) m_pStream->Close();
+			isOpen = false;
+		}
+	}
+
+	// Silence reported by ReceiveSilence() is written as silent frames, so the
+	// MP3 keeps the length of the recording. Throws with parallel encoding,
+	// whose frames come out later than the silent ones would go in.
+	void useSilentFrames()
+	{
+		if (m_pParallel != NULL) throw "Silent frames can't be combined with parallel encoding.";
+		m_pSilence = new CMP3SilenceWriter(*m_pMp3Enc);
+	}
+
+	// The encoded sound is also served over HTTP on the port (see
+	// CMP3StreamServer), to any number of listeners. Throws if the port
+	// can't be listened on.
+	void useStreaming(WORD nPort, unsigned int bitrate)
+	{
+		m_pStream = new CMP3StreamServer(nPort, bitrate);
+	}
+
+	// Writes the pre-roll kept in memory into preroll_0001.mp3, preroll_0002.mp3,
+	// etc., and everything after it for postSeconds (zero - until called again).
+	// Called again while a dump is being written, ends it. Returns true if a
+	// dump was started; a file which can't be created is reported, and the
+	// recording goes on.
+	bool dumpPreroll(unsigned int postSeconds)
+	{
+		char szName[32];
+
+		if (m_pPreroll == NULL) return false;
+		if (m_pPreroll->IsDumping()) {
+			m_pPreroll->EndDump();
+			printf("Pre-roll dump ended.\n");
+			return false;
+		}
+		_snprintf(szName, sizeof(szName) - 1, "preroll_%04u.mp3", ++m_nDumps);
+		szName[sizeof(szName) - 1] = 0;
+		try {
+			if (!m_pPreroll->Dump(szName, postSeconds)) return false;
 		}
+		catch (const char *err) {
+			printf("%s\n", err);
+			return false;
+		}
+		printf("Dumping %.1f s of pre-roll into %s.\n", m_pPreroll->GetKeptMillis() / 1000.0, szName);
+		return true;
+	}
+
+	// Prints how the disk (and the listeners) kept up.
+	void printStats()
+	{
+		m_pSink->PrintStats();
+		if (m_pStream != NULL) m_pStream->PrintStats();
 	}
 
 	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) {
 
 		KLocker temp(gCriticalSesion);
-		if (f == NULL)
+		if (!isOpen)
 		{
 			return;
 		}
 
-		BYTE	mp3Out[44100 * 4];
-		DWORD	dwOut;
-		m_mp3Enc.Encode((PSHORT) lpData, dwBytesRecorded/2, mp3Out, &dwOut);
+		LONGLONG nStart = QClock::Micros();
+
+		if (m_pParallel != NULL) m_pParallel->Encode((PSHORT) lpData, dwBytesRecorded/2);
+		else m_mp3Chunker.Encode((PSHORT) lpData, dwBytesRecorded/2);
 
-		fwrite(mp3Out, dwOut, 1, f);
+		m_Counters.Encode.Add(QClock::Micros() - nStart);
+		m_Counters.Buffers.Inc();
+		m_Counters.PCMBytes.Add(dwBytesRecorded);
+	};
+
+	// Called by m_mp3Chunker for each encoded block.
+	virtual void ReceiveMP3(PBYTE pData, DWORD dwBytes) {
+		m_Counters.MP3Bytes.Add(dwBytes);
+		m_pSink->ReceiveMP3(pData, dwBytes);
+		if (m_pStream != NULL) m_pStream->ReceiveMP3(pData, dwBytes);
+	};
+
+	// Called by the CSilenceReceiver for the silence it leaves out.
+	virtual void ReceiveSilence(DWORD nFrames) {
+		KLocker temp(gCriticalSesion);
+		if (!isOpen || (m_pSilence == NULL))
+		{
+			return;
+		}
+
+		m_pSilence->Write(m_mp3Chunker, this, nFrames);
+	};
+};
+
+// Another example of the IReceiver implementation, archives the captured
+// sound as it is (in the format it was recorded), into a WAV file.
+class wavWriter: public IReceiver {
+private:
+	FILE *f;
+	DWORD dwDataSize;
+	DWORD dwSampleRate;
+	WORD wChannels;
+	WORD wBitsPerSample;
+
+public:
+	wavWriter(const char *fileName, DWORD sampleRate = 44100, WORD channels = 2, WORD bitsPerSample = 16) {
+		dwDataSize = 0;
+		dwSampleRate = sampleRate;
+		wChannels = channels;
+		wBitsPerSample = bitsPerSample;
+		f = fopen(fileName, "wb");
+		if (f == NULL) throw "Can't create WAV file.";
+		writeHeader();
+	};
+
+	~wavWriter()
+	{
+		close();
+	};
+
+	// RIFF header, sizes are patched in close().
+	void writeHeader() {
+		DWORD dwValue;
+		WORD wValue;
+
+		fwrite("RIFF", 4, 1, f);
+		dwValue = 36 + dwDataSize; fwrite(&dwValue, 4, 1, f);
+		fwrite("WAVEfmt ", 8, 1, f);
+		dwValue = 16; fwrite(&dwValue, 4, 1, f);
+		wValue = WAVE_FORMAT_PCM; fwrite(&wValue, 2, 1, f);
+		wValue = wChannels; fwrite(&wValue, 2, 1, f);
+		dwValue = dwSampleRate; fwrite(&dwValue, 4, 1, f);
+		dwValue = dwSampleRate * wChannels * ((wBitsPerSample + 7) / 8); fwrite(&dwValue, 4, 1, f);
+		wValue = wChannels * ((wBitsPerSample + 7) / 8); fwrite(&wValue, 2, 1, f);
+		wValue = wBitsPerSample; fwrite(&wValue, 2, 1, f);
+		fwrite("data", 4, 1, f);
+		fwrite(&dwDataSize, 4, 1, f);
+	}
+
+	void close()
+	{
+		if (f != NULL)
+		{
+			fseek(f, 0, SEEK_SET);
+			writeHeader();
+			fclose(f);
+			f = NULL;
+		}
+	}
+
+	virtual void ReceiveBuffer(LPSTR lpData, DWORD dwBytesRecorded) {
+		fwrite(lpData, dwBytesRecorded, 1, f);
+		dwDataSize += dwBytesRecorded;
 	};
 };
 
@@ -232,13 +474,149 @@ void printHelp(char *progname) {
 	printf("%s -devices\n\tWill list WaveIN devices.\n\n", progname);
 	printf("%s -device=<device_name>\n\tWill list recording lines of the WaveIN <device_name> device.\n\n", progname);
 	printf("%s -device=<device_name> -line=<line_name> [-v=<volume>] [-br=<bitrate>] [-sr=<samplerate>]\n", progname);
+	printf("\t[-nb=<buffers>] [-bl=<buffer_ms>] [-aq=<slots>] [-pe=<threads>] [-wav=<file>]\n");
+	printf("\t[-fs=<sync_ms>] [-mm] [-seg=<seconds>] [-segmb=<MB>] [-gain=<dB>] [-agc[=<dBFS>]] [-rs=<quality>]\n");
+	printf("\t[-silence=<policy>] [-sdb=<dBFS>] [-cr=<capture_rate>] [-ch=<channels>] [-bits=<bits>] [-http=<port>]\n");
+	printf("\t[-idx[=<index_ms>]] [-preroll=<seconds> [-postroll=<seconds>]] [-iot=<io_threads>]\n");
 	printf("\tWill record from the <line_name> at the given voice <volume>, output <bitrate> (in Kbps)\n");
 	printf("\tand output <samplerate> (in Hz).\n\n");
-	printf("\t<volume>, <bitrate> and <samplerate> are optional parameters.\n");
+	printf("\tAll parameters in square brackets are optional.\n");
 	printf("\t<volume> - integer value between (0..100), defaults to 0 if not set.\n");
 	printf("\t<bitrate> - integer value (16, 24, 32, .., 64, etc.), defaults to 128 if not set.\n");
-	printf("\t<samplerate> - integer value (44100, 32000, 22050, etc.), defaults to 44100 if not set.\n");
+	printf("\t<samplerate> - integer value (44100, 32000, 22050, etc.), defaults to the capture rate if not set.\n");
+	printf("\t<buffers> - number of capture buffers (%d..%d), defaults to 2 if not set.\n",
+		WAVEIN_MIN_BUFFERS, WAVEIN_MAX_BUFFERS);
+	printf("\t<buffer_ms> - duration of each capture buffer (%d..%d ms), defaults to 2000 if not set.\n",
+		WAVEIN_MIN_BUFFER_MS, WAVEIN_MAX_BUFFER_MS);
+	printf("\t<slots> - if set, encoding runs on its own thread, fed through a queue of <slots>\n");
+	printf("\tcapture buffers, so a slow encode or disk doesn't stall the capture.\n");
+	printf("\t<threads> - if set, MP3 frames are encoded in segments on <threads> cores.\n");
+	printf("\tCan't be combined with <samplerate>.\n");
+	printf("\t<file> - if set, captured sound is also archived into the WAV <file>. MP3 and WAV\n");
+	printf("\tare written on their own threads, sharing the capture buffers.\n");
+	printf("\t<sync_ms> - if set, the MP3 file is flushed to the disk every <sync_ms> ms.\n");
+	printf("\t-mm - if set, the MP3 file is preallocated in %d MB extents and written via\n", SINK_MAP_EXTENT / (1024 * 1024));
+	printf("\tmemory mapping, for long recordings. Can't be combined with <sync_ms>.\n");
+	printf("\t<seconds>, <MB> - if set, recording is split into music_0001.mp3, music_0002.mp3, etc.\n");
+	printf("\tof this length or size, without stopping the capture (e.g. -seg=3600 for hourly files).\n");
+	printf("\t<dB> - if set, the sound is amplified by <dB> (e.g. 12, or -6 to attenuate) in software\n");
+	printf("\tbefore encoding, with a soft limiter instead of clipping. The WAV <file> stays as captured.\n");
+	printf("\t-agc - if set, the gain follows the sound's level, aiming at <dBFS> (RMS), defaults to %.0f.\n",
+		GAIN_AGC_TARGET_DB);
+	printf("\tWith either of them <+> and <-> raise and lower the gain (or the level) by 1 dB while recording.\n");
+	printf("\t<quality> - if set, the sound is converted to <samplerate> by the built-in resampler\n");
+	printf("\t(fast, medium or best) instead of LAME, then <threads> may be combined with <samplerate>.\n");
+	printf("\t<policy> - if set, silent stretches (quieter than <dBFS>, defaults to %.0f) aren't encoded:\n",
+		SILENCE_OPEN_DB);
+	printf("\tdrop leaves them out, frames writes silent frames instead (keeps the MP3's length, can't be\n");
+	printf("\tcombined with <threads>), gaps leaves them out and lists them in music_gaps.txt.\n");
+	printf("\t<capture_rate>, <channels>, <bits> - if set, the sound is recorded in this format (e.g.\n");
+	printf("\t-cr=16000 -ch=1 for a voice line) instead of 44100Hz, stereo, 16-bit. If the device can't\n");
+	printf("\trecord it, the nearest format it can is used, and converted to <channels> and 16 bits.\n");
+	printf("\tThe MP3 is mono with <channels> 1. The WAV <file> stays as captured.\n");
+	printf("\t<port> - if set, the MP3 is also served over HTTP on this port (e.g. http://localhost:8000/),\n");
+	printf("\tto up to %d listeners at once. A listener falling %d KB behind is disconnected.\n\n",
+		STREAM_MAX_CLIENTS, STREAM_RING_SIZE / 2 / 1024);
+	printf("\t-idx - if set, music.mp3.idx (or an .idx per segment) indexes the MP3 every <index_ms>\n");
+	printf("\t(defaults to %d), so -extract finds any time in it right away.\n", INDEX_DEFAULT_MS);
+	printf("\t-preroll - if set, nothing is written but the last <seconds> of the MP3 are kept in memory.\n");
+	printf("\t<d> writes them into preroll_0001.mp3 (preroll_0002.mp3, etc.), followed by what comes next,\n");
+	printf("\tfor -postroll <seconds> or until <d> is hit again. Can't be combined with -mm, -seg, -segmb, -idx.\n");
+	printf("\t<io_threads> - WaveIN devices share this many threads (1..%d) taking the buffers from the\n",
+		WAVEIN_MAX_IO_THREADS);
+	printf("\tdriver, defaults to one per CPU.\n\n");
+	printf("%s -replay=<wav_file|tone|noise> [-len=<seconds>] [-fast] [-loop] [<options>]\n", progname);
+	printf("\tWill run the recording above without a sound card, the sound comes from the\n");
+	printf("\t<wav_file> (integer PCM, mono or stereo), a 440Hz tone or white noise instead.\n");
+	printf("\t<options> - any of -br, -sr, -nb, -bl, -aq, -pe, -wav, -fs, -mm, -seg, -segmb, -gain, -agc, -rs,\n");
+	printf("\t-silence, -sdb, -cr, -ch, -bits, -http, -idx,\n");
+	printf("\t-preroll, -postroll (the <wav_file> is replayed in its own format).\n");
+	printf("\t<seconds> - length of the tone or noise, endless if not set.\n");
+	printf("\t-fast - if set, sound is delivered as fast as it is encoded, not in real time.\n");
+	printf("\t-loop - if set, the <wav_file> is replayed over and over.\n\n");
+	printf("%s -batch=<dir_or_list> [-out=<dir>] [-jobs=<threads>] [-br=<bitrate>] [-sr=<samplerate>]\n", progname);
+	printf("\tWill encode every .wav, .pcm and .raw file of the <dir_or_list> (a directory, or a text\n");
+	printf("\tfile listing one path per line) into MP3, next to the input file or into <dir>.\n");
+	printf("\t<threads> - files encoded at once, defaults to one per CPU.\n");
+	printf("\tRaw PCM files are taken as 44100Hz, 16-bit, stereo.\n\n");
+	printf("%s -extract=<mp3_file> -from=<seconds> [-to=<seconds>] [-out=<file>]\n", progname);
+	printf("\tWill copy the sound between the two times (till the end without -to) of the recorded\n");
+	printf("\t<mp3_file> into the <file> (defaults to extract.mp3), found via <mp3_file>.idx if it is there.\n");
+
+}
+
+// Encodes files in the batch mode, see printHelp().
+int runBatch(int argc, char* argv[]) {
+	char *strBatch = &argv[1][7];
+	char *strOutDir = NULL;
+	char *strTemp = NULL;
+	UINT nBitRate = 128;
+	UINT nFSimpleRate = 0;
+	UINT nJobs = 0;
+
+	for (int i = 2; i < argc; i ++) {
+		if ((strTemp = ::strstr(argv[i],"-out=")) == argv[i]) {
+			strOutDir = &strTemp[5];
+		}
+		else if ((strTemp = ::strstr(argv[i],"-jobs=")) == argv[i]) {
+			nJobs = (UINT) atoi(&strTemp[6]);
+		}
+		else if ((strTemp = ::strstr(argv[i],"-br=")) == argv[i]) {
+			nBitRate = (UINT) atoi(&strTemp[4]);
+		}
+		else if ((strTemp = ::strstr(argv[i],"-sr=")) == argv[i]) {
+			nFSimpleRate = (UINT) atoi(&strTemp[4]);
+		}
+		else {
+			printHelp(argv[0]);
+			return 0;
+		}
+	}
+
+	CBatchTranscoder transcoder(nBitRate, nFSimpleRate, strOutDir, nJobs);
+	transcoder.Add(strBatch);
+	return (transcoder.Run() > 0) ? 1 : 0;
+}
 
+// Copies a part of a recording in the extract mode, see printHelp().
+int runExtract(int argc, char* argv[]) {
+	char *strInput = &argv[1][9];
+	const char *strOutput = "extract.mp3";
+	char *strTemp = NULL;
+	double dFrom = -1.0;
+	double dTo = -1.0;
+	ULONGLONG nBytes;
+	LONGLONG nStart;
+
+	for (int i = 2; i < argc; i ++) {
+		if ((strTemp = ::strstr(argv[i],"-from=")) == argv[i]) {
+			dFrom = atof(&strTemp[6]);
+		}
+		else if ((strTemp = ::strstr(argv[i],"-to=")) == argv[i]) {
+			dTo = atof(&strTemp[4]);
+		}
+		else if ((strTemp = ::strstr(argv[i],"-out=")) == argv[i]) {
+			strOutput = &strTemp[5];
+		}
+		else {
+			printHelp(argv[0]);
+			return 0;
+		}
+	}
+	if ((dFrom < 0.0) || ((dTo >= 0.0) && (dTo <= dFrom))) {
+		printHelp(argv[0]);
+		return 0;
+	}
+
+	nStart = QClock::Micros();
+	CMP3FileIndex index(strInput);
+	CAsyncFileSink output(strOutput);
+
+	nBytes = index.Extract((ULONGLONG) (dFrom * 1000.0), (dTo < 0.0) ? (ULONGLONG) -1 : (ULONGLONG) (dTo * 1000.0), &output);
+	output.Close();
+	printf("%" QFMT_I64 "u bytes copied into %s in %.3f ms (%s).\n", nBytes, strOutput,
+		(QClock::Micros() - nStart) / 1000.0, index.IsIndexed() ? "indexed" : "no index, scanned");
+	return (nBytes > 0) ? 0 : 1;
 }
 
 // Lists WaveIN devices present in the system.
@@ -276,20 +654,70 @@ int main(int argc, char* argv[])
 {
 	maink();
 	mp3Writer *mp3Wr;
+	CAsyncReceiver *asyncRcv = NULL;
+	wavWriter *wavWr = NULL;
+	CFanOutReceiver *fanOut = NULL;
+	CGainReceiver *gainRcv = NULL;
+	CResampleReceiver *resampleRcv = NULL;
+	CSilenceReceiver *silenceRcv = NULL;
+	CFormatReceiver *formatRcv = NULL;
+	IReceiver *receiver;
+	ICaptureSource *source;
+	CPacedSource *replay = NULL;
+	CWaveINSimple *pDevice = NULL;
 
 	char *strDeviceName = NULL;
 	char *strLineName = NULL;
+	char *strReplay = NULL;
 	char *strTemp = NULL;
 
 	UINT nVolume = 0;
 	UINT nBitRate = 128;
 	UINT nFSimpleRate = 0;
+	UINT nBuffers = 2;
+	UINT nBufferMillis = 2000;
+	UINT nQueueSlots = 0;
+	UINT nThreads = 0;
+	char *strWavFile = NULL;
+	UINT nSyncMillis = 0;
+	bool isMapped = false;
+	UINT nSegSeconds = 0;
+	UINT nSegMBytes = 0;
+	UINT nReplaySeconds = 0;
+	bool isFast = false;
+	bool isLooping = false;
+	double dGainDB = 0.0;
+	bool isGain = false;
+	bool isAGC = false;
+	double dAGCTargetDB = GAIN_AGC_TARGET_DB;
+	int nResampleQuality = -1;
+	int nSilencePolicy = -1;
+	double dSilenceDB = SILENCE_OPEN_DB;
+	DWORD nCaptureRate = 0;
+	WORD nCaptureChannels = 0;
+	WORD nCaptureBits = 0;
+	UINT nHttpPort = 0;
+	UINT nIndexMillis = 0;
+	UINT nPrerollSeconds = 0;
+	UINT nPostrollSeconds = 0;
+	UINT nIOThreads = 0;
+	WORD nChannels;
+	UINT nEncodeRate;
+	int nFirstOption = 3;
+	int nExitCode = 0;
+	int nKey;
 
 
 	//setlocale( LC_ALL, ".866");
 	try {
 
 		if (argc < 2) printHelp(argv[0]);
+		else if (::strstr(argv[1],"-batch=") == argv[1]) {
+			nExitCode = runBatch(argc, argv);
+		}
+		else if (::strstr(argv[1],"-extract=") == argv[1]) {
+			nExitCode = runExtract(argc, argv);
+		}
 		else if (argc == 2) {
 			if (::strcmp(argv[1],"-devices") == 0) printWaveINDevices();
 			else if ((strTemp = ::strstr(argv[1],"-device=")) == argv[1]) {
@@ -300,21 +728,27 @@ int main(int argc, char* argv[])
 			else printHelp(argv[0]);
 		}
 		else {
-			if ((strTemp = ::strstr(argv[1],"-device=")) == argv[1]) {
-				strDeviceName = &strTemp[8];
+			if ((strTemp = ::strstr(argv[1],"-replay=")) == argv[1]) {
+				strReplay = &strTemp[8];
+				nFirstOption = 2;
 			}
+			else {
+				if ((strTemp = ::strstr(argv[1],"-device=")) == argv[1]) {
+					strDeviceName = &strTemp[8];
+				}
 
-			if ((strTemp = ::strstr(argv[2],"-line=")) == argv[2]) {
-				strLineName = &strTemp[6];
-			}
+				if ((strTemp = ::strstr(argv[2],"-line=")) == argv[2]) {
+					strLineName = &strTemp[6];
+				}
 
-			if ((strDeviceName == NULL) || (strLineName == NULL)) {
-				printHelp(argv[0]);
-				clearup();
-				return 0;
+				if ((strDeviceName == NULL) || (strLineName == NULL)) {
+					printHelp(argv[0]);
+					clearup();
+					return 0;
+				}
 			}
 
-			for (int i = 3; i < argc; i ++) {
+			for (int i = nFirstOption; i < argc; i ++) {
 				if ((strTemp = ::strstr(argv[i],"-v=")) == argv[i]) {
 					strTemp = &strTemp[3];
 					nVolume = (UINT) atoi(strTemp);
@@ -327,6 +761,138 @@ int main(int argc, char* argv[])
 					strTemp = &strTemp[4];
 					nFSimpleRate = (UINT) atoi(strTemp);
 				}
+				else if ((strTemp = ::strstr(argv[i],"-nb=")) == argv[i]) {
+					strTemp = &strTemp[4];
+					nBuffers = (UINT) atoi(strTemp);
+				}
+				else if ((strTemp = ::strstr(argv[i],"-bl=")) == argv[i]) {
+					strTemp = &strTemp[4];
+					nBufferMillis = (UINT) atoi(strTemp);
+				}
+				else if ((strTemp = ::strstr(argv[i],"-aq=")) == argv[i]) {
+					strTemp = &strTemp[4];
+					nQueueSlots = (UINT) atoi(strTemp);
+				}
+				else if ((strTemp = ::strstr(argv[i],"-pe=")) == argv[i]) {
+					strTemp = &strTemp[4];
+					nThreads = (UINT) atoi(strTemp);
+				}
+				else if ((strTemp = ::strstr(argv[i],"-wav=")) == argv[i]) {
+					strWavFile = &strTemp[5];
+				}
+				else if (::strcmp(argv[i],"-mm") == 0) {
+					isMapped = true;
+				}
+				else if ((strTemp = ::strstr(argv[i],"-seg=")) == argv[i]) {
+					strTemp = &strTemp[5];
+					nSegSeconds = (UINT) atoi(strTemp);
+				}
+				else if ((strTemp = ::strstr(argv[i],"-segmb=")) == argv[i]) {
+					strTemp = &strTemp[7];
+					nSegMBytes = (UINT) atoi(strTemp);
+				}
+				else if ((strTemp = ::strstr(argv[i],"-fs=")) == argv[i]) {
+					strTemp = &strTemp[4];
+					nSyncMillis = (UINT) atoi(strTemp);
+				}
+				else if (((strTemp = ::strstr(argv[i],"-len=")) == argv[i]) && (strReplay != NULL)) {
+					strTemp = &strTemp[5];
+					nReplaySeconds = (UINT) atoi(strTemp);
+				}
+				else if ((::strcmp(argv[i],"-fast") == 0) && (strReplay != NULL)) {
+					isFast = true;
+				}
+				else if ((::strcmp(argv[i],"-loop") == 0) && (strReplay != NULL)) {
+					isLooping = true;
+				}
+				else if ((strTemp = ::strstr(argv[i],"-gain=")) == argv[i]) {
+					strTemp = &strTemp[6];
+					dGainDB = atof(strTemp);
+					isGain = true;
+				}
+				else if (::strcmp(argv[i],"-agc") == 0) {
+					isAGC = true;
+				}
+				else if ((strTemp = ::strstr(argv[i],"-agc=")) == argv[i]) {
+					strTemp = &strTemp[5];
+					dAGCTargetDB = atof(strTemp);
+					isAGC = true;
+				}
+				else if ((strTemp = ::strstr(argv[i],"-rs=")) == argv[i]) {
+					strTemp = &strTemp[4];
+					nResampleQuality = CResampler::ParseQuality(strTemp);
+					if (nResampleQuality < 0) {
+						printHelp(argv[0]);
+						clearup();
+						return 0;
+					}
+				}
+				else if ((strTemp = ::strstr(argv[i],"-silence=")) == argv[i]) {
+					strTemp = &strTemp[9];
+					if (::strcmp(strTemp, "drop") == 0) nSilencePolicy = SILENCE_DROP;
+					else if (::strcmp(strTemp, "frames") == 0) nSilencePolicy = SILENCE_FRAMES;
+					else if (::strcmp(strTemp, "gaps") == 0) nSilencePolicy = SILENCE_GAPS;
+					else {
+						printHelp(argv[0]);
+						clearup();
+						return 0;
+					}
+				}
+				else if ((strTemp = ::strstr(argv[i],"-sdb=")) == argv[i]) {
+					strTemp = &strTemp[5];
+					dSilenceDB = atof(strTemp);
+				}
+				else if ((strTemp = ::strstr(argv[i],"-cr=")) == argv[i]) {
+					strTemp = &strTemp[4];
+					nCaptureRate = (DWORD) atoi(strTemp);
+				}
+				else if ((strTemp = ::strstr(argv[i],"-ch=")) == argv[i]) {
+					strTemp = &strTemp[4];
+					nCaptureChannels = (WORD) atoi(strTemp);
+					if ((nCaptureChannels != 1) && (nCaptureChannels != 2)) {
+						printHelp(argv[0]);
+						clearup();
+						return 0;
+					}
+				}
+				else if ((strTemp = ::strstr(argv[i],"-bits=")) == argv[i]) {
+					strTemp = &strTemp[6];
+					nCaptureBits = (WORD) atoi(strTemp);
+				}
+				else if (::strcmp(argv[i],"-idx") == 0) {
+					nIndexMillis = INDEX_DEFAULT_MS;
+				}
+				else if ((strTemp = ::strstr(argv[i],"-idx=")) == argv[i]) {
+					strTemp = &strTemp[5];
+					nIndexMillis = (UINT) atoi(strTemp);
+					if (nIndexMillis == 0) nIndexMillis = INDEX_DEFAULT_MS;
+				}
+				else if ((strTemp = ::strstr(argv[i],"-preroll=")) == argv[i]) {
+					strTemp = &strTemp[9];
+					nPrerollSeconds = (UINT) atoi(strTemp);
+				}
+				else if ((strTemp = ::strstr(argv[i],"-postroll=")) == argv[i]) {
+					strTemp = &strTemp[10];
+					nPostrollSeconds = (UINT) atoi(strTemp);
+				}
+				else if (((strTemp = ::strstr(argv[i],"-iot=")) == argv[i]) && (strReplay == NULL)) {
+					strTemp = &strTemp[5];
+					nIOThreads = (UINT) atoi(strTemp);
+					if ((nIOThreads == 0) || (nIOThreads > WAVEIN_MAX_IO_THREADS)) {
+						printHelp(argv[0]);
+						clearup();
+						return 0;
+					}
+				}
+				else if ((strTemp = ::strstr(argv[i],"-http=")) == argv[i]) {
+					strTemp = &strTemp[6];
+					nHttpPort = (UINT) atoi(strTemp);
+					if ((nHttpPort == 0) || (nHttpPort > 65535)) {
+						printHelp(argv[0]);
+						clearup();
+						return 0;
+					}
+				}
 				else {
 					printHelp(argv[0]);
 					clearup();
@@ -335,27 +901,171 @@ int main(int argc, char* argv[])
 			}
 
 			printf("\nRecording at %dKbps, ", nBitRate);
-			if (nFSimpleRate == 0) printf("44100Hz\n");
+			if (nFSimpleRate == 0) printf("capture rate\n");
 			else printf("%dHz\n", nFSimpleRate);
-			printf("from %s (%s).\n", strLineName, strDeviceName);
-			printf("Volume %d%%.\n\n", nVolume);
-			
-			CWaveINSimple& device = CWaveINSimple::GetDevice(strDeviceName);
-			CMixer& mixer = device.OpenMixer();
-			CMixerLine& mixerline = mixer.GetLine(strLineName);
-
-			mixerline.UnMute();
-			mixerline.SetVolume(nVolume);
-			mixerline.Select();
-			mixer.Close();
-
-			mp3Wr = new mp3Writer(nBitRate, nFSimpleRate);
-			device.Start((IReceiver *) mp3Wr);
-			printf("hit <ENTER> to stop ...\n");
-			while( !_kbhit() ) ::Sleep(100);
+			if (strReplay != NULL) {
+				printf("from %s%s.\n", strReplay, isFast ? " (as fast as possible)" : "");
+			}
+			else {
+				printf("from %s (%s).\n", strLineName, strDeviceName);
+				printf("Volume %d%%.\n", nVolume);
+			}
+			if (isAGC) printf("Automatic gain control, aiming at %.1f dBFS.\n", dAGCTargetDB);
+			else if (isGain) printf("Software gain %.1f dB.\n", dGainDB);
+			if (nResampleQuality >= 0) printf("Re-sampled by the built-in resampler (%s).\n", CResampler::QualityName(nResampleQuality));
+			if (nSilencePolicy >= 0) printf("Silence below %.1f dBFS isn't encoded.\n", dSilenceDB);
+			printf("%d capture buffers of %dms.\n", nBuffers, nBufferMillis);
+
+			if (strReplay != NULL) {
+				if (::strcmp(strReplay, "tone") == 0) replay = new CSyntheticSource(SYNTH_TONE, 440, nReplaySeconds, !isFast);
+				else if (::strcmp(strReplay, "noise") == 0) replay = new CSyntheticSource(SYNTH_NOISE, 0, nReplaySeconds, !isFast);
+				else replay = new CWaveFileSource(strReplay, !isFast, isLooping);
+				source = replay;
+			}
+			else {
+				if (nIOThreads > 0) CWaveINSimple::SetIOThreads(nIOThreads);
+				CWaveINSimple& device = CWaveINSimple::GetDevice(strDeviceName);
+				CMixer& mixer = device.OpenMixer();
+				CMixerLine& mixerline = mixer.GetLine(strLineName);
+
+				mixerline.UnMute();
+				mixerline.SetVolume(nVolume);
+				mixerline.Select();
+				mixer.Close();
+				pDevice = &device;
+				source = pDevice;
+			}
+
+			// The format asked for, or the nearest one the source has. The rest of
+			// the pipeline gets it as 16-bit sound of the channels asked for.
+			if ((nCaptureRate != 0) || (nCaptureChannels != 0) || (nCaptureBits != 0)) {
+				if (nCaptureRate == 0) nCaptureRate = source->GetSampleRate();
+				if (nCaptureChannels == 0) nCaptureChannels = source->GetChannels();
+				if (nCaptureBits == 0) nCaptureBits = source->GetBitsPerSample();
+				nChannels = nCaptureChannels;
+				if (!source->MatchFormat(nCaptureRate, nCaptureChannels, nCaptureBits)) {
+					delete replay;
+					throw "Capture source can't record any format near the one asked for.";
+				}
+			}
+			else nChannels = (source->GetChannels() == 1) ? 1 : 2;
+			printf("Capturing %dHz, %d-bit, %s%s.\n\n", (int) source->GetSampleRate(), source->GetBitsPerSample(),
+				(source->GetChannels() == 1) ? "mono" : (source->GetChannels() == 2) ? "stereo" : "multichannel",
+				CFormatReceiver::IsNeeded(source->GetChannels(), source->GetBitsPerSample(), nChannels) ?
+				((nChannels == 1) ? ", encoded as 16-bit mono" : ", encoded as 16-bit stereo") : "");
+
+			if (nResampleQuality >= 0) {
+				// The encoder gets the sound at its final rate, LAME doesn't re-sample.
+				nEncodeRate = (nFSimpleRate == 0) ? source->GetSampleRate() : nFSimpleRate;
+				mp3Wr = new mp3Writer(nBitRate, 0, nThreads, nSyncMillis, isMapped, nSegSeconds, nSegMBytes, nEncodeRate, nChannels,
+					nIndexMillis, nPrerollSeconds);
+			}
+			else {
+				nEncodeRate = source->GetSampleRate();
+				mp3Wr = new mp3Writer(nBitRate, nFSimpleRate, nThreads, nSyncMillis, isMapped, nSegSeconds, nSegMBytes,
+					nEncodeRate, nChannels, nIndexMillis, nPrerollSeconds);
+			}
+			if (nPrerollSeconds > 0) printf("Keeping the last %d s in memory, <d> writes them out.\n", nPrerollSeconds);
+			if (nHttpPort != 0) {
+				mp3Wr->useStreaming((WORD) nHttpPort, nBitRate);
+				printf("Streaming on http://localhost:%d/.\n", nHttpPort);
+			}
+			receiver = (IReceiver *) mp3Wr;
+			if (nSilencePolicy >= 0) {
+				// Right in front of the encoder, judging the sound it would encode.
+				if (nSilencePolicy == SILENCE_FRAMES) mp3Wr->useSilentFrames();
+				silenceRcv = new CSilenceReceiver(receiver, nEncodeRate, nChannels, nSilencePolicy, mp3Wr, "music_gaps.txt", dSilenceDB);
+				receiver = (IReceiver *) silenceRcv;
+			}
+			if (nResampleQuality >= 0) {
+				resampleRcv = new CResampleReceiver(receiver, source->GetSampleRate(), nEncodeRate, nChannels, nResampleQuality);
+				receiver = (IReceiver *) resampleRcv;
+			}
+			if (isGain || isAGC) {
+				// Runs on the encoder's thread when there is a queue (-aq).
+				gainRcv = new CGainReceiver(receiver, source->GetSampleRate(), nChannels, dGainDB, isAGC, dAGCTargetDB);
+				receiver = (IReceiver *) gainRcv;
+			}
+			if (CFormatReceiver::IsNeeded(source->GetChannels(), source->GetBitsPerSample(), nChannels)) {
+				formatRcv = new CFormatReceiver(receiver, source->GetChannels(), source->GetBitsPerSample(), nChannels);
+				receiver = (IReceiver *) formatRcv;
+			}
+			if (nQueueSlots > 0) {
+				asyncRcv = new CAsyncReceiver(receiver, nQueueSlots, source->CalcBufferLength(nBufferMillis));
+				receiver = (IReceiver *) asyncRcv;
+			}
+			if (strWavFile != NULL) {
+				wavWr = new wavWriter(strWavFile, source->GetSampleRate(), source->GetChannels(), source->GetBitsPerSample());
+				fanOut = new CFanOutReceiver();
+				fanOut->AddSink(receiver);
+				fanOut->AddSink((IReceiver *) wavWr);
+				receiver = (IReceiver *) fanOut;
+			}
+
+			source->Start(receiver, nBuffers, nBufferMillis);
+			printf("hit <ENTER> to stop, <s> to print the counters%s%s ...\n",
+				(gainRcv != NULL) ? ", <+>/<-> to change the gain" : "", (nPrerollSeconds > 0) ? ", <d> to dump the pre-roll" : "");
+			// A replayed sound may also simply end.
+			while( (replay == NULL) || !replay->WaitForEnd(0) ) {
+				if (_kbhit()) {
+					nKey = _getch();
+					if ((gainRcv != NULL) && ((nKey == '+') || (nKey == '-'))) {
+						dGainDB = gainRcv->Adjust((nKey == '+') ? 1.0 : -1.0);
+						printf(gainRcv->IsAGC() ? "AGC level %.1f dBFS.\n" : "Gain %.1f dB.\n", dGainDB);
+					}
+					else if ((nPrerollSeconds > 0) && ((nKey == 'd') || (nKey == 'D'))) {
+						mp3Wr->dumpPreroll(nPostrollSeconds);
+					}
+					else if ((nKey != 's') && (nKey != 'S')) break;
+					else CCounterSet::PrintSnapshot();
+				}
+				::Sleep(100);
+			}
 		
-			device.Stop();
+			source->Stop();
+			if (replay != NULL) {
+				printf("Replay: %d buffers, %d overruns, latest buffer %.3f ms late.\n",
+					replay->GetBuffers(), replay->GetOverruns(), replay->GetMaxLateMicros() / 1000.0);
+			}
+			else {
+				printf("Capture: first buffer %.3f ms after the start, stopped in %.3f ms.\n",
+					pDevice->GetStartLatency() / 1000.0, pDevice->GetStopLatency() / 1000.0);
+			}
+			if (fanOut != NULL) {
+				fanOut->Stop();
+				printf("Fan-out: MP3 missed %d buffers, WAV missed %d buffers.\n",
+					fanOut->GetOverruns(0), fanOut->GetOverruns(1));
+				delete fanOut;
+				delete wavWr;
+			}
+			if (asyncRcv != NULL) {
+				// Let the encoder finish everything that was captured.
+				asyncRcv->Stop();
+				printf("Queue: %d buffers, %d overruns (%d bytes dropped), high-water %d of %d slots.\n",
+					asyncRcv->GetBuffers(), asyncRcv->GetOverruns(), asyncRcv->GetDroppedBytes(),
+					asyncRcv->GetHighWater(), asyncRcv->GetCapacity());
+				delete asyncRcv;
+			}
+			delete formatRcv;
+			if (gainRcv != NULL) {
+				printf("Gain: %.1f dB at the end.\n", gainRcv->GetGainDB());
+				delete gainRcv;
+			}
+			if (resampleRcv != NULL) {
+				// The resampler's delay, before the encoder is closed.
+				resampleRcv->Flush();
+				delete resampleRcv;
+			}
+			if (silenceRcv != NULL) {
+				// The silence held back, and its gap.
+				silenceRcv->Flush();
+				silenceRcv->PrintStats();
+				delete silenceRcv;
+			}
+			mp3Wr->close();
+			mp3Wr->printStats();
 			delete mp3Wr;
+			delete replay;
 		}
 	}
 	catch (const char *err) {
@@ -363,7 +1073,8 @@ int main(int argc, char* argv[])
 	}
 
 	CWaveINSimple::CleanUp();
+	CMP3EncoderPool::CleanUp();
 	clearup();
-	return 0;
+	return nExitCode;
 }
 